@@ -0,0 +1,224 @@
+// Microbenchmark de disputa do TupleServer (sem rede).
+//
+// Chama write/rd/in/ex direto, de 1 até N threads, em quatro cenários:
+//
+//   1. chave quente: todos os threads fazem WR + RD + IN na mesma chave;
+//   2. chaves frias: cada thread faz WR + EX + IN em 4096 chaves próprias;
+//   3. pares produtor/consumidor: metade dos threads faz WR e a outra
+//      metade IN, um par por chave, com no máximo 64 tuplas na fila (o
+//      produtor também estaciona quando ela enche);
+//   4. waiters estacionados: um thread faz WR numa chave e os demais
+//      esperam nela em IN; cada WR deve acordar um só waiter;
+//   5. leitura dominante: todos fazem RD de um valor de 4 KiB numa chave,
+//      e o thread 0 troca a frente (WR + IN) a cada 4096 RDs — o RD sai
+//      da frente publicada, sem lock (ver read_cache.hpp).
+//
+// Para cada rodada: ops/s, aquisições de lock por operação, fração das
+// aquisições que encontraram o lock ocupado, espera e posse médias por
+// aquisição e despertares de waiters por operação. Compilado com
+// LINDA_LOCK_STATS=1 (ver lock_stats.hpp): os ops/s incluem o custo da
+// medida, então comparam-se só com rodadas deste mesmo binário.
+//
+// linda_bench_contention_std é o mesmo com std::condition_variable nos
+// waiters (LINDA_STD_CONDVAR=1), para comparar com a espera sobre futex.
+//
+// Uso: linda_bench_contention [max_threads] [ms_por_rodada] [shards]
+#include "main.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Round {
+    double    ops_per_s = 0;
+    size_t    ops       = 0;
+    LockStats locks;
+};
+
+// Corpo de um thread: recebe o índice e a flag de parada; retorna quantas
+// operações fez.
+using Body = function<size_t(unsigned t, const atomic<bool>& stop)>;
+
+// Roda `threads` corpos por `ms` milissegundos num TupleServer novo.
+static Round run_round(TupleServer& ts, unsigned threads, unsigned ms, const Body& body) {
+    atomic<bool>   go{false}, stop{false};
+    atomic<size_t> total{0};
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            while (!go.load(memory_order_acquire))
+                this_thread::yield();
+            total += body(t, stop);
+        });
+    }
+    auto start = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    stop = true;
+    for (auto& th : pool)
+        th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    Round r;
+    r.ops       = total.load();
+    r.ops_per_s = static_cast<double>(r.ops) / secs;
+    r.locks     = ts.lock_stats();
+    return r;
+}
+
+static void print_header(const char* title) {
+    printf("\n=== %s ===\n", title);
+    printf("%7s %12s %9s %8s %11s %11s %11s\n", "threads", "ops/s", "locks/op", "ocupado",
+           "espera(ns)", "posse(ns)", "desp./op");
+}
+
+static void print_round(unsigned threads, const Round& r) {
+    const LockStats& l   = r.locks;
+    double           ops = static_cast<double>(r.ops ? r.ops : 1);
+    double           acq = static_cast<double>(l.acquisitions ? l.acquisitions : 1);
+    printf("%7u %12.0f %9.2f %7.1f%% %11.0f %11.0f %11.2f\n", threads, r.ops_per_s,
+           static_cast<double>(l.acquisitions) / ops,
+           100.0 * static_cast<double>(l.contended) / acq,
+           static_cast<double>(l.wait_ns) / acq, static_cast<double>(l.hold_ns) / acq,
+           static_cast<double>(l.wakeups) / ops);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max_threads = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 64;
+    unsigned ms     = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 300;
+    size_t   shards = argc > 3 ? strtoull(argv[3], nullptr, 10) : TupleServer::DEFAULT_SHARDS;
+
+#if !LINDA_LOCK_STATS
+    printf("(compilado sem LINDA_LOCK_STATS: só ops/s)\n");
+#endif
+    printf("espera dos waiters: %s; shards: %zu, %u ms por rodada\n",
+           LINDA_FUTEX_WAITS ? "futex" : "std::condition_variable", shards, ms);
+
+    vector<unsigned> counts;
+    for (unsigned t = 1; t <= max_threads; t *= 2)
+        counts.push_back(t);
+    if (counts.back() != max_threads)
+        counts.push_back(max_threads);
+
+    const string value(64, 'v');
+
+    // 1. Chave quente: três operações por volta, todas no mesmo shard.
+    print_header("Chave quente: WR + RD + IN numa só chave");
+    for (unsigned threads : counts) {
+        TupleServer ts(shards);
+        Round r = run_round(ts, threads, ms, [&](unsigned, const atomic<bool>& stop) {
+            size_t ops = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                ts.write("quente", value);
+                ts.rd("quente");
+                ts.in("quente");
+                ops += 3;
+            }
+            return ops;
+        });
+        print_round(threads, r);
+    }
+
+    // 2. Chaves frias: só a disputa de shards entre chaves diferentes.
+    print_header("Chaves frias: WR + EX + IN em chaves próprias");
+    for (unsigned threads : counts) {
+        TupleServer ts(shards);
+        Round r = run_round(ts, threads, ms, [&](unsigned t, const atomic<bool>& stop) {
+            vector<string> in_keys, out_keys;
+            for (int k = 0; k < 4096; ++k) {
+                in_keys.push_back("t" + to_string(t) + "_in" + to_string(k));
+                out_keys.push_back("t" + to_string(t) + "_out" + to_string(k));
+            }
+            size_t ops = 0;
+            for (size_t k = 0; !stop.load(memory_order_relaxed); k = (k + 1) % in_keys.size()) {
+                ts.write(in_keys[k], value);
+                ts.ex(in_keys[k], out_keys[k], 1);
+                ts.in(out_keys[k]);
+                ops += 3;
+            }
+            return ops;
+        });
+        print_round(threads, r);
+    }
+
+    // 3 e 4 terminam por sentinela: o consumidor sai ao receber "fim", e o
+    // produtor a escreve depois das suas tuplas (a fila é FIFO). Assim
+    // ninguém fica preso em IN, nem o produtor em WR com a fila cheia.
+    TupleServer::Limits bounded;
+    bounded.key_tuples = 64;
+
+    print_header("Pares produtor/consumidor: WR | IN, fila de até 64");
+    for (unsigned threads : counts) {
+        if (threads < 2)
+            continue;
+        unsigned    pairs = threads / 2;
+        TupleServer ts(shards);
+        ts.set_limits(bounded);
+        Round r = run_round(ts, pairs * 2, ms, [&](unsigned t, const atomic<bool>& stop) {
+            string key = "par" + to_string(t % pairs);
+            size_t ops = 0;
+            if (t < pairs) {
+                for (; !stop.load(memory_order_relaxed); ++ops)
+                    ts.write(key, value);
+                ts.write(key, "fim");
+            } else {
+                while (ts.in(key) != "fim")
+                    ++ops;
+            }
+            return ops;
+        });
+        print_round(pairs * 2, r);
+    }
+
+    print_header("Waiters estacionados: 1 WR | N-1 IN na mesma chave");
+    for (unsigned threads : counts) {
+        if (threads < 2)
+            continue;
+        TupleServer ts(shards);
+        Round r = run_round(ts, threads, ms, [&](unsigned t, const atomic<bool>& stop) {
+            size_t ops = 0;
+            if (t == 0) {
+                for (; !stop.load(memory_order_relaxed); ++ops)
+                    ts.write("tarefas", value);
+                for (unsigned i = 1; i < threads; ++i)
+                    ts.write("tarefas", "fim");
+            } else {
+                while (ts.in("tarefas") != "fim")
+                    ++ops;
+            }
+            return ops;
+        });
+        print_round(threads, r);
+    }
+
+    print_header("Leitura dominante: RD de 4 KiB, frente trocada a cada 4096");
+    const string config(4096, 'c');
+    for (unsigned threads : counts) {
+        TupleServer ts(shards);
+        ts.write("config", config);
+        Round r = run_round(ts, threads, ms, [&](unsigned t, const atomic<bool>& stop) {
+            size_t ops = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                for (int i = 0; i < 4096; ++i)
+                    ts.rd("config");
+                ops += 4096;
+                if (t == 0) {
+                    ts.write("config", config);
+                    ts.in("config");
+                    ops += 2;
+                }
+            }
+            return ops;
+        });
+        print_round(threads, r);
+    }
+    return 0;
+}
@@ -0,0 +1,751 @@
+// Gerador de carga pela rede: vazão e latência do servidor vistas por
+// clientes de verdade.
+//
+// Abre N conexões, um thread cada, e mantém em cada uma até `depth`
+// requisições em voo (pipelining): envia o lote, lê as respostas que
+// chegarem e completa a janela de novo. Roda uma das cargas abaixo por um
+// tempo fixo, depois de um aquecimento que não entra nas medidas:
+//
+//   queue  fila de tarefas: WR k v seguido de IN k
+//   read   leitura de configuração: RD k em chaves pré-carregadas; uma
+//          fração (--write-pct) são atualizações WR k v + IN k (a chave
+//          nunca fica vazia, então nenhum RD espera)
+//   ex     serviço: WR k v, EX k k.out <svc>, IN k.out (--svc aceita um
+//          pipeline "1,2" no protocolo de texto)
+//   churn  clientes que vão embora: cada um conecta, manda um IN numa
+//          chave vazia e fecha sem esperar (metade com FIN, metade com
+//          RST), --clients vezes ao todo. A cada décimo, o STATS do
+//          servidor mostra conexões, operações estacionadas, threads e
+//          memória; no fim, nenhum IN pode ter ficado estacionado e um WR
+//          em cada chave tem que continuar lá (nenhum IN de cliente morto
+//          o consome). Sem histogramas.
+//
+// Fora do churn, nenhuma requisição fica esperando tupla: cada IN/EX vem
+// depois do WR que o alimenta, na mesma conexão. As chaves são sorteadas entre --keys
+// chaves, uniforme ou com distribuição zipfiana (a chave 0 é a mais
+// quente). A latência de cada requisição, do envio à resposta, vai para
+// um histograma por operação (histogram.hpp). O resultado sai em texto e,
+// com --json, num objeto JSON para comparar versões do servidor.
+//
+// Uso: linda_bench [opções]   (linda_bench --help lista as opções)
+#include "histogram.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
+
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Options {
+    string   host       = "127.0.0.1";
+    string   port       = "54321";
+    unsigned conns      = 16;
+    unsigned depth      = 1;
+    string   workload   = "queue";
+    size_t   keys       = 10000;
+    double   zipf       = 0;  // expoente; 0 = uniforme
+    size_t   value_size = 64;
+    double   duration   = 5;
+    double   warmup     = 1;
+    unsigned write_pct  = 5;
+    string   svc        = "1";
+    bool     binary     = false;
+    size_t   clients    = 100000;  // churn
+    string   json;  // arquivo; "-" = saída padrão
+    string   label;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Uso: %s [opções]\n"
+            "  --host H          servidor (127.0.0.1)\n"
+            "  --port P          porta (54321)\n"
+            "  --conns N         conexões, um thread cada (16)\n"
+            "  --depth D         requisições em voo por conexão (1)\n"
+            "  --workload W      queue | read | ex | churn (queue)\n"
+            "  --keys K          chaves distintas (10000)\n"
+            "  --zipf S          distribuição zipfiana com expoente S (0 = uniforme)\n"
+            "  --value-size B    bytes por valor (64)\n"
+            "  --duration S      segundos medidos (5)\n"
+            "  --warmup S        segundos de aquecimento, fora das medidas (1)\n"
+            "  --write-pct P     read: %% de atualizações (5)\n"
+            "  --svc IDS         ex: svc_id ou pipeline \"1,2\" (1)\n"
+            "  --clients N       churn: conexões abertas e abandonadas (100000)\n"
+            "  --binary          protocolo binário\n"
+            "  --json ARQ        resultado em JSON (\"-\": saída padrão)\n"
+            "  --label L         rótulo copiado para o JSON (ex.: versão do servidor)\n",
+            prog);
+}
+
+// Retorna false (com a mensagem já impressa) se alguma opção é inválida.
+static bool parse_options(int argc, char* argv[], Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        string_view a = argv[i];
+        if (a == "--binary") {
+            o.binary = true;
+            continue;
+        }
+        if (a == "--help" || i + 1 >= argc) {
+            usage(argv[0]);
+            return false;
+        }
+        const char* v = argv[++i];
+        if      (a == "--host")       o.host       = v;
+        else if (a == "--port")       o.port       = v;
+        else if (a == "--conns")      o.conns      = static_cast<unsigned>(atoi(v));
+        else if (a == "--depth")      o.depth      = static_cast<unsigned>(atoi(v));
+        else if (a == "--workload")   o.workload   = v;
+        else if (a == "--keys")       o.keys       = strtoull(v, nullptr, 10);
+        else if (a == "--zipf")       o.zipf       = atof(v);
+        else if (a == "--value-size") o.value_size = strtoull(v, nullptr, 10);
+        else if (a == "--duration")   o.duration   = atof(v);
+        else if (a == "--warmup")     o.warmup     = atof(v);
+        else if (a == "--write-pct")  o.write_pct  = static_cast<unsigned>(atoi(v));
+        else if (a == "--svc")        o.svc        = v;
+        else if (a == "--clients")    o.clients    = strtoull(v, nullptr, 10);
+        else if (a == "--json")       o.json       = v;
+        else if (a == "--label")      o.label      = v;
+        else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    const char* err = nullptr;
+    if (o.workload != "queue" && o.workload != "read" && o.workload != "ex" &&
+        o.workload != "churn")
+        err = "--workload deve ser queue, read, ex ou churn";
+    else if (o.conns == 0 || o.depth == 0 || o.keys == 0 || o.value_size == 0 ||
+             o.clients == 0)
+        err = "--conns, --depth, --keys, --value-size e --clients devem ser positivos";
+    else if (o.duration <= 0 || o.warmup < 0 || o.zipf < 0 || o.write_pct > 100)
+        err = "--duration, --warmup, --zipf ou --write-pct fora da faixa";
+    else if (o.binary && o.svc.find(',') != string::npos)
+        err = "pipelines no EX (--svc 1,2) só no protocolo de texto";
+    if (err) {
+        fprintf(stderr, "%s\n", err);
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Sorteio de chaves: uniforme, ou zipfiana por busca binária na função de
+// distribuição acumulada (calculada uma vez e compartilhada, só leitura).
+// ---------------------------------------------------------------------------
+class KeyDist {
+public:
+    KeyDist(size_t n, double s) : n(n) {
+        if (s <= 0)
+            return;
+        cdf.resize(n);
+        double acc = 0;
+        for (size_t i = 0; i < n; ++i)
+            cdf[i] = acc += 1.0 / pow(static_cast<double>(i + 1), s);
+    }
+
+    size_t next(mt19937_64& rng) const {
+        if (cdf.empty())
+            return uniform_int_distribution<size_t>(0, n - 1)(rng);
+        double u = uniform_real_distribution<double>(0, cdf.back())(rng);
+        return min(static_cast<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()),
+                   n - 1);
+    }
+
+private:
+    size_t         n;
+    vector<double> cdf;
+};
+
+// ---------------------------------------------------------------------------
+// Client: uma conexão bloqueante com requisições em voo. request() só
+// monta a requisição; send() envia as acumuladas e receive() bloqueia até
+// ler algo, chamando done(op, ok, enviada_em) por resposta completa.
+// ---------------------------------------------------------------------------
+enum Op : uint8_t { WR, RD, IN, EX, N_OPS };
+static const char* const OP_NAMES[N_OPS] = {"WR", "RD", "IN", "EX"};
+static const uint8_t     OPCODES[N_OPS]  = {protocol::OP_WR, protocol::OP_RD,
+                                            protocol::OP_IN, protocol::OP_EX};
+
+class Client {
+public:
+    explicit Client(const Options& o)
+        : binary(o.binary), svc(o.svc), svc_id(static_cast<uint32_t>(atoi(o.svc.c_str()))) {}
+    ~Client() {
+        if (sock != INVALID_SOCK)
+            net::close_socket(sock);
+    }
+
+    Client(const Client&)            = delete;
+    Client& operator=(const Client&) = delete;
+
+    bool connect(const string& host, const string& port) {
+        addrinfo hints{};
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res     = nullptr;
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+            return false;
+        for (addrinfo* rp = res; rp != nullptr; rp = rp->ai_next) {
+            sock = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (sock == INVALID_SOCK)
+                continue;
+            if (::connect(sock, rp->ai_addr, static_cast<int>(rp->ai_addrlen)) == 0)
+                break;
+            net::close_socket(sock);
+            sock = INVALID_SOCK;
+        }
+        freeaddrinfo(res);
+        if (sock == INVALID_SOCK)
+            return false;
+        net::set_nodelay(sock);
+        if (binary)
+            out += static_cast<char>(protocol::BINARY_MAGIC);
+        return true;
+    }
+
+    // EX: `value` é a chave de saída.
+    void request(Op op, string_view key, string_view value, Clock::time_point now) {
+        if (binary) {
+            uint32_t id = next_id++;
+            protocol::append_request(out, OPCODES[op], id, key, op == EX || op == WR ? value : "",
+                                     op == EX ? svc_id : 0);
+            by_id.emplace(id, Pending{op, now});
+            return;
+        }
+        out += OP_NAMES[op];
+        out += ' ';
+        out.append(key.data(), key.size());
+        if (op == WR || op == EX) {
+            out += ' ';
+            out.append(value.data(), value.size());
+        }
+        if (op == EX) {
+            out += ' ';
+            out += svc;
+        }
+        out += '\n';
+        fifo.push_back(Pending{op, now});
+    }
+
+    size_t in_flight() const { return binary ? by_id.size() : fifo.size(); }
+
+    // Fechar com RST em vez de FIN (SO_LINGER zerado), como um cliente que
+    // cai sem se despedir.
+    void abort_on_close() {
+        linger l{1, 0};
+        ::setsockopt(sock, SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&l), sizeof(l));
+    }
+
+    // Texto, fora da janela: envia `line` e lê uma linha de resposta (sem
+    // o '\n'). Para comandos de resposta longa, seguir com read_line().
+    bool call(const string& line, string& reply) {
+        out += line;
+        out += '\n';
+        return send() && read_line(reply);
+    }
+
+    bool read_line(string& line) {
+        size_t nl;
+        while ((nl = in.find('\n')) == string::npos) {
+            char buf[4096];
+            long n = net::recv_some(sock, buf, sizeof(buf));
+            if (n <= 0)
+                return false;
+            in.append(buf, static_cast<size_t>(n));
+        }
+        line.assign(in, 0, nl);
+        in.erase(0, nl + 1);
+        return true;
+    }
+
+    bool send() {
+        for (size_t off = 0; off < out.size();) {
+            long n = net::send_some(sock, out.data() + off, out.size() - off);
+            if (n <= 0)
+                return false;
+            off += static_cast<size_t>(n);
+        }
+        out.clear();
+        return true;
+    }
+
+    template <class F>
+    bool receive(F&& done) {
+        char buf[64 * 1024];
+        long n = net::recv_some(sock, buf, sizeof(buf));
+        if (n <= 0)
+            return false;
+        in.append(buf, static_cast<size_t>(n));
+        size_t pos = 0;
+        if (binary) {
+            while (in.size() - pos >= protocol::REPLY_HEADER) {
+                const auto* p   = reinterpret_cast<const unsigned char*>(in.data() + pos);
+                uint32_t    id  = u32(p + 4);
+                size_t      len = u32(p + 8);
+                if (in.size() - pos < protocol::REPLY_HEADER + len)
+                    break;
+                pos += protocol::REPLY_HEADER + len;
+                auto it = by_id.find(id);
+                if (it == by_id.end())
+                    continue;  // OP_PUSH ou id desconhecido
+                done(it->second.op, p[0] == protocol::ST_OK, it->second.sent);
+                by_id.erase(it);
+            }
+        } else {
+            size_t nl;
+            while ((nl = in.find('\n', pos)) != string::npos) {
+                bool ok = in.compare(pos, 2, "OK") == 0;
+                pos     = nl + 1;
+                if (fifo.empty())
+                    return false;  // resposta sem requisição
+                done(fifo.front().op, ok, fifo.front().sent);
+                fifo.pop_front();
+            }
+        }
+        in.erase(0, pos);
+        return true;
+    }
+
+private:
+    struct Pending {
+        Op                op;
+        Clock::time_point sent;
+    };
+
+    static uint32_t u32(const unsigned char* p) {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+
+    socket_t sock = INVALID_SOCK;
+    bool     binary;
+    string   svc;
+    uint32_t svc_id;
+    uint32_t next_id = 1;
+    string   out, in;
+
+    deque<Pending>                     fifo;   // texto: respostas em ordem
+    unordered_map<uint32_t, Pending>   by_id;  // binário: casadas pelo id
+};
+
+// ---------------------------------------------------------------------------
+// Uma conexão da carga.
+// ---------------------------------------------------------------------------
+struct Result {
+    Histogram lat[N_OPS];  // ns
+    uint64_t  errors = 0;
+    bool      failed = false;
+};
+
+static void run_conn(const Options& o, const KeyDist& dist, unsigned index,
+                     Clock::time_point measure_from, Clock::time_point until, Result& r) {
+    Client c(o);
+    if (!c.connect(o.host, o.port)) {
+        r.failed = true;
+        return;
+    }
+    mt19937_64 rng(index + 1);  // sementes fixas: rodadas comparáveis
+    string     value(o.value_size, 'v');
+    string     key, out_key;
+    const char kind   = o.workload[0];  // q, r ou e
+    const char* prefix = kind == 'q' ? "q:" : kind == 'r' ? "cfg:" : "ex:";
+
+    auto done = [&](Op op, bool ok, Clock::time_point sent) {
+        auto now = Clock::now();
+        if (sent < measure_from || now > until)
+            return;
+        if (!ok)
+            ++r.errors;
+        r.lat[op].record(static_cast<uint64_t>(
+            chrono::duration_cast<chrono::nanoseconds>(now - sent).count()));
+    };
+
+    while (true) {
+        auto now = Clock::now();
+        if (now >= until)
+            break;
+        while (c.in_flight() < o.depth) {
+            key = prefix;
+            key += to_string(dist.next(rng));
+            if (kind == 'q') {
+                c.request(WR, key, value, now);
+                c.request(IN, key, {}, now);
+            } else if (kind == 'r') {
+                if (rng() % 100 < o.write_pct) {
+                    c.request(WR, key, value, now);
+                    c.request(IN, key, {}, now);
+                } else {
+                    c.request(RD, key, {}, now);
+                }
+            } else {
+                out_key = key + ".out";
+                c.request(WR, key, value, now);
+                c.request(EX, key, out_key, now);
+                c.request(IN, out_key, {}, now);
+            }
+        }
+        if (!c.send() || !c.receive(done)) {
+            r.failed = true;
+            return;
+        }
+    }
+    // Drena o que ficou em voo: as chaves terminam como começaram.
+    while (c.in_flight() > 0) {
+        if (!c.receive(done)) {
+            r.failed = true;
+            return;
+        }
+    }
+}
+
+// read: uma tupla por chave antes da medida, em lotes pipelined.
+static bool preload(const Options& o) {
+    Client c(o);
+    if (!c.connect(o.host, o.port))
+        return false;
+    string value(o.value_size, 'v');
+    bool   ok  = true;
+    auto   now = Clock::now();
+    for (size_t i = 0; i < o.keys && ok;) {
+        for (size_t end = min(o.keys, i + 1000); i < end; ++i)
+            c.request(WR, "cfg:" + to_string(i), value, now);
+        ok = c.send();
+        while (ok && c.in_flight() > 0)
+            ok = c.receive([&ok](Op, bool good, Clock::time_point) { ok = ok && good; });
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Relatório
+// ---------------------------------------------------------------------------
+static double us(uint64_t ns) {
+    return static_cast<double>(ns) / 1000.0;
+}
+
+static void print_row(const char* name, const Histogram& h, double secs) {
+    printf("%-6s %10llu %11.0f %8.1f %8.1f %8.1f %8.1f %9.1f\n", name,
+           static_cast<unsigned long long>(h.count()), static_cast<double>(h.count()) / secs,
+           us(h.percentile(0.50)), us(h.percentile(0.90)), us(h.percentile(0.99)),
+           us(h.percentile(0.999)), us(h.max()));
+}
+
+static string json_string(const string& s) {
+    string r = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            r += '\\';
+            r += ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            r += buf;
+        } else {
+            r += ch;
+        }
+    }
+    return r + "\"";
+}
+
+static void json_latency(FILE* f, const Histogram& h) {
+    fprintf(f,
+            "{\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+            "\"max\": %.1f, \"mean\": %.1f}",
+            us(h.percentile(0.50)), us(h.percentile(0.90)), us(h.percentile(0.99)),
+            us(h.percentile(0.999)), us(h.max()), h.mean() / 1000.0);
+}
+
+static void write_json(FILE* f, const Options& o, const Histogram* ops, const Histogram& total,
+                       uint64_t errors) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"label\": %s,\n", json_string(o.label).c_str());
+    fprintf(f, "  \"workload\": %s,\n", json_string(o.workload).c_str());
+    fprintf(f, "  \"protocol\": \"%s\",\n", o.binary ? "binary" : "text");
+    fprintf(f, "  \"host\": %s,\n", json_string(o.host).c_str());
+    fprintf(f, "  \"port\": %s,\n", json_string(o.port).c_str());
+    fprintf(f, "  \"connections\": %u,\n", o.conns);
+    fprintf(f, "  \"depth\": %u,\n", o.depth);
+    fprintf(f, "  \"keys\": %zu,\n", o.keys);
+    fprintf(f, "  \"distribution\": \"%s\",\n", o.zipf > 0 ? "zipf" : "uniform");
+    fprintf(f, "  \"zipf_s\": %g,\n", o.zipf);
+    fprintf(f, "  \"value_size\": %zu,\n", o.value_size);
+    if (o.workload == "read")
+        fprintf(f, "  \"write_pct\": %u,\n", o.write_pct);
+    if (o.workload == "ex")
+        fprintf(f, "  \"svc\": %s,\n", json_string(o.svc).c_str());
+    fprintf(f, "  \"duration_s\": %g,\n", o.duration);
+    fprintf(f, "  \"requests\": %llu,\n", static_cast<unsigned long long>(total.count()));
+    fprintf(f, "  \"requests_per_s\": %.0f,\n", static_cast<double>(total.count()) / o.duration);
+    fprintf(f, "  \"errors\": %llu,\n", static_cast<unsigned long long>(errors));
+    fprintf(f, "  \"latency_us\": ");
+    json_latency(f, total);
+    fprintf(f, ",\n  \"ops\": {");
+    bool first = true;
+    for (int op = 0; op < N_OPS; ++op) {
+        if (ops[op].count() == 0)
+            continue;
+        fprintf(f, "%s\n    \"%s\": {\"requests\": %llu, \"latency_us\": ", first ? "" : ",",
+                OP_NAMES[op], static_cast<unsigned long long>(ops[op].count()));
+        json_latency(f, ops[op]);
+        fprintf(f, "}");
+        first = false;
+    }
+    fprintf(f, "\n  }\n}\n");
+}
+
+// ---------------------------------------------------------------------------
+// churn
+// ---------------------------------------------------------------------------
+
+// Um thread da carga: clientes de vida curta até `next` passar de
+// --clients. Cada thread usa a própria chave, "churn:<i>".
+static void run_churn(const Options& o, unsigned index, atomic<size_t>& next,
+                      atomic<size_t>& finished, atomic<size_t>& failed) {
+    string key = "churn:" + to_string(index);
+    for (size_t n; (n = next.fetch_add(1)) < o.clients; ++finished) {
+        Client c(o);
+        if (!c.connect(o.host, o.port)) {
+            ++failed;
+            continue;
+        }
+        if (n % 2)
+            c.abort_on_close();
+        c.request(IN, key, {}, Clock::now());
+        if (!c.send())
+            ++failed;
+    }  // ~Client fecha sem ler a resposta
+}
+
+// O que o STATS conta dos efeitos de um cliente que vai embora.
+struct ServerUsage {
+    double connections = 0;  // sem contar a conexão do próprio STATS
+    double blocked_in  = 0;
+    double threads     = 0;  // 0: servidor fora do Linux
+    double rss_bytes   = 0;
+};
+
+static bool query_usage(const Options& o, ServerUsage& u) {
+    Options text = o;
+    text.binary  = false;
+    Client c(text);
+    string line;
+    if (!c.connect(o.host, o.port) || !c.call("STATS", line) || line.compare(0, 3, "OK ") != 0)
+        return false;
+    for (long n = atol(line.c_str() + 3); n > 0; --n) {
+        if (!c.read_line(line))
+            return false;
+        size_t sp = line.rfind(' ');
+        if (line.empty() || line[0] == '#' || sp == string::npos)
+            continue;
+        string_view name(line.data(), sp);
+        double      v = atof(line.c_str() + sp + 1);
+        if (name == "linda_connections")                   u.connections = v - 1;
+        else if (name == "linda_blocked_total{op=\"in\"}") u.blocked_in  = v;
+        else if (name == "process_threads")                 u.threads     = v;
+        else if (name == "process_resident_memory_bytes")   u.rss_bytes   = v;
+    }
+    return true;
+}
+
+// Depois da carga: um WR em cada chave tem que sobreviver a um INP. Se um
+// IN de cliente morto ainda estivesse estacionado, consumiria a tupla.
+static size_t count_lost(const Options& o) {
+    Options text = o;
+    text.binary  = false;
+    Client c(text);
+    if (!c.connect(o.host, o.port))
+        return o.conns;
+    size_t lost = 0;
+    string reply;
+    for (unsigned i = 0; i < o.conns; ++i) {
+        string key = "churn:" + to_string(i);
+        if (!c.call("WR " + key + " vivo", reply) || !c.call("INP " + key, reply) ||
+            reply != "OK vivo")
+            ++lost;
+    }
+    return lost;
+}
+
+static void print_usage_row(size_t clients, const ServerUsage& u) {
+    printf("%10zu %9.0f %13.0f %8.0f %9.1f\n", clients, u.connections, u.blocked_in, u.threads,
+           u.rss_bytes / (1024.0 * 1024.0));
+}
+
+static void json_usage(FILE* f, size_t clients, const ServerUsage& u) {
+    fprintf(f,
+            "{\"clients\": %zu, \"connections\": %.0f, \"blocked_in\": %.0f, "
+            "\"threads\": %.0f, \"rss_bytes\": %.0f}",
+            clients, u.connections, u.blocked_in, u.threads, u.rss_bytes);
+}
+
+static int churn(const Options& o) {
+    vector<pair<size_t, ServerUsage>> samples(1);
+    if (!query_usage(o, samples[0].second)) {
+        fprintf(stderr, "STATS falhou (servidor em %s:%s?)\n", o.host.c_str(), o.port.c_str());
+        return 1;
+    }
+    bool quiet = o.json == "-";
+    if (!quiet) {
+        printf("churn, %s, %u threads, %zu clientes\n", o.binary ? "binário" : "texto", o.conns,
+               o.clients);
+        printf("%10s %9s %13s %8s %9s\n", "clientes", "conexões", "IN estac.", "threads",
+               "RSS (MiB)");
+        print_usage_row(0, samples[0].second);
+    }
+
+    atomic<size_t> next{0}, finished{0}, failed{0};
+    vector<thread> pool;
+    auto           start = Clock::now();
+    for (unsigned i = 0; i < o.conns; ++i)
+        pool.emplace_back(run_churn, cref(o), i, ref(next), ref(finished), ref(failed));
+    size_t step = max<size_t>(o.clients / 10, 1);
+    for (size_t mark = step; mark < o.clients; mark += step) {
+        while (finished.load() < mark)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        ServerUsage u;
+        if (query_usage(o, u)) {
+            samples.emplace_back(mark, u);
+            if (!quiet)
+                print_usage_row(mark, u);
+        }
+    }
+    for (auto& t : pool)
+        t.join();
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+
+    // O servidor percebe os últimos fechamentos com algum atraso (o
+    // backend de threads olha o socket a cada 100 ms).
+    ServerUsage end;
+    auto        give_up = Clock::now() + chrono::seconds(10);
+    while (query_usage(o, end) && (end.blocked_in > 0 || end.connections > 0) &&
+           Clock::now() < give_up)
+        this_thread::sleep_for(chrono::milliseconds(50));
+    samples.emplace_back(o.clients, end);
+    size_t lost = count_lost(o);
+    if (!quiet) {
+        print_usage_row(o.clients, end);
+        printf("%.0f clientes/s; falhas de conexão: %zu; tuplas perdidas: %zu\n",
+               static_cast<double>(o.clients) / secs, failed.load(), lost);
+    }
+
+    if (!o.json.empty()) {
+        FILE* f = quiet ? stdout : fopen(o.json.c_str(), "w");
+        if (f == nullptr) {
+            fprintf(stderr, "não foi possível escrever %s\n", o.json.c_str());
+            return 1;
+        }
+        fprintf(f, "{\n");
+        fprintf(f, "  \"label\": %s,\n", json_string(o.label).c_str());
+        fprintf(f, "  \"workload\": \"churn\",\n");
+        fprintf(f, "  \"protocol\": \"%s\",\n", o.binary ? "binary" : "text");
+        fprintf(f, "  \"threads\": %u,\n", o.conns);
+        fprintf(f, "  \"clients\": %zu,\n", o.clients);
+        fprintf(f, "  \"clients_per_s\": %.0f,\n", static_cast<double>(o.clients) / secs);
+        fprintf(f, "  \"connect_failures\": %zu,\n", failed.load());
+        fprintf(f, "  \"lost_tuples\": %zu,\n", lost);
+        fprintf(f, "  \"samples\": [");
+        for (size_t i = 0; i < samples.size(); ++i) {
+            fprintf(f, "%s\n    ", i ? "," : "");
+            json_usage(f, samples[i].first, samples[i].second);
+        }
+        fprintf(f, "\n  ]\n}\n");
+        if (f != stdout)
+            fclose(f);
+    }
+    return end.blocked_in > 0 || lost > 0 || failed.load() > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options o;
+    if (!parse_options(argc, argv, o))
+        return 2;
+    if (net::startup() != 0) {
+        fprintf(stderr, "falha ao inicializar sockets\n");
+        return 1;
+    }
+    if (o.workload == "churn") {
+        int rc = churn(o);
+        net::cleanup();
+        return rc;
+    }
+
+    if (o.workload == "read" && !preload(o)) {
+        fprintf(stderr, "não foi possível pré-carregar as chaves em %s:%s\n", o.host.c_str(),
+                o.port.c_str());
+        net::cleanup();
+        return 1;
+    }
+
+    KeyDist        dist(o.keys, o.zipf);
+    vector<Result> results(o.conns);
+    vector<thread> pool;
+    auto start = Clock::now();
+    auto from  = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(o.warmup));
+    auto until = from + chrono::duration_cast<Clock::duration>(chrono::duration<double>(o.duration));
+    for (unsigned i = 0; i < o.conns; ++i)
+        pool.emplace_back(run_conn, cref(o), cref(dist), i, from, until, ref(results[i]));
+    for (auto& t : pool)
+        t.join();
+    net::cleanup();
+
+    Histogram ops[N_OPS], total;
+    uint64_t  errors = 0;
+    unsigned  lost   = 0;
+    for (auto& r : results) {
+        for (int op = 0; op < N_OPS; ++op)
+            ops[op].merge(r.lat[op]);
+        errors += r.errors;
+        lost += r.failed;
+    }
+    if (lost > 0) {
+        fprintf(stderr, "%u de %u conexões falharam (servidor em %s:%s?)\n", lost, o.conns,
+                o.host.c_str(), o.port.c_str());
+        return 1;
+    }
+    for (auto& h : ops)
+        total.merge(h);
+
+    if (o.json != "-") {
+        char shape[32] = "uniforme";
+        if (o.zipf > 0)
+            snprintf(shape, sizeof(shape), "zipf %g", o.zipf);
+        printf("%s, %s, %u conexões x %u em voo, %zu chaves (%s), valor de %zu B, %g s\n",
+               o.workload.c_str(), o.binary ? "binário" : "texto", o.conns, o.depth, o.keys,
+               shape, o.value_size, o.duration);
+        printf("%-6s %10s %11s %8s %8s %8s %8s %9s\n", "op", "n", "req/s", "p50",
+               "p90", "p99", "p99.9", "max (µs)");
+        for (int op = 0; op < N_OPS; ++op)
+            if (ops[op].count() > 0)
+                print_row(OP_NAMES[op], ops[op], o.duration);
+        print_row("total", total, o.duration);
+        printf("erros: %llu\n", static_cast<unsigned long long>(errors));
+    }
+    if (!o.json.empty()) {
+        FILE* f = o.json == "-" ? stdout : fopen(o.json.c_str(), "w");
+        if (f == nullptr) {
+            fprintf(stderr, "não foi possível escrever %s\n", o.json.c_str());
+            return 1;
+        }
+        write_json(f, o, ops, total, errors);
+        if (f != stdout)
+            fclose(f);
+    }
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+// Benchmark de memória do índice de chaves (sem rede).
+//
+// 1. Chaves de uso único: WR seguido de IN em chaves sempre novas, como um
+//    cliente que usa uma chave por requisição como canal de resposta. Ao
+//    fim o espaço está vazio; o que sobra na memória é o custo das chaves
+//    já drenadas.
+// 2. Chaves com uma tupla: bytes por chave com a tupla ainda na fila (o
+//    caso comum de fila curta).
+// 3. Busca: RDP aleatório sobre as chaves do item 2.
+//
+// A memória é o RSS do processo (Linux: /proc/self/statm; nas demais
+// plataformas a coluna sai vazia).
+//
+// Uso: linda_bench_mem [chaves_uso_unico] [chaves_com_tupla]
+#include "main.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// RSS atual em MiB; negativo se indisponível.
+static double rss_mib() {
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr)
+        return -1;
+    long pages = 0, resident = 0;
+    int  got   = fscanf(f, "%ld %ld", &pages, &resident);
+    fclose(f);
+    if (got != 2)
+        return -1;
+    return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE)) /
+           (1024.0 * 1024.0);
+#else
+    return -1;
+#endif
+}
+
+static string key_of(const char* prefix, size_t i) {
+    return prefix + to_string(i);
+}
+
+int main(int argc, char* argv[]) {
+    size_t one_shot = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t held     = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;
+
+    TupleServer ts;
+    double      base = rss_mib();
+
+    printf("=== Chaves de uso único: WR + IN em %zu chaves novas ===\n", one_shot);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < one_shot; ++i) {
+        string key = key_of("reply:", i);
+        ts.write(key, "ok");
+        ts.in(key);
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double after = rss_mib();
+    printf("%14s %14s %14s\n", "ns/par", "RSS (MiB)", "bytes/chave");
+    printf("%14.1f %14.1f %14.1f\n", secs * 1e9 / static_cast<double>(one_shot),
+           after - base,
+           (after - base) * 1024 * 1024 / static_cast<double>(max<size_t>(1, one_shot)));
+
+    printf("\n=== Chaves com uma tupla: %zu chaves ===\n", held);
+    base  = rss_mib();
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < held; ++i)
+        ts.write(key_of("k", i), "v");
+    secs  = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    after = rss_mib();
+    printf("%14s %14s %14s\n", "ns/WR", "RSS (MiB)", "bytes/chave");
+    printf("%14.1f %14.1f %14.1f\n", secs * 1e9 / static_cast<double>(max<size_t>(1, held)),
+           after - base,
+           (after - base) * 1024 * 1024 / static_cast<double>(max<size_t>(1, held)));
+
+    printf("\n=== Busca: RDP aleatório sobre as %zu chaves ===\n", held);
+    vector<string> keys;
+    size_t         probes = min<size_t>(held, 1000000);
+    mt19937_64     rng(42);
+    for (size_t i = 0; i < probes; ++i)
+        keys.push_back(key_of("k", rng() % max<size_t>(1, held)));
+    size_t found = 0;
+    string out;
+    start = chrono::steady_clock::now();
+    for (auto& k : keys) {
+        out.clear();
+        found += ts.rdp(k, out);
+    }
+    secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%14s %14s\n", "ns/RDP", "encontradas");
+    printf("%14.1f %14zu\n", secs * 1e9 / static_cast<double>(max<size_t>(1, probes)), found);
+    return 0;
+}
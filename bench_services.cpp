@@ -0,0 +1,164 @@
+// Benchmark dos serviços internos e do EXALL (sem rede).
+//
+// 1. Kernels: GB/s de maiúsculas e inversão por tamanho de valor — as
+//    lambdas de antes (resultado montado byte a byte / copiado por
+//    iteradores reversos) contra os kernels escalar, SSE2 e AVX2 de
+//    simd.hpp (os disponíveis neste processador).
+// 2. EX contra EXALL: tuplas/s para drenar uma chave com N tuplas,
+//    uma a uma com EX ou de uma vez com EXALL, por tamanho de valor.
+// 3. Pipeline 1,2 (maiúsculas e inversão): dois EX com uma chave
+//    intermediária contra um EX com o pipeline (fundido numa passada).
+//
+// Uso: linda_bench_services [ms_por_medida] [tuplas_por_chave]
+#include "main.hpp"
+#include "simd.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Lambdas originais dos serviços 1 e 2 (com cópia do valor, como o EX
+// fazia).
+static string old_upper(string s) {
+    string r;
+    r.reserve(s.size());
+    for (unsigned char c : s)
+        r += static_cast<char>(toupper(c));
+    return r;
+}
+
+static string old_reverse(string s) {
+    return string(s.rbegin(), s.rend());
+}
+
+static volatile size_t sink;  // impede que o compilador descarte o trabalho
+
+// GB/s de `fn` aplicada repetidamente a um valor de `size` bytes.
+template <class Fn>
+static double measure(size_t size, unsigned ms, Fn fn) {
+    string v(size, 'x');
+    for (size_t i = 0; i < size; ++i)
+        v[i] = static_cast<char>("aZ9 bq~\xc3\xa9"[i % 9]);
+    size_t bytes = 0;
+    auto   start = chrono::steady_clock::now();
+    auto   end   = start + chrono::milliseconds(ms);
+    while (chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 64; ++i)
+            sink = fn(v);
+        bytes += 64 * size;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return static_cast<double>(bytes) / secs / 1e9;
+}
+
+// Tuplas/s para transformar `n` tuplas de `size` bytes: EX uma a uma ou
+// EXALL.
+static double drain(size_t size, size_t n, unsigned ms, bool all) {
+    TupleServer ts;
+    string      v(size, 'q');
+    size_t      done  = 0;
+    auto        start = chrono::steady_clock::now();
+    auto        end   = start + chrono::milliseconds(ms);
+    double      busy  = 0;  // só o tempo da transformação, sem os WRs
+    while (chrono::steady_clock::now() < end) {
+        for (size_t i = 0; i < n; ++i)
+            ts.write("in", v);
+        auto t0 = chrono::steady_clock::now();
+        if (all) {
+            size_t got = 0;
+            ts.ex_all("in", "out", 1, got);
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                ts.ex("in", "out", 1);
+        }
+        busy += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        vector<string> out;
+        ts.inp_many("out", n, out);
+        done += n;
+    }
+    return static_cast<double>(done) / busy;
+}
+
+// Tuplas/s de maiúsculas + inversão: dois EX encadeados por uma chave
+// intermediária ou um EX com o pipeline 1,2.
+static double chained(size_t size, unsigned ms, bool pipeline) {
+    TupleServer ts;
+    string      v(size, 'q');
+    int         ids[] = {1, 2};
+    size_t      done  = 0;
+    auto        start = chrono::steady_clock::now();
+    auto        end   = start + chrono::milliseconds(ms);
+    while (chrono::steady_clock::now() < end) {
+        for (int i = 0; i < 64; ++i) {
+            ts.write("in", v);
+            if (pipeline) {
+                ts.ex("in", "out", ServiceChain(ids, 2));
+            } else {
+                ts.ex("in", "mid", 1);
+                ts.ex("mid", "out", 2);
+            }
+            sink = ts.in("out").size();
+        }
+        done += 64;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return static_cast<double>(done) / secs;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned ms = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 200;
+    size_t   n  = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000;
+    const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+
+    printf("Kernels disponíveis: despacho = %s\n", simd::name(simd::best()));
+    for (int svc = 1; svc <= 2; ++svc) {
+        printf("\n=== Serviço %d (%s), GB/s ===\n", svc, svc == 1 ? "maiúsculas" : "inversão");
+        printf("%8s %10s", "bytes", "lambda");
+        const simd::Isa isas[] = {simd::Isa::SCALAR, simd::Isa::SSE2, simd::Isa::AVX2};
+        for (auto isa : isas)
+            printf(" %10s", simd::name(isa));
+        printf("\n");
+        for (size_t size : sizes) {
+            printf("%8zu %10.2f", size,
+                   measure(size, ms, [svc](const string& v) {
+                       return (svc == 1 ? old_upper(v) : old_reverse(v)).size();
+                   }));
+            for (auto isa : isas) {
+                simd::Kernel k = svc == 1 ? simd::upper_kernel(isa) : simd::reverse_kernel(isa);
+                if (k == nullptr) {
+                    printf(" %10s", "-");
+                    continue;
+                }
+                // Mesma cópia do valor que o EX faz, mais o kernel no lugar.
+                printf(" %10.2f", measure(size, ms, [k](const string& v) {
+                           string r = v;
+                           k(&r[0], r.size());
+                           return r.size();
+                       }));
+            }
+            printf("\n");
+        }
+    }
+
+    printf("\n=== Drenar %zu tuplas com o serviço 1: EX x EXALL, tuplas/s ===\n", n);
+    printf("%8s %14s %14s %8s\n", "bytes", "EX", "EXALL", "ganho");
+    for (size_t size : sizes) {
+        double ex  = drain(size, n, ms, false);
+        double all = drain(size, n, ms, true);
+        printf("%8zu %14.0f %14.0f %7.1fx\n", size, ex, all, all / ex);
+    }
+
+    printf("\n=== Maiúsculas + inversão: EX 1 e EX 2 x EX 1,2, tuplas/s ===\n");
+    printf("%8s %14s %14s %8s\n", "bytes", "dois EX", "pipeline", "ganho");
+    for (size_t size : sizes) {
+        double two = chained(size, ms, false);
+        double one = chained(size, ms, true);
+        printf("%8zu %14.0f %14.0f %7.1fx\n", size, two, one, one / two);
+    }
+    return 0;
+}
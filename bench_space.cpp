@@ -0,0 +1,114 @@
+// Benchmark de escalabilidade do TupleServer (sem rede).
+//
+// Cada thread faz pares WR + IN em chaves próprias, então não há disputa
+// lógica entre threads: qualquer perda de escala vem do lock. Compara o
+// espaço com um único shard (lock global) contra o espaço particionado.
+// Em seguida mede o custo por tupla de MWR + INN em lotes de tamanhos
+// crescentes, contra WR + IN uma a uma.
+//
+// Uso: linda_bench_space [max_threads] [shards] [ms_por_rodada]
+#include "main.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Executa `threads` threads por `ms` milissegundos; retorna ops/s.
+static double run_round(size_t shards, unsigned threads, unsigned ms) {
+    TupleServer    ts(shards);
+    atomic<bool>   go{false}, stop{false};
+    atomic<size_t> total{0};
+
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            // 64 chaves por thread: o hash as espalha pelos shards.
+            vector<string> keys;
+            for (int k = 0; k < 64; ++k)
+                keys.push_back("t" + to_string(t) + "_k" + to_string(k));
+
+            while (!go.load(memory_order_acquire))
+                this_thread::yield();
+
+            size_t ops = 0;
+            for (size_t i = 0; !stop.load(memory_order_relaxed); ++i) {
+                const string& key = keys[i % keys.size()];
+                ts.write(key, "v");
+                ts.in(key);
+                ops += 2;
+            }
+            total += ops;
+        });
+    }
+
+    auto start = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    stop = true;
+    for (auto& th : pool)
+        th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return static_cast<double>(total.load()) / secs;
+}
+
+// Lotes de `batch` tuplas (MWR + INN) numa chave, por `ms` milissegundos
+// em um thread; retorna ns por tupla (escrita + remoção). batch == 0 mede
+// WR + IN uma a uma.
+static double run_batches(size_t batch, unsigned ms) {
+    TupleServer ts;
+    size_t      tuples = 0;
+    auto        start  = chrono::steady_clock::now();
+    auto        until  = start + chrono::milliseconds(ms);
+    vector<string> taken;
+    while (chrono::steady_clock::now() < until) {
+        for (int r = 0; r < 64; ++r) {
+            if (batch == 0) {
+                ts.write("lote", "v");
+                ts.in("lote");
+                ++tuples;
+                continue;
+            }
+            vector<pair<string, string>> items(batch, {"lote", "v"});
+            ts.write_many(move(items));
+            taken.clear();
+            tuples += ts.inp_many("lote", batch, taken);
+        }
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return secs * 1e9 / static_cast<double>(tuples);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max_threads = argc > 1 ? static_cast<unsigned>(atoi(argv[1]))
+                                    : max(1u, 2 * thread::hardware_concurrency());
+    size_t   shards      = argc > 2 ? static_cast<size_t>(atoi(argv[2]))
+                                    : TupleServer::DEFAULT_SHARDS;
+    unsigned ms          = argc > 3 ? static_cast<unsigned>(atoi(argv[3])) : 500;
+
+    printf("=== Escalabilidade do TupleServer (WR+IN, chaves por thread) ===\n");
+    printf("%8s %16s %16s %8s\n", "threads", "1 shard (op/s)",
+           (to_string(shards) + " shards (op/s)").c_str(), "ganho");
+
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+        double single  = run_round(1, t, ms);
+        double sharded = run_round(shards, t, ms);
+        printf("%8u %16.0f %16.0f %7.2fx\n", t, single, sharded, sharded / single);
+    }
+
+    printf("\n=== Lotes: custo por tupla (WR+IN vs MWR+INN, 1 thread) ===\n");
+    printf("%8s %12s %8s\n", "lote", "ns/tupla", "ganho");
+    double one = run_batches(0, ms);
+    printf("%8s %12.1f %7.2fx\n", "WR+IN", one, 1.0);
+    for (size_t b : {1, 10, 100, 1000}) {
+        double ns = run_batches(b, ms);
+        printf("%8zu %12.1f %7.2fx\n", b, ns, one / ns);
+    }
+    return 0;
+}
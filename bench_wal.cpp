@@ -0,0 +1,150 @@
+// Benchmark do write-ahead log (sem rede).
+//
+// Cada thread faz WRs em chaves próprias por um tempo fixo, com o espaço só
+// em memória e com o WAL em cada modo de sincronização. No modo ALWAYS
+// cada WR só retorna depois do fsync; com vários threads o group commit
+// junta os registros que chegam durante um fsync no fsync seguinte, e a
+// coluna "WR/lote" mostra quantas operações cada gravação (write + fsync,
+// ou só write no modo OS) cobriu.
+//
+// Depois mede o tempo de partida com o mesmo número de chaves e volumes
+// crescentes de dados: relendo só o log, e a partir de um snapshot (cujas
+// tuplas ficam no arquivo mapeado até serem lidas).
+//
+// Uso: linda_bench_wal [max_threads] [ms_por_rodada] [arquivo]
+#include "main.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Remove o log (segmentos e snapshot) com base em `path`.
+static void remove_log(const string& path) {
+    filesystem::path p(path);
+    filesystem::path dir    = p.has_parent_path() ? p.parent_path() : filesystem::path(".");
+    string           prefix = p.filename().string() + ".";
+    error_code       ec;
+    for (auto& ent : filesystem::directory_iterator(dir, ec))
+        if (ent.path().filename().string().rfind(prefix, 0) == 0)
+            filesystem::remove(ent.path(), ec);
+}
+
+struct Result {
+    double ops_per_sec;
+    double ops_per_flush;  // 0 sem WAL
+};
+
+// `mode` nulo: sem WAL.
+static Result run_round(const Wal::Sync* mode, unsigned threads, unsigned ms,
+                        const string& path) {
+    remove_log(path);
+    TupleServer ts;
+    if (mode)
+        ts.open_wal(Wal::Options{path, *mode, chrono::milliseconds(10)});
+
+    atomic<bool>   go{false}, stop{false};
+    atomic<size_t> total{0};
+    string         value(100, 'v');  // tupla típica de fila de tarefas
+
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            vector<string> keys;
+            for (int k = 0; k < 64; ++k)
+                keys.push_back("t" + to_string(t) + "_k" + to_string(k));
+
+            while (!go.load(memory_order_acquire))
+                this_thread::yield();
+
+            size_t ops = 0;
+            for (size_t i = 0; !stop.load(memory_order_relaxed); ++i) {
+                ts.write(keys[i % keys.size()], value);
+                ++ops;
+            }
+            total += ops;
+        });
+    }
+
+    auto start = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    stop = true;
+    for (auto& th : pool)
+        th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    Result r{static_cast<double>(total.load()) / secs, 0};
+    if (mode && ts.wal_log()->flush_count() > 0)
+        r.ops_per_flush = static_cast<double>(total.load()) /
+                          static_cast<double>(ts.wal_log()->flush_count());
+    return r;
+}
+
+// Partida (open_wal) com `keys` chaves e `per_key` tuplas de 1 KiB cada;
+// retorna ms. `snap`: a partir de um snapshot em vez de só do log.
+static double run_startup(size_t keys, size_t per_key, bool snap, const string& path) {
+    remove_log(path);
+    {
+        TupleServer ts;
+        ts.open_wal(Wal::Options{path, Wal::Sync::OS, chrono::milliseconds(10)});
+        string value(1024, 'v');
+        for (size_t t = 0; t < per_key; ++t) {
+            vector<pair<string, string>> batch;
+            for (size_t k = 0; k < keys; ++k)
+                batch.emplace_back("chave" + to_string(k), value);
+            ts.write_many(move(batch));
+        }
+        if (snap)
+            ts.write_snapshot();
+    }
+    auto        start = chrono::steady_clock::now();
+    TupleServer ts;
+    ts.open_wal(Wal::Options{path, Wal::Sync::OS, chrono::milliseconds(10)});
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    unsigned max_threads = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 16;
+    unsigned ms          = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 500;
+    string   path        = argc > 3 ? argv[3] : "linda_bench.wal";
+
+    struct Mode {
+        const char* name;
+        Wal::Sync   sync;
+    };
+    const Mode modes[] = {
+        {"os", Wal::Sync::OS},
+        {"interval", Wal::Sync::INTERVAL},
+        {"always", Wal::Sync::ALWAYS},
+    };
+
+    printf("=== WAL: vazão de WR por modo de sincronização (valor de 100 bytes) ===\n");
+    printf("%8s %10s %14s %10s\n", "threads", "modo", "WR/s", "WR/lote");
+    for (unsigned t = 1; t <= max_threads; t *= 4) {
+        Result mem = run_round(nullptr, t, ms, path);
+        printf("%8u %10s %14.0f %10s\n", t, "sem WAL", mem.ops_per_sec, "-");
+        for (const Mode& m : modes) {
+            Result r = run_round(&m.sync, t, ms, path);
+            printf("%8u %10s %14.0f %10.1f\n", t, m.name, r.ops_per_sec, r.ops_per_flush);
+        }
+    }
+
+    printf("\n=== Partida: 10000 chaves, tuplas de 1 KiB ===\n");
+    printf("%10s %10s %14s %14s\n", "tuplas", "MiB", "só log (ms)", "snapshot (ms)");
+    for (size_t per_key : {1, 4, 16}) {
+        double log  = run_startup(10000, per_key, false, path);
+        double snap = run_startup(10000, per_key, true, path);
+        printf("%10zu %10zu %14.1f %14.1f\n", 10000 * per_key, 10000 * per_key / 1024,
+               log, snap);
+    }
+    remove_log(path);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Espera dos waiters síncronos dos shards sobre o futex do Linux.
+//
+// FutexCondVar: contador de eventos (eventcount). Quem espera lê o
+// contador com o lock adquirido, solta o lock e dorme no futex enquanto o
+// contador não mudar; notify incrementa e acorda. Como o notify dos
+// waiters acontece com o lock adquirido, não há despertar perdido. Serve a
+// qualquer lock com lock()/unlock() (o std::condition_variable só aceita
+// std::mutex), então o lock instrumentado de lock_stats.hpp não precisa
+// do std::condition_variable_any.
+//
+// O lock dos shards é o std::mutex: na glibc ele já é um mutex sobre
+// futex, sem syscall quando não há disputa.
+// ---------------------------------------------------------------------------
+
+#if defined(__linux__)
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace futex {
+
+inline void wait(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                 const timespec* timeout = nullptr) {
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                  "futex exige uma palavra de 32 bits");
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE,
+              expected, timeout, nullptr, 0);
+}
+
+inline void wake(std::atomic<std::uint32_t>& word, int n) {
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, n,
+              nullptr, nullptr, 0);
+}
+
+}  // namespace futex
+
+class FutexCondVar {
+public:
+    void notify_one() {
+        seq.fetch_add(1, std::memory_order_release);
+        futex::wake(seq, 1);
+    }
+
+    void notify_all() {
+        seq.fetch_add(1, std::memory_order_release);
+        futex::wake(seq, INT_MAX);
+    }
+
+    // Uma espera; retorna ao ser notificado ou espuriamente.
+    template <class Lock>
+    void wait(std::unique_lock<Lock>& lk) {
+        std::uint32_t s = seq.load(std::memory_order_acquire);
+        lk.unlock();
+        futex::wait(seq, s);
+        lk.lock();
+    }
+
+    // Idem, ou no prazo.
+    template <class Lock, class Clock, class Duration>
+    std::cv_status wait_until(std::unique_lock<Lock>&                         lk,
+                              const std::chrono::time_point<Clock, Duration>& until) {
+        std::uint32_t s    = seq.load(std::memory_order_acquire);
+        auto          left = until - Clock::now();
+        if (left <= left.zero())
+            return std::cv_status::timeout;
+        auto     ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+        lk.unlock();
+        futex::wait(seq, s, &ts);
+        lk.lock();
+        return Clock::now() < until ? std::cv_status::no_timeout : std::cv_status::timeout;
+    }
+
+    template <class Lock, class Pred>
+    void wait(std::unique_lock<Lock>& lk, Pred pred) {
+        while (!pred())
+            wait(lk);
+    }
+
+    template <class Lock, class Rep, class Period, class Pred>
+    bool wait_for(std::unique_lock<Lock>& lk, const std::chrono::duration<Rep, Period>& timeout,
+                  Pred pred) {
+        auto until = std::chrono::steady_clock::now() + timeout;
+        while (!pred()) {
+            if (wait_until(lk, until) == std::cv_status::timeout)
+                return pred();
+        }
+        return true;
+    }
+
+private:
+    std::atomic<std::uint32_t> seq{0};
+};
+
+#endif  // __linux__
@@ -0,0 +1,97 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Histograma de latências no estilo HDR: faixas log-lineares com erro
+// relativo fixo, sem limite de valor e sem guardar as amostras.
+//
+// Valores até 255 têm uma faixa cada; acima disso, cada potência de 2 é
+// dividida em 128 faixas, então uma faixa cobre no máximo 1/128 do seu
+// valor (< 0,8%: dois dígitos significativos). Os percentis retornam o
+// maior valor da faixa, como o HdrHistogram. O vetor de contadores cresce
+// só até a faixa do maior valor registrado (latências de até 1 ms em ns:
+// ~1,5k contadores).
+//
+// Não é thread-safe: cada thread registra no seu e os resultados são
+// somados com merge().
+// ---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Histogram {
+public:
+    void record(std::uint64_t v) {
+        std::size_t i = index(v);
+        if (i >= counts.size())
+            counts.resize(i + 1);
+        ++counts[i];
+        ++n;
+        sum += static_cast<double>(v);
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+    }
+
+    void merge(const Histogram& o) {
+        if (o.counts.size() > counts.size())
+            counts.resize(o.counts.size());
+        for (std::size_t i = 0; i < o.counts.size(); ++i)
+            counts[i] += o.counts[i];
+        n += o.n;
+        sum += o.sum;
+        lo = std::min(lo, o.lo);
+        hi = std::max(hi, o.hi);
+    }
+
+    std::uint64_t count() const { return n; }
+    std::uint64_t min() const { return n ? lo : 0; }  // exatos
+    std::uint64_t max() const { return hi; }
+    double        mean() const { return n ? sum / static_cast<double>(n) : 0; }
+
+    // Menor valor v (com o erro de uma faixa) tal que uma fração q das
+    // amostras é <= v. q em [0, 1]; 0 sem amostras.
+    std::uint64_t percentile(double q) const {
+        if (n == 0)
+            return 0;
+        auto target = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(n)));
+        target      = std::max<std::uint64_t>(target, 1);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target)
+                return std::min(highest(i), hi);
+        }
+        return hi;
+    }
+
+private:
+    static constexpr unsigned    SUB_BITS = 8;
+    static constexpr std::size_t SUB      = std::size_t(1) << SUB_BITS;  // faixas exatas
+    static constexpr std::size_t HALF     = SUB / 2;  // faixas por potência de 2
+
+    // Acima de SUB: expoente e = msb - 7 e mantissa v >> e em [128, 256),
+    // as faixas de cada expoente logo após as do anterior.
+    static std::size_t index(std::uint64_t v) {
+        if (v < SUB)
+            return static_cast<std::size_t>(v);
+        unsigned e = 63 - static_cast<unsigned>(__builtin_clzll(v)) - (SUB_BITS - 1);
+        return e * HALF + static_cast<std::size_t>(v >> e);
+    }
+
+    // Maior valor da faixa i.
+    static std::uint64_t highest(std::size_t i) {
+        if (i < SUB)
+            return i;
+        std::size_t e = i / HALF - 1;
+        std::size_t m = i - e * HALF;
+        return ((std::uint64_t(m) + 1) << e) - 1;
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t              n   = 0;
+    double                     sum = 0;
+    std::uint64_t              lo  = UINT64_MAX;
+    std::uint64_t              hi  = 0;
+};
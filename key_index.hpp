@@ -0,0 +1,246 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Estruturas compactas do espaço de tuplas:
+//
+//   TupleQueue  fila FIFO de tuplas de uma chave
+//   KeyIndex    índice chave -> estado da chave de um shard
+//
+// Feitas para o caso comum de muitas chaves com filas curtas (uma chave por
+// requisição como canal de resposta): uma chave com uma tupla custa uma
+// única alocação, e uma chave drenada pode sair do índice.
+// ---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// ---------------------------------------------------------------------------
+// TupleQueue: até uma tupla fica inline, sem alocação; a partir da segunda,
+// um anel com capacidade potência de 2 que cresce dobrando (std::deque
+// aloca um bloco de 512 bytes já para a primeira).
+// ---------------------------------------------------------------------------
+class TupleQueue {
+public:
+    TupleQueue() = default;
+
+    TupleQueue(const TupleQueue&)            = delete;
+    TupleQueue& operator=(const TupleQueue&) = delete;
+
+    bool        empty() const { return n == 0; }
+    std::size_t size() const { return n; }
+
+    // Pré-condição: !empty() (operator[]: i < size()).
+    const std::string& front() const { return at(0); }
+    const std::string& back() const { return at(n - 1); }
+    const std::string& operator[](std::size_t i) const { return at(i); }
+
+    void push_back(std::string v) {
+        if (!ring && n == 0) {
+            one = std::move(v);
+            n   = 1;
+            return;
+        }
+        if (!ring || n == cap)
+            grow();
+        ring[(head + n) & (cap - 1)] = std::move(v);
+        ++n;
+    }
+
+    // Libera o valor da tupla i, que fica vazia no lugar (TTL vencido no
+    // meio da fila). Pré-condição: i < size().
+    void release(std::size_t i) {
+        std::string& v = ring ? ring[(head + i) & (cap - 1)] : one;
+        std::string().swap(v);
+    }
+
+    std::string pop_front() {
+        --n;
+        if (!ring)
+            return std::move(one);
+        std::string v = std::move(ring[head]);
+        head          = (head + 1) & (cap - 1);
+        return v;
+    }
+
+private:
+    const std::string& at(std::size_t i) const {
+        return ring ? ring[(head + i) & (cap - 1)] : one;
+    }
+
+    void grow() {
+        std::uint32_t next = cap == 0 ? 4 : 2 * cap;
+        auto          r    = std::make_unique<std::string[]>(next);
+        if (!ring)
+            r[0] = std::move(one);
+        else
+            for (std::uint32_t i = 0; i < n; ++i)
+                r[i] = std::move(ring[(head + i) & (cap - 1)]);
+        ring = std::move(r);
+        cap  = next;
+        head = 0;
+    }
+
+    std::string                    one;  // a tupla, enquanto não há anel
+    std::unique_ptr<std::string[]> ring;
+    std::uint32_t                  cap  = 0;
+    std::uint32_t                  head = 0;
+    std::uint32_t                  n    = 0;
+};
+
+// ---------------------------------------------------------------------------
+// KeyIndex: hash com endereçamento aberto (sondagem linear; remoção por
+// deslocamento para trás, sem lápides). A tabela guarda só (hash, valor):
+// a sondagem percorre memória contígua e só toca o nó quando o hash bate.
+//
+// Cada chave é um nó de uma única alocação — cabeçalho, valor e os bytes
+// da chave, guardados uma só vez (key() os devolve sem cópia). O endereço
+// do valor não muda enquanto a chave estiver no índice.
+//
+// `Hash` mapeia string_view -> uint64_t; a posição na tabela vem dos bits
+// altos do hash multiplicado (os baixos já escolheram o shard).
+// ---------------------------------------------------------------------------
+template <class T, class Hash>
+class KeyIndex {
+public:
+    KeyIndex() = default;
+    ~KeyIndex() {
+        for (std::size_t i = 0; i < cap; ++i)
+            if (slots[i].value)
+                destroy(slots[i].value);
+    }
+
+    KeyIndex(const KeyIndex&)            = delete;
+    KeyIndex& operator=(const KeyIndex&) = delete;
+
+    std::size_t size() const { return count; }
+
+    // Valor da chave, ou nulo.
+    T* find(std::string_view key) const {
+        if (count == 0)
+            return nullptr;
+        std::uint64_t h = Hash{}(key);
+        for (std::size_t i = home(h);; i = (i + 1) & (cap - 1)) {
+            const Slot& s = slots[i];
+            if (!s.value)
+                return nullptr;
+            if (s.hash == h && KeyIndex::key(*s.value) == key)
+                return s.value;
+        }
+    }
+
+    // Valor da chave, criado (T{}) se ela não existe.
+    T& emplace(std::string_view key) {
+        if (T* v = find(key))
+            return *v;
+        if (4 * (count + 1) > 3 * cap)
+            rehash(cap == 0 ? MIN_CAP : 2 * cap);
+
+        std::uint64_t h   = Hash{}(key);
+        char*         mem = static_cast<char*>(::operator new(VALUE_OFF + sizeof(T) + key.size()));
+        new (mem) Head{h, key.size()};
+        T* v = new (mem + VALUE_OFF) T();
+        if (!key.empty())
+            std::memcpy(mem + VALUE_OFF + sizeof(T), key.data(), key.size());
+        insert({h, v});
+        ++count;
+        return *v;
+    }
+
+    // Remove a chave de `v` (um valor do índice).
+    void erase(T& v) {
+        std::size_t i = home(head(v).hash);
+        while (slots[i].value != &v)
+            i = (i + 1) & (cap - 1);
+
+        // Traz para o buraco os que sondaram por cima dele.
+        for (std::size_t j = (i + 1) & (cap - 1); slots[j].value; j = (j + 1) & (cap - 1)) {
+            std::size_t ideal = home(slots[j].hash);
+            if (((j - ideal) & (cap - 1)) >= ((j - i) & (cap - 1))) {
+                slots[i] = slots[j];
+                i        = j;
+            }
+        }
+        slots[i] = Slot{};
+        destroy(&v);
+        --count;
+
+        if (cap > MIN_CAP && 8 * count < cap)
+            rehash(cap / 2);
+    }
+
+    // Chave de `v` (um valor do índice); vale enquanto ela existir.
+    static std::string_view key(const T& v) {
+        return {reinterpret_cast<const char*>(&v) + sizeof(T), head(v).key_len};
+    }
+
+    // Chama `fn(chave, valor)` para cada chave, em ordem arbitrária. `fn`
+    // não pode inserir nem remover chaves.
+    template <class F>
+    void for_each(F&& fn) const {
+        for (std::size_t i = 0; i < cap; ++i)
+            if (slots[i].value)
+                fn(key(*slots[i].value), *slots[i].value);
+    }
+
+private:
+    struct Head {
+        std::uint64_t hash;
+        std::size_t   key_len;
+    };
+    static constexpr std::size_t VALUE_OFF =
+        (sizeof(Head) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                  "KeyIndex: alinhamento de T maior que o de operator new");
+
+    struct Slot {
+        std::uint64_t hash  = 0;
+        T*            value = nullptr;  // nulo: posição livre
+    };
+
+    static constexpr std::size_t MIN_CAP = 16;
+
+    static const Head& head(const T& v) {
+        return *reinterpret_cast<const Head*>(reinterpret_cast<const char*>(&v) - VALUE_OFF);
+    }
+
+    static void destroy(T* v) {
+        char* mem = reinterpret_cast<char*>(v) - VALUE_OFF;
+        v->~T();
+        ::operator delete(mem);
+    }
+
+    std::size_t home(std::uint64_t h) const {
+        return static_cast<std::size_t>((h * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    void insert(Slot s) {
+        std::size_t i = home(s.hash);
+        while (slots[i].value)
+            i = (i + 1) & (cap - 1);
+        slots[i] = s;
+    }
+
+    void rehash(std::size_t n) {
+        std::unique_ptr<Slot[]> old      = std::move(slots);
+        std::size_t             old_cap  = cap;
+        slots = std::make_unique<Slot[]>(n);
+        cap   = n;
+        shift = 64;
+        for (std::size_t c = n; c > 1; c >>= 1)
+            --shift;
+        for (std::size_t i = 0; i < old_cap; ++i)
+            if (old[i].value)
+                insert(old[i]);
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t             cap   = 0;  // potência de 2
+    unsigned                shift = 64;
+    std::size_t             count = 0;
+};
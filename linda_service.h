@@ -0,0 +1,79 @@
+#ifndef LINDA_SERVICE_H
+#define LINDA_SERVICE_H
+
+/*
+ * ABI estável dos serviços do EX.
+ *
+ * Um serviço transforma o valor da tupla de entrada no próprio buffer, sem
+ * alocar: o servidor entrega o valor com alguma folga de capacidade e o
+ * serviço escreve o resultado por cima. Se o resultado não cabe, o serviço
+ * não escreve nada e devolve a capacidade necessária; o servidor aumenta o
+ * buffer (preservando o valor) e chama de novo.
+ *
+ * Uma biblioteca compartilhada (.so / .dll) exporta a função
+ * linda_services(), que devolve um vetor de descritores — vários serviços
+ * por biblioteca. O servidor a carrega na partida (services_dir) ou pelo
+ * comando LOAD; um svc_id já registrado é substituído. Os descritores e o
+ * código precisam continuar válidos enquanto a biblioteca estiver aberta:
+ * ela só é fechada depois que nenhum EX a usa mais.
+ *
+ * Serviços podem ser chamados por vários threads ao mesmo tempo.
+ *
+ * Compatível com C e C++. Mudanças incompatíveis trocam LINDA_SERVICE_ABI.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINDA_SERVICE_ABI   1u
+#define LINDA_SERVICE_ENTRY "linda_services"
+
+#if defined(_WIN32)
+#define LINDA_EXPORT __declspec(dllexport)
+#else
+#define LINDA_EXPORT __attribute__((visibility("default")))
+#endif
+
+/* Um valor, transformado no lugar. */
+typedef struct linda_value {
+    char*  data;
+    size_t len; /* bytes válidos em data */
+    size_t cap; /* bytes que podem ser escritos em data (cap >= len) */
+} linda_value;
+
+/*
+ * Transforma v: escreve o resultado em v->data, atualiza v->len e retorna
+ * 0. Se o resultado não cabe em v->cap, não altera nada e retorna a
+ * capacidade necessária (> v->cap).
+ */
+typedef size_t (*linda_transform_fn)(linda_value* v);
+
+/*
+ * Lote: o mesmo contrato para n valores independentes; need[i] recebe o
+ * retorno que transform() daria para values[i]. Os valores com need[i] != 0
+ * são refeitos um a um com transform(). Opcional.
+ */
+typedef void (*linda_batch_fn)(linda_value* values, size_t* need, size_t n);
+
+typedef struct linda_service {
+    int32_t            svc_id;
+    const char*        name;
+    linda_transform_fn transform;
+    linda_batch_fn     batch; /* NULL: o servidor chama transform() por valor */
+} linda_service;
+
+/*
+ * Ponto de entrada exportado pela biblioteca (LINDA_SERVICE_ENTRY).
+ * Preenche *abi com LINDA_SERVICE_ABI e *count com o número de descritores.
+ */
+typedef const linda_service* (*linda_services_fn)(uint32_t* abi, size_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LINDA_SERVICE_H */
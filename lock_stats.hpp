@@ -0,0 +1,148 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Lock e espera dos shards do TupleServer, com instrumentação opcional.
+//
+// ShardMutex é o std::mutex. No Linux, ShardCondVar é o FutexCondVar (ver
+// futex.hpp); -DLINDA_STD_CONDVAR=1, ou outra plataforma, volta para o
+// std::condition_variable (linda_bench_contention_std, para comparar os
+// dois).
+//
+// A instrumentação é ligada só ao compilar com -DLINDA_LOCK_STATS=1
+// (linda_bench_contention); sem ela não há custo nenhum.
+//
+// Com ela, cada aquisição mede quanto tempo esperou pelo lock e quanto
+// tempo o segurou, e cada retorno de uma espera de waiter síncrono conta
+// um despertar. Os contadores ficam no próprio mutex e só mudam com ele
+// adquirido: a medida não acrescenta nenhum atômico disputado entre
+// threads, só as leituras do relógio (dezenas de ns por aquisição, que
+// entram nos tempos de posse curtos).
+// ---------------------------------------------------------------------------
+
+#include "futex.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#ifndef LINDA_LOCK_STATS
+#define LINDA_LOCK_STATS 0
+#endif
+
+#ifndef LINDA_STD_CONDVAR
+#define LINDA_STD_CONDVAR 0
+#endif
+
+using BaseShardMutex = std::mutex;
+
+#if defined(__linux__) && !LINDA_STD_CONDVAR
+#define LINDA_FUTEX_WAITS 1
+using BaseShardCondVar = FutexCondVar;  // qualquer lock
+#else
+#define LINDA_FUTEX_WAITS 0
+using BaseShardCondVar = std::condition_variable;  // só std::mutex
+#endif
+
+struct LockStats {
+    std::uint64_t acquisitions = 0;
+    std::uint64_t contended    = 0;  // aquisições que encontraram o lock ocupado
+    std::uint64_t wait_ns      = 0;  // esperando o lock
+    std::uint64_t hold_ns      = 0;  // com o lock (fora das esperas no cv)
+    std::uint64_t wakeups      = 0;  // retornos de esperas no cv, espúrios inclusive
+
+    LockStats& operator+=(const LockStats& o) {
+        acquisitions += o.acquisitions;
+        contended += o.contended;
+        wait_ns += o.wait_ns;
+        hold_ns += o.hold_ns;
+        wakeups += o.wakeups;
+        return *this;
+    }
+};
+
+#if LINDA_LOCK_STATS
+
+class ShardMutex {
+public:
+    void lock() {
+        if (mtx.try_lock()) {
+            since = Clock::now();
+        } else {
+            auto t0 = Clock::now();
+            mtx.lock();
+            since = Clock::now();
+            ++counters.contended;
+            counters.wait_ns += ns(since - t0);
+        }
+        ++counters.acquisitions;
+    }
+
+    bool try_lock() {
+        if (!mtx.try_lock())
+            return false;
+        since = Clock::now();
+        ++counters.acquisitions;
+        return true;
+    }
+
+    void unlock() {
+        counters.hold_ns += ns(Clock::now() - since);
+        mtx.unlock();
+    }
+
+    // Com o lock adquirido.
+    LockStats& stats() { return counters; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static std::uint64_t ns(Clock::duration d) {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    BaseShardMutex    mtx;
+    Clock::time_point since;
+    LockStats         counters;
+};
+
+class ShardCondVar {
+public:
+    void notify_one() { cv.notify_one(); }
+
+    template <class Pred>
+    void wait(std::unique_lock<ShardMutex>& lk, Pred pred) {
+        while (!pred()) {
+            cv.wait(lk);
+            ++lk.mutex()->stats().wakeups;
+        }
+    }
+
+    template <class Rep, class Period, class Pred>
+    bool wait_for(std::unique_lock<ShardMutex>& lk,
+                  const std::chrono::duration<Rep, Period>& timeout, Pred pred) {
+        auto until = std::chrono::steady_clock::now() + timeout;
+        while (!pred()) {
+            bool expired = cv.wait_until(lk, until) == std::cv_status::timeout;
+            ++lk.mutex()->stats().wakeups;
+            if (expired)
+                return pred();
+        }
+        return true;
+    }
+
+private:
+#if LINDA_FUTEX_WAITS
+    BaseShardCondVar cv;
+#else
+    std::condition_variable_any cv;
+#endif
+};
+
+#else
+
+using ShardMutex   = BaseShardMutex;
+using ShardCondVar = BaseShardCondVar;
+
+#endif
@@ -1,35 +1,145 @@
 #include "main.hpp"
 #include "tcp_server.hpp"
 
+#include <cctype>
+#include <chrono>
+#include <climits>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
-// Lê a porta de um arquivo "config.txt" (primeira linha = número inteiro).
-// Se o arquivo não existir ou for inválido, retorna o valor padrão.
-static unsigned short load_port(const char* config_file, unsigned short default_port) {
+// Configuração lida de "config.txt".
+struct Config {
+    unsigned short port       = 54321;
+    unsigned       io_threads = 0;  // 0 = um por núcleo
+    std::size_t    shards     = TupleServer::DEFAULT_SHARDS;
+    Wal::Options   wal;             // wal.path vazio = sem WAL
+    unsigned       snapshot_s = 0;  // 0 = sem snapshots periódicos
+    TupleServer::Limits limits;     // zeros = sem limite
+    bool                 ex_pool = false;  // serviços do EX em workers próprios
+    ServicePool::Options ex;
+    std::string          services_dir;  // vazio = sem serviços externos
+    Subscriptions::Options subs;
+    unsigned short         metrics_port = 0;  // 0 = sem listener de métricas
+    std::vector<std::pair<std::string, long>> key_ttl;  // padrão -> TTL em ms
+};
+
+// Lê a configuração de um arquivo "config.txt":
+//   - primeira linha: número da porta;
+//   - linhas seguintes (opcionais): "chave=valor", ex.: "io_threads=4",
+//     "shards=32", "wal=linda.wal", "wal_sync=interval",
+//     "wal_interval_ms=5", "snapshot_interval_s=60", "key_max_tuples=1000",
+//     "key_max_bytes=65536", "key_full=fail", "mem_high_water_mb=512",
+//     "max_value_mb=64", "ex_workers=4", "ex_ack=consume", "ex_concurrency=2",
+//     "ex_concurrency.3=1" (limite só do serviço 3), "services_dir=services",
+//     "sub_max_events=4096", "sub_max_kb=4096", "sub_overflow=disconnect",
+//     "metrics_port=9464", "key_ttl.sessao=30000" (TTL padrão em ms da
+//     chave "sessao"), "key_ttl.cache:*=5000" (das chaves com o prefixo).
+// Se o arquivo não existir ou um valor for inválido, mantém o padrão.
+static Config load_config(const char* config_file) {
+    Config cfg;
     std::ifstream f(config_file);
     if (!f.is_open())
-        return default_port;
+        return cfg;
 
     int port = 0;
     f >> port;
     if (port <= 0 || port > 65535) {
         std::cerr << "[AVISO] Porta inválida em " << config_file
-                  << "; usando " << default_port << ".\n";
-        return default_port;
+                  << "; usando " << cfg.port << ".\n";
+    } else {
+        cfg.port = static_cast<unsigned short>(port);
+    }
+
+    std::string      line;
+    Wal::Sync        sync;
+    ServicePool::Ack ack;
+    Subscriptions::Overflow overflow;
+    while (std::getline(f, line)) {
+        auto eq = line.find('=');
+        if (eq == std::string::npos)
+            continue;
+        std::string key = line.substr(0, eq);
+        std::string str = line.substr(eq + 1);
+        long        val = std::strtol(str.c_str(), nullptr, 10);
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+            str.pop_back();  // '\r' de arquivos editados no Windows
+        if (key == "io_threads" && val >= 0)
+            cfg.io_threads = static_cast<unsigned>(val);
+        else if (key == "shards" && val > 0)
+            cfg.shards = static_cast<std::size_t>(val);
+        else if (key == "wal" && !str.empty())
+            cfg.wal.path = str;
+        else if (key == "wal_sync" && Wal::parse_sync(str, sync))
+            cfg.wal.sync = sync;
+        else if (key == "wal_interval_ms" && val > 0)
+            cfg.wal.interval = std::chrono::milliseconds(val);
+        else if (key == "snapshot_interval_s" && val >= 0)
+            cfg.snapshot_s = static_cast<unsigned>(val);
+        else if (key == "key_max_tuples" && val >= 0)
+            cfg.limits.key_tuples = static_cast<std::size_t>(val);
+        else if (key == "key_max_bytes" && val >= 0)
+            cfg.limits.key_bytes = static_cast<std::size_t>(val);
+        else if (key == "key_full" && (str == "block" || str == "fail"))
+            cfg.limits.block = str == "block";
+        else if (key == "mem_high_water_mb" && val >= 0)
+            cfg.limits.high_water = static_cast<std::size_t>(val) << 20;
+        else if (key == "max_value_mb" && val > 0 && val < 4096)
+            cfg.limits.value_bytes = static_cast<std::size_t>(val) << 20;
+        else if (key == "ex_workers" && val >= 0) {
+            cfg.ex_pool    = true;
+            cfg.ex.workers = static_cast<unsigned>(val);
+        } else if (key == "ex_ack" && ServicePool::parse_ack(str, ack))
+            cfg.ex.ack = ack;
+        else if (key == "ex_concurrency" && val >= 0)
+            cfg.ex.concurrency = static_cast<unsigned>(val);
+        else if (key.rfind("ex_concurrency.", 0) == 0 && val >= 0)
+            cfg.ex.service_concurrency[std::atoi(key.c_str() + 15)] = static_cast<unsigned>(val);
+        else if (key == "services_dir" && !str.empty())
+            cfg.services_dir = str;
+        else if (key == "sub_max_events" && val > 0)
+            cfg.subs.max_events = static_cast<std::size_t>(val);
+        else if (key == "sub_max_kb" && val > 0)
+            cfg.subs.max_bytes = static_cast<std::size_t>(val) << 10;
+        else if (key == "sub_overflow" && Subscriptions::parse_overflow(str, overflow))
+            cfg.subs.overflow = overflow;
+        else if (key == "metrics_port" && val > 0 && val <= 65535)
+            cfg.metrics_port = static_cast<unsigned short>(val);
+        else if (key.rfind("key_ttl.", 0) == 0 && key.size() > 8 && val > 0 && val <= INT_MAX)
+            cfg.key_ttl.emplace_back(key.substr(8), val);
+        else
+            std::cerr << "[AVISO] Opção ignorada em " << config_file
+                      << ": " << line << "\n";
     }
-    return static_cast<unsigned short>(port);
+    return cfg;
 }
 
 int main() {
-    const unsigned short DEFAULT_PORT = 54321;
-    unsigned short port = load_port("config.txt", DEFAULT_PORT);
+    Config cfg = load_config("config.txt");
 
     try {
-        TupleServer ts;
-        TcpServer   server(ts, port);
+        TupleServer ts(cfg.shards);
+        ts.set_limits(cfg.limits);
+        for (auto& [pattern, ms] : cfg.key_ttl)
+            ts.set_default_ttl(pattern, std::chrono::milliseconds(ms));
+        ts.subscriptions().set_options(cfg.subs);
+        if (cfg.ex_pool)
+            ts.start_service_pool(cfg.ex);
+        if (!cfg.services_dir.empty()) {
+            ts.service_registry().set_dir(cfg.services_dir);
+            std::size_t n = ts.service_registry().load_dir();
+            std::cout << "Serviços carregados de " << cfg.services_dir << ": " << n << "\n";
+        }
+        if (!cfg.wal.path.empty()) {
+            ts.open_wal(cfg.wal);  // reconstrói as filas: snapshot + log
+            if (cfg.snapshot_s > 0)
+                ts.start_snapshots(std::chrono::seconds(cfg.snapshot_s));
+        }
+        TcpServer server(ts, cfg.port, cfg.io_threads);
+        if (cfg.metrics_port != 0)
+            server.serve_metrics(cfg.metrics_port);
         server.run();   // bloqueia até o processo ser encerrado (Ctrl+C)
     } catch (const std::exception& e) {
         std::cerr << "[ERRO FATAL] " << e.what() << std::endl;
@@ -37,4 +147,4 @@ int main() {
     }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
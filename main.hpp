@@ -1,39 +1,731 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "key_index.hpp"
+#include "lock_stats.hpp"
+#include "radix_tree.hpp"
+#include "read_cache.hpp"
+#include "service_pool.hpp"
+#include "service_registry.hpp"
+#include "subscriptions.hpp"
+#include "timer_wheel.hpp"
+#include "wal.hpp"
+
+namespace snapshot { class Image; }
 
 class TupleServer {
+    struct Waiter;
+    struct KeyEntry;
+    struct Shard;
+
 public:
-    TupleServer();
+    // Continuação de uma operação estacionada: recebe o resultado
+    // (valor para RD/IN, "OK"/"NO-SERVICE" para EX). É chamada no thread
+    // do WR que satisfez a operação (EX com pool: no worker do serviço),
+    // já fora do lock.
+    using Continuation = std::function<void(std::string)>;
+
+    // Número padrão de shards (partições do espaço por hash da chave).
+    static constexpr std::size_t DEFAULT_SHARDS = 16;
+
+    // n_shards: em quantas partições dividir o espaço de tuplas. Cada shard
+    // tem lock e espera próprios; chaves em shards diferentes não disputam
+    // o mesmo mutex. 1 reproduz o comportamento de lock único.
+    explicit TupleServer(std::size_t n_shards = DEFAULT_SHARDS);
+    ~TupleServer();  // encerra o pool de serviços e o thread de snapshots
+
+    std::size_t shard_count() const { return n_shards; }
+
+    // Chaves no índice (com tuplas ou com operações esperando). Uma chave
+    // drenada sem ninguém esperando sai do índice.
+    std::size_t key_count();
+
+    // Esperas e posses dos locks dos shards e despertares de waiters
+    // síncronos, somados desde a criação (ver lock_stats.hpp). Zerados se
+    // o binário não foi compilado com LINDA_LOCK_STATS=1.
+    LockStats lock_stats();
+
+    // Retrato do espaço para o STATS e as métricas (ver metrics.hpp),
+    // somado shard a shard: cada shard fica travado só durante a sua
+    // parte, então o retrato não é atômico entre shards. As operações
+    // estacionadas contam por chave: RD em `readers`, IN/INN/EX (o EX
+    // espera como um IN de k_in) em `takers` e WRs esperando vaga em
+    // `writers`.
+    struct Blocked {
+        std::string key;
+        std::size_t readers = 0;
+        std::size_t takers  = 0;
+        std::size_t writers = 0;
+
+        std::size_t total() const { return readers + takers + writers; }
+    };
+    struct Stats {
+        std::size_t          keys  = 0;
+        std::size_t          bytes = 0;  // valores em fila, como bytes_used()
+        Blocked              parked;     // soma de todas as chaves (sem `key`)
+        std::vector<Blocked> blocked;    // as chaves com mais operações esperando
+        std::uint64_t        lock_contended = 0;  // aquisições com o lock ocupado
+        std::uint64_t        lock_wait_ns   = 0;  // esperando por elas
+        std::size_t          ttl_tuples     = 0;  // em fila com TTL
+        std::uint64_t        expired        = 0;  // tuplas que expiraram, desde a criação
+        std::uint64_t        expired_bytes  = 0;  // e os bytes delas
+    };
+    // `top`: quantas chaves listar em `blocked`, da mais para a menos
+    // disputada.
+    Stats stats(std::size_t top = 20);
+
+    // Limites de memória. Os bytes contados são os dos valores em fila
+    // (tuplas entregues direto a um waiter não ocupam fila) e os dos
+    // frames ainda em recepção (charge()). Zero = sem limite, salvo
+    // `value_bytes`.
+    struct Limits {
+        std::size_t key_tuples  = 0;          // tuplas por chave
+        std::size_t key_bytes   = 0;          // bytes por chave
+        bool        block       = true;       // chave cheia: WR espera vaga (false: FULL)
+        std::size_t high_water  = 0;          // bytes no espaço inteiro (backpressure)
+        std::size_t value_bytes = 64u << 20;  // maior valor de um frame binário
+    };
+
+    // Deve ser chamado antes da primeira operação.
+    void          set_limits(const Limits& limits);
+    const Limits& limits() const { return budget.limits; }
+
+    // Bytes em fila no espaço inteiro / numa chave.
+    std::size_t bytes_used() const { return budget.used.load(); }
+    std::size_t key_bytes(std::string_view key);
+
+    // Buffers dos backends TCP para frames ainda incompletos: contam em
+    // bytes_used() (e no limite global) enquanto crescem; refund() os
+    // devolve e libera os produtores parados se o uso caiu.
+    void charge(std::size_t bytes);
+    void refund(std::size_t bytes);
 
-    // WR: insere tupla (key, value). Nunca bloqueia.
-    void write(std::string key, std::string value);
+    // Backpressure global (Limits::high_water): acima do limite, os
+    // backends TCP param de ler das conexões que produzem (WR/MWR) até o
+    // uso voltar a 7/8 dele. over_high_water() é só a consulta;
+    // wait_high_water() bloqueia enquanto for preciso esperar;
+    // wait_high_water_async() retorna true se pode seguir, ou guarda
+    // `resume` e retorna false — `resume` é chamada, fora de qualquer lock,
+    // por quem liberar a memória.
+    bool over_high_water() const;
+    void wait_high_water();
+    bool wait_high_water_async(std::function<void()> resume);
+
+    // Liga o write-ahead log (ver wal.hpp): carrega o snapshot
+    // "<path>.snap", se houver, relê o log a partir dele para reconstruir
+    // as filas e passa a registrar as mutações. Deve ser chamado antes da
+    // primeira operação. Lança std::runtime_error se um arquivo não puder
+    // ser aberto ou estiver corrompido.
+    void open_wal(const Wal::Options& opt);
+
+    // Grava um snapshot de todas as filas (ver snapshot.hpp) e apaga os
+    // segmentos do WAL que ele cobre. Cada shard fica travado só enquanto
+    // suas filas são copiadas; a gravação acontece fora dos locks. Retorna
+    // false sem WAL. Lança std::runtime_error em falha de E/S.
+    bool write_snapshot();
+
+    // Chama write_snapshot() a cada `every`, num thread próprio, se houve
+    // mutação desde o anterior.
+    void start_snapshots(std::chrono::seconds every);
+    const Wal* wal_log() const { return wal.get(); }  // nulo sem WAL
+
+    // Liga o pool de workers dos serviços do EX (ver service_pool.hpp).
+    // Deve ser chamado antes da primeira operação.
+    void               start_service_pool(const ServicePool::Options& opt);
+    const ServicePool* service_pool() const { return pool.get(); }  // nulo sem pool
+
+    // Verdadeiro se a resposta do EX espera um worker (pool no modo
+    // PUBLISH): ex_async() só conclui na hora sem continuação (sondagem).
+    bool ex_deferred() const { return pool && pool->ack() == ServicePool::Ack::PUBLISH; }
+
+    // Registro dos serviços do EX (ver service_registry.hpp): LOAD/UNLOAD
+    // e o services_dir da configuração.
+    ServiceRegistry& service_registry() { return services; }
+
+    // Assinaturas (SUB/UNSUB, ver subscriptions.hpp): toda tupla que entra
+    // no espaço (WR, MWR, resultado de EX/EXALL, WR admitido numa vaga) é
+    // publicada para as conexões que assinam a chave. A releitura do WAL
+    // não publica nada.
+    Subscriptions& subscriptions() { return subs; }
+
+    // Modo ALWAYS do WAL: espera até as mutações já feitas por este thread
+    // estarem no disco. Sem WAL, ou nos demais modos, retorna na hora.
+    void commit();
+
+    // Enquanto existir, as mutações deste thread não esperam o fsync uma a
+    // uma (cada operação, sozinha, só retorna depois dele). Os backends TCP
+    // abrem um GroupCommit por lote de comandos recebidos e chamam commit()
+    // antes de enviar as respostas: um fsync por lote. O destrutor não
+    // espera nada.
+    class GroupCommit {
+    public:
+        GroupCommit();
+        ~GroupCommit();
+        GroupCommit(const GroupCommit&)            = delete;
+        GroupCommit& operator=(const GroupCommit&) = delete;
+    };
+
+    // TTL das tuplas: uma tupla com TTL expira `ttl_ms` depois do WR (ou
+    // da entrada na fila, para um WR que esperou vaga): sai da fila sem
+    // nunca mais ser entregue e é contada em Stats::expired. Os prazos
+    // ficam numa roda de timers por shard (timer_wheel.hpp), servida por um
+    // único thread, criado no primeiro TTL; RD/IN conferem o prazo da
+    // frente, então uma tupla vencida não é entregue nem no intervalo até o
+    // thread passar. Tuplas com TTL não vão para o WAL nem para o snapshot:
+    // depois de uma nova partida, não existem mais.
+    //
+    // Nas operações, `ttl_ms` -1 usa o TTL padrão da chave; 0, nenhum.
+    // set_default_ttl(): TTL padrão das chaves que casam com `pattern`
+    // (chave exata, ou prefixo terminado em '*'; o mais longo vale, e a
+    // exata antes de qualquer prefixo) — inclusive para MWR e resultados
+    // de EX/EXALL. `ttl` zero tira o padrão. Deve ser chamado antes da
+    // primeira operação.
+    void set_default_ttl(std::string_view pattern, std::chrono::milliseconds ttl);
+
+    // WR: insere tupla (key, value). Sem limite por chave nunca bloqueia.
+    // Com a chave cheia (Limits), espera uma vaga aberta por IN/INP/INN
+    // (os WRs esperando entram na ordem de chegada) ou, com
+    // Limits::block == false, retorna false sem inserir (FULL).
+    bool write(std::string key, std::string value, int ttl_ms = -1);
 
     // RD: leitura não destrutiva, bloqueante. Política FIFO por chave.
+    // Como RDP/rd_for/rd_async, tenta antes rd_cached().
     std::string rd(std::string key);
 
     // IN: leitura destrutiva, bloqueante. Política FIFO por chave.
     std::string in(std::string key);
 
     // EX: consume tupla k_in, aplica svc_id, insere resultado em k_out.
-    //     Retorna "OK" ou "NO-SERVICE".
-    std::string ex(std::string k_in, std::string k_out, int svc_id);
+    //     Com vários svc_ids (pipeline), aplica todos em sequência e só o
+    //     resultado final entra em k_out (ver ServiceChain).
+    //     Retorna "OK" ou "NO-SERVICE". Com o pool no modo CONSUME, o
+    //     "OK" vem logo após o consumo e o resultado é publicado depois.
+    std::string ex(std::string k_in, std::string k_out, const ServiceChain& chain);
+
+    // MWR: insere várias tuplas de uma vez, atomicamente — nenhuma
+    // operação enxerga o lote pela metade. Cada shard envolvido é travado
+    // uma única vez; os waiters acordados pelo lote são atendidos juntos,
+    // depois de soltar os locks. A ordem do lote vale como ordem FIFO.
+    // Com limites por chave, o lote inteiro precisa caber (contando todas
+    // as suas tuplas); senão retorna false sem inserir nada (FULL) — um
+    // lote nunca espera vaga, para não prender vagas de várias chaves.
+    bool write_many(std::vector<std::pair<std::string, std::string>> tuples);
+
+    // INN: remove até `n` tuplas da frente da fila da chave. Sem tupla,
+    // bloqueia como IN e retorna só a que o acordou.
+    std::vector<std::string> in_many(const std::string& key, std::size_t n);
+
+    // INN sem bloquear: acrescenta até `n` tuplas a `out` e retorna quantas.
+    std::size_t inp_many(std::string_view key, std::size_t n,
+                         std::vector<std::string>& out);
+
+    // EXALL: consome todas as tuplas de k_in com um único lock, aplica
+    // svc_id ao lote inteiro e publica os resultados em k_out, na mesma
+    // ordem, com um único lock. Nunca bloqueia: sem tupla, `n` = 0.
+    // Retorna false (nada consumido) se o serviço não existe. Roda no
+    // thread que chama, mesmo com o pool: é uma operação em lote.
+    bool ex_all(std::string_view k_in, std::string_view k_out, const ServiceChain& chain,
+                std::size_t& n);
+
+    // MRD: lê várias chaves de uma vez (snapshot atômico), sem bloquear.
+    // Chaves sem tupla resultam em std::nullopt.
+    std::vector<std::optional<std::string>>
+    rd_many(const std::vector<std::string_view>& keys);
+
+    // RD sem lock (ver read_cache.hpp): se a frente da chave está
+    // publicada, acrescenta-a a `out` e retorna true; senão retorna false e
+    // o RD segue pelo lock do shard. Com `shared`, um valor a partir de
+    // SHARE_BYTES não é copiado: `*shared` recebe o buffer e `out` fica
+    // como estava.
+    static constexpr std::size_t SHARE_BYTES = 16 * 1024;
+    bool rd_cached(std::string_view key, std::string& out, SharedValue* shared = nullptr);
+
+    // RDP/INP: como RD/IN, mas nunca bloqueiam. Retornam false (sem tocar
+    // em `out`) se não há tupla com a chave.
+    bool rdp(std::string_view key, std::string& out);
+    bool inp(std::string_view key, std::string& out);
+
+    // RD/IN/EX com prazo: esperam no máximo `timeout` pela tupla. Em caso
+    // de timeout retornam false e nada é consumido. `out` recebe o valor
+    // (RD/IN) ou "OK"/"NO-SERVICE" (EX).
+    bool rd_for(const std::string& key, std::chrono::milliseconds timeout,
+                std::string& out);
+    bool in_for(const std::string& key, std::chrono::milliseconds timeout,
+                std::string& out);
+    bool ex_for(const std::string& k_in, std::string k_out, const ServiceChain& chain,
+                std::chrono::milliseconds timeout, std::string& out);
+
+    // RDM/INM: RD/IN por padrão de chave — um prefixo ("pedidos:*") ou um
+    // glob simples ('*' casa qualquer sequência, '?' um byte, em qualquer
+    // posição; sem curinga, a chave exata). Entre as chaves que casam e têm
+    // tupla, vale a que espera há mais tempo: a que recebeu a primeira
+    // tupla ou foi servida por um IN/INM há mais tempo, então uma chave
+    // movimentada não deixa as outras sem vez; dentro da chave, FIFO.
+    // Sem tupla, o RDM/INM espera registrado pela parte literal do padrão
+    // (até o primeiro curinga): um WR só confere os padrões cujo literal é
+    // prefixo da sua chave. O WR atende todos os RDMs que casam e um só
+    // consumidor — o IN/EX da própria chave antes, senão o INM mais antigo.
+    //
+    // O índice de chaves é uma árvore de prefixos por shard, criada no
+    // primeiro RDM/INM (ver radix_tree.hpp). Cada RDM/INM trava todos os
+    // shards, como um MWR do espaço inteiro: é feito para consumidores que
+    // atendem famílias de chaves, não para o caminho quente.
+    struct Match {
+        std::string key;
+        std::string value;
+    };
+    Match rdm(std::string_view pattern);  // bloqueantes
+    Match inm(std::string_view pattern);
+
+    // Com prazo (zero: sondagem); em caso de timeout retornam false e nada
+    // é consumido.
+    bool rdm_for(std::string_view pattern, std::chrono::milliseconds timeout, Match& out);
+    bool inm_for(std::string_view pattern, std::chrono::milliseconds timeout, Match& out);
+
+    // Identifica uma operação assíncrona estacionada, para cancel().
+    class Ticket {
+        friend class TupleServer;
+        Shard*                waiter_shard = nullptr;
+        bool                  pattern      = false;  // RDM/INM: em Patterns
+        std::weak_ptr<Waiter> waiter;
+    };
+
+    // Versões assíncronas (usadas pelos backends TCP): se a operação pode
+    // ser concluída agora, ACRESCENTA o resultado a `out` (ex.: direto no
+    // buffer de saída da conexão) e retorna true sem chamar `done`. Caso
+    // contrário estaciona `done` e retorna false; nenhum thread fica preso
+    // esperando. Com `done` vazio nada é estacionado (apenas sondagem).
+    // Se `ticket` não é nulo e a operação estaciona, ele passa a
+    // identificá-la (ver cancel()).
+    bool rd_async(std::string_view key, std::string& out, Continuation done,
+                  Ticket* ticket = nullptr);
+    bool in_async(std::string_view key, std::string& out, Continuation done,
+                  Ticket* ticket = nullptr);
+    bool ex_async(std::string_view k_in, std::string_view k_out, const ServiceChain& chain,
+                  std::string& out, Continuation done, Ticket* ticket = nullptr);
+
+    // RDM/INM assíncronos: o resultado (em `out`, ou para `done`) é a
+    // chave e o valor como dois registros u32 big-endian + bytes — o mesmo
+    // formato dos lotes do protocolo binário; split_match() os separa.
+    bool match_async(std::string_view pattern, bool consume, std::string& out,
+                     Continuation done, Ticket* ticket = nullptr);
+    static bool split_match(std::string_view result, std::string_view& key,
+                            std::string_view& value);
+
+    // WR assíncrono: acrescenta "OK" (ou "FULL") a `out`; com a chave
+    // cheia e Limits::block, estaciona `done` (chamada com "OK" quando a
+    // tupla entrar). `value` só é consumido se retorna true ou estaciona.
+    bool write_async(std::string_view key, std::string&& value, std::string& out,
+                     Continuation done, Ticket* ticket = nullptr, int ttl_ms = -1);
+
+    // Retira da fila uma operação estacionada que ainda não foi atendida:
+    // a continuação nunca será chamada e nada é consumido. Retorna false se
+    // um WR chegou antes (a continuação já foi ou ainda será chamada).
+    bool cancel(const Ticket& ticket);
 
 private:
-    // Checa se há ao menos uma tupla para a chave sem criar entrada no mapa.
-    bool has_tuple(const std::string& key) const;
+    // Operação bloqueada (RD/IN/EX) aguardando uma tupla de uma chave.
+    // O WR entrega o valor diretamente ao waiter: quem acorda já tem o
+    // resultado e não precisa disputar o lock para conferir a fila.
+    struct Waiter {
+        bool                    consume;       // IN/EX removem a tupla; RD copia
+        bool                    put  = false;  // WR esperando vaga; `value` é a tupla
+        bool                    done = false;  // valor já entregue
+        std::string             value;
+        std::uint64_t           expires = 0;  // put: prazo da tupla (ver Timed), 0 sem TTL
+        Continuation            cont;  // vazio: waiter síncrono, acorda por `cv`
+        ShardCondVar            cv;
+
+        // Posição na fila de waiters da chave enquanto !done (para
+        // cancelamento e timeout sem busca). Enquanto há waiter a chave
+        // não sai do índice, então `entry` não fica pendurado.
+        KeyEntry*                                    entry = nullptr;
+        std::list<std::shared_ptr<Waiter>>::iterator pos;
+
+        // RDM/INM: o padrão, a ordem de chegada entre eles e o nó do
+        // literal em Patterns enquanto !done (`pos` é a posição na lista
+        // dele; `entry` fica nulo).
+        std::string                                          pattern;
+        std::uint64_t                                        seq  = 0;
+        RadixTree<std::list<std::shared_ptr<Waiter>>>::Node* node = nullptr;
+
+        Waiter(bool consume, Continuation cont)
+            : consume(consume), cont(std::move(cont)) {}
+    };
+    using WaiterPtr = std::shared_ptr<Waiter>;
+
+    // Continuações prontas, executadas fora do lock.
+    using Ready = std::vector<WaiterPtr>;
+
+    // Estado de uma chave: tuplas em FIFO e waiters em ordem de chegada.
+    // Invariante: se há waiters, não há tuplas (um WR com waiters
+    // estacionados é entregue a eles antes de entrar na fila); se há
+    // producers (WRs esperando vaga), a fila está cheia. Sem tuplas nem
+    // waiters, a chave sai do índice (Shard::reclaim()).
+    // Depois de uma partida com snapshot, a frente da fila fica no arquivo
+    // mapeado (`snap`, registros u32 + bytes) e cada tupla só é copiada
+    // para a memória quando é lida; `tuples` vem depois dela.
+    // Uma frente lida algumas vezes sob o lock é publicada no FrontCache
+    // do shard (`cache_slot`); sair da frente a despublica.
+    // As tuplas com TTL da fila ficam em `timed`, que só existe enquanto
+    // houver alguma.
+    struct Timed;
+    struct KeyEntry {
+        std::string_view     snap;
+        std::size_t          snap_count = 0;
+        TupleQueue           tuples;
+        std::size_t          bytes = 0;  // valores em fila (snap + tuples)
+        std::list<WaiterPtr> waiters;
+        std::list<WaiterPtr> producers;
+        std::uint16_t        cache_slot = 0;  // ver FrontCache
+        std::uint16_t        reads      = 0;  // RDs sob o lock desta frente
+        std::unique_ptr<Timed> timed;
+
+        bool        has_tuples() const { return snap_count > 0 || !tuples.empty(); }
+        std::size_t tuple_count() const;  // sem as já expiradas no meio da fila
+        bool        front_timed() const;  // a frente tem TTL
+        std::string_view front() const;  // válido até a próxima mutação
+        void             push_back(std::string v);
+        std::string      pop_front();
+    };
+
+    // Tuplas com TTL de uma chave, em ordem de posição na fila. A posição
+    // conta as tuplas da chave a partir de `head` (a frente quando o
+    // registro foi criado vale 0), então identifica uma tupla para a roda
+    // de timers mesmo depois de a fila andar. Uma tupla que expira no meio
+    // da fila tem o valor liberado e fica no lugar, com `expires` 0, até
+    // chegar à frente (`dead` conta essas). Tuplas com TTL nunca estão no
+    // snapshot mapeado: a posição sempre cai em `tuples`.
+    struct Timed {
+        struct Tuple {
+            std::uint64_t pos;
+            std::uint64_t expires;  // ms de expiry_clock(); 0: já expirada
+        };
+        std::uint64_t     gen;       // chave em Shard::timed_keys
+        std::uint64_t     head = 0;  // posição da frente da fila
+        std::deque<Tuple> tuples;
+        std::size_t       dead = 0;
+    };
+
+    // Timer de uma tupla com TTL: a geração do Timed da chave e a posição.
+    // Se a tupla sai antes (IN), o timer vence e não encontra nada.
+    struct Expiry {
+        std::uint64_t gen;
+        std::uint64_t pos;
+    };
+
+    // Thread de expiração: criado no primeiro timer; dorme até o próximo
+    // evento das rodas dos shards. `planned` é o instante em que ele vai
+    // acordar (NEVER: sem prazo, ou percorrendo os shards); um timer antes
+    // disso precisa acordá-lo (wake(), com o lock do shard).
+    struct Expirer {
+        std::atomic<std::uint64_t> planned{TimerWheel<Expiry>::NEVER};
+        std::mutex                 mtx;
+        std::condition_variable    cv;
+        bool                       kick = false;
+        bool                       stop = false;
+        std::thread                thread;
+        std::function<void()>      body;
+
+        void wake(std::uint64_t when);
+    };
+
+    // TTL padrão por chave (set_default_ttl()).
+    struct TtlRules {
+        std::map<std::string, std::uint32_t, std::less<>> exact;
+        std::map<std::string, std::uint32_t, std::less<>> prefix;
+        std::vector<std::size_t>                          lengths;  // dos prefixos, decrescentes
+
+        std::uint32_t find(std::string_view key) const;  // 0: sem padrão
+    };
+
+    // Contabilidade de memória e produtores parados pelo limite global.
+    struct Budget {
+        Limits                   limits;
+        std::atomic<std::size_t> used{0};
+        std::atomic<std::size_t> throttled{0};  // esperando, síncronos ou não
+
+        std::mutex                         mtx;
+        std::condition_variable            below;   // wait_high_water()
+        std::vector<std::function<void()>> resume;  // wait_high_water_async()
+
+        std::size_t low_water() const { return limits.high_water - limits.high_water / 8; }
+    };
+
+    // RDM/INM estacionados, pela parte literal do padrão. `count` é lido
+    // sem lock pelo WR (sob o lock do shard): o registro acontece com todos
+    // os shards travados, então um WR que não o enxerga não tinha o que
+    // entregar. Ordem de lock: shards, depois `mtx`.
+    using PatternTree = RadixTree<std::list<WaiterPtr>>;
+    struct Patterns {
+        ShardMutex               mtx;
+        PatternTree              tree;
+        std::uint64_t            next_seq = 0;
+        std::atomic<std::size_t> count{0};
+
+        // Registra / retira um waiter ainda não atendido. Com `mtx`
+        // adquirido.
+        void park(std::string_view pattern, WaiterPtr w);
+        void unpark(const WaiterPtr& w);
+    };
+
+    // Chaves com tuplas de um shard, para o RDM/INM: cada nó guarda desde
+    // quando a chave espera a vez (`since`: a primeira tupla, ou o último
+    // IN) e o menor `since` da subárvore (`oldest`), então a chave mais
+    // antiga sob um prefixo é achada descendo pelos mínimos.
+    struct KeyAge {
+        KeyEntry*     entry  = nullptr;
+        std::uint64_t since  = TimerWheel<Expiry>::NEVER;
+        std::uint64_t oldest = TimerWheel<Expiry>::NEVER;
+    };
+    using AgeTree = RadixTree<KeyAge>;
+
+    struct KeyHash {
+        std::uint64_t operator()(std::string_view key) const { return key_hash(key); }
+    };
+
+    // Partição do espaço: as chaves cujo hash cai aqui, com lock próprio.
+    struct Shard {
+        ShardMutex mtx;
+
+        // Espaço de tuplas: chave -> fila FIFO de valores + waiters.
+        KeyIndex<KeyEntry, KeyHash> tuple_space;
+
+        // Frentes publicadas para o RD sem lock (rd_cached()).
+        FrontCache<KeyEntry> fronts;
+
+        // Aquisições de `mtx` que o encontraram ocupado e quanto tempo
+        // esperaram por ele (só as de lock(); as esperas dos waiters
+        // síncronos no cv não contam). Alterados com `mtx` adquirido.
+        std::uint64_t contended = 0;
+        std::uint64_t wait_ns   = 0;
+
+        // Chaves que já tiveram operação estacionada desde a última
+        // limpeza de stats(). Uma chave sai ao ser tirada do índice, então
+        // nenhum ponteiro fica pendurado; as que só esvaziaram as filas de
+        // espera são descartadas na próxima leitura.
+        std::unordered_set<KeyEntry*> blocked;
+
+        Wal*           wal     = nullptr;  // open_wal(); mutações registradas sob `mtx`
+        Budget*        budget  = nullptr;
+        Subscriptions* subs    = nullptr;  // tuplas novas, publicadas sob `mtx`
+        Expirer*       expirer = nullptr;
+
+        // TTL: prazos das tuplas do shard, as chaves que têm alguma (pela
+        // geração do Timed) e as contagens do STATS.
+        TimerWheel<Expiry>                           expiry;
+        std::unordered_map<std::uint64_t, KeyEntry*> timed_keys;
+        std::uint64_t                                next_gen      = 0;
+        std::size_t                                  ttl_tuples    = 0;
+        std::uint64_t                                expired       = 0;
+        std::uint64_t                                expired_bytes = 0;
+
+        // RDM/INM: os WRs conferem os padrões estacionados; o índice de
+        // chaves só existe (e só é mantido) depois do primeiro RDM/INM.
+        Patterns*                patterns = nullptr;
+        std::unique_ptr<AgeTree> ages;
+
+        // Trava `mtx`. Sem disputa custa o mesmo que lock(); com ela,
+        // mede a espera em `contended`/`wait_ns`.
+        std::unique_lock<ShardMutex> lock();
+
+        // Registram no WAL (se houver) a tupla que entrou na fila / as `n`
+        // que saíram da frente. Chamados com `mtx` adquirido.
+        void log_put(std::string_view key, std::string_view value);
+        void log_take(std::string_view key, std::size_t n);
+
+        // Fim da fila da chave / frente dela, com a contabilidade de bytes.
+        // enqueue() registra no WAL (sem TTL; `expires` diferente de zero
+        // agenda o timer); a remoção é registrada por quem chama (um TAKE
+        // por lote, só das tuplas sem TTL) e despublica a frente. Chamados
+        // com `mtx` adquirido.
+        void        enqueue(std::string_view key, KeyEntry& e, std::string value,
+                            std::uint64_t expires = 0);
+        std::string dequeue(KeyEntry& e);
+
+        // WR já admitido: entrega aos waiters ou enfileira. Chamado com
+        // `mtx` adquirido.
+        void put(std::string_view key, KeyEntry& e, std::string value, Ready& ready,
+                 std::uint64_t expires = 0);
+
+        // Tira da frente as tuplas vencidas em `now`; retorna true se tirou
+        // alguma (quem chama admite WRs esperando vaga e faz o reclaim()).
+        // Chamado com `mtx` adquirido.
+        bool drop_expired(KeyEntry& e, std::uint64_t now);
+
+        // Thread de expiração: avança a roda até `now` e retorna o próximo
+        // evento dela. WRs admitidos pelas vagas vão para `ready`. Chamado
+        // com `mtx` adquirido.
+        std::uint64_t expire(std::uint64_t now, Ready& ready);
+
+        // Verdadeiro se mais `n` tuplas somando `bytes` cabem nos limites
+        // por chave (`e` nulo: chave sem fila). Uma tupla sempre cabe numa
+        // fila vazia, por maior que seja.
+        bool room(const KeyEntry* e, std::size_t n, std::size_t bytes) const;
+
+        // Depois de uma remoção: admite os WRs esperando vaga que couberem,
+        // em ordem. Chamado com `mtx` adquirido.
+        void admit(std::string_view key, KeyEntry& e, Ready& ready);
+
+        // Se há tupla para a chave, acrescenta a da frente a `out` (e a
+        // remove, se `consume`) e retorna true. WRs admitidos pela vaga vão
+        // para `ready`. Um RD frequente publica a frente (ver
+        // try_take()). Chamado com `mtx` adquirido.
+        bool try_take(std::string_view key, bool consume, std::string& out, Ready& ready);
+
+        // Enfileira `w` no fim da fila de waiters da chave (ou de
+        // producers, se w->put). Como só se estaciona quando não há tupla
+        // (ou vaga), quem chega depois nunca passa na frente de quem já
+        // espera. Chamado com `mtx` adquirido.
+        void park(std::string_view key, WaiterPtr w);
+
+        // Retira da fila um waiter ainda não atendido. Chamado com `mtx`
+        // adquirido.
+        void unpark(const WaiterPtr& w);
+
+        // Índice de chaves do RDM/INM. index_keys() o cria com as chaves
+        // que já têm tuplas; requeue() é chamado quando a frente da chave
+        // muda (primeira tupla, ou uma saiu): ela vai para o fim da vez, ou
+        // sai do índice se esvaziou. oldest_match() retorna a chave mais
+        // antiga que casa com o padrão e o `since` dela. Chamados com `mtx`
+        // adquirido.
+        void      index_keys();
+        void      requeue(std::string_view key, KeyEntry& e);
+        KeyEntry* oldest_match(std::string_view pattern, std::uint64_t& since);
+
+        // WR com RDM/INM estacionados: como deliver(), mas também entrega
+        // aos padrões que casam com a chave. Chamado com `mtx` adquirido.
+        bool offer(std::string_view key, KeyEntry& e, std::string& value, Ready& ready);
+
+        // Tira `e` do índice se a chave ficou sem tuplas e sem waiters;
+        // retorna true se tirou. Chamado com `mtx` adquirido.
+        bool reclaim(KeyEntry& e);
+    };
+
+    // Entrega `value` aos waiters da chave: todos os RDs recebem cópia e o
+    // primeiro IN/EX na ordem de chegada consome (e retorna true). Sem
+    // consumidor, `value` fica intacto para ir à fila. Chamado com o lock
+    // do shard adquirido.
+    static bool deliver(KeyEntry& e, std::string& value, Ready& ready);
+
+    // Marca o waiter como atendido e o acorda (síncrono) ou o agenda em
+    // `ready` (continuação).
+    static void hand_over(const WaiterPtr& w, std::string value, Ready& ready);
+
+    // Chama as continuações prontas (fora de qualquer lock).
+    void run_ready(Ready& ready);
+
+    // WR; `limited` = false para o resultado do EX, que sempre entra (a
+    // entrada já foi consumida).
+    bool store(std::string key, std::string value, bool limited, int ttl_ms = -1);
+
+    // Prazo de uma tupla da chave (ms de expiry_clock()), 0 sem TTL.
+    std::uint64_t deadline(std::string_view key, int ttl_ms) const;
+
+    // Laço do thread de expiração (Expirer::body).
+    void expire_loop();
+
+    // Vários resultados na mesma chave, com um único lock (EXALL); fora
+    // dos limites, como store(..., false).
+    void store_all(std::string_view key, std::vector<std::string> values);
+
+    // Lote inteiro dentro dos limites por chave. Shards travados.
+    bool batch_fits(const std::vector<std::pair<std::string, std::string>>& tuples,
+                    const std::vector<std::size_t>& idx);
+
+    // RD/IN síncronos: bloqueiam no cv do próprio waiter.
+    std::string take(const std::string& key, bool consume);
+
+    // RDP/INP.
+    bool take_now(std::string_view key, bool consume, std::string& out);
+
+    // RD/IN síncronos com prazo.
+    bool take_for(const std::string& key, bool consume,
+                  std::chrono::milliseconds timeout, std::string& out);
+
+    // RD/IN assíncronos (ver rd_async()).
+    bool take_async(std::string_view key, bool consume, std::string& out,
+                    Continuation done, Ticket* ticket);
+
+    // RDM/INM: com todos os shards travados, retira (ou copia) a frente da
+    // chave mais antiga que casa e acrescenta o resultado a `out`.
+    bool take_match(std::string_view pattern, bool consume, std::string& out, Ready& ready);
+
+    // RDM/INM síncronos: timeout < 0 espera sem prazo.
+    bool match_for(std::string_view pattern, bool consume,
+                   std::chrono::milliseconds timeout, Match& out);
+
+    // Hash estável da chave (FNV-1a); escolhe o shard.
+    static std::uint64_t key_hash(std::string_view key);
+    std::size_t shard_index(std::string_view key) const;
+    Shard&      shard_for(std::string_view key);
+
+    // Trava os shards indicados (sem repetição) em ordem crescente de
+    // índice — a ordem global que evita deadlock entre operações em lote.
+    using ShardLocks = std::vector<std::unique_lock<ShardMutex>>;
+    ShardLocks lock_shards(std::vector<std::size_t> indices);
+
+    // Trava todos os shards, em ordem, com o índice de chaves ligado.
+    ShardLocks lock_for_match();
+
+    // Parte final do EX, após consumir a tupla de entrada. Retorna true
+    // com "OK"/"NO-SERVICE" em `result`, ou false se a resposta depende
+    // de um worker: `done` será chamada com ela (pool no modo PUBLISH e
+    // `done` não vazia).
+    bool finish_ex(std::string v, std::string k_out, const ServiceChain& chain,
+                   std::string& result, const Continuation& done);
+    std::string await_ex(std::string v, std::string k_out,
+                         const ServiceChain& chain);  // EX síncrono
+
+    // Fim de uma mutação: commit(), salvo dentro de um GroupCommit, e
+    // libera os produtores parados se o uso caiu abaixo do limite global.
+    void settle();
+    void wake_throttled();  // a parte de settle() dos produtores parados
+
+    std::size_t              n_shards;
+    std::unique_ptr<Shard[]> shards;
+
+    // Serviços do EX: svc_id -> serviço (internos e carregados).
+    ServiceRegistry services;
+
+    Subscriptions subs;
+
+    Patterns patterns;
+
+    std::unique_ptr<Wal> wal;  // nulo: só em memória
+    Budget               budget;
+    TtlRules             ttl_rules;
+    Expirer              expirer;
 
-    std::mutex mtx;
-    std::condition_variable cv;
+    // Workers do EX; nulo: o serviço roda no thread que consumiu k_in.
+    // Encerrado primeiro no destrutor: as tarefas publicam nos shards.
+    std::unique_ptr<ServicePool> pool;
 
-    // Espaço de tuplas: chave -> fila FIFO de valores.
-    std::map<std::string, std::deque<std::string>> tuple_space;
+    // Snapshot carregado na partida: as filas apontam para ele.
+    std::shared_ptr<const snapshot::Image> image;
+    std::string                            snapshot_path;
 
-    // Tabela de serviços: svc_id -> função(string) -> string.
-    std::map<int, std::function<std::string(std::string)>> services;
-};
\ No newline at end of file
+    std::mutex              snapshot_mtx;  // um write_snapshot() por vez
+    std::thread             snapshotter;
+    std::mutex              snapshotter_mtx;
+    std::condition_variable snapshotter_cv;
+    bool                    snapshotter_stop = false;
+};
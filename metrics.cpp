@@ -0,0 +1,305 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// Contadores de um thread. Só o dono escreve; a leitura (totals()) vem de
+// outro thread, daí os atômicos.
+struct alignas(64) Metrics::Slot {
+    atomic<uint64_t> ops[OPS]          = {};
+    atomic<uint64_t> lat[OPS][BUCKETS] = {};
+    atomic<uint64_t> lat_ns[OPS]       = {};
+    unsigned         tick              = 0;  // sorteio das amostras; só o dono
+};
+
+// Todos os Slots já criados; os de threads encerrados ficam em `spare`.
+struct Metrics::Registry {
+    mutex                    mtx;
+    vector<unique_ptr<Slot>> slots;
+    vector<Slot*>            spare;
+
+    Slot* acquire() {
+        lock_guard<mutex> lock(mtx);
+        if (!spare.empty()) {
+            Slot* s = spare.back();
+            spare.pop_back();
+            return s;
+        }
+        slots.push_back(make_unique<Slot>());
+        return slots.back().get();
+    }
+
+    void release(Slot* s) {
+        lock_guard<mutex> lock(mtx);
+        spare.push_back(s);
+    }
+};
+
+// Slots do thread, um por Metrics em que ele já contou. Cada um segura o
+// Registry, que assim sobrevive ao Metrics até o thread terminar.
+struct Metrics::Local {
+    struct Held {
+        Registry*            reg;
+        Slot*                slot;
+        shared_ptr<Registry> keep;
+    };
+    vector<Held> held;
+
+    ~Local() {
+        for (auto& h : held)
+            h.reg->release(h.slot);
+    }
+};
+
+// Mesma ordem de protocol::Command::Op.
+static const char* const OP_NAMES[Metrics::OPS] = {
+    "wr",    "rd",   "in",     "ex",  "rdp",   "inp", "mwr", "inn",   "mrd",
+    "exall", "load", "unload", "sub", "unsub", "rdm", "inm", "halfclose", "stats",
+};
+
+Metrics::Metrics() : reg(make_shared<Registry>()) {}
+
+Metrics::~Metrics() = default;
+
+const char* Metrics::op_name(Op op) {
+    return OP_NAMES[op];
+}
+
+Metrics::Slot& Metrics::slot() {
+    thread_local Local local;
+    for (auto& h : local.held)
+        if (h.reg == reg.get())
+            return *h.slot;
+    local.held.push_back({reg.get(), reg->acquire(), reg});
+    return *local.held.back().slot;
+}
+
+// Incremento de um contador de um só escritor.
+static void bump(atomic<uint64_t>& c, uint64_t n = 1) {
+    c.store(c.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+Metrics::Start Metrics::begin(Op op) {
+    Slot& s = slot();
+    bump(s.ops[op]);
+    if (++s.tick % SAMPLE != 0)
+        return {op, Clock::time_point{}};
+    return {op, Clock::now()};
+}
+
+// Faixa: menor i com a duração (arredondada para cima, em µs) <= 2^i.
+void Metrics::record(Op op, Clock::duration d) {
+    auto   ns = static_cast<uint64_t>(max<Clock::rep>(
+        chrono::duration_cast<chrono::nanoseconds>(d).count(), 0));
+    auto   us = (ns + 999) / 1000;
+    size_t i  = us <= 1 ? 0 : static_cast<size_t>(64 - __builtin_clzll(us - 1));
+    Slot&  s  = slot();
+    bump(s.lat[op][min(i, BUCKETS - 1)]);
+    bump(s.lat_ns[op], ns);
+}
+
+Metrics::Totals Metrics::totals() const {
+    Totals t;
+    lock_guard<mutex> lock(reg->mtx);
+    for (auto& s : reg->slots) {
+        for (size_t op = 0; op < OPS; ++op) {
+            t.ops[op] += s->ops[op].load(memory_order_relaxed);
+            t.lat_ns[op] += s->lat_ns[op].load(memory_order_relaxed);
+            for (size_t i = 0; i < BUCKETS; ++i)
+                t.lat[op][i] += s->lat[op][i].load(memory_order_relaxed);
+        }
+    }
+    return t;
+}
+
+// ---------------------------------------------------------------------------
+// Formato de exposição do Prometheus: "nome{rótulos} valor". Nos valores
+// dos rótulos, '\', '"' e '\n' são escapados.
+// ---------------------------------------------------------------------------
+static void append_label(string& out, string_view value) {
+    out += '"';
+    for (char ch : value) {
+        if (ch == '\\' || ch == '"')
+            out += '\\';
+        if (ch == '\n')
+            out += "\\n";
+        else
+            out += ch;
+    }
+    out += '"';
+}
+
+static void append_header(string& out, bool help, const char* name, const char* type,
+                          const char* text) {
+    if (!help)
+        return;
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += text;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void append_value(string& out, double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), " %.9g\n", v);
+    out += buf;
+}
+
+static void append_value(string& out, uint64_t v) {
+    out += ' ';
+    out += to_string(v);
+    out += '\n';
+}
+
+// Memória residente e threads do processo, de /proc/self/status (só
+// Linux): mostram se conexões encerradas deixam threads ou memória para trás.
+struct ProcessUsage {
+    uint64_t rss_bytes = 0;
+    uint64_t threads   = 0;
+};
+
+static bool process_usage(ProcessUsage& p) {
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f == nullptr)
+        return false;
+    char               line[256];
+    unsigned long long n = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %llu kB", &n) == 1)
+            p.rss_bytes = n * 1024;
+        else if (sscanf(line, "Threads: %llu", &n) == 1)
+            p.threads = n;
+    }
+    fclose(f);
+    return p.threads > 0;
+#else
+    (void)p;
+    return false;
+#endif
+}
+
+string Metrics::render(const TupleServer::Stats& space, int64_t connections,
+                       bool help) const {
+    Totals t = totals();
+    string out;
+
+    append_header(out, help, "linda_ops_total", "counter", "Operações recebidas, por tipo.");
+    for (size_t op = 0; op < OPS; ++op) {
+        if (t.ops[op] == 0)
+            continue;
+        out += "linda_ops_total{op=\"";
+        out += OP_NAMES[op];
+        out += "\"}";
+        append_value(out, t.ops[op]);
+    }
+
+    append_header(out, help, "linda_op_latency_seconds", "histogram",
+                  "Latência das operações, da chegada à resposta (amostrada).");
+    for (size_t op = 0; op < OPS; ++op) {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+            seen += t.lat[op][i];
+        if (seen == 0)
+            continue;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            cumulative += t.lat[op][i];
+            char le[32];
+            if (i + 1 < BUCKETS)
+                snprintf(le, sizeof(le), "%.9g", static_cast<double>(bucket_us(i)) * 1e-6);
+            else
+                snprintf(le, sizeof(le), "+Inf");
+            out += "linda_op_latency_seconds_bucket{op=\"";
+            out += OP_NAMES[op];
+            out += "\",le=\"";
+            out += le;
+            out += "\"}";
+            append_value(out, cumulative);
+        }
+        out += "linda_op_latency_seconds_sum{op=\"";
+        out += OP_NAMES[op];
+        out += "\"}";
+        append_value(out, static_cast<double>(t.lat_ns[op]) * 1e-9);
+        out += "linda_op_latency_seconds_count{op=\"";
+        out += OP_NAMES[op];
+        out += "\"}";
+        append_value(out, seen);
+    }
+
+    append_header(out, help, "linda_blocked_total", "gauge",
+                  "Operações estacionadas: rd = RD, in = IN/INN/EX, wr = WR esperando vaga.");
+    out += "linda_blocked_total{op=\"rd\"}";
+    append_value(out, uint64_t(space.parked.readers));
+    out += "linda_blocked_total{op=\"in\"}";
+    append_value(out, uint64_t(space.parked.takers));
+    out += "linda_blocked_total{op=\"wr\"}";
+    append_value(out, uint64_t(space.parked.writers));
+
+    append_header(out, help, "linda_blocked", "gauge",
+                  "Operações estacionadas nas chaves mais disputadas.");
+    for (auto& b : space.blocked) {
+        const pair<const char*, size_t> per_op[] = {
+            {"rd", b.readers}, {"in", b.takers}, {"wr", b.writers}};
+        for (auto& [name, n] : per_op) {
+            if (n == 0)
+                continue;
+            out += "linda_blocked{key=";
+            append_label(out, b.key);
+            out += ",op=\"";
+            out += name;
+            out += "\"}";
+            append_value(out, uint64_t(n));
+        }
+    }
+
+    append_header(out, help, "linda_keys", "gauge", "Chaves no índice.");
+    out += "linda_keys";
+    append_value(out, uint64_t(space.keys));
+    append_header(out, help, "linda_tuple_bytes", "gauge", "Bytes dos valores em fila.");
+    out += "linda_tuple_bytes";
+    append_value(out, uint64_t(space.bytes));
+    append_header(out, help, "linda_connections", "gauge", "Conexões abertas.");
+    out += "linda_connections";
+    append_value(out, static_cast<uint64_t>(max<int64_t>(connections, 0)));
+    append_header(out, help, "linda_lock_contended_total", "counter",
+                  "Aquisições de locks de shard que encontraram o lock ocupado.");
+    out += "linda_lock_contended_total";
+    append_value(out, space.lock_contended);
+    append_header(out, help, "linda_lock_wait_seconds_total", "counter",
+                  "Tempo esperando por locks de shard ocupados.");
+    out += "linda_lock_wait_seconds_total";
+    append_value(out, static_cast<double>(space.lock_wait_ns) * 1e-9);
+    append_header(out, help, "linda_ttl_tuples", "gauge", "Tuplas com TTL em fila.");
+    out += "linda_ttl_tuples";
+    append_value(out, uint64_t(space.ttl_tuples));
+    append_header(out, help, "linda_expired_total", "counter",
+                  "Tuplas com TTL que expiraram sem ser consumidas.");
+    out += "linda_expired_total";
+    append_value(out, space.expired);
+    append_header(out, help, "linda_expired_bytes_total", "counter",
+                  "Bytes das tuplas que expiraram.");
+    out += "linda_expired_bytes_total";
+    append_value(out, space.expired_bytes);
+
+    ProcessUsage p;
+    if (process_usage(p)) {
+        append_header(out, help, "process_resident_memory_bytes", "gauge",
+                      "Memória residente do processo.");
+        out += "process_resident_memory_bytes";
+        append_value(out, p.rss_bytes);
+        append_header(out, help, "process_threads", "gauge", "Threads do processo.");
+        out += "process_threads";
+        append_value(out, p.threads);
+    }
+    return out;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Métricas do servidor: operações por tipo e histogramas de latência,
+// contados pelos backends TCP, mais o retrato do espaço de tuplas
+// (TupleServer::stats()) na hora da leitura. Saem pelo comando STATS e,
+// se configurado, por um listener HTTP no formato de texto do Prometheus.
+//
+// Cada thread conta no seu próprio Slot (contadores atômicos escritos só
+// pelo dono, com load + store relaxados: nenhuma instrução com lock e
+// nenhuma linha de cache disputada). A leitura soma todos os Slots. Um
+// thread que termina devolve o Slot, com as contagens, para o próximo
+// thread — no backend de um thread por cliente os Slots não crescem com
+// o número de conexões já atendidas.
+//
+// Toda operação é contada; a latência (da chegada do comando à resposta
+// pronta, incluindo a espera de um RD/IN/EX estacionado) é amostrada em
+// uma de cada SAMPLE, para não ler o relógio duas vezes por comando.
+// Operações estacionadas que vencem o prazo não entram no histograma.
+// ---------------------------------------------------------------------------
+
+#include "main.hpp"
+#include "protocol.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Op    = protocol::Command::Op;
+
+    static constexpr std::size_t OPS     = protocol::Command::STATS + 1;
+    static constexpr std::size_t BUCKETS = 25;  // até 2^23 µs (~8 s), mais +Inf
+    static constexpr unsigned    SAMPLE  = 16;
+
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&)            = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // Início de uma operação: conta e, se ela foi sorteada, guarda o
+    // relógio (`t0` vazio: sem amostra).
+    struct Start {
+        Op                op;
+        Clock::time_point t0;
+    };
+    Start begin(Op op);
+
+    // Fim de uma operação começada por begin(), em qualquer thread (ex.: o
+    // WR que completou um IN estacionado).
+    void end(const Start& s) {
+        if (s.t0 != Clock::time_point{})
+            record(s.op, Clock::now() - s.t0);
+    }
+
+    // begin() na construção e end() na destruição, salvo release(): a
+    // operação estacionou e quem a completar chama end() com start().
+    class Span {
+    public:
+        Span(Metrics& m, Op op) : m(&m), s(m.begin(op)) {}
+        ~Span() {
+            if (m)
+                m->end(s);
+        }
+        Span(const Span&)            = delete;
+        Span& operator=(const Span&) = delete;
+
+        const Start& start() const { return s; }
+        void         release() { m = nullptr; }
+
+    private:
+        Metrics* m;
+        Start    s;
+    };
+
+    // Soma dos Slots. lat[op][i]: amostras em (2^(i-1), 2^i] µs (a última
+    // faixa, sem limite).
+    struct Totals {
+        std::uint64_t ops[OPS]          = {};
+        std::uint64_t lat[OPS][BUCKETS] = {};
+        std::uint64_t lat_ns[OPS]       = {};  // soma das amostras
+    };
+    Totals totals() const;
+
+    // Nome da operação nos rótulos ("wr", "rd", ...).
+    static const char* op_name(Op op);
+
+    // Limite superior da faixa i, em µs (i < BUCKETS - 1).
+    static std::uint64_t bucket_us(std::size_t i) { return std::uint64_t(1) << i; }
+
+    // Texto no formato de exposição do Prometheus (0.0.4), uma amostra por
+    // linha; `help` acrescenta as linhas # HELP / # TYPE. Operações nunca
+    // vistas são omitidas. `connections`: conexões abertas agora.
+    std::string render(const TupleServer::Stats& space, std::int64_t connections,
+                       bool help) const;
+
+private:
+    struct Slot;
+    struct Registry;
+    struct Local;
+
+    Slot& slot();
+    void  record(Op op, Clock::duration d);
+
+    std::shared_ptr<Registry> reg;
+};
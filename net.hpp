@@ -0,0 +1,216 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Camada de plataforma para sockets.
+//
+// Isola as diferenças entre Winsock2 (Windows) e sockets POSIX (Linux e
+// afins). O restante do servidor usa apenas socket_t, INVALID_SOCK e as
+// funções do namespace net, sem #ifdef espalhados pelo código.
+// ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+// Winsock2 deve ser incluído antes de qualquer header do Windows
+// para evitar conflitos com <windows.h>.
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+// Linka automaticamente com a biblioteca Winsock (equivale a -lws2_32).
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <string>
+
+// Backend de I/O: epoll no Linux; nas demais plataformas, um thread por
+// cliente (tcp_server_threads.cpp). Pode ser forçado com
+// -DLINDA_USE_EPOLL=0 (ex.: para testar o backend portável no Linux).
+#ifndef LINDA_USE_EPOLL
+#if defined(__linux__)
+#define LINDA_USE_EPOLL 1
+#else
+#define LINDA_USE_EPOLL 0
+#endif
+#endif
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+constexpr socket_t INVALID_SOCK = INVALID_SOCKET;
+#else
+using socket_t = int;
+constexpr socket_t INVALID_SOCK = -1;
+#endif
+
+namespace net {
+
+// Inicializa o subsistema de sockets (WSAStartup no Windows).
+// Retorna 0 em caso de sucesso ou o código de erro.
+inline int startup() {
+#ifdef _WIN32
+    // Versão 2.2 é a mais recente e amplamente suportada.
+    WSADATA wsa_data;
+    return WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#else
+    return 0;
+#endif
+}
+
+// Par obrigatório de startup().
+inline void cleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+inline void close_socket(socket_t s) {
+#ifdef _WIN32
+    ::closesocket(s);
+#else
+    ::close(s);
+#endif
+}
+
+// Encerra os dois sentidos da conexão sem fechar o socket: um recv()
+// bloqueado em outro thread retorna.
+inline void shutdown_socket(socket_t s) {
+#ifdef _WIN32
+    ::shutdown(s, SD_BOTH);
+#else
+    ::shutdown(s, SHUT_RDWR);
+#endif
+}
+
+// Código do último erro de socket (WSAGetLastError() ou errno).
+inline int last_error() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// Monta "prefixo (erro: N)" com o último erro de socket.
+inline std::string error_message(const char* prefix) {
+    return std::string(prefix) + " (erro de socket: " + std::to_string(last_error()) + ")";
+}
+
+// Coloca o socket em modo não bloqueante. Retorna false em caso de falha.
+inline bool set_nonblocking(socket_t s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ::ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = ::fcntl(s, F_GETFL, 0);
+    return flags >= 0 && ::fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Desliga o algoritmo de Nagle: respostas curtas saem sem atraso.
+inline void set_nodelay(socket_t s) {
+    int opt = 1;
+    ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY,
+                 reinterpret_cast<const char*>(&opt), sizeof(opt));
+}
+
+// Prazo de cada send()/recv() bloqueante: esgotado, falham com -1.
+inline void set_timeouts(socket_t s, int ms) {
+#ifdef _WIN32
+    DWORD tv = static_cast<DWORD>(ms);
+#else
+    timeval tv{ms / 1000, (ms % 1000) * 1000};
+#endif
+    ::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&tv), sizeof(tv));
+    ::setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&tv), sizeof(tv));
+}
+
+// send()/recv() com a mesma assinatura nas duas plataformas.
+// Retornam o número de bytes transferidos, 0 (recv: conexão encerrada)
+// ou -1 em caso de erro.
+inline long send_some(socket_t s, const char* buf, std::size_t len) {
+#ifdef _WIN32
+    int n = ::send(s, buf, static_cast<int>(len), 0);
+    return n == SOCKET_ERROR ? -1 : n;
+#else
+    // MSG_NOSIGNAL: escrever em socket fechado pelo par não gera SIGPIPE.
+    return static_cast<long>(::send(s, buf, len, MSG_NOSIGNAL));
+#endif
+}
+
+inline long recv_some(socket_t s, char* buf, std::size_t len) {
+#ifdef _WIN32
+    int n = ::recv(s, buf, static_cast<int>(len), 0);
+    return n == SOCKET_ERROR ? -1 : n;
+#else
+    return static_cast<long>(::recv(s, buf, len, 0));
+#endif
+}
+
+// Verdadeiro se o cliente já encerrou o envio ou a conexão, sem consumir
+// nada do que ele mandou e sem bloquear. No Linux o fim do envio aparece
+// mesmo com dados ainda não lidos (POLLRDHUP); nas demais plataformas, só
+// depois deles.
+inline bool peer_closed(socket_t s) {
+#ifdef _WIN32
+    WSAPOLLFD p{};
+    p.fd     = s;
+    p.events = POLLRDNORM;
+    if (WSAPoll(&p, 1, 0) <= 0)
+        return false;
+    if (p.revents & (POLLERR | POLLHUP))
+        return true;
+    char c;
+    return ::recv(s, &c, 1, MSG_PEEK) <= 0;
+#else
+#ifdef POLLRDHUP
+    constexpr short closed = POLLERR | POLLHUP | POLLRDHUP;
+#else
+    constexpr short closed = POLLERR | POLLHUP;
+#endif
+    pollfd p{};
+    p.fd     = s;
+    p.events = POLLIN | closed;
+    if (::poll(&p, 1, 0) <= 0)
+        return false;
+    if (p.revents & closed)
+        return true;
+    char c;
+    return ::recv(s, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+#endif
+}
+
+// Como peer_closed(), mas só a queda da conexão (POLLHUP/POLLERR: RST,
+// erro ou fechada nos dois sentidos) conta; o fim só do envio não. Para
+// conexões que toleram o meio fechamento (HALFCLOSE). Um TCP fechado com
+// FIN só aparece aqui depois que um envio para ele falhar.
+inline bool peer_gone(socket_t s) {
+#ifdef _WIN32
+    WSAPOLLFD p{};
+    p.fd     = s;
+    p.events = POLLRDNORM;
+    return WSAPoll(&p, 1, 0) > 0 && (p.revents & (POLLERR | POLLHUP));
+#else
+    pollfd p{};
+    p.fd     = s;
+    p.events = POLLIN;
+    return ::poll(&p, 1, 0) > 0 && (p.revents & (POLLERR | POLLHUP));
+#endif
+}
+
+// Verdadeiro se o último erro indica "tente novamente" em socket não bloqueante.
+inline bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+}  // namespace net
@@ -0,0 +1,433 @@
+#include "protocol.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+using namespace std;
+
+namespace protocol {
+
+// Espaço em branco do locale "C" (o mesmo que `istream >>` pula).
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static void skip_spaces(string_view line, size_t& pos) {
+    while (pos < line.size() && is_space(line[pos]))
+        ++pos;
+}
+
+// ---------------------------------------------------------------------------
+// next_token(): equivalente a `istream >> string` — pula espaços e lê até o
+// próximo espaço. O espaço que encerra o token não é consumido.
+// ---------------------------------------------------------------------------
+static bool next_token(string_view line, size_t& pos, string_view& tok) {
+    skip_spaces(line, pos);
+    if (pos == line.size())
+        return false;
+    size_t start = pos;
+    while (pos < line.size() && !is_space(line[pos]))
+        ++pos;
+    tok = line.substr(start, pos - start);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// next_int(): equivalente a `istream >> int` — espaços, sinal opcional e
+// dígitos decimais; o que vier depois dos dígitos é ignorado. Falha se não
+// houver dígito ou se o valor não couber em int.
+// ---------------------------------------------------------------------------
+static bool next_int(string_view line, size_t& pos, int& out) {
+    skip_spaces(line, pos);
+    bool neg = false;
+    if (pos < line.size() && (line[pos] == '+' || line[pos] == '-')) {
+        neg = line[pos] == '-';
+        ++pos;
+    }
+    if (pos == line.size() || !is_digit(line[pos]))
+        return false;
+
+    long long v        = 0;
+    bool      overflow = false;
+    for (; pos < line.size() && is_digit(line[pos]); ++pos) {
+        if (!overflow) {
+            v        = v * 10 + (line[pos] - '0');
+            overflow = v > static_cast<long long>(INT_MAX) + 1;
+        }
+    }
+    if (neg)
+        v = -v;
+    if (overflow || v > INT_MAX || v < INT_MIN)
+        return false;
+    out = static_cast<int>(v);
+    return true;
+}
+
+// Prazo opcional: só um inteiro >= 0 conta; qualquer outra coisa é
+// ignorada (o parser original descartava o resto da linha).
+static void next_timeout(string_view line, size_t& pos, int& timeout_ms) {
+    int t;
+    if (next_int(line, pos, t) && t >= 0)
+        timeout_ms = t;
+}
+
+// TTL do WRT: inteiro >= 0 obrigatório, seguido de espaço ou do fim da
+// linha (o valor vem depois, como no WR).
+static bool next_ttl(string_view line, size_t& pos, int& ttl_ms) {
+    skip_spaces(line, pos);
+    if (pos == line.size() || !is_digit(line[pos]) || !next_int(line, pos, ttl_ms))
+        return false;
+    return pos == line.size() || line[pos] == ' ';
+}
+
+// Serviços do EX/EXALL: "svc_id" ou "svc1,svc2,..." (até MAX_STAGES, sem
+// espaço em volta das vírgulas).
+static bool next_chain(string_view line, size_t& pos, Command& cmd) {
+    cmd.stages = 0;
+    do {
+        bool gap = cmd.stages > 0 && (pos == line.size() || is_space(line[pos]));
+        if (cmd.stages == MAX_STAGES || gap || !next_int(line, pos, cmd.chain[cmd.stages]))
+            return false;
+        ++cmd.stages;
+    } while (pos < line.size() && line[pos] == ',' && ++pos);
+    cmd.svc_id = cmd.chain[0];
+    return true;
+}
+
+// Quantidade de um lote: inteiro em [1, MAX_BATCH].
+static bool next_count(string_view line, size_t& pos, uint32_t& count) {
+    int n;
+    if (!next_int(line, pos, n) || n < 1 || static_cast<uint32_t>(n) > MAX_BATCH)
+        return false;
+    count = static_cast<uint32_t>(n);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// parse_command()
+// ---------------------------------------------------------------------------
+bool parse_command(string_view line, Command& cmd) {
+    size_t      pos = 0;
+    string_view op;
+    if (!next_token(line, pos, op))
+        return false;
+    cmd.timeout_ms = -1;
+    cmd.ttl_ms     = -1;
+
+    // ------------------------------------------------------------------ WR
+    if (op == "WR") {
+        cmd.op = Command::WR;
+        return parse_pair(line.substr(pos), cmd.key, cmd.value);
+    }
+    if (op == "WRT") {
+        cmd.op = Command::WR;
+        if (!next_token(line, pos, cmd.key) || !next_ttl(line, pos, cmd.ttl_ms))
+            return false;
+        cmd.value = line.substr(pos);
+        if (!cmd.value.empty())
+            cmd.value.remove_prefix(1);
+        return true;
+    }
+
+    // ------------------------------------------------------------- RD / IN
+    if (op == "RD" || op == "IN") {
+        cmd.op = op == "RD" ? Command::RD : Command::IN;
+        if (!next_token(line, pos, cmd.key))
+            return false;
+        next_timeout(line, pos, cmd.timeout_ms);
+        return true;
+    }
+
+    // ----------------------------------------------------------- RDP / INP
+    if (op == "RDP" || op == "INP") {
+        cmd.op = op == "RDP" ? Command::RDP : Command::INP;
+        return next_token(line, pos, cmd.key);
+    }
+
+    // ------------------------------------------------------------------ EX
+    if (op == "EX") {
+        cmd.op = Command::EX;
+        if (!next_token(line, pos, cmd.key))    return false;
+        if (!next_token(line, pos, cmd.value))  return false;
+        if (!next_chain(line, pos, cmd))        return false;
+        next_timeout(line, pos, cmd.timeout_ms);
+        return true;
+    }
+
+    // ------------------------------------------------------------ lotes
+    if (op == "MWR") {
+        cmd.op = Command::MWR;
+        return next_count(line, pos, cmd.count);
+    }
+    if (op == "INN") {
+        cmd.op = Command::INN;
+        if (!next_token(line, pos, cmd.key) || !next_count(line, pos, cmd.count))
+            return false;
+        next_timeout(line, pos, cmd.timeout_ms);
+        return true;
+    }
+    if (op == "EXALL") {
+        cmd.op = Command::EXALL;
+        return next_token(line, pos, cmd.key) && next_token(line, pos, cmd.value) &&
+               next_chain(line, pos, cmd);
+    }
+    if (op == "MRD") {
+        cmd.op = Command::MRD;
+        skip_spaces(line, pos);
+        cmd.value = line.substr(pos);
+        size_t      p = 0, n = 0;
+        string_view k;
+        while (next_word(cmd.value, p, k))
+            ++n;
+        return n > 0 && n <= MAX_BATCH;
+    }
+
+    // ---------------------------------------------------------- RDM / INM
+    if (op == "RDM" || op == "INM") {
+        cmd.op = op == "RDM" ? Command::RDM : Command::INM;
+        if (!next_token(line, pos, cmd.key))
+            return false;
+        next_timeout(line, pos, cmd.timeout_ms);
+        return true;
+    }
+
+    // ---------------------------------------------------------- SUB / UNSUB
+    if (op == "SUB" || op == "UNSUB") {
+        cmd.op = op == "SUB" ? Command::SUB : Command::UNSUB;
+        return next_token(line, pos, cmd.key);
+    }
+
+    // ------------------------------------------------------ LOAD / UNLOAD
+    if (op == "LOAD") {
+        cmd.op = Command::LOAD;
+        return next_token(line, pos, cmd.key);
+    }
+    if (op == "UNLOAD") {
+        cmd.op = Command::UNLOAD;
+        return next_int(line, pos, cmd.svc_id);
+    }
+
+    // --------------------------------------------------------- HALFCLOSE
+    if (op == "HALFCLOSE") {
+        cmd.op = Command::HALFCLOSE;
+        return true;
+    }
+
+    // ------------------------------------------------------------- STATS
+    if (op == "STATS") {
+        cmd.op = Command::STATS;
+        return true;
+    }
+
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// parse_pair(): "chave valor" — valor = resto da linha, sem o primeiro
+// espaço separador (se houver).
+// ---------------------------------------------------------------------------
+bool parse_pair(string_view line, string_view& key, string_view& value) {
+    size_t pos = 0;
+    if (!next_token(line, pos, key))
+        return false;
+    value = line.substr(pos);
+    if (!value.empty() && value.front() == ' ')
+        value.remove_prefix(1);
+    return true;
+}
+
+bool next_word(string_view s, size_t& pos, string_view& word) {
+    return next_token(s, pos, word);
+}
+
+// ---------------------------------------------------------------------------
+// next_line(): o '\r' é removido em qualquer posição, como no read_line()
+// original. Quando a linha não tem '\r' (o caso comum), nada é copiado.
+// ---------------------------------------------------------------------------
+bool next_line(string& buf, size_t& pos, string_view& line) {
+    const char* base = buf.data();
+    const void* nl   = memchr(base + pos, '\n', buf.size() - pos);
+    if (nl == nullptr)
+        return false;
+
+    size_t end = static_cast<size_t>(static_cast<const char*>(nl) - base);
+    size_t out = pos;
+    if (memchr(base + pos, '\r', end - pos) != nullptr) {
+        for (size_t i = pos; i < end; ++i)
+            if (buf[i] != '\r')
+                buf[out++] = buf[i];
+        // A sobra vira '\r': reler a mesma linha dá o mesmo resultado.
+        fill(buf.begin() + static_cast<ptrdiff_t>(out),
+             buf.begin() + static_cast<ptrdiff_t>(end), '\r');
+    } else {
+        out = end;
+    }
+
+    line = string_view(buf.data() + pos, out - pos);
+    pos  = end + 1;
+    return true;
+}
+
+bool has_lines(const string& buf, size_t pos, size_t n) {
+    const char* p   = buf.data() + pos;
+    const char* end = buf.data() + buf.size();
+    for (; n > 0; --n) {
+        auto nl = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        if (nl == nullptr)
+            return false;
+        p = nl + 1;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Protocolo binário: inteiros em big-endian (ordem de rede).
+// ---------------------------------------------------------------------------
+static uint32_t get_u32(const char* p) {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+static void put_u16(string& out, uint16_t v) {
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+static void put_u32(string& out, uint32_t v) {
+    out += static_cast<char>(v >> 24);
+    out += static_cast<char>(v >> 16);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+FrameHeader decode_header(const char* p) {
+    auto        b = reinterpret_cast<const unsigned char*>(p);
+    FrameHeader h;
+    h.opcode    = b[0];
+    h.flags     = b[1];
+    h.key_len   = static_cast<uint16_t>(b[2] << 8 | b[3]);
+    h.id        = get_u32(p + 4);
+    h.value_len = get_u32(p + 8);
+    h.arg       = get_u32(p + 12);
+    return h;
+}
+
+void decode_trailer(FrameHeader& h, const char* p) {
+    if (h.flags & FLAG_TIMEOUT) {
+        h.timeout_ms = static_cast<int>(min<uint32_t>(get_u32(p), INT_MAX));
+        p += 4;
+    }
+    if (h.flags & FLAG_TTL)
+        h.ttl_ms = static_cast<int>(min<uint32_t>(get_u32(p), INT_MAX));
+}
+
+bool frame_to_command(const FrameHeader& h, string_view key, string_view value,
+                      Command& cmd) {
+    cmd.key        = key;
+    cmd.value      = value;
+    cmd.timeout_ms = h.timeout_ms;
+    cmd.ttl_ms     = h.ttl_ms;
+    switch (h.opcode) {
+    case OP_WR:  cmd.op = Command::WR;  return true;
+    case OP_RD:  cmd.op = Command::RD;  return true;
+    case OP_IN:  cmd.op = Command::IN;  return true;
+    case OP_RDP: cmd.op = Command::RDP; return true;
+    case OP_INP: cmd.op = Command::INP; return true;
+    case OP_MWR: cmd.op = Command::MWR; return true;
+    case OP_MRD: cmd.op = Command::MRD; return true;
+    case OP_SUB:   cmd.op = Command::SUB;   return true;
+    case OP_UNSUB: cmd.op = Command::UNSUB; return true;
+    case OP_RDM:   cmd.op = Command::RDM;   return true;
+    case OP_INM:   cmd.op = Command::INM;   return true;
+    case OP_INN:
+        cmd.op    = Command::INN;
+        cmd.count = h.arg;
+        return h.arg >= 1 && h.arg <= MAX_BATCH;
+    case OP_EX:
+    case OP_EXALL:
+        cmd.op       = h.opcode == OP_EX ? Command::EX : Command::EXALL;
+        cmd.svc_id   = static_cast<int>(h.arg);
+        cmd.chain[0] = cmd.svc_id;
+        cmd.stages   = 1;
+        return true;
+    }
+    return false;
+}
+
+size_t begin_reply(string& out, Status st, uint8_t opcode, uint32_t id) {
+    size_t at = out.size();
+    out += static_cast<char>(st);
+    out += static_cast<char>(opcode);
+    put_u16(out, 0);
+    put_u32(out, id);
+    put_u32(out, 0);  // value_len: preenchido por finish_reply()
+    return at;
+}
+
+void finish_reply(string& out, size_t at) {
+    uint32_t len = static_cast<uint32_t>(out.size() - at - REPLY_HEADER);
+    for (int i = 0; i < 4; ++i)
+        out[at + 8 + i] = static_cast<char>(len >> (24 - 8 * i));
+}
+
+void append_reply(string& out, Status st, uint8_t opcode, uint32_t id,
+                  string_view value) {
+    size_t at = begin_reply(out, st, opcode, id);
+    out.append(value.data(), value.size());
+    finish_reply(out, at);
+}
+
+void append_record(string& out, string_view v) {
+    put_u32(out, static_cast<uint32_t>(v.size()));
+    out.append(v.data(), v.size());
+}
+
+void append_missing(string& out) {
+    put_u32(out, MISSING_RECORD);
+}
+
+size_t begin_record(string& out) {
+    size_t at = out.size();
+    put_u32(out, 0);
+    return at;
+}
+
+void finish_record(string& out, size_t at) {
+    uint32_t len = static_cast<uint32_t>(out.size() - at - 4);
+    for (int i = 0; i < 4; ++i)
+        out[at + i] = static_cast<char>(len >> (24 - 8 * i));
+}
+
+bool next_record(string_view& rest, string_view& rec) {
+    if (rest.size() < 4)
+        return false;
+    uint32_t len = get_u32(rest.data());
+    if (len == MISSING_RECORD || rest.size() - 4 < len)
+        return false;
+    rec = rest.substr(4, len);
+    rest.remove_prefix(4 + size_t(len));
+    return true;
+}
+
+void append_request(string& out, uint8_t opcode, uint32_t id, string_view key,
+                    string_view value, uint32_t arg, int timeout_ms, int ttl_ms) {
+    out += static_cast<char>(opcode);
+    out += static_cast<char>((timeout_ms >= 0 ? FLAG_TIMEOUT : 0) | (ttl_ms >= 0 ? FLAG_TTL : 0));
+    put_u16(out, static_cast<uint16_t>(key.size()));
+    put_u32(out, id);
+    put_u32(out, static_cast<uint32_t>(value.size()));
+    put_u32(out, arg);
+    out.append(key.data(), key.size());
+    out.append(value.data(), value.size());
+    if (timeout_ms >= 0)
+        put_u32(out, static_cast<uint32_t>(timeout_ms));
+    if (ttl_ms >= 0)
+        put_u32(out, static_cast<uint32_t>(ttl_ms));
+}
+
+}  // namespace protocol
@@ -0,0 +1,200 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Protocolos de texto e binário, comuns aos dois backends.
+//
+// Não aloca: os campos do comando são string_view que apontam para a
+// própria linha no buffer de entrada da conexão. A gramática aceita é a
+// mesma do parser original baseado em istringstream (tokens separados por
+// espaço em branco, valor do WR = resto da linha, svc_id lido como
+// `istream >> int`).
+// ---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace protocol {
+
+// Máximo de serviços num pipeline do EX/EXALL ("EX a b 1,2,3").
+constexpr std::size_t MAX_STAGES = 8;
+
+// Comando de texto já separado em campos. Os string_view valem enquanto a
+// linha de origem não for alterada.
+struct Command {
+    enum Op {
+        WR, RD, IN, EX, RDP, INP, MWR, INN, MRD, EXALL, LOAD, UNLOAD, SUB, UNSUB, RDM, INM,
+        HALFCLOSE, STATS
+    } op = WR;
+    std::string_view key;    // WR/RD/IN/INN: chave; EX/EXALL: chave de entrada;
+                             // LOAD: arquivo; SUB/UNSUB/RDM/INM: padrão
+    std::string_view value;  // WR: valor; EX/EXALL: chave de saída; MRD: as chaves
+    int              svc_id = 0;       // EX/EXALL/UNLOAD; pipeline: o primeiro
+    int              chain[MAX_STAGES] = {};  // EX/EXALL: os svc_ids, em ordem
+    std::uint8_t     stages = 1;              // EX/EXALL: quantos em `chain`
+    int              timeout_ms = -1;  // RD/IN/EX/INN/RDM/INM: prazo; -1 = sem prazo
+    int              ttl_ms     = -1;  // WR: TTL da tupla; -1 = o padrão da chave
+    std::uint32_t    count      = 0;   // MWR: linhas do lote; INN: máximo
+
+    // Falso para RDP/INP/MRD/EXALL e prazo zero: sem tupla, a resposta é
+    // NO-TUPLE (EXALL: "OK 0").
+    bool may_block() const {
+        return op != RDP && op != INP && op != MRD && op != EXALL && op != HALFCLOSE &&
+               !is_admin() && !is_subscription() && timeout_ms != 0;
+    }
+
+    // LOAD/UNLOAD (serviços) e STATS (métricas): administração, só no
+    // protocolo de texto.
+    bool is_admin() const { return op == LOAD || op == UNLOAD || op == STATS; }
+
+    // SUB/UNSUB: assinaturas da conexão (ver subscriptions.hpp).
+    bool is_subscription() const { return op == SUB || op == UNSUB; }
+
+    // RDM/INM: RD/IN por padrão de chave; a resposta traz a chave e o valor.
+    bool is_match() const { return op == RDM || op == INM; }
+};
+
+// Limite de itens de um comando em lote (MWR/INN/MRD).
+constexpr std::uint32_t MAX_BATCH = 1u << 20;
+
+// Parse de uma linha de comando (sem '\n').
+// Retorna false se o comando é inválido ou mal-formado ("ERROR").
+// RD/IN/EX/RDM/INM aceitam um prazo opcional em ms após os argumentos; um token
+// que não seja inteiro >= 0 é ignorado, como era qualquer sobra da linha.
+// WRT é o WR com TTL: "WRT chave ms valor" (0: sem TTL, mesmo com padrão
+// para a chave); o valor do WR é sempre gravado como está.
+bool parse_command(std::string_view line, Command& cmd);
+
+// Extrai de `buf`, a partir de `pos`, a próxima linha completa: sem o '\n'
+// e sem nenhum '\r' (removidos no próprio buffer). Avança `pos` para depois
+// do '\n'. Retorna false se ainda não há linha completa. Pode ser chamada
+// de novo a partir do mesmo `pos` (ex.: lote incompleto) com o mesmo
+// resultado.
+bool next_line(std::string& buf, std::size_t& pos, std::string_view& line);
+
+// Verdadeiro se `buf` tem, a partir de `pos`, `n` linhas completas.
+bool has_lines(const std::string& buf, std::size_t pos, std::size_t n);
+
+// Linha "chave valor" de um lote MWR (mesma regra do WR).
+bool parse_pair(std::string_view line, std::string_view& key,
+                std::string_view& value);
+
+// Próxima palavra de `s` a partir de `pos` (chaves de um MRD).
+bool next_word(std::string_view s, std::size_t& pos, std::string_view& word);
+
+// ---------------------------------------------------------------------------
+// Protocolo binário (opcional), escolhido quando o primeiro byte recebido
+// na conexão é BINARY_MAGIC (nenhum comando de texto começa com ele).
+//
+// Requisição: cabeçalho de 16 bytes, inteiros em big-endian, seguido da
+// chave e do valor:
+//
+//   u8  opcode      1=WR 2=RD 3=IN 4=EX 5=RDP 6=INP 7=MWR 8=INN 9=MRD
+//                   10=EXALL 11=SUB 12=UNSUB 14=RDM 15=INM
+//   u8  flags       FLAG_TIMEOUT: o corpo termina com u32 timeout_ms
+//                   FLAG_TTL (WR): o corpo termina com u32 ttl_ms (depois
+//                   do timeout_ms, se houver os dois)
+//   u16 key_len     bytes da chave (EX/EXALL: chave de entrada; SUB/UNSUB/
+//                   RDM/INM: padrão)
+//   u32 request_id  devolvido na resposta
+//   u32 value_len   bytes do valor (WR: valor; EX/EXALL: chave de saída)
+//   u32 arg         EX/EXALL: svc_id; INN: máximo de tuplas; demais: 0
+//
+// Resposta: cabeçalho de 12 bytes seguido do valor:
+//
+//   u8  status      0=OK 1=NO-SERVICE 2=ERROR 3=NO-TUPLE 4=FULL
+//   u8  opcode      eco da requisição
+//   u16 reservado
+//   u32 request_id
+//   u32 value_len   RD/IN: bytes do valor; EXALL: tuplas transformadas,
+//                   em decimal; demais: 0
+//
+// Lotes usam registros (u32 tamanho + bytes) no lugar do valor: MWR envia
+// chave, valor, chave, valor...; MRD envia as chaves; as respostas de INN
+// e MRD trazem um registro por tupla (MRD: tamanho 0xFFFFFFFF = chave sem
+// tupla). A resposta de RDM/INM traz dois registros: chave e valor.
+//
+// Tuplas de uma assinatura (SUB) chegam como respostas com opcode OP_PUSH
+// e request_id 0, a qualquer momento entre as demais: status OK com dois
+// registros (chave e valor), ou FULL com o número de tuplas perdidas, em
+// decimal, quando o buffer da conexão encheu.
+//
+// Valores podem conter qualquer byte (inclusive '\n'). As respostas são
+// casadas pelo request_id e podem sair fora de ordem: um RD/IN/EX que
+// precisa esperar não impede a conexão de executar os frames seguintes.
+// ---------------------------------------------------------------------------
+
+constexpr unsigned char BINARY_MAGIC = 0xB1;
+constexpr std::size_t   FRAME_HEADER = 16;
+constexpr std::size_t   REPLY_HEADER = 12;
+
+enum Opcode : std::uint8_t {
+    OP_WR = 1, OP_RD = 2, OP_IN = 3, OP_EX = 4, OP_RDP = 5, OP_INP = 6,
+    OP_MWR = 7, OP_INN = 8, OP_MRD = 9, OP_EXALL = 10, OP_SUB = 11, OP_UNSUB = 12,
+    OP_PUSH = 13,  // só em respostas: tupla de uma assinatura
+    OP_RDM = 14, OP_INM = 15
+};
+enum Status : std::uint8_t {
+    ST_OK = 0, ST_NO_SERVICE = 1, ST_ERROR = 2, ST_NO_TUPLE = 3, ST_FULL = 4
+};
+constexpr std::uint8_t FLAG_TIMEOUT = 0x01;
+constexpr std::uint8_t FLAG_TTL     = 0x02;
+
+struct FrameHeader {
+    std::uint8_t  opcode     = 0;
+    std::uint8_t  flags      = 0;
+    std::uint16_t key_len    = 0;
+    std::uint32_t id         = 0;
+    std::uint32_t value_len  = 0;
+    std::uint32_t arg        = 0;
+    int           timeout_ms = -1;  // preenchidos por decode_trailer()
+    int           ttl_ms     = -1;
+
+    std::size_t trailer_len() const {
+        return ((flags & FLAG_TIMEOUT) ? 4 : 0) + ((flags & FLAG_TTL) ? 4 : 0);
+    }
+    std::size_t body_len() const {
+        return std::size_t(key_len) + value_len + trailer_len();
+    }
+};
+
+// Decodifica os FRAME_HEADER bytes em `p`.
+FrameHeader decode_header(const char* p);
+
+// Lê o trailer (trailer_len() bytes em `p`, logo após o valor).
+void decode_trailer(FrameHeader& h, const char* p);
+
+// Monta o Command de um frame já completo. Retorna false se o opcode é
+// desconhecido (resposta ST_ERROR).
+bool frame_to_command(const FrameHeader& h, std::string_view key,
+                      std::string_view value, Command& cmd);
+
+// Acrescenta a `out` uma resposta completa.
+void append_reply(std::string& out, Status st, std::uint8_t opcode,
+                  std::uint32_t id, std::string_view value);
+
+// Reserva o cabeçalho de uma resposta cujo valor será acrescentado a `out`
+// logo em seguida (sem cópia intermediária); finish_reply() preenche o
+// tamanho. Retorna a posição do cabeçalho.
+std::size_t begin_reply(std::string& out, Status st, std::uint8_t opcode,
+                        std::uint32_t id);
+void        finish_reply(std::string& out, std::size_t at);
+
+// Registros de lote. next_record() retorna false no fim de `rest` ou se
+// o registro está truncado (distinguir por rest.empty()).
+constexpr std::uint32_t MISSING_RECORD = 0xFFFFFFFFu;
+void        append_record(std::string& out, std::string_view v);
+void        append_missing(std::string& out);
+std::size_t begin_record(std::string& out);  // conteúdo acrescentado depois
+void        finish_record(std::string& out, std::size_t at);
+bool next_record(std::string_view& rest, std::string_view& rec);
+
+// Acrescenta a `out` uma requisição (lado cliente; usado em testes e
+// ferramentas de carga).
+// timeout_ms >= 0 liga FLAG_TIMEOUT; ttl_ms >= 0, FLAG_TTL.
+void append_request(std::string& out, std::uint8_t opcode, std::uint32_t id,
+                    std::string_view key, std::string_view value,
+                    std::uint32_t arg = 0, int timeout_ms = -1, int ttl_ms = -1);
+
+}  // namespace protocol
@@ -0,0 +1,245 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// RadixTree: árvore de prefixos compactada. Cada aresta guarda uma sequência
+// de bytes; os filhos de um nó diferem no primeiro byte dela (no máximo
+// 256, em ordem), e um nó sem valor tem pelo menos dois filhos (salvo a
+// raiz). Buscar, inserir e remover custam O(tamanho da chave), qualquer que
+// seja o número de chaves.
+//
+// Usada pelo casamento por padrão (RDM/INM, ver main.hpp): as chaves com
+// tuplas de cada shard e os padrões estacionados. Um nó com valor não muda
+// de endereço enquanto o valor existir — só nós sem valor são criados
+// (divisão de aresta) ou removidos (fusão com o único filho) em volta dele.
+// Sem sincronização: o dono trava.
+//
+// glob_match(): '*' casa qualquer sequência de bytes (inclusive vazia) e
+// '?' exatamente um; os demais bytes casam só com eles mesmos.
+// ---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+template <class T>
+class RadixTree {
+public:
+    struct Node {
+        std::string                        label;  // aresta vinda do pai
+        Node*                              parent = nullptr;
+        std::vector<std::unique_ptr<Node>> children;  // pelo primeiro byte de `label`
+        bool                               used = false;
+        T                                  value{};
+    };
+
+    RadixTree() = default;
+
+    RadixTree(const RadixTree&)            = delete;
+    RadixTree& operator=(const RadixTree&) = delete;
+
+    std::size_t size() const { return count; }
+    Node&       root() { return top; }
+
+    // Nó com valor da chave, ou nulo.
+    Node* find(std::string_view key) {
+        Node*       n = &top;
+        std::size_t i = 0;
+        while (i < key.size()) {
+            Node* c = child(*n, key[i]);
+            if (!c || key.substr(i, c->label.size()) != c->label)
+                return nullptr;
+            i += c->label.size();
+            n = c;
+        }
+        return n->used ? n : nullptr;
+    }
+
+    // Nó da chave, criado (com T{}) se ela não existe.
+    Node& emplace(std::string_view key) {
+        Node*       n = &top;
+        std::size_t i = 0;
+        while (i < key.size()) {
+            auto it = slot(*n, key[i]);
+            if (it == n->children.end() || (*it)->label[0] != key[i]) {
+                auto leaf    = std::make_unique<Node>();
+                leaf->label  = std::string(key.substr(i));
+                leaf->parent = n;
+                n            = n->children.insert(it, std::move(leaf))->get();
+                break;
+            }
+            Node*       c    = it->get();
+            std::size_t same = common(c->label, key.substr(i));
+            if (same < c->label.size()) {
+                // Divide a aresta: um nó sem valor no ponto em que a chave
+                // se separa dela.
+                auto mid    = std::make_unique<Node>();
+                mid->label  = c->label.substr(0, same);
+                mid->parent = n;
+                std::unique_ptr<Node> old = std::move(*it);
+                old->label.erase(0, same);
+                old->parent = mid.get();
+                mid->children.push_back(std::move(old));
+                *it = std::move(mid);
+                c   = it->get();
+            }
+            n = c;
+            i += same;
+        }
+        if (!n->used) {
+            n->used = true;
+            ++count;
+        }
+        return *n;
+    }
+
+    // Tira o valor de `n` (um nó com valor) e desfaz os nós que ficaram
+    // sobrando. Retorna o nó mais fundo cuja subárvore mudou (para quem
+    // mantém agregados subindo até a raiz).
+    Node* erase(Node& n) {
+        n.used  = false;
+        n.value = T{};
+        --count;
+        Node* p = &n;
+        if (p != &top && p->children.empty()) {
+            Node* up = p->parent;
+            up->children.erase(slot(*up, p->label[0]));
+            p = up;
+        }
+        if (p != &top && !p->used && p->children.size() == 1) {
+            Node*                 up   = p->parent;
+            std::unique_ptr<Node> only = std::move(p->children[0]);
+            only->label.insert(0, p->label);
+            only->parent = up;
+            *slot(*up, only->label[0]) = std::move(only);  // destrói `p`
+            p = up;
+        }
+        return p;
+    }
+
+    // Nó do topo da subárvore das chaves que começam com `prefix` (o
+    // caminho dele pode ir além do prefixo, no meio de uma aresta), ou nulo.
+    Node* subtree(std::string_view prefix) {
+        Node*       n = &top;
+        std::size_t i = 0;
+        while (i < prefix.size()) {
+            Node* c = child(*n, prefix[i]);
+            if (!c)
+                return nullptr;
+            std::size_t len = std::min(c->label.size(), prefix.size() - i);
+            if (prefix.substr(i, len) != std::string_view(c->label).substr(0, len))
+                return nullptr;
+            i += len;
+            n = c;
+        }
+        return n;
+    }
+
+    // Chama `fn(nó)` para cada nó com valor cuja chave é prefixo de `key`
+    // (inclusive a própria), da raiz para baixo. `fn` não pode mudar a
+    // árvore.
+    template <class F>
+    void along(std::string_view key, F&& fn) {
+        Node*       n = &top;
+        std::size_t i = 0;
+        while (true) {
+            if (n->used)
+                fn(*n);
+            if (i == key.size())
+                return;
+            Node* c = child(*n, key[i]);
+            if (!c || key.substr(i, c->label.size()) != c->label)
+                return;
+            i += c->label.size();
+            n = c;
+        }
+    }
+
+    // Chama `fn(nó)` para cada nó com valor da subárvore de `from`. `fn`
+    // não pode mudar a árvore.
+    template <class F>
+    void for_each(Node& from, F&& fn) {
+        std::vector<Node*> stack{&from};
+        while (!stack.empty()) {
+            Node* n = stack.back();
+            stack.pop_back();
+            if (n->used)
+                fn(*n);
+            for (auto it = n->children.rbegin(); it != n->children.rend(); ++it)
+                stack.push_back(it->get());
+        }
+    }
+
+    // Chave de `n`: os rótulos da raiz até ele.
+    static std::string key(const Node& n) {
+        std::vector<const Node*> path;
+        std::size_t              len = 0;
+        for (const Node* p = &n; p->parent; p = p->parent) {
+            path.push_back(p);
+            len += p->label.size();
+        }
+        std::string k;
+        k.reserve(len);
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+            k += (*it)->label;
+        return k;
+    }
+
+private:
+    using Children = std::vector<std::unique_ptr<Node>>;
+
+    static typename Children::iterator slot(Node& n, char c) {
+        return std::lower_bound(n.children.begin(), n.children.end(), c,
+                                [](const std::unique_ptr<Node>& a, char b) {
+                                    return static_cast<unsigned char>(a->label[0]) <
+                                           static_cast<unsigned char>(b);
+                                });
+    }
+
+    static Node* child(Node& n, char c) {
+        auto it = slot(n, c);
+        return it != n.children.end() && (*it)->label[0] == c ? it->get() : nullptr;
+    }
+
+    static std::size_t common(std::string_view a, std::string_view b) {
+        std::size_t n = std::min(a.size(), b.size()), i = 0;
+        while (i < n && a[i] == b[i])
+            ++i;
+        return i;
+    }
+
+    Node        top;
+    std::size_t count = 0;
+};
+
+// Parte literal do padrão: até o primeiro '*' ou '?'.
+inline std::string_view glob_prefix(std::string_view pattern) {
+    return pattern.substr(0, pattern.find_first_of("*?"));
+}
+
+// Casamento guloso com retrocesso até o último '*': O(|padrão| * |chave|)
+// no pior caso, sem recursão.
+inline bool glob_match(std::string_view pattern, std::string_view key) {
+    std::size_t p = 0, k = 0;
+    std::size_t star = std::string_view::npos, mark = 0;
+    while (k < key.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = k;
+        } else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == key[k])) {
+            ++p;
+            ++k;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            k = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
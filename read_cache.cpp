@@ -0,0 +1,94 @@
+#include "read_cache.hpp"
+
+#include <limits>
+#include <mutex>
+
+using namespace std;
+
+namespace epoch {
+
+namespace {
+
+// Começa em 1: `active` zero é "fora de leitura".
+atomic<uint64_t> global{1};
+
+// Registro de um thread leitor, numa linha de cache própria.
+struct alignas(64) Record {
+    atomic<uint64_t> active{0};
+};
+
+// Todos os registros já criados; os de threads encerrados ficam em
+// `spare` (com `active` zero). Nunca destruído: threads podem terminar
+// depois dos destrutores estáticos.
+struct Registry {
+    mutex                      mtx;
+    vector<unique_ptr<Record>> records;
+    vector<Record*>            spare;
+
+    static Registry& get() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+};
+
+struct Local {
+    Record* rec = nullptr;
+
+    Record& get() {
+        if (rec)
+            return *rec;
+        Registry&         r = Registry::get();
+        lock_guard<mutex> lock(r.mtx);
+        if (!r.spare.empty()) {
+            rec = r.spare.back();
+            r.spare.pop_back();
+        } else {
+            r.records.push_back(make_unique<Record>());
+            rec = r.records.back().get();
+        }
+        return *rec;
+    }
+
+    ~Local() {
+        if (!rec)
+            return;
+        Registry&         r = Registry::get();
+        lock_guard<mutex> lock(r.mtx);
+        r.spare.push_back(rec);
+    }
+};
+
+thread_local Local local;
+
+}  // namespace
+
+// A cerca de entrada e a de oldest() formam o par clássico: ou quem
+// libera enxerga este leitor ativo, ou o leitor enxerga o nó já
+// despublicado.
+Guard::Guard() : active(&local.get().active) {
+    active->store(global.load(memory_order_acquire), memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+Guard::~Guard() {
+    active->store(0, memory_order_release);
+}
+
+uint64_t advance() {
+    return global.fetch_add(1, memory_order_seq_cst) + 1;
+}
+
+uint64_t oldest() {
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t          low = numeric_limits<uint64_t>::max();
+    Registry&         r   = Registry::get();
+    lock_guard<mutex> lock(r.mtx);
+    for (auto& rec : r.records) {
+        uint64_t e = rec->active.load(memory_order_acquire);
+        if (e != 0 && e < low)
+            low = e;
+    }
+    return low;
+}
+
+}  // namespace epoch
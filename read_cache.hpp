@@ -0,0 +1,168 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Leitura sem lock da frente das chaves lidas com frequência (RD/RDP).
+//
+// Chaves de configuração recebem milhares de RDs por WR. Em vez de travar o
+// shard e copiar o valor a cada leitura, a frente de uma chave já lida
+// algumas vezes sob o lock é publicada no FrontCache do shard como um
+// buffer imutável com contagem de referências (SharedValue). O RD seguinte
+// a encontra sem lock nenhum: só leituras de memória compartilhada, nenhum
+// atômico escrito — a vazão cresce com os núcleos. Quem precisa do valor
+// além da leitura (o envio de um valor grande, ver tcp_server_epoll.cpp)
+// fica com uma referência ao buffer, sem copiá-lo.
+//
+// Tudo o que muda a frente (o IN/INP/INN/EX que a retira) passa pelo lock
+// do shard e despublica a chave sob ele; WR numa fila não vazia não mexe
+// na frente. Assim a frente publicada é sempre a frente atual, e um RD sem
+// lock equivale a um RD sob o lock no instante em que leu o ponteiro.
+//
+// Os nós despublicados só são liberados quando nenhum leitor pode mais
+// estar com eles (reclamação por épocas, namespace epoch): o leitor marca a
+// época global no seu registro ao entrar (epoch::Guard) e zera ao sair; um
+// nó retirado na época t é liberado quando todo leitor ativo entrou numa
+// época >= t.
+// ---------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Valor imutável compartilhado entre o espaço de tuplas e os leitores.
+using SharedValue = std::shared_ptr<const std::string>;
+
+namespace epoch {
+
+// Seção de leitura: enquanto existir, nenhum nó que o thread possa ter
+// visto publicado é liberado. Curta (só a leitura) e sem aninhamento.
+class Guard {
+public:
+    Guard();
+    ~Guard();
+    Guard(const Guard&)            = delete;
+    Guard& operator=(const Guard&) = delete;
+
+private:
+    std::atomic<std::uint64_t>* active;
+};
+
+// Avança a época global; chamado depois de despublicar um nó, cujo
+// retorno é a etiqueta dele.
+std::uint64_t advance();
+
+// Menor época entre os leitores ativos (UINT64_MAX sem nenhum): os nós
+// com etiqueta <= oldest() podem ser liberados.
+std::uint64_t oldest();
+
+}  // namespace epoch
+
+// ---------------------------------------------------------------------------
+// FrontCache: tabela de mapeamento direto (uma posição por hash, sem
+// sondagem) da chave para a frente publicada. Uma chave que cai numa
+// posição ocupada por outra a despeja: a despejada volta a ser lida sob o
+// lock, nunca errada.
+//
+// Escrita (publish/drop) só com o lock do shard; find() sem lock, dentro
+// de um epoch::Guard. `Owner` (o estado da chave no shard) guarda em
+// `cache_slot` 1 + a posição em que está publicado, ou 0.
+// ---------------------------------------------------------------------------
+template <class Owner>
+class FrontCache {
+public:
+    static constexpr std::size_t SLOTS = 256;  // por shard
+
+    FrontCache() = default;
+    ~FrontCache() {
+        for (auto& s : slots)
+            delete s.load(std::memory_order_relaxed);
+        for (auto& r : limbo)
+            delete r.node;
+    }
+
+    FrontCache(const FrontCache&)            = delete;
+    FrontCache& operator=(const FrontCache&) = delete;
+
+    // Verdadeiro se pode haver algo publicado na posição de `h` (sem
+    // Guard: o ponteiro não é seguido).
+    bool maybe(std::uint64_t h) const {
+        return slots[pos(h)].load(std::memory_order_relaxed) != nullptr;
+    }
+
+    // Frente publicada da chave, ou nulo. Dentro de um epoch::Guard; o
+    // ponteiro vale até o Guard acabar.
+    const SharedValue* find(std::string_view key, std::uint64_t h) const {
+        const Node* n = slots[pos(h)].load(std::memory_order_acquire);
+        if (n == nullptr || n->hash != h || n->key != key)
+            return nullptr;
+        return &n->value;
+    }
+
+    // Publica `value` como frente da chave de `owner`, despejando quem
+    // estava na posição. Com o lock do shard.
+    void publish(std::string_view key, std::uint64_t h, Owner& owner, SharedValue value) {
+        std::size_t i   = pos(h);
+        Node*       old = slots[i].load(std::memory_order_relaxed);
+        if (old)
+            old->owner->cache_slot = 0;
+        slots[i].store(new Node{h, std::string(key), std::move(value), &owner},
+                       std::memory_order_release);
+        owner.cache_slot = static_cast<std::uint16_t>(i + 1);
+        if (old)
+            retire(old);
+    }
+
+    // Despublica a frente de `owner`, se publicada. Com o lock do shard.
+    void drop(Owner& owner) {
+        if (owner.cache_slot == 0)
+            return;
+        std::size_t i = owner.cache_slot - 1u;
+        owner.cache_slot = 0;
+        retire(slots[i].exchange(nullptr, std::memory_order_relaxed));
+    }
+
+private:
+    struct Node {
+        std::uint64_t hash;
+        std::string   key;
+        SharedValue   value;
+        Owner*        owner;  // só sob o lock
+    };
+    struct Retired {
+        Node*         node;
+        std::uint64_t tag;
+    };
+
+    static_assert(SLOTS <= 0xFFFF, "cache_slot tem 16 bits");
+
+    static std::size_t pos(std::uint64_t h) {
+        return static_cast<std::size_t>(h >> 40) & (SLOTS - 1);  // os bits baixos escolhem o shard
+    }
+
+    void retire(Node* n) {
+        limbo.push_back({n, epoch::advance()});
+        if (limbo.size() >= COLLECT_AT)
+            collect();
+    }
+
+    // Libera os nós que nenhum leitor ativo pode estar lendo.
+    void collect() {
+        std::uint64_t safe = epoch::oldest();
+        std::size_t   kept = 0;
+        for (auto& r : limbo) {
+            if (r.tag <= safe)
+                delete r.node;
+            else
+                limbo[kept++] = r;
+        }
+        limbo.resize(kept);
+    }
+
+    static constexpr std::size_t COLLECT_AT = 32;
+
+    std::atomic<Node*>   slots[SLOTS]{};
+    std::vector<Retired> limbo;  // despublicados, ainda não liberados
+};
@@ -0,0 +1,180 @@
+#include "service_pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+// Worker do thread atual (submissões de dentro de uma tarefa ficam nele).
+thread_local const ServicePool* current_pool   = nullptr;
+thread_local unsigned           current_worker = 0;
+}  // namespace
+
+bool ServicePool::parse_ack(string_view name, Ack& out) {
+    if (name == "publish") { out = Ack::PUBLISH; return true; }
+    if (name == "consume") { out = Ack::CONSUME; return true; }
+    return false;
+}
+
+ServicePool::ServicePool(const Options& opt)
+    : ack_mode(opt.ack),
+      concurrency(opt.concurrency),
+      service_concurrency(opt.service_concurrency) {
+    unsigned n = opt.workers > 0 ? opt.workers : max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < n; ++i)
+        workers.push_back(make_unique<Worker>());
+    // Só depois de todas as filas existirem: um worker pode roubar de
+    // qualquer uma.
+    for (unsigned i = 0; i < n; ++i)
+        workers[i]->thread = thread([this, i]() { run(i); });
+}
+
+ServicePool::~ServicePool() {
+    {
+        lock_guard<mutex> lk(sleep_mtx);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers)
+        w->thread.join();
+}
+
+shared_ptr<ServicePool::Queue> ServicePool::queue(int svc_id) {
+    lock_guard<mutex> lk(queues_mtx);
+    auto&             q = queues[svc_id];
+    if (!q) {
+        q        = make_shared<Queue>();
+        auto it  = service_concurrency.find(svc_id);
+        q->limit = it != service_concurrency.end() ? it->second : concurrency;
+    }
+    return q;
+}
+
+// ---------------------------------------------------------------------------
+// submit(): com limite de concorrência, a tarefa só vai para a fila de um
+// worker se o serviço tem vaga; senão espera no backlog do serviço.
+// ---------------------------------------------------------------------------
+void ServicePool::submit(const shared_ptr<Queue>& q, function<void()> task) {
+    Queue& svc = *q;
+    ++svc.queued;
+    Job job{q, move(task)};
+    if (svc.limit > 0) {
+        lock_guard<mutex> lk(svc.mtx);
+        if (svc.active == svc.limit) {
+            svc.backlog.push_back(move(job));
+            return;
+        }
+        ++svc.active;
+    }
+    push(move(job));
+}
+
+ServicePool::Stats ServicePool::stats(int svc_id) const {
+    Stats             s;
+    lock_guard<mutex> lk(queues_mtx);
+    auto              it = queues.find(svc_id);
+    if (it != queues.end()) {
+        s.queued    = it->second->queued.load();
+        s.running   = it->second->running.load();
+        s.completed = it->second->completed.load();
+    }
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// push(): fila do worker atual ou, de fora do pool, a próxima em rodízio.
+// `pending` sobe depois de a tarefa estar na fila e `idle` é lido depois:
+// um worker que vá dormir ao mesmo tempo ou vê `pending` ou é acordado.
+// ---------------------------------------------------------------------------
+void ServicePool::push(Job job) {
+    unsigned target = current_pool == this
+                          ? current_worker
+                          : next.fetch_add(1, memory_order_relaxed) % workers.size();
+    {
+        Worker&           w = *workers[target];
+        lock_guard<mutex> lk(w.mtx);
+        w.jobs.push_back(move(job));
+    }
+    ++pending;
+    if (idle.load() > 0) {
+        lock_guard<mutex> lk(sleep_mtx);
+        wake.notify_one();
+    }
+}
+
+bool ServicePool::pop(unsigned self, Job& job) {
+    Worker&           w = *workers[self];
+    lock_guard<mutex> lk(w.mtx);
+    if (w.jobs.empty())
+        return false;
+    job = move(w.jobs.front());
+    w.jobs.pop_front();
+    return true;
+}
+
+bool ServicePool::steal(unsigned self, Job& job) {
+    for (size_t k = 1; k < workers.size(); ++k) {
+        Worker&           w = *workers[(self + k) % workers.size()];
+        lock_guard<mutex> lk(w.mtx);
+        if (!w.jobs.empty()) {
+            job = move(w.jobs.back());
+            w.jobs.pop_back();
+            ++steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fim de uma tarefa: a vaga passa para a próxima do backlog, se houver.
+void ServicePool::finish(Queue& svc) {
+    if (svc.limit == 0)
+        return;
+    Job job;
+    {
+        lock_guard<mutex> lk(svc.mtx);
+        if (svc.backlog.empty()) {
+            --svc.active;
+            return;
+        }
+        job = move(svc.backlog.front());
+        svc.backlog.pop_front();
+    }
+    push(move(job));
+}
+
+// ---------------------------------------------------------------------------
+// run(): laço de um worker. Na parada, só sai quando não há mais tarefa em
+// fila nenhuma — o que já foi aceito (e, no modo CONSUME, confirmado ao
+// cliente) é executado.
+// ---------------------------------------------------------------------------
+void ServicePool::run(unsigned self) {
+    current_pool   = this;
+    current_worker = self;
+    Job job;
+    while (true) {
+        if (pop(self, job) || steal(self, job)) {
+            --pending;
+            Queue& svc = *job.svc;
+            --svc.queued;
+            ++svc.running;
+            job.task();
+            job.task = nullptr;
+            --svc.running;
+            ++svc.completed;
+            finish(svc);
+            job.svc.reset();
+            continue;
+        }
+
+        unique_lock<mutex> lk(sleep_mtx);
+        if (pending.load() > 0)
+            continue;  // outro worker está retirando a tarefa; tenta de novo
+        if (stop)
+            return;
+        ++idle;
+        wake.wait(lk, [this] { return pending.load() > 0 || stop; });
+        --idle;
+    }
+}
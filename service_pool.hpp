@@ -0,0 +1,133 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Pool de workers dos serviços do EX (opcional).
+//
+// Sem o pool, o serviço roda no thread que consumiu a tupla de entrada (o
+// thread de I/O da conexão, ou o do WR que a entregou): um serviço lento
+// prende a conexão, e serviços pesados disputam CPU com o I/O. Com o pool,
+// o EX consome k_in e entrega o resto (serviço + publicação em k_out) a
+// um dos workers.
+//
+// Cada worker tem sua fila. Tarefas submetidas por um worker (um EX
+// acordado pela publicação de outro) vão para a fila dele mesmo; as
+// demais são distribuídas em rodízio. O dono retira da frente da sua fila;
+// um worker sem trabalho rouba do fim da fila dos outros antes de dormir.
+//
+// Concorrência por serviço: com limite, no máximo `limite` tarefas do
+// serviço ficam nas filas dos workers ou rodando; as excedentes esperam
+// numa fila do próprio serviço e entram à medida que as anteriores
+// terminam — um serviço pesado não ocupa todos os workers. O estado de
+// cada serviço (Queue) é criado no primeiro uso do svc_id e sobrevive a
+// recargas do serviço: limite e métricas valem por svc_id.
+// ---------------------------------------------------------------------------
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class ServicePool {
+public:
+    // Quando o cliente recebe o "OK" do EX.
+    enum class Ack {
+        PUBLISH,  // depois que o resultado entrou em k_out (como sem pool)
+        CONSUME,  // logo depois de consumir k_in; o resultado sai depois
+    };
+
+    struct Options {
+        unsigned                workers     = 0;  // 0 = um por núcleo
+        Ack                     ack         = Ack::PUBLISH;
+        unsigned                concurrency = 0;  // por serviço; 0 = sem limite
+        std::map<int, unsigned> service_concurrency;  // exceções por svc_id
+    };
+
+    // Profundidade de fila e contadores de um serviço.
+    struct Stats {
+        std::size_t   queued    = 0;  // aceitas e ainda não iniciadas
+        std::size_t   running   = 0;
+        std::uint64_t completed = 0;
+    };
+
+    // Fila e contadores de um serviço.
+    struct Queue;
+
+    // "publish" / "consume". Retorna false se o nome é desconhecido.
+    static bool parse_ack(std::string_view name, Ack& out);
+
+    explicit ServicePool(const Options& opt);
+    ~ServicePool();  // executa tudo o que já foi aceito e encerra os workers
+
+    ServicePool(const ServicePool&)            = delete;
+    ServicePool& operator=(const ServicePool&) = delete;
+
+    unsigned worker_count() const { return static_cast<unsigned>(workers.size()); }
+    Ack      ack() const { return ack_mode; }
+
+    // Estado do serviço `svc_id`, criado na primeira chamada. Quem submete
+    // com frequência guarda o ponteiro e evita a busca.
+    std::shared_ptr<Queue> queue(int svc_id);
+
+    // Agenda `task` no serviço.
+    void submit(const std::shared_ptr<Queue>& q, std::function<void()> task);
+    void submit(int svc_id, std::function<void()> task) { submit(queue(svc_id), std::move(task)); }
+
+    Stats         stats(int svc_id) const;
+    std::uint64_t steal_count() const { return steals.load(); }
+
+private:
+    struct Job {
+        std::shared_ptr<Queue> svc;
+        std::function<void()>  task;
+    };
+
+    struct Worker {
+        std::mutex      mtx;
+        std::deque<Job> jobs;
+        std::thread     thread;
+    };
+
+    void run(unsigned self);
+    void push(Job job);
+    bool pop(unsigned self, Job& job);
+    bool steal(unsigned self, Job& job);
+    void finish(Queue& svc);
+
+    Ack                                  ack_mode;
+    unsigned                             concurrency;
+    std::map<int, unsigned>              service_concurrency;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    mutable std::mutex                    queues_mtx;
+    std::map<int, std::shared_ptr<Queue>> queues;
+
+    std::atomic<unsigned>      next{0};     // rodízio das submissões externas
+    std::atomic<std::size_t>   pending{0};  // tarefas nas filas dos workers
+    std::atomic<unsigned>      idle{0};     // workers dormindo
+    std::atomic<std::uint64_t> steals{0};
+
+    std::mutex              sleep_mtx;
+    std::condition_variable wake;
+    bool                    stop = false;
+};
+
+struct ServicePool::Queue {
+    unsigned                   limit = 0;  // 0 = sem limite
+    std::atomic<std::size_t>   queued{0};
+    std::atomic<std::size_t>   running{0};
+    std::atomic<std::uint64_t> completed{0};
+
+    // Só com limite: tarefas nas filas dos workers ou rodando, e as que
+    // esperam vaga.
+    std::mutex      mtx;
+    unsigned        active = 0;
+    std::deque<Job> backlog;
+};
@@ -0,0 +1,352 @@
+#include "service_registry.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Serviços internos, na mesma ABI dos externos. Maiúsculas e inversão
+// trabalham no próprio buffer, sem alocar, com os kernels vetorizados de
+// simd.hpp.
+// ---------------------------------------------------------------------------
+namespace {
+
+// Serviço 1: converter para maiúsculas.
+size_t svc_upper(linda_value* v) {
+    simd::upper(v->data, v->len);
+    return 0;
+}
+
+// Serviço 2: inverter a string.
+size_t svc_reverse(linda_value* v) {
+    simd::reverse(v->data, v->len);
+    return 0;
+}
+
+// Serviço 3: retornar o tamanho como texto.
+size_t svc_length(linda_value* v) {
+    string n = to_string(v->len);
+    if (n.size() > v->cap)
+        return n.size();
+    memcpy(v->data, n.data(), n.size());
+    v->len = n.size();
+    return 0;
+}
+
+const linda_service BUILTIN[] = {
+    {1, "upper", svc_upper, nullptr},
+    {2, "reverse", svc_reverse, nullptr},
+    {3, "length", svc_length, nullptr},
+};
+
+// Estágios fundidos dos pipelines (fora da tabela).
+size_t svc_upper_reverse(linda_value* v) {
+    simd::upper_reverse(v->data, v->len);
+    return 0;
+}
+
+const linda_service UPPER_REVERSE = {0, "upper+reverse", svc_upper_reverse, nullptr};
+
+// svc_id do serviço interno que `s` é, ou 0 (carregado, inclusive um que
+// substituiu um interno).
+int builtin_id(const ServiceRegistry::Service& s) {
+    for (auto& b : BUILTIN)
+        if (s.desc == &b)
+            return b.svc_id;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// fuse(): maiúsculas e inversão comutam, maiúsculas é idempotente e a
+// inversão é involução: qualquer sequência delas se reduz a nada, a uma
+// delas ou às duas numa passada (upper_reverse). Antes de "length" a
+// sequência é descartada, pois não muda o tamanho.
+// ---------------------------------------------------------------------------
+vector<ServiceRegistry::Handle> fuse(const vector<ServiceRegistry::Handle>& chain) {
+    using Handle = ServiceRegistry::Handle;
+    static const Handle fused[4] = {
+        nullptr,
+        make_shared<ServiceRegistry::Service>(ServiceRegistry::Service{&BUILTIN[0], {}, "", {}, {}}),
+        make_shared<ServiceRegistry::Service>(ServiceRegistry::Service{&BUILTIN[1], {}, "", {}, {}}),
+        make_shared<ServiceRegistry::Service>(ServiceRegistry::Service{&UPPER_REVERSE, {}, "", {}, {}}),
+    };
+
+    vector<Handle> out;
+    bool           up = false, rev = false;
+    auto           flush = [&]() {
+        if (up || rev)
+            out.push_back(fused[int(up) | int(rev) << 1]);
+        up = rev = false;
+    };
+    for (auto& h : chain) {
+        int id = builtin_id(*h);
+        if (id == 1 || id == 2) {
+            up |= id == 1;
+            rev ^= id == 2;
+            continue;
+        }
+        if (id == 3)
+            up = rev = false;
+        else
+            flush();
+        out.push_back(h);
+    }
+    flush();
+    return out;
+}
+
+// Prepara `v` para o serviço: a folga de capacidade da string também pode
+// ser escrita.
+linda_value open_value(string& v) {
+    size_t len = v.size();
+    v.resize(max(v.capacity(), len));
+    return {&v[0], len, v.size()};
+}
+
+// Conclui `v` depois da primeira chamada; `need` != 0: aumenta o buffer e
+// refaz. Um serviço que viola a ABI (pede mais de novo, ou informa um
+// tamanho maior que a capacidade) produz um valor vazio.
+void close_value(const linda_service& d, string& v, linda_value& lv, size_t need) {
+    if (need > lv.cap) {
+        size_t len = lv.len;
+        v.resize(need);
+        lv   = {&v[0], len, need};
+        need = d.transform(&lv);
+    }
+    v.resize(need == 0 && lv.len <= lv.cap ? lv.len : 0);
+}
+
+}  // namespace
+
+ServiceChain::ServiceChain(const int* first, size_t count)
+    : n(static_cast<uint8_t>(min(count, MAX))) {
+    copy(first, first + n, ids);
+}
+
+string ServiceRegistry::Service::apply(string v) const {
+    if (desc == nullptr) {
+        for (auto& s : stages)
+            v = s->apply(move(v));
+        return v;
+    }
+    linda_value lv = open_value(v);
+    close_value(*desc, v, lv, desc->transform(&lv));
+    return v;
+}
+
+void ServiceRegistry::Service::apply_batch(vector<string>& values) const {
+    if (desc == nullptr) {
+        for (auto& s : stages)
+            s->apply_batch(values);
+        return;
+    }
+    vector<linda_value> lv;
+    lv.reserve(values.size());
+    for (auto& v : values)
+        lv.push_back(open_value(v));
+    vector<size_t> need(values.size(), 0);
+    if (desc->batch != nullptr)
+        desc->batch(lv.data(), need.data(), lv.size());
+    else
+        for (size_t i = 0; i < lv.size(); ++i)
+            need[i] = desc->transform(&lv[i]);
+    for (size_t i = 0; i < values.size(); ++i)
+        close_value(*desc, values[i], lv[i], need[i]);
+}
+
+// ---------------------------------------------------------------------------
+// ServiceRegistry
+// ---------------------------------------------------------------------------
+ServiceRegistry::ServiceRegistry() : table(new Table) {
+    readers[0] = 0;
+    readers[1] = 0;
+    add(BUILTIN, sizeof(BUILTIN) / sizeof(BUILTIN[0]), nullptr, "");
+}
+
+ServiceRegistry::~ServiceRegistry() {
+    delete table.load();
+}
+
+// ---------------------------------------------------------------------------
+// find(): entra na época atual, copia o shared_ptr e sai. Se a época virar
+// no meio, o escritor espera este leitor na fase seguinte do período de
+// graça (ver publish()).
+// ---------------------------------------------------------------------------
+ServiceRegistry::Handle ServiceRegistry::find(int svc_id) const {
+    size_t p = epoch.load() & 1;
+    ++readers[p];
+    const Table* t = table.load();
+    Handle       h;
+    auto         it = t->find(svc_id);
+    if (it != t->end())
+        h = it->second;
+    --readers[p];
+    return h;
+}
+
+ServiceRegistry::Handle ServiceRegistry::resolve(const ServiceChain& chain) const {
+    if (chain.size() == 1)
+        return find(chain[0]);
+    vector<Handle> found;
+    for (size_t i = 0; i < chain.size(); ++i) {
+        Handle h = find(chain[i]);
+        if (!h)
+            return nullptr;
+        found.push_back(move(h));
+    }
+    auto svc    = make_shared<Service>();
+    svc->queue  = found.front()->queue;
+    svc->stages = fuse(found);
+    return svc;
+}
+
+vector<int> ServiceRegistry::ids() const {
+    size_t p = epoch.load() & 1;
+    ++readers[p];
+    vector<int> out;
+    for (auto& s : *table.load())
+        out.push_back(s.first);
+    --readers[p];
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// publish(): cada fase vira a época e espera sair quem entrou na anterior
+// — a época que já não recebe leitores novos, então a espera termina. Duas
+// fases cobrem também o leitor que leu a época logo antes de uma virada e
+// só então se registrou (ele pode ter visto qualquer uma das tabelas).
+// ---------------------------------------------------------------------------
+void ServiceRegistry::publish(Table* next) {
+    const Table* old = table.exchange(next);
+    for (int phase = 0; phase < 2; ++phase) {
+        size_t p = epoch.fetch_add(1) & 1;
+        while (readers[p].load() != 0)
+            this_thread::yield();
+    }
+    delete old;
+}
+
+void ServiceRegistry::add(const linda_service* descs, size_t n, shared_ptr<void> lib,
+                          const string& origin) {
+    lock_guard<mutex> lk(writer_mtx);
+    auto              next = new Table(*table.load());
+    for (size_t i = 0; i < n; ++i) {
+        auto svc    = make_shared<Service>();
+        svc->desc   = &descs[i];
+        svc->lib    = lib;
+        svc->origin = origin;
+        if (pool != nullptr)
+            svc->queue = pool->queue(descs[i].svc_id);
+        (*next)[descs[i].svc_id] = move(svc);
+    }
+    publish(next);
+}
+
+bool ServiceRegistry::unload(int svc_id) {
+    lock_guard<mutex> lk(writer_mtx);
+    const Table*      cur = table.load();
+    if (cur->count(svc_id) == 0)
+        return false;
+    auto next = new Table(*cur);
+    next->erase(svc_id);
+    publish(next);
+    return true;
+}
+
+void ServiceRegistry::attach(ServicePool* p) {
+    lock_guard<mutex> lk(writer_mtx);
+    pool      = p;
+    auto next = new Table;
+    for (auto& [id, svc] : *table.load()) {
+        auto copy   = make_shared<Service>(*svc);
+        copy->queue = pool->queue(id);
+        (*next)[id] = move(copy);
+    }
+    publish(next);
+}
+
+// ---------------------------------------------------------------------------
+// load(): a biblioteca fica aberta enquanto algum Service a referencia.
+// ---------------------------------------------------------------------------
+vector<int> ServiceRegistry::load(const string& path) {
+#ifdef _WIN32
+    HMODULE h = ::LoadLibraryA(path.c_str());
+    if (h == nullptr)
+        throw runtime_error("serviços: não foi possível abrir " + path);
+    shared_ptr<void> lib(h, [](void* p) { ::FreeLibrary(static_cast<HMODULE>(p)); });
+    auto entry = reinterpret_cast<linda_services_fn>(
+        reinterpret_cast<void*>(::GetProcAddress(h, LINDA_SERVICE_ENTRY)));
+#else
+    void* h = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (h == nullptr)
+        throw runtime_error(string("serviços: ") + ::dlerror());
+    shared_ptr<void> lib(h, [](void* p) { ::dlclose(p); });
+    auto entry = reinterpret_cast<linda_services_fn>(::dlsym(h, LINDA_SERVICE_ENTRY));
+#endif
+    if (entry == nullptr)
+        throw runtime_error("serviços: " + path + " não exporta " LINDA_SERVICE_ENTRY);
+
+    uint32_t             abi   = 0;
+    size_t               count = 0;
+    const linda_service* descs = entry(&abi, &count);
+    if (abi != LINDA_SERVICE_ABI)
+        throw runtime_error("serviços: " + path + " usa a ABI " + to_string(abi) +
+                            "; esperada " + to_string(LINDA_SERVICE_ABI));
+    if (descs == nullptr || count == 0)
+        throw runtime_error("serviços: " + path + " não declara nenhum serviço");
+    for (size_t i = 0; i < count; ++i)
+        if (descs[i].transform == nullptr)
+            throw runtime_error("serviços: " + path + ": serviço " +
+                                to_string(descs[i].svc_id) + " sem transform");
+
+    add(descs, count, move(lib), path);
+    vector<int> ids;
+    for (size_t i = 0; i < count; ++i)
+        ids.push_back(descs[i].svc_id);
+    return ids;
+}
+
+size_t ServiceRegistry::load_dir() {
+#ifdef _WIN32
+    const char* ext = ".dll";
+#else
+    const char* ext = ".so";
+#endif
+    vector<filesystem::path> libs;
+    for (auto& entry : filesystem::directory_iterator(services_dir))
+        if (entry.is_regular_file() && entry.path().extension() == ext)
+            libs.push_back(entry.path());
+    sort(libs.begin(), libs.end());  // ordem estável: o último vence um svc_id repetido
+
+    size_t loaded = 0;
+    for (auto& path : libs) {
+        try {
+            loaded += load(path.string()).size();
+        } catch (const exception& e) {
+            cerr << "[AVISO] " << e.what() << "; ignorado.\n";
+        }
+    }
+    return loaded;
+}
+
+vector<int> ServiceRegistry::load_file(const string& name) {
+    if (services_dir.empty())
+        throw runtime_error("serviços: LOAD sem services_dir configurado");
+    if (name.empty() || name[0] == '.' || name.find_first_of("/\\:") != string::npos)
+        throw runtime_error("serviços: nome inválido para LOAD: " + name);
+    return load((filesystem::path(services_dir) / name).string());
+}
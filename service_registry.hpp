@@ -0,0 +1,128 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Registro dos serviços do EX: svc_id -> serviço (ABI de linda_service.h).
+//
+// Os serviços internos (1–3) usam a mesma ABI dos carregados de
+// bibliotecas compartilhadas, que entram na partida (load_dir()) ou pelo
+// comando LOAD, e saem por UNLOAD — sem reiniciar o servidor.
+//
+// Leitura sem lock: a tabela publicada é imutável. Quem altera monta uma
+// cópia, publica-a com uma troca atômica de ponteiro e espera os leitores
+// que ainda podiam estar na antiga antes de liberá-la (um período de
+// graça, como no RCU, com dois contadores de leitores alternados por
+// época). O leitor só incrementa e decrementa um contador: nunca espera o
+// escritor. find() devolve o serviço por shared_ptr, que mantém a
+// biblioteca aberta enquanto um EX a usa; ela é fechada quando o último
+// usuário de todas as suas versões termina.
+//
+// Pipelines: um EX pode encadear vários svc_ids (ServiceChain), aplicados
+// em sequência ao mesmo buffer, sem tuplas intermediárias. resolve()
+// monta o serviço composto e funde as combinações conhecidas dos
+// serviços internos: maiúsculas e inversão, em qualquer ordem e número,
+// viram uma passada só; antes de "length", que só depende do tamanho,
+// são descartadas.
+// ---------------------------------------------------------------------------
+
+#include "linda_service.h"
+#include "service_pool.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// svc_ids de um EX: um serviço ou um pipeline, aplicado em ordem.
+class ServiceChain {
+public:
+    static constexpr std::size_t MAX = 8;
+
+    ServiceChain(int svc_id) : n(1) { ids[0] = svc_id; }  // implícito: um serviço
+    ServiceChain(const int* first, std::size_t count);    // count em [1, MAX]
+
+    std::size_t size() const { return n; }
+    int         operator[](std::size_t i) const { return ids[i]; }
+
+private:
+    int           ids[MAX];
+    std::uint8_t  n;
+};
+
+class ServiceRegistry {
+public:
+    struct Service {
+        const linda_service*         desc = nullptr;  // nulo: pipeline (stages)
+        std::shared_ptr<void>        lib;     // nulo: serviço interno
+        std::string                  origin;  // arquivo de origem ("" = interno)
+        std::shared_ptr<ServicePool::Queue> queue;  // nulo sem pool
+        std::vector<std::shared_ptr<const Service>> stages;  // pipeline, já fundido
+
+        // Aplica o serviço a `v`, no próprio buffer sempre que couber.
+        std::string apply(std::string v) const;
+
+        // Aplica a cada valor do lote (batch() da ABI, se houver).
+        void apply_batch(std::vector<std::string>& values) const;
+    };
+    using Handle = std::shared_ptr<const Service>;
+
+    ServiceRegistry();  // com os serviços internos
+    ~ServiceRegistry();
+
+    ServiceRegistry(const ServiceRegistry&)            = delete;
+    ServiceRegistry& operator=(const ServiceRegistry&) = delete;
+
+    // Serviço `svc_id`, ou nulo. Sem lock; pode correr junto com
+    // load()/unload().
+    Handle find(int svc_id) const;
+
+    std::vector<int> ids() const;
+
+    // Serviço de um EX: find() para um svc_id; para um pipeline, o serviço
+    // composto (nulo se algum svc_id não existe). No pool, um pipeline
+    // conta no limite e nas métricas do seu primeiro svc_id.
+    Handle resolve(const ServiceChain& chain) const;
+
+    // Abre a biblioteca em `path` e registra seus serviços, substituindo os
+    // svc_id já existentes. Retorna os svc_id registrados. Lança
+    // std::runtime_error se a biblioteca não abre, não exporta
+    // LINDA_SERVICE_ENTRY ou é de outra versão da ABI.
+    std::vector<int> load(const std::string& path);
+
+    // Diretório dos serviços: load_dir() carrega todas as bibliotecas dele
+    // (.so; .dll no Windows), e load_file() uma delas pelo nome — só um
+    // nome simples, sem caminho: LOAD não abre arquivos fora do diretório.
+    // Sem diretório, load_file() lança std::runtime_error.
+    void             set_dir(std::string dir) { services_dir = std::move(dir); }
+    std::size_t      load_dir();
+    std::vector<int> load_file(const std::string& name);
+
+    // Remove o serviço. Retorna false se não existe. EXs que já o
+    // obtiveram terminam normalmente.
+    bool unload(int svc_id);
+
+    // Pool de workers: cada serviço (atual ou futuro) ganha a Queue do seu
+    // svc_id. Chamado antes da primeira operação.
+    void attach(ServicePool* pool);
+
+private:
+    using Table = std::map<int, Handle>;
+
+    void add(const linda_service* descs, std::size_t n, std::shared_ptr<void> lib,
+             const std::string& origin);
+
+    // Publica `next` e libera a tabela anterior após o período de graça.
+    // Chamado com `writer_mtx` adquirido.
+    void publish(Table* next);
+
+    std::atomic<const Table*>        table;
+    mutable std::atomic<std::uint64_t> epoch{0};
+    mutable std::atomic<std::size_t>   readers[2];
+
+    std::mutex   writer_mtx;  // um escritor por vez
+    std::string  services_dir;
+    ServicePool* pool = nullptr;
+};
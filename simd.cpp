@@ -0,0 +1,219 @@
+#include "simd.hpp"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define LINDA_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define LINDA_SIMD_X86 0
+#endif
+
+using namespace std;
+
+namespace simd {
+
+// ---------------------------------------------------------------------------
+// Escalar: a referência das demais e o resto que não enche um vetor.
+// ---------------------------------------------------------------------------
+static char upper_char(char c) {
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+static void upper_scalar(char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        p[i] = upper_char(p[i]);
+}
+
+// Inversão, opcionalmente já em maiúsculas (pipeline 1,2 fundido).
+template <bool Upper>
+static void reverse_scalar(char* p, size_t n) {
+    if (!Upper) {
+        std::reverse(p, p + n);
+        return;
+    }
+    for (size_t i = 0, j = n; i < j--; ++i) {
+        char a = p[i];
+        p[i]   = upper_char(p[j]);
+        p[j]   = upper_char(a);
+    }
+}
+
+#if LINDA_SIMD_X86
+// ---------------------------------------------------------------------------
+// SSE2 (garantido em todo x86-64): 16 bytes por vez. A comparação é com
+// sinal, então bytes >= 0x80 nunca caem na faixa 'a'..'z'.
+// ---------------------------------------------------------------------------
+static __m128i upper16(__m128i v) {
+    const __m128i lo   = _mm_set1_epi8('a' - 1);
+    const __m128i hi   = _mm_set1_epi8('z' + 1);
+    const __m128i diff = _mm_set1_epi8('a' - 'A');
+    __m128i       in   = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    return _mm_sub_epi8(v, _mm_and_si128(in, diff));
+}
+
+static void upper_sse2(char* p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), upper16(v));
+    }
+    upper_scalar(p + i, n - i);
+}
+
+// Inverte os 16 bytes sem pshufb (SSSE3): troca os bytes de cada palavra
+// de 16 bits e depois inverte a ordem das 8 palavras.
+static __m128i reverse16(__m128i v) {
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+// Troca os blocos das duas pontas, cada um invertido, até sobrar menos de
+// dois blocos no meio.
+template <bool Upper>
+static void reverse_sse2(char* p, size_t n) {
+    char* a = p;
+    char* b = p + n;
+    while (b - a >= 32) {
+        b -= 16;
+        __m128i x = reverse16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)));
+        __m128i y = reverse16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+        if (Upper) {
+            x = upper16(x);
+            y = upper16(y);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a), y);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b), x);
+        a += 16;
+    }
+    reverse_scalar<Upper>(a, static_cast<size_t>(b - a));
+}
+
+// ---------------------------------------------------------------------------
+// AVX2: 32 bytes por vez. Compilado com target("avx2") só nestas funções;
+// chamado apenas se o processador anuncia AVX2.
+// ---------------------------------------------------------------------------
+__attribute__((target("avx2"))) static __m256i upper32(__m256i v) {
+    const __m256i lo   = _mm256_set1_epi8('a' - 1);
+    const __m256i hi   = _mm256_set1_epi8('z' + 1);
+    const __m256i diff = _mm256_set1_epi8('a' - 'A');
+    __m256i       in   = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+    return _mm256_sub_epi8(v, _mm256_and_si256(in, diff));
+}
+
+__attribute__((target("avx2"))) static void upper_avx2(char* p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), upper32(v));
+    }
+    upper_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static __m256i reverse32(__m256i v) {
+    const __m256i mask = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    v = _mm256_shuffle_epi8(v, mask);                // inverte cada metade
+    return _mm256_permute2x128_si256(v, v, 0x01);    // e troca as metades
+}
+
+template <bool Upper>
+__attribute__((target("avx2"))) static void reverse_avx2(char* p, size_t n) {
+    char* a = p;
+    char* b = p + n;
+    while (b - a >= 64) {
+        b -= 32;
+        __m256i x = reverse32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)));
+        __m256i y = reverse32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+        if (Upper) {
+            x = upper32(x);
+            y = upper32(y);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a), y);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(b), x);
+        a += 32;
+    }
+    reverse_sse2<Upper>(a, static_cast<size_t>(b - a));
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Despacho
+// ---------------------------------------------------------------------------
+static bool supported(Isa isa) {
+#if LINDA_SIMD_X86
+    if (isa == Isa::AVX2)
+        return __builtin_cpu_supports("avx2");
+    return true;
+#else
+    return isa == Isa::SCALAR;
+#endif
+}
+
+Isa best() {
+    static const Isa isa = supported(Isa::AVX2)   ? Isa::AVX2
+                           : supported(Isa::SSE2) ? Isa::SSE2
+                                                  : Isa::SCALAR;
+    return isa;
+}
+
+const char* name(Isa isa) {
+    switch (isa) {
+    case Isa::SCALAR: return "escalar";
+    case Isa::SSE2:   return "sse2";
+    case Isa::AVX2:   return "avx2";
+    }
+    return "?";
+}
+
+Kernel upper_kernel(Isa isa) {
+    if (!supported(isa))
+        return nullptr;
+    switch (isa) {
+#if LINDA_SIMD_X86
+    case Isa::AVX2: return upper_avx2;
+    case Isa::SSE2: return upper_sse2;
+#endif
+    default:        return upper_scalar;
+    }
+}
+
+template <bool Upper>
+static Kernel reverse_for(Isa isa) {
+    if (!supported(isa))
+        return nullptr;
+    switch (isa) {
+#if LINDA_SIMD_X86
+    case Isa::AVX2: return reverse_avx2<Upper>;
+    case Isa::SSE2: return reverse_sse2<Upper>;
+#endif
+    default:        return reverse_scalar<Upper>;
+    }
+}
+
+Kernel reverse_kernel(Isa isa) {
+    return reverse_for<false>(isa);
+}
+
+Kernel upper_reverse_kernel(Isa isa) {
+    return reverse_for<true>(isa);
+}
+
+void upper(char* data, size_t len) {
+    static const Kernel k = upper_kernel(best());
+    k(data, len);
+}
+
+void reverse(char* data, size_t len) {
+    static const Kernel k = reverse_kernel(best());
+    k(data, len);
+}
+
+void upper_reverse(char* data, size_t len) {
+    static const Kernel k = upper_reverse_kernel(best());
+    k(data, len);
+}
+
+}  // namespace simd
@@ -0,0 +1,41 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Kernels vetorizados dos serviços internos (maiúsculas e inversão), no
+// próprio buffer.
+//
+// Cada kernel tem uma versão escalar e, em x86, versões SSE2 e AVX2. A
+// melhor que o processador suporta é escolhida em tempo de execução, uma
+// vez, na primeira chamada: o binário roda em qualquer x86-64 e usa AVX2
+// onde houver. Fora do x86 só existe a escalar.
+//
+// upper_reverse(): as duas numa passada só (pipelines do EX com 1 e 2).
+//
+// Maiúsculas: só ASCII ('a'–'z'), como o toupper() da locale "C" que o
+// servidor usa; os demais bytes (UTF-8 inclusive) passam intactos.
+// ---------------------------------------------------------------------------
+
+#include <cstddef>
+
+namespace simd {
+
+enum class Isa { SCALAR, SSE2, AVX2 };
+
+using Kernel = void (*)(char* data, std::size_t len);
+
+// Conjunto usado pelos kernels despachados.
+Isa         best();
+const char* name(Isa isa);
+
+// Versão de um conjunto específico (testes e benchmarks); nulo se o
+// processador ou o compilador não a oferece.
+Kernel upper_kernel(Isa isa);
+Kernel reverse_kernel(Isa isa);
+Kernel upper_reverse_kernel(Isa isa);
+
+// Despachados para best().
+void upper(char* data, std::size_t len);
+void reverse(char* data, std::size_t len);
+void upper_reverse(char* data, std::size_t len);
+
+}  // namespace simd
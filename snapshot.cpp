@@ -0,0 +1,230 @@
+#include "snapshot.hpp"
+#include "wal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace snapshot {
+
+static constexpr char   MAGIC[8] = {'L', 'I', 'N', 'D', 'A', 'S', 'N', 'P'};
+static constexpr size_t HEADER   = 8 + 4 + 4 + 8 + 8;
+
+static void put_u32(string& out, uint32_t v) {
+    for (int i = 3; i >= 0; --i)
+        out += static_cast<char>(v >> (8 * i));
+}
+
+static void put_u64(string& out, uint64_t v) {
+    for (int i = 7; i >= 0; --i)
+        out += static_cast<char>(v >> (8 * i));
+}
+
+static uint32_t get_u32(const char* p) {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+static uint64_t get_u64(const char* p) {
+    return uint64_t(get_u32(p)) << 32 | get_u32(p + 4);
+}
+
+string_view next_tuple(string_view& recs) {
+    if (recs.size() < 4) {  // quantidade maior que os registros: arquivo corrompido
+        recs = {};
+        return {};
+    }
+    uint32_t    len = static_cast<uint32_t>(min<size_t>(get_u32(recs.data()), recs.size() - 4));
+    string_view v   = recs.substr(4, len);
+    recs.remove_prefix(4 + size_t(len));
+    return v;
+}
+
+// ---------------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------------
+Writer::Writer(string path_, uint32_t n_shards)
+    : path(move(path_)), tmp(path + ".tmp") {
+    file = fopen(tmp.c_str(), "wb");
+    if (file == nullptr)
+        throw runtime_error("snapshot: não foi possível criar " + tmp);
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    // Cabeçalho e cortes definitivos só em finish().
+    string blank(HEADER + 8 * size_t(n_shards), '\0');
+    write(blank.data(), blank.size());
+}
+
+Writer::~Writer() {
+    if (file != nullptr) {
+        fclose(file);
+        remove(tmp.c_str());
+    }
+}
+
+void Writer::write(const void* p, size_t n) {
+    if (n == 0) return;  // valor vazio: data() pode ser nulo
+    if (fwrite(p, 1, n, file) != n)
+        throw runtime_error("snapshot: falha ao gravar " + tmp);
+    offset += n;
+}
+
+void Writer::begin_key(string_view key) {
+    put_u32(index, static_cast<uint32_t>(key.size()));
+    index.append(key.data(), key.size());
+    key_offset = offset;
+    key_count  = 0;
+}
+
+void Writer::add_tuple(string_view value) {
+    string len;
+    put_u32(len, static_cast<uint32_t>(value.size()));
+    write(len.data(), len.size());
+    write(value.data(), value.size());
+    ++key_count;
+}
+
+void Writer::add_records(string_view recs, size_t count) {
+    write(recs.data(), recs.size());
+    key_count += static_cast<uint32_t>(count);
+}
+
+void Writer::end_key() {
+    put_u64(index, key_offset);
+    put_u64(index, offset - key_offset);
+    put_u32(index, key_count);
+    ++n_keys;
+}
+
+void Writer::finish(const vector<uint64_t>& cuts) {
+    string head(MAGIC, sizeof(MAGIC));
+    put_u32(head, VERSION);
+    put_u32(head, static_cast<uint32_t>(cuts.size()));
+    put_u64(head, n_keys);
+    put_u64(head, offset);  // o índice começa aqui
+    for (uint64_t c : cuts)
+        put_u64(head, c);
+
+    uint32_t crc = Wal::crc32(head.data(), head.size());
+    crc          = Wal::crc32(index.data(), index.size(), crc);
+    string tail;
+    put_u32(tail, crc);
+    write(index.data(), index.size());
+    write(tail.data(), tail.size());
+
+    bool ok = fseek(file, 0, SEEK_SET) == 0 &&
+              fwrite(head.data(), 1, head.size(), file) == head.size() &&
+              Wal::sync_file(file);
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    if (!ok) {
+        remove(tmp.c_str());
+        throw runtime_error("snapshot: falha ao gravar " + tmp);
+    }
+    // rename() substitui o snapshot anterior atomicamente.
+    filesystem::rename(tmp, path);
+}
+
+// ---------------------------------------------------------------------------
+// Image
+// ---------------------------------------------------------------------------
+Image::Image(const string& path) {
+#ifdef _WIN32
+    ifstream f(path, ios::binary);
+    if (!f)
+        throw runtime_error("snapshot: não foi possível abrir " + path);
+    copy.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+    data = copy.data();
+    size = copy.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("snapshot: não foi possível abrir " + path);
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        size    = static_cast<size_t>(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data    = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+    }
+    ::close(fd);
+    if (data == nullptr)
+        throw runtime_error("snapshot: não foi possível mapear " + path);
+#endif
+    try {
+        validate(path);
+    } catch (...) {
+        unmap();  // o destrutor não roda se o construtor lança
+        throw;
+    }
+}
+
+void Image::validate(const string& path) {
+    if (size < HEADER + 4 || memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+        throw runtime_error("snapshot: " + path + " não é um snapshot");
+    uint32_t version = get_u32(data + 8);
+    if (version != VERSION)
+        throw runtime_error("snapshot: versão " + to_string(version) + " não suportada");
+    n_shards     = get_u32(data + 12);
+    n_keys       = get_u64(data + 16);
+    index_offset = get_u64(data + 24);
+
+    size_t head = HEADER + 8 * size_t(n_shards);
+    if (n_shards == 0 || head > index_offset || index_offset > size - 4)
+        throw runtime_error("snapshot: cabeçalho inválido em " + path);
+    uint32_t crc = Wal::crc32(data, head);
+    crc          = Wal::crc32(data + index_offset, size - 4 - index_offset, crc);
+    if (crc != get_u32(data + size - 4))
+        throw runtime_error("snapshot: CRC inválido em " + path);
+}
+
+Image::~Image() {
+    unmap();
+}
+
+void Image::unmap() {
+#ifndef _WIN32
+    if (data != nullptr)
+        ::munmap(const_cast<char*>(data), size);
+#endif
+    data = nullptr;
+}
+
+uint64_t Image::cut(size_t shard) const {
+    return get_u64(data + HEADER + 8 * shard);
+}
+
+void Image::for_each_key(
+    const function<void(string_view, string_view, size_t)>& fn) const {
+    const size_t first = HEADER + 8 * size_t(n_shards);
+    const char*  p     = data + index_offset;
+    const char*  end   = data + size - 4;
+    for (uint64_t k = 0; k < n_keys; ++k) {
+        if (end - p < 4 || size_t(end - p) - 4 < size_t(get_u32(p)) + 20)
+            throw runtime_error("snapshot: índice truncado");
+        uint32_t    key_len = get_u32(p);
+        string_view key(p + 4, key_len);
+        p += 4 + key_len;
+        uint64_t off   = get_u64(p);
+        uint64_t bytes = get_u64(p + 8);
+        uint32_t count = get_u32(p + 16);
+        p += 20;
+        if (off < first || off > index_offset || bytes > index_offset - off)
+            throw runtime_error("snapshot: índice aponta para fora das tuplas");
+        fn(key, string_view(data + off, bytes), count);
+    }
+}
+
+}  // namespace snapshot
@@ -0,0 +1,107 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Snapshot do espaço de tuplas: imagem binária compacta e versionada de
+// todas as filas, gravada em segundo plano (TupleServer::write_snapshot())
+// e mapeada em memória na partida.
+//
+// Formato (inteiros em big-endian):
+//
+//   cabeçalho   char[8] "LINDASNP", u32 versão, u32 n_shards,
+//               u64 n_keys, u64 index_offset
+//   cortes      u64 por shard: LSN do WAL até onde o shard está incluído
+//   tuplas      por chave, as tuplas em ordem FIFO como registros
+//               (u32 tamanho + bytes, os mesmos do protocolo binário)
+//   índice      por chave: u32 key_len, chave, u64 offset das tuplas,
+//               u64 bytes das tuplas, u32 quantidade
+//   crc         u32 crc32 do cabeçalho, dos cortes e do índice
+//
+// A partida lê só o cabeçalho e o índice: o custo depende do número de
+// chaves, não do volume de dados. As tuplas ficam no arquivo mapeado até
+// serem lidas (ver TupleServer::KeyEntry).
+// ---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace snapshot {
+
+constexpr std::uint32_t VERSION = 1;
+
+// Próxima tupla de uma sequência de registros; avança `recs`.
+std::string_view next_tuple(std::string_view& recs);
+
+// ---------------------------------------------------------------------------
+// Writer: grava em "<path>.tmp" e, em finish(), sincroniza e renomeia para
+// `path` — um snapshot pela metade nunca substitui o anterior.
+// Lança std::runtime_error em falha de E/S.
+// ---------------------------------------------------------------------------
+class Writer {
+public:
+    Writer(std::string path, std::uint32_t n_shards);
+    ~Writer();  // sem finish(): descarta o arquivo temporário
+
+    Writer(const Writer&)            = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // Uma chave: begin_key(), tuplas em ordem FIFO, end_key().
+    void begin_key(std::string_view key);
+    void add_tuple(std::string_view value);
+    void add_records(std::string_view recs, std::size_t count);  // já codificadas
+    void end_key();
+
+    void finish(const std::vector<std::uint64_t>& cuts);
+
+private:
+    void write(const void* p, std::size_t n);
+
+    std::string   path, tmp;
+    std::FILE*    file;
+    std::uint64_t offset = 0;  // posição atual no arquivo
+    std::uint64_t n_keys = 0;
+    std::string   index;
+
+    // Chave em andamento.
+    std::uint64_t key_offset = 0;
+    std::uint32_t key_count  = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Image: snapshot aberto (mmap; no Windows, lido para a memória). Valida
+// formato, versão e CRC do índice; lança std::runtime_error se inválido.
+// As string_view entregues valem enquanto a Image existir.
+// ---------------------------------------------------------------------------
+class Image {
+public:
+    explicit Image(const std::string& path);
+    ~Image();
+
+    Image(const Image&)            = delete;
+    Image& operator=(const Image&) = delete;
+
+    std::uint32_t shard_count() const { return n_shards; }
+    std::uint64_t cut(std::size_t shard) const;
+    std::uint64_t key_count() const { return n_keys; }
+
+    // Chama `fn(chave, registros, quantidade)` para cada chave.
+    void for_each_key(const std::function<void(std::string_view, std::string_view,
+                                               std::size_t)>& fn) const;
+
+private:
+    void validate(const std::string& path);
+    void unmap();
+
+    const char*   data = nullptr;
+    std::size_t   size = 0;
+    std::string   copy;  // plataformas sem mmap
+    std::uint32_t n_shards = 0;
+    std::uint64_t n_keys   = 0;
+    std::uint64_t index_offset = 0;
+};
+
+}  // namespace snapshot
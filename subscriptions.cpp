@@ -0,0 +1,221 @@
+#include "subscriptions.hpp"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+bool Subscriptions::parse_overflow(string_view name, Overflow& out) {
+    if (name == "drop")       { out = Overflow::DROP;       return true; }
+    if (name == "disconnect") { out = Overflow::DISCONNECT; return true; }
+    return false;
+}
+
+Subscriptions::~Subscriptions() {
+    {
+        lock_guard<mutex> lk(queue_mtx);
+        stop = true;
+    }
+    queue_cv.notify_one();
+    if (dispatcher.joinable())
+        dispatcher.join();
+}
+
+shared_ptr<Subscriptions::Feed> Subscriptions::open(function<void()> wake) {
+    {
+        lock_guard<mutex> lk(queue_mtx);
+        if (!dispatcher.joinable())
+            dispatcher = thread([this]() { dispatch(); });
+    }
+    return shared_ptr<Feed>(new Feed(*this, move(wake)));
+}
+
+// ---------------------------------------------------------------------------
+// Tabela de padrões. Um prefixo é procurado pelos comprimentos assinados:
+// com "log.*" e "l*", uma chave custa duas buscas, com qualquer número de
+// assinantes.
+// ---------------------------------------------------------------------------
+template <class F>
+void Subscriptions::match(string_view key, F&& fn) const {
+    if (Entry* e = exact.find(key))
+        fn(*e);
+    for (auto& [len, n] : lengths) {
+        if (len > key.size())
+            break;
+        if (Entry* e = prefixes.find(key.substr(0, len)))
+            fn(*e);
+    }
+}
+
+void Subscriptions::subscribe(Feed& feed, string_view pattern) {
+    unique_lock<shared_mutex> lk(table_mtx);
+    if (find(feed.patterns.begin(), feed.patterns.end(), pattern) != feed.patterns.end())
+        return;
+    bool   prefix = !pattern.empty() && pattern.back() == '*';
+    Entry& e      = prefix ? prefixes.emplace(pattern.substr(0, pattern.size() - 1))
+                           : exact.emplace(pattern);
+    if (prefix && e.feeds.empty())
+        ++lengths[pattern.size() - 1];
+    e.feeds.push_back(&feed);
+    feed.patterns.emplace_back(pattern);
+    ++count;
+}
+
+bool Subscriptions::unsubscribe(Feed& feed, string_view pattern) {
+    unique_lock<shared_mutex> lk(table_mtx);
+    auto it = find(feed.patterns.begin(), feed.patterns.end(), pattern);
+    if (it == feed.patterns.end())
+        return false;
+    feed.patterns.erase(it);
+    --count;
+
+    bool        prefix = !pattern.empty() && pattern.back() == '*';
+    string_view p      = prefix ? pattern.substr(0, pattern.size() - 1) : pattern;
+    auto&       index  = prefix ? prefixes : exact;
+    Entry&      e      = *index.find(p);
+    e.feeds.erase(find(e.feeds.begin(), e.feeds.end(), &feed));
+    if (e.feeds.empty()) {
+        index.erase(e);
+        if (prefix && --lengths[p.size()] == 0)
+            lengths.erase(p.size());
+    }
+    return true;
+}
+
+void Subscriptions::drop(Feed& feed) {
+    while (!feed.patterns.empty()) {
+        string p = feed.patterns.back();
+        unsubscribe(feed, p);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// publish(): só a tupla de uma chave assinada é copiada; a entrega a cada
+// Feed fica para o thread de despacho.
+// ---------------------------------------------------------------------------
+void Subscriptions::publish(string_view key, string_view value) {
+    {
+        shared_lock<shared_mutex> lk(table_mtx);
+        bool                      any = false;
+        match(key, [&any](Entry&) { any = true; });
+        if (!any)
+            return;
+    }
+    auto ev = make_shared<const Event>(Event{string(key), string(value)});
+    {
+        lock_guard<mutex> lk(queue_mtx);
+        queue.push_back(move(ev));
+    }
+    ++published_n;
+    queue_cv.notify_one();
+}
+
+// ---------------------------------------------------------------------------
+// dispatch(): esvazia a fila em lotes. Os Feeds são tocados com o lock da
+// tabela compartilhado, então um Feed não é destruído no meio da entrega
+// (drop() precisa dele exclusivo).
+// ---------------------------------------------------------------------------
+void Subscriptions::dispatch() {
+    vector<EventPtr>   batch;
+    vector<Feed*>      targets;
+    unique_lock<mutex> lk(queue_mtx);
+    while (true) {
+        queue_cv.wait(lk, [this] { return stop || !queue.empty(); });
+        if (queue.empty())
+            return;
+        batch.swap(queue);
+        lk.unlock();
+        {
+            shared_lock<shared_mutex> table(table_mtx);
+            for (auto& ev : batch) {
+                targets.clear();
+                match(ev->key, [&targets](Entry& e) {
+                    targets.insert(targets.end(), e.feeds.begin(), e.feeds.end());
+                });
+                sort(targets.begin(), targets.end());
+                targets.erase(unique(targets.begin(), targets.end()), targets.end());
+                for (Feed* f : targets)
+                    f->push(ev);
+            }
+        }
+        batch.clear();
+        lk.lock();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Feed
+// ---------------------------------------------------------------------------
+Subscriptions::Feed::~Feed() {
+    owner.drop(*this);
+}
+
+// Uma tupla sempre cabe num buffer vazio, por maior que seja.
+void Subscriptions::Feed::push(const EventPtr& ev) {
+    const Options& opt  = owner.opt;
+    size_t         size = ev->key.size() + ev->value.size();
+    bool           first;
+    {
+        lock_guard<mutex> lk(mtx);
+        if (is_cut || closed)
+            return;
+        bool full = !events.empty() &&
+                    (events.size() >= opt.max_events || bytes + size > opt.max_bytes);
+        first = events.empty() && lost == 0;
+        if (full && opt.overflow == Overflow::DROP) {
+            ++lost;
+            ++owner.dropped_n;
+            return;
+        }
+        if (full) {
+            is_cut = true;
+            events.clear();
+            bytes = 0;
+            first = true;
+        } else {
+            events.push_back(ev);
+            bytes += size;
+        }
+    }
+    if (first) {
+        ready.notify_one();
+        if (wake)
+            wake();
+    }
+}
+
+bool Subscriptions::Feed::take(vector<EventPtr>& out, uint64_t& n_lost) {
+    lock_guard<mutex> lk(mtx);
+    if (events.empty() && lost == 0)
+        return false;
+    out.insert(out.end(), make_move_iterator(events.begin()), make_move_iterator(events.end()));
+    events.clear();
+    bytes  = 0;
+    n_lost = exchange(lost, 0);
+    return true;
+}
+
+bool Subscriptions::Feed::wait(vector<EventPtr>& out, uint64_t& n_lost) {
+    {
+        unique_lock<mutex> lk(mtx);
+        ready.wait(lk, [this] { return is_cut || closed || !events.empty() || lost > 0; });
+        if (is_cut || closed)
+            return false;
+    }
+    return take(out, n_lost);
+}
+
+bool Subscriptions::Feed::cut() {
+    lock_guard<mutex> lk(mtx);
+    return is_cut;
+}
+
+void Subscriptions::Feed::close() {
+    {
+        lock_guard<mutex> lk(mtx);
+        closed = true;
+        events.clear();
+        bytes = 0;
+    }
+    ready.notify_all();
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Assinaturas (SUB/UNSUB): o servidor empurra para a conexão cada tupla
+// nova de uma chave, ou de todas as chaves com um prefixo ("SUB log.*").
+//
+// O WR não paga pelo número de assinantes. Com o lock do shard ele só
+// confere se a chave tem alguma assinatura (uma busca pela chave exata e
+// uma por comprimento de prefixo assinado) e, se tem, põe a tupla na fila
+// do thread de despacho. Como isso acontece sob o lock do shard, a ordem
+// da fila é a ordem em que as tuplas entraram em cada chave. O despacho,
+// fora de qualquer lock do espaço, entrega a tupla ao Feed de cada
+// conexão assinante (a mesma cópia para todos).
+//
+// Feed: buffer limitado (eventos e bytes) de uma conexão, esvaziado à
+// medida que o socket aceita. Um leitor lento enche o buffer e, conforme
+// Options::overflow, perde as tuplas seguintes (DROP: depois recebe
+// quantas perdeu) ou é desconectado (DISCONNECT).
+//
+// Sem nenhuma assinatura, o custo no WR é a leitura de um atômico.
+// ---------------------------------------------------------------------------
+
+#include "key_index.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class Subscriptions {
+public:
+    // Buffer de um Feed cheio.
+    enum class Overflow {
+        DROP,        // descarta a tupla nova e conta a perda
+        DISCONNECT,  // corta o Feed; a conexão é encerrada
+    };
+
+    struct Options {
+        std::size_t max_events = 4096;     // por Feed
+        std::size_t max_bytes  = 4 << 20;  // por Feed (chaves + valores)
+        Overflow    overflow   = Overflow::DROP;
+    };
+
+    // Tupla publicada, compartilhada pelos Feeds que a recebem.
+    struct Event {
+        std::string key;
+        std::string value;
+    };
+    using EventPtr = std::shared_ptr<const Event>;
+
+    class Feed;
+
+    // "drop" / "disconnect". Retorna false se o nome é desconhecido.
+    static bool parse_overflow(std::string_view name, Overflow& out);
+
+    Subscriptions() = default;
+    ~Subscriptions();  // encerra o thread de despacho
+
+    Subscriptions(const Subscriptions&)            = delete;
+    Subscriptions& operator=(const Subscriptions&) = delete;
+
+    // Deve ser chamado antes do primeiro open().
+    void           set_options(const Options& o) { opt = o; }
+    const Options& options() const { return opt; }
+
+    // Feed de uma conexão. `wake` (opcional) é chamada pelo thread de
+    // despacho, sem lock do espaço, quando o Feed passa a ter o que
+    // entregar ou é cortado; sem ela, quem consome espera em Feed::wait().
+    // Destruir o Feed cancela as suas assinaturas.
+    std::shared_ptr<Feed> open(std::function<void()> wake = nullptr);
+
+    // Padrão: a chave exata ou, terminado em '*', um prefixo ("*" sozinho:
+    // todas as chaves). Assinar de novo o mesmo padrão não muda nada, e
+    // uma tupla que casa com vários padrões do Feed chega uma vez só.
+    void subscribe(Feed& feed, std::string_view pattern);
+    bool unsubscribe(Feed& feed, std::string_view pattern);  // false: não assinado
+
+    // Chamados pelo TupleServer, com o lock do shard da chave, para cada
+    // tupla que entra no espaço (na fila ou entregue a um waiter).
+    bool active() const { return count.load() > 0; }
+    void publish(std::string_view key, std::string_view value);
+
+    std::uint64_t published() const { return published_n.load(); }  // postas na fila de despacho
+    std::uint64_t dropped() const { return dropped_n.load(); }       // perdidas por Feeds cheios
+
+private:
+    // Feeds que assinam um padrão.
+    struct Entry {
+        std::vector<Feed*> feeds;
+    };
+
+    struct PatternHash {
+        std::uint64_t operator()(std::string_view p) const {
+            return std::hash<std::string_view>{}(p);
+        }
+    };
+
+    // Chamam `fn(Entry&)` para cada padrão que casa com `key`. Com o lock
+    // da tabela (compartilhado ou exclusivo).
+    template <class F>
+    void match(std::string_view key, F&& fn) const;
+
+    void dispatch();  // thread de despacho
+    void drop(Feed& feed);
+
+    Options opt;
+
+    // Tabela de padrões: alterada só por SUB/UNSUB e pelo fim de conexões.
+    mutable std::shared_mutex          table_mtx;
+    KeyIndex<Entry, PatternHash>       exact;
+    KeyIndex<Entry, PatternHash>       prefixes;  // sem o '*'
+    std::map<std::size_t, std::size_t> lengths;   // comprimento -> prefixos assinados
+    std::atomic<std::size_t>           count{0};  // assinaturas (Feed, padrão)
+
+    std::mutex              queue_mtx;
+    std::condition_variable queue_cv;
+    std::vector<EventPtr>   queue;
+    bool                    stop = false;
+    std::thread             dispatcher;  // criado no primeiro open()
+
+    std::atomic<std::uint64_t> published_n{0};
+    std::atomic<std::uint64_t> dropped_n{0};
+};
+
+class Subscriptions::Feed {
+public:
+    ~Feed();  // cancela as assinaturas
+
+    Feed(const Feed&)            = delete;
+    Feed& operator=(const Feed&) = delete;
+
+    // Retira tudo o que está pendente: as tuplas, em ordem, e em `lost`
+    // quantas foram descartadas antes delas. Retorna false se não havia
+    // nada.
+    bool take(std::vector<EventPtr>& out, std::uint64_t& lost);
+
+    // Como take(), mas espera haver algo. Retorna false quando o Feed é
+    // fechado ou cortado.
+    bool wait(std::vector<EventPtr>& out, std::uint64_t& lost);
+
+    // DISCONNECT: o buffer encheu e a conexão deve ser encerrada.
+    bool cut();
+
+    // Fim da conexão: libera quem espera em wait() e descarta o resto.
+    void close();
+
+private:
+    friend class Subscriptions;
+    Feed(Subscriptions& owner, std::function<void()> wake)
+        : owner(owner), wake(std::move(wake)) {}
+
+    // Thread de despacho, com o lock da tabela compartilhado.
+    void push(const EventPtr& ev);
+
+    Subscriptions&           owner;
+    std::function<void()>    wake;
+    std::vector<std::string> patterns;  // assinados; sob o lock da tabela
+
+    std::mutex              mtx;
+    std::condition_variable ready;
+    std::deque<EventPtr>    events;
+    std::size_t             bytes   = 0;
+    std::uint64_t           lost    = 0;
+    bool                    is_cut  = false;
+    bool                    closed  = false;
+};
@@ -0,0 +1,55 @@
+/*
+ * Serviços de exemplo carregáveis pelo servidor (LOAD / services_dir).
+ *
+ *   gcc -std=c99 -O2 -shared -fPIC svc_example.c -o linda_svc_example.so
+ *
+ * 10 "rot13":  troca cada letra pela 13ª seguinte; no próprio buffer,
+ *              também em lote.
+ * 11 "double": o valor repetido duas vezes; pede mais capacidade quando
+ *              o resultado não cabe.
+ */
+
+#include "linda_service.h"
+
+#include <string.h>
+
+static void rot13_one(linda_value* v) {
+    for (size_t i = 0; i < v->len; ++i) {
+        char c = v->data[i];
+        if (c >= 'a' && c <= 'z')
+            v->data[i] = (char)('a' + (c - 'a' + 13) % 26);
+        else if (c >= 'A' && c <= 'Z')
+            v->data[i] = (char)('A' + (c - 'A' + 13) % 26);
+    }
+}
+
+static size_t rot13(linda_value* v) {
+    rot13_one(v);
+    return 0;
+}
+
+static void rot13_batch(linda_value* values, size_t* need, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        rot13_one(&values[i]);
+        need[i] = 0;
+    }
+}
+
+static size_t twice(linda_value* v) {
+    if (2 * v->len > v->cap)
+        return 2 * v->len;
+    memcpy(v->data + v->len, v->data, v->len);
+    v->len *= 2;
+    return 0;
+}
+
+static const linda_service SERVICES[] = {
+    {10, "rot13", rot13, rot13_batch},
+    {11, "double", twice, NULL},
+};
+
+LINDA_EXPORT const linda_service* linda_services(uint32_t* abi, size_t* count) {
+    *abi   = LINDA_SERVICE_ABI;
+    *count = sizeof(SERVICES) / sizeof(SERVICES[0]);
+    return SERVICES;
+}
@@ -1,42 +1,28 @@
 #include "tcp_server.hpp"
 
-#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <iostream>
-#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
 // ---------------------------------------------------------------------------
-// Auxiliar: retorna a mensagem de erro do último erro Winsock.
-// WSAGetLastError() é o equivalente Windows de errno para sockets.
+// Socket de escuta TCP em todas as interfaces.
 // ---------------------------------------------------------------------------
-static string wsa_error(const char* prefix) {
-    return string(prefix) + " (WSA erro: " + to_string(WSAGetLastError()) + ")";
-}
-
-// ---------------------------------------------------------------------------
-// Construtor: inicializa Winsock e cria o socket de escuta.
-// ---------------------------------------------------------------------------
-TcpServer::TcpServer(TupleServer& ts, unsigned short port)
-    : ts_(ts), port_(port), server_sock_(INVALID_SOCKET) {
-
-    // WSAStartup: obrigatório no Windows antes de qualquer chamada Winsock.
-    // Versão 2.2 é a mais recente e amplamente suportada.
-    WSADATA wsa_data;
-    int ret = WSAStartup(MAKEWORD(2, 2), &wsa_data);
-    if (ret != 0)
-        throw runtime_error("WSAStartup() falhou: " + to_string(ret));
-
-    server_sock_ = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (server_sock_ == INVALID_SOCKET)
-        throw runtime_error(wsa_error("socket()"));
+static socket_t open_listener(unsigned short port) {
+    socket_t sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCK)
+        throw runtime_error(net::error_message("socket()"));
 
     // SO_REUSEADDR evita "Address already in use" ao reiniciar o servidor.
     int opt = 1;
-    ::setsockopt(server_sock_, SOL_SOCKET, SO_REUSEADDR,
+    ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
                  reinterpret_cast<const char*>(&opt), sizeof(opt));
     //           ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
     // No Windows, setsockopt espera const char* em vez de const void*.
@@ -44,146 +30,386 @@ TcpServer::TcpServer(TupleServer& ts, unsigned short port)
     sockaddr_in addr{};
     addr.sin_family      = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port        = htons(port_);
+    addr.sin_port        = htons(port);
+
+    if (::bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(sock, SOMAXCONN) != 0) {
+        string msg = net::error_message("bind()/listen()");
+        net::close_socket(sock);
+        throw runtime_error(msg);
+    }
+    return sock;
+}
 
-    if (::bind(server_sock_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
-        throw runtime_error(wsa_error("bind()"));
+// ---------------------------------------------------------------------------
+// Construtor: inicializa a camada de sockets e cria o socket de escuta.
+// ---------------------------------------------------------------------------
+TcpServer::TcpServer(TupleServer& ts, unsigned short port, unsigned io_threads)
+    : ts_(ts), port_(port), io_threads_(io_threads), server_sock_(INVALID_SOCK) {
 
-    if (::listen(server_sock_, SOMAXCONN) == SOCKET_ERROR)
-        throw runtime_error(wsa_error("listen()"));
+    if (io_threads_ == 0)
+        io_threads_ = max(1u, thread::hardware_concurrency());
+
+    // No Windows: WSAStartup é obrigatório antes de qualquer chamada Winsock.
+    int ret = net::startup();
+    if (ret != 0)
+        throw runtime_error("inicialização de sockets falhou: " + to_string(ret));
+
+    server_sock_ = open_listener(port_);
 }
 
 // ---------------------------------------------------------------------------
-// Destrutor: fecha o socket e encerra o Winsock.
+// Destrutor: fecha o socket e encerra a camada de sockets.
 // ---------------------------------------------------------------------------
 TcpServer::~TcpServer() {
-    if (server_sock_ != INVALID_SOCKET) {
-        ::closesocket(server_sock_);  // Windows: closesocket() em vez de close()
-        server_sock_ = INVALID_SOCKET;
+    if (server_sock_ != INVALID_SOCK) {
+        net::close_socket(server_sock_);
+        server_sock_ = INVALID_SOCK;
     }
-    WSACleanup();  // Encerra o subsistema Winsock; par obrigatório do WSAStartup.
+    net::cleanup();  // Par obrigatório do net::startup().
+}
+
+// Serviço ou pipeline de um EX/EXALL.
+static ServiceChain chain_of(const protocol::Command& cmd) {
+    static_assert(protocol::MAX_STAGES <= ServiceChain::MAX, "pipeline maior que ServiceChain");
+    return ServiceChain(cmd.chain, cmd.stages);
 }
 
 // ---------------------------------------------------------------------------
-// run(): loop principal de accept.
+// try_execute(): despacho comum de WR/RD/IN/EX/RDM/INM para a API assíncrona.
 // ---------------------------------------------------------------------------
-void TcpServer::run() {
-    cout << "Servidor Linda ouvindo na porta " << port_ << endl;
-
-    while (true) {
-        sockaddr_in client_addr{};
-        int client_len = sizeof(client_addr);  // Windows usa int, não socklen_t
-
-        SOCKET client_sock = ::accept(
-            server_sock_,
-            reinterpret_cast<sockaddr*>(&client_addr),
-            &client_len
-        );
+bool TcpServer::try_execute(const protocol::Command& cmd, string& out,
+                            TupleServer::Continuation done,
+                            TupleServer::Ticket* ticket) {
+    using protocol::Command;
+    switch (cmd.op) {
+    case Command::RD:  return ts_.rd_async(cmd.key, out, move(done), ticket);
+    case Command::IN:  return ts_.in_async(cmd.key, out, move(done), ticket);
+    case Command::RDP: return ts_.rd_async(cmd.key, out, nullptr);
+    case Command::INP: return ts_.in_async(cmd.key, out, nullptr);
+    case Command::EX:
+        // Com o pool no modo PUBLISH, um EX que pode esperar já vai direto
+        // para a continuação: sem ela, o serviço rodaria aqui.
+        if (!done && cmd.may_block() && ts_.ex_deferred())
+            return false;
+        return ts_.ex_async(cmd.key, cmd.value, chain_of(cmd), out, move(done), ticket);
+    // INN sem tupla disponível espera como um IN (ver take_batch()).
+    case Command::INN: return ts_.in_async(cmd.key, out, move(done), ticket);
+    // RDM/INM: chave e valor em dois registros (ver match_async()).
+    case Command::RDM: return ts_.match_async(cmd.key, false, out, move(done), ticket);
+    case Command::INM: return ts_.match_async(cmd.key, true, out, move(done), ticket);
+    case Command::WR: {
+        string value(cmd.value);
+        return ts_.write_async(cmd.key, move(value), out, move(done), ticket, cmd.ttl_ms);
+    }
+    case Command::MWR:
+    case Command::MRD:
+    case Command::EXALL:
+    case Command::LOAD:
+    case Command::UNLOAD:
+    case Command::SUB:
+    case Command::UNSUB:
+    case Command::HALFCLOSE:
+    case Command::STATS: break;
+    }
+    return false;
+}
 
-        if (client_sock == INVALID_SOCKET) {
-            cerr << "[ERRO] accept(): WSA erro " << WSAGetLastError() << endl;
-            continue;
-        }
+// O valor vai até o fim da linha, como no WR: pode ter espaços.
+void TcpServer::match_text(string& out, size_t from) {
+    string_view key, value;
+    if (!TupleServer::split_match(string_view(out).substr(from), key, value))
+        return;
+    string line;
+    line.reserve(key.size() + 1 + value.size());
+    line += key;
+    line += ' ';
+    line += value;
+    out.replace(from, string::npos, line);
+}
 
-        // Cada cliente recebe um thread dedicado.
-        // detach() imediato: o thread fecha o socket e se auto-destrói.
-        thread([this, client_sock]() {
-            session(client_sock);
-            ::closesocket(client_sock);  // Windows: closesocket()
-        }).detach();
+// ---------------------------------------------------------------------------
+// Administração (só texto):
+//   LOAD arquivo   ->  "OK n" (serviços registrados) ou "ERROR"
+//   UNLOAD svc_id  ->  "OK" ou "NO-SERVICE"
+//   STATS          ->  "OK n" + n linhas de métricas, no formato do
+//                      Prometheus sem os comentários (ver metrics.hpp)
+// O motivo de um LOAD recusado vai para o log, não para o cliente.
+// ---------------------------------------------------------------------------
+void TcpServer::admin(const protocol::Command& cmd, string& out) {
+    if (cmd.op == protocol::Command::STATS) {
+        string text = render_metrics(false);
+        out += "OK " + to_string(count(text.begin(), text.end(), '\n')) + "\n";
+        out += text;
+        return;
+    }
+    ServiceRegistry& services = ts_.service_registry();
+    if (cmd.op == protocol::Command::UNLOAD) {
+        out += services.unload(cmd.svc_id) ? "OK\n" : "NO-SERVICE\n";
+        return;
+    }
+    try {
+        out += "OK " + to_string(services.load_file(string(cmd.key)).size()) + "\n";
+    } catch (const exception& e) {
+        cerr << "[AVISO] " << e.what() << "\n";
+        out += "ERROR\n";
     }
 }
 
 // ---------------------------------------------------------------------------
-// read_line(): lê bytes até '\n', descartando '\r'.
-// Retorna false se a conexão foi encerrada.
+// Assinaturas:
+//   SUB padrão    ->  "OK"; depois, "PUSH chave valor" a cada tupla nova
+//   UNSUB padrão  ->  "OK" (também se o padrão não estava assinado)
+// Um buffer cheio vira "PUSH-DROPPED n" antes das tuplas seguintes (DROP)
+// ou o fim da conexão (DISCONNECT).
 // ---------------------------------------------------------------------------
-bool TcpServer::read_line(SOCKET client_sock, string& out) {
-    out.clear();
-    char ch;
-    while (true) {
-        // recv() é idêntico em POSIX e Windows; retorna SOCKET_ERROR em vez de -1.
-        int n = ::recv(client_sock, &ch, 1, 0);
-        if (n <= 0)
-            return false;   // 0 = conexão encerrada; SOCKET_ERROR = erro
-        if (ch == '\n')
-            return true;
-        if (ch != '\r')
-            out += ch;
+void TcpServer::subscription(const protocol::Command& cmd, Subscriptions::Feed& feed) {
+    if (cmd.op == protocol::Command::SUB)
+        ts_.subscriptions().subscribe(feed, cmd.key);
+    else
+        ts_.subscriptions().unsubscribe(feed, cmd.key);
+}
+
+void TcpServer::append_pushes(string& out, bool binary,
+                              const vector<Subscriptions::EventPtr>& events, uint64_t lost) {
+    using namespace protocol;
+    if (lost > 0) {
+        if (binary)
+            append_reply(out, ST_FULL, OP_PUSH, 0, to_string(lost));
+        else
+            out += "PUSH-DROPPED " + to_string(lost) + "\n";
+    }
+    for (auto& ev : events) {
+        if (binary) {
+            size_t at = begin_reply(out, ST_OK, OP_PUSH, 0);
+            append_record(out, ev->key);
+            append_record(out, ev->value);
+            finish_reply(out, at);
+        } else {
+            out += "PUSH ";
+            out += ev->key;
+            out += ' ';
+            out += ev->value;
+            out += '\n';
+        }
     }
 }
 
+protocol::Status TcpServer::result_status(string_view result) {
+    if (result == "OK")
+        return protocol::ST_OK;
+    return result == "FULL" ? protocol::ST_FULL : protocol::ST_NO_SERVICE;
+}
+
+bool TcpServer::produces(uint8_t opcode) {
+    return opcode == protocol::OP_WR || opcode == protocol::OP_MWR;
+}
+
+bool TcpServer::produces(const protocol::Command& cmd) {
+    return cmd.op == protocol::Command::WR || cmd.op == protocol::Command::MWR;
+}
+
 // ---------------------------------------------------------------------------
-// session(): loop por cliente.
+// Lotes em texto:
+//   MWR n      + n linhas "chave valor"   ->  "OK n" (ou "FULL")
+//   INN chave n                           ->  "OK k" + k linhas com valores
+//   MRD k1 k2 ...                         ->  "OK n" + n linhas "OK valor"
+//                                             ou "NO-TUPLE"
+//   EXALL k_in k_out svc_id[,svc_id...]  ->  "OK n" ou "NO-SERVICE"
+// Um MWR com alguma linha inválida não escreve nada ("ERROR").
 // ---------------------------------------------------------------------------
-void TcpServer::session(SOCKET client_sock) {
-    string line;
-    while (read_line(client_sock, line)) {
-        if (line.empty())
-            continue;
-
-        string response = process_command(line);
-
-        // Envio completo mesmo que o Winsock fragmente internamente.
-        const char* buf       = response.data();
-        int         remaining = static_cast<int>(response.size());
-        while (remaining > 0) {
-            // send() no Windows também retorna SOCKET_ERROR em caso de falha.
-            int sent = ::send(client_sock, buf, remaining, 0);
-            if (sent == SOCKET_ERROR) return;
-            buf       += sent;
-            remaining -= sent;
+bool TcpServer::write_batch(const protocol::Command& cmd, string& in, size_t& pos,
+                            string& out) {
+    if (!protocol::has_lines(in, pos, cmd.count))
+        return false;
+
+    // Só aqui o MWR em texto é contado: ele não passa pelo execute().
+    Metrics::Span span(metrics_, cmd.op);
+    vector<pair<string, string>> tuples;
+    tuples.reserve(cmd.count);
+    bool        ok = true;
+    string_view line, key, value;
+    for (uint32_t i = 0; i < cmd.count; ++i) {
+        protocol::next_line(in, pos, line);
+        if (ok && (ok = protocol::parse_pair(line, key, value)))
+            tuples.emplace_back(string(key), string(value));
+    }
+    if (!ok) {
+        out += "ERROR\n";
+        return true;
+    }
+    if (ts_.write_many(move(tuples)))
+        out += "OK " + to_string(cmd.count) + "\n";
+    else
+        out += "FULL\n";
+    return true;
+}
+
+bool TcpServer::take_batch(const protocol::Command& cmd, string& out) {
+    vector<string> values;
+    if (ts_.inp_many(cmd.key, cmd.count, values) == 0)
+        return false;
+    out += "OK " + to_string(values.size()) + "\n";
+    for (auto& v : values) {
+        out += v;
+        out += '\n';
+    }
+    return true;
+}
+
+void TcpServer::read_batch(const protocol::Command& cmd, string& out) {
+    vector<string_view> keys;
+    size_t              pos = 0;
+    string_view         k;
+    while (protocol::next_word(cmd.value, pos, k))
+        keys.push_back(k);
+
+    auto values = ts_.rd_many(keys);
+    out += "OK " + to_string(values.size()) + "\n";
+    for (auto& v : values) {
+        if (v) {
+            out += "OK ";
+            out += *v;
+            out += '\n';
+        } else {
+            out += "NO-TUPLE\n";
         }
     }
 }
 
 // ---------------------------------------------------------------------------
-// process_command(): parse e despacho para o TupleServer.
+// Lotes em frames binários: registros no lugar do valor (ver protocol.hpp).
 // ---------------------------------------------------------------------------
-string TcpServer::process_command(const string& line) {
-    istringstream iss(line);
-    string cmd;
-    if (!(iss >> cmd))
-        return "ERROR\n";
+void TcpServer::transform_batch(const protocol::Command& cmd, string& out) {
+    size_t n = 0;
+    if (ts_.ex_all(cmd.key, cmd.value, chain_of(cmd), n))
+        out += "OK " + to_string(n) + "\n";
+    else
+        out += "NO-SERVICE\n";
+}
 
-    // ------------------------------------------------------------------ WR
-    if (cmd == "WR") {
-        string key;
-        if (!(iss >> key))
-            return "ERROR\n";
-        string value;
-        getline(iss, value);
-        if (!value.empty() && value.front() == ' ')
-            value.erase(0, 1);
-        ts_.write(move(key), move(value));
-        return "OK\n";
+void TcpServer::write_batch_frame(const protocol::FrameHeader& h,
+                                  const protocol::Command& cmd, string& out) {
+    vector<pair<string, string>> tuples;
+    string_view                  rest = cmd.value, key, value;
+    bool                         ok   = true;
+    while (ok && protocol::next_record(rest, key)) {
+        ok = protocol::next_record(rest, value);  // chave sem valor: ERROR
+        if (ok)
+            tuples.emplace_back(string(key), string(value));
     }
+    if (!ok || !rest.empty() || tuples.size() > protocol::MAX_BATCH) {
+        protocol::append_reply(out, protocol::ST_ERROR, h.opcode, h.id, {});
+        return;
+    }
+    protocol::Status st = ts_.write_many(move(tuples)) ? protocol::ST_OK : protocol::ST_FULL;
+    protocol::append_reply(out, st, h.opcode, h.id, {});
+}
 
-    // ------------------------------------------------------------------ RD
-    if (cmd == "RD") {
-        string key;
-        if (!(iss >> key))
-            return "ERROR\n";
-        return "OK " + ts_.rd(key) + "\n";
+bool TcpServer::take_batch_frame(const protocol::FrameHeader& h,
+                                 const protocol::Command& cmd, string& out) {
+    vector<string> values;
+    if (ts_.inp_many(cmd.key, cmd.count, values) == 0)
+        return false;
+    size_t at = protocol::begin_reply(out, protocol::ST_OK, h.opcode, h.id);
+    for (auto& v : values)
+        protocol::append_record(out, v);
+    protocol::finish_reply(out, at);
+    return true;
+}
+
+void TcpServer::read_batch_frame(const protocol::FrameHeader& h,
+                                 const protocol::Command& cmd, string& out) {
+    vector<string_view> keys;
+    string_view         rest = cmd.value, k;
+    while (protocol::next_record(rest, k))
+        keys.push_back(k);
+    if (!rest.empty() || keys.size() > protocol::MAX_BATCH) {
+        protocol::append_reply(out, protocol::ST_ERROR, h.opcode, h.id, {});
+        return;
     }
 
-    // ------------------------------------------------------------------ IN
-    if (cmd == "IN") {
-        string key;
-        if (!(iss >> key))
-            return "ERROR\n";
-        return "OK " + ts_.in(key) + "\n";
+    auto   values = ts_.rd_many(keys);
+    size_t at     = protocol::begin_reply(out, protocol::ST_OK, h.opcode, h.id);
+    for (auto& v : values) {
+        if (v)
+            protocol::append_record(out, *v);
+        else
+            protocol::append_missing(out);
     }
+    protocol::finish_reply(out, at);
+}
+
+void TcpServer::transform_batch_frame(const protocol::FrameHeader& h,
+                                      const protocol::Command& cmd, string& out) {
+    size_t n = 0;
+    if (ts_.ex_all(cmd.key, cmd.value, chain_of(cmd), n))
+        protocol::append_reply(out, protocol::ST_OK, h.opcode, h.id, to_string(n));
+    else
+        protocol::append_reply(out, protocol::ST_NO_SERVICE, h.opcode, h.id, {});
+}
 
-    // ------------------------------------------------------------------ EX
-    if (cmd == "EX") {
-        string k_in, k_out;
-        int    svc_id;
-        if (!(iss >> k_in))   return "ERROR\n";
-        if (!(iss >> k_out))  return "ERROR\n";
-        if (!(iss >> svc_id)) return "ERROR\n";
-        return ts_.ex(k_in, k_out, svc_id) + "\n";
+// ---------------------------------------------------------------------------
+// Métricas. O listener HTTP é mínimo: um único thread aceita as conexões e
+// responde cada uma na hora (HTTP/1.0, sem keep-alive). Um cliente lento
+// segura as raspagens seguintes por no máximo METRICS_TIMEOUT_MS em cada
+// recv()/send(); uma falha persistente do accept (EMFILE, ENFILE) espera
+// cada vez mais, até 1 s, em vez de girar.
+// ---------------------------------------------------------------------------
+static constexpr int METRICS_TIMEOUT_MS = 2000;
+
+string TcpServer::render_metrics(bool help) {
+    return metrics_.render(ts_.stats(), connections_.load(), help);
+}
+
+void TcpServer::serve_metrics(unsigned short port) {
+    socket_t sock = open_listener(port);
+    thread([this, sock]() {
+        int backoff_ms = 0;
+        while (true) {
+            socket_t fd = ::accept(sock, nullptr, nullptr);
+            if (fd == INVALID_SOCK) {
+                if (backoff_ms == 0)  // um aviso por sequência de falhas
+                    cerr << "[ERRO] " << net::error_message("accept(métricas)") << endl;
+                backoff_ms = min(max(2 * backoff_ms, 10), 1000);
+                this_thread::sleep_for(chrono::milliseconds(backoff_ms));
+                continue;
+            }
+            backoff_ms = 0;
+            net::set_timeouts(fd, METRICS_TIMEOUT_MS);
+            metrics_request(fd);
+        }
+    }).detach();
+    cout << "Métricas em http://0.0.0.0:" << port << "/metrics" << endl;
+}
+
+void TcpServer::metrics_request(socket_t fd) {
+    // Só a linha de requisição importa, mas o cabeçalho é lido inteiro:
+    // fechar o socket com dados não lidos derrubaria a resposta (RST).
+    string req;
+    char   buf[1024];
+    while (req.find("\r\n\r\n") == string::npos && req.find("\n\n") == string::npos &&
+           req.size() < 8192) {
+        long n = net::recv_some(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        req.append(buf, static_cast<size_t>(n));
     }
 
-    return "ERROR\n";
-}
\ No newline at end of file
+    string status = "200 OK", body;
+    if (req.compare(0, 13, "GET /metrics ") == 0 || req.compare(0, 6, "GET / ") == 0)
+        body = render_metrics(true);
+    else
+        status = "404 Not Found";
+    string resp = "HTTP/1.0 " + status +
+                  "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8"
+                  "\r\nContent-Length: " + to_string(body.size()) +
+                  "\r\nConnection: close\r\n\r\n" + body;
+    for (size_t sent = 0; sent < resp.size();) {
+        long n = net::send_some(fd, resp.data() + sent, resp.size() - sent);
+        if (n <= 0)
+            break;
+        sent += static_cast<size_t>(n);
+    }
+    net::close_socket(fd);
+}
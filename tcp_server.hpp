@@ -1,38 +1,174 @@
 #pragma once
 
-// Winsock2 deve ser incluído antes de qualquer header do Windows
-// para evitar conflitos com <windows.h>.
-#include <winsock2.h>
-#include <ws2tcpip.h>
-
 #include "main.hpp"
-#include <string>
+#include "metrics.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
 
-// Linka automaticamente com a biblioteca Winsock (equivale a -lws2_32).
-#pragma comment(lib, "ws2_32.lib")
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 class TcpServer {
 public:
     // port: porta TCP a escutar (ex: 54321).
-    TcpServer(TupleServer& ts, unsigned short port);
+    // io_threads: threads de I/O do backend epoll (0 = um por núcleo).
+    //             Ignorado no backend de um thread por cliente.
+    TcpServer(TupleServer& ts, unsigned short port, unsigned io_threads = 0);
     ~TcpServer();
 
     // Bloqueia aceitando conexões até o processo ser encerrado.
     void run();
 
+    // Abre um listener HTTP em `port` que responde às requisições GET
+    // /metrics com as métricas no formato de texto do Prometheus (ver
+    // metrics.hpp), num único thread próprio. Chamar antes de run(). Lança
+    // std::runtime_error se a porta não puder ser aberta.
+    void serve_metrics(unsigned short port);
+
 private:
+    // Executa WR/RD/IN/EX/RDP/INP/RDM/INM acrescentando o resultado a `out` se
+    // puder ser concluído agora; senão estaciona `done` (vazio = apenas
+    // tenta; RDP/INP nunca estacionam). Mesma semântica de
+    // TupleServer::rd_async(); o WR só estaciona com a chave cheia.
+    // Comum aos backends.
+    bool try_execute(const protocol::Command& cmd, std::string& out,
+                     TupleServer::Continuation done,
+                     TupleServer::Ticket* ticket = nullptr);
+
+    // LOAD/UNLOAD/STATS: nunca bloqueiam; resposta em `out`.
+    void admin(const protocol::Command& cmd, std::string& out);
+
+    // SUB/UNSUB no Feed da conexão; a resposta é sempre OK.
+    void subscription(const protocol::Command& cmd, Subscriptions::Feed& feed);
+
+    // Tuplas de um Feed no formato da conexão (texto: "PUSH chave valor"
+    // por tupla; binário: frames OP_PUSH), precedidas do aviso de perda
+    // se `lost` > 0.
+    static void append_pushes(std::string& out, bool binary,
+                              const std::vector<Subscriptions::EventPtr>& events,
+                              std::uint64_t lost);
+
+    // Resultado de RDM/INM (dois registros, ver match_async()) a partir de
+    // out[from] reescrito como "chave valor", para o protocolo de texto.
+    static void match_text(std::string& out, std::size_t from);
+
+    // Status binário do resultado textual de um EX ou WR
+    // ("OK"/"NO-SERVICE"/"FULL").
+    static protocol::Status result_status(std::string_view result);
+
+    // WR/MWR: comandos que aumentam o espaço, sujeitos ao limite global.
+    static bool produces(std::uint8_t opcode);
+    static bool produces(const protocol::Command& cmd);
+
+    // Lotes, comuns aos backends. write_batch(): MWR em texto — aplica as
+    // `cmd.count` linhas seguintes de `in` num único write_many(); retorna
+    // false, sem consumir nada, se o lote ainda não chegou inteiro.
+    // take_batch(): INN com tuplas disponíveis (false se não há nenhuma;
+    // aí o INN estaciona como um IN). read_batch(): MRD, nunca bloqueia.
+    // transform_batch(): EXALL, nunca bloqueia.
+    bool write_batch(const protocol::Command& cmd, std::string& in,
+                     std::size_t& pos, std::string& out);
+    bool take_batch(const protocol::Command& cmd, std::string& out);
+    void read_batch(const protocol::Command& cmd, std::string& out);
+    void transform_batch(const protocol::Command& cmd, std::string& out);
+
+    // Os mesmos, com requisição e resposta em frames binários.
+    void write_batch_frame(const protocol::FrameHeader& h,
+                           const protocol::Command& cmd, std::string& out);
+    bool take_batch_frame(const protocol::FrameHeader& h,
+                          const protocol::Command& cmd, std::string& out);
+    void read_batch_frame(const protocol::FrameHeader& h,
+                          const protocol::Command& cmd, std::string& out);
+    void transform_batch_frame(const protocol::FrameHeader& h,
+                               const protocol::Command& cmd, std::string& out);
+
+#if LINDA_USE_EPOLL
+    // Backend epoll (tcp_server_epoll.cpp): poucos threads de I/O
+    // multiplexam todas as conexões; RD/IN/EX bloqueados viram
+    // continuações estacionadas no TupleServer.
+    struct Loop;
+    struct Conn;
+    struct Waiting;
+
+    void loop_main(Loop& loop);
+    void accept_ready(Loop& loop);
+    void adopt(Loop& loop, socket_t fd);
+    void handle_io(Conn& c, unsigned events);
+    void drain_input(Conn& c);
+    void drain_frames(Conn& c);
+    void execute(Conn& c, const protocol::Command& cmd);
+    bool admit(Conn& c);
+    void execute_frame(Conn& c, const protocol::FrameHeader& h,
+                       std::string_view key, std::string_view value);
+    void grow_big_frame(Conn& c);
+    void finish_big_frame(Conn& c);
+    void track(Conn& c, const std::shared_ptr<Waiting>& w, int timeout_ms,
+               std::string expired);
+    void untrack(Conn& c, Waiting& w);
+    void withdraw(Conn& c);
+    void complete(Conn& c, std::string response);
+    Subscriptions::Feed& feed_of(Conn& c);
+    void pump(Conn& c);
+    void close_if_done(Conn& c);
+    void flush(Conn& c);
+    bool send_spliced(Conn& c);
+    void update_events(Conn& c);
+    void close_conn(Conn& c);
+
+    std::vector<std::shared_ptr<Loop>> loops_;
+    unsigned                           next_loop_ = 0;  // round-robin do accept
+#else
+    // Backend portável (tcp_server_threads.cpp): um thread por cliente.
+
     // Loop de sessão: roda em thread dedicada por cliente.
-    void session(SOCKET client_sock);
+    void session(socket_t client_sock);
+
+    // Socket do cliente compartilhado com as continuações de frames
+    // binários estacionados, que respondem a partir de outros threads.
+    struct Session;
+
+    // Acima do limite global de memória: envia as respostas acumuladas e
+    // bloqueia o thread da sessão (sem ler o socket) até o uso cair.
+    // Retorna false se a conexão caiu.
+    bool throttle(Session& s, std::string& out);
 
-    // Parse e execução de um comando de texto.
-    // Retorna a string de resposta (com '\n' no final).
-    std::string process_command(const std::string& line);
+    // Execução de um comando de texto; a resposta (com '\n' no final) é
+    // acrescentada a `out`. Retorna false se a conexão caiu.
+    bool process_command(const protocol::Command& cmd, Session& s,
+                         std::string& out);
 
-    // Lê bytes até '\n' (descartando '\r').
-    // Retorna false se a conexão foi encerrada.
-    bool read_line(SOCKET client_sock, std::string& out);
+    // Estaciona `cmd` e bloqueia o thread da sessão até o resultado ou o
+    // prazo. Antes de bloquear, envia as respostas acumuladas em `out`.
+    enum class Await { READY, TIMEOUT, CLOSED };
+    Await await_result(const protocol::Command& cmd, Session& s,
+                       std::string& out, std::string& result);
+
+    // Feed da sessão, criado na primeira assinatura junto com o thread
+    // que envia as tuplas dele (push_loop()).
+    Subscriptions::Feed& feed_of(Session& s, bool binary);
+    static void          push_loop(Session& s, bool binary);
+
+    // Execução de um frame binário; a resposta vai para `out` ou, se a
+    // operação estacionar, é enviada depois pela continuação.
+    void process_frame(const protocol::FrameHeader& h, std::string_view key,
+                       std::string_view value,
+                       const std::shared_ptr<Session>& s, std::string& out);
+#endif
+
+    // Métricas em texto (STATS e o listener HTTP).
+    std::string render_metrics(bool help);
+
+    // Responde a uma conexão do listener de métricas e a fecha.
+    void metrics_request(socket_t fd);
 
     TupleServer&   ts_;
     unsigned short port_;
-    SOCKET         server_sock_;  // socket de escuta
-};
\ No newline at end of file
+    unsigned       io_threads_;
+    socket_t       server_sock_;  // socket de escuta
+
+    Metrics                   metrics_;
+    std::atomic<std::int64_t> connections_{0};  // abertas agora
+};
@@ -0,0 +1,1000 @@
+// Backend Linux: event loop com epoll.
+//
+// Um conjunto fixo de threads de I/O (um Loop por thread) multiplexa todas
+// as conexões com sockets não bloqueantes. Um RD/IN/EX que não pode ser
+// atendido na hora não prende thread nenhum: vira uma continuação
+// estacionada no TupleServer e a conexão deixa de processar comandos até
+// que o WR correspondente a complete (ou o prazo dela vença). A
+// capacidade de conexões simultâneas passa a depender só de memória.
+#include "tcp_server.hpp"
+
+#if LINDA_USE_EPOLL
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+// Tamanho de cada leitura do socket.
+static constexpr size_t READ_CHUNK = 64 * 1024;
+
+// Frames binários com valor a partir deste tamanho são lidos direto para o
+// buffer definitivo do valor, sem passar pelo buffer de entrada.
+static constexpr size_t BIG_VALUE = 64 * 1024;
+
+// Texto: com tantos bytes ainda não executados em `in`, a leitura para até
+// drain_input() consumi-los (um cliente com pipeline não enche a memória).
+static constexpr size_t TEXT_BACKLOG = 256 * 1024;
+
+// ---------------------------------------------------------------------------
+// Loop: um epoll + um eventfd para receber tarefas de outros threads.
+// As conexões de um Loop só são tocadas pelo seu próprio thread.
+// ---------------------------------------------------------------------------
+struct TcpServer::Loop {
+    int epfd    = -1;
+    int wake_fd = -1;  // eventfd: acorda epoll_wait quando há tarefas
+
+    mutex                    tasks_mtx;
+    vector<function<void()>> tasks;
+
+    unordered_map<Conn*, shared_ptr<Conn>> conns;
+    vector<shared_ptr<Conn>>               closed;  // liberadas ao fim da rodada
+
+    // Prazos de operações estacionadas, em ordem de vencimento.
+    using Timers = multimap<Clock::time_point, function<void()>>;
+    Timers timers;
+
+    // Agenda `fn` para rodar no thread deste Loop. Pode ser chamada de
+    // qualquer thread (ex.: o WR que completou uma continuação).
+    void post(function<void()> fn) {
+        {
+            lock_guard<mutex> lock(tasks_mtx);
+            tasks.push_back(move(fn));
+        }
+        uint64_t one = 1;
+        ssize_t  n   = ::write(wake_fd, &one, sizeof(one));
+        (void)n;  // eventfd só falha se o contador saturar; nesse caso já há aviso pendente
+    }
+
+    // Timeout do epoll_wait() até o próximo prazo (-1: nenhum).
+    int next_timeout() const {
+        if (timers.empty())
+            return -1;
+        auto wait = chrono::ceil<chrono::milliseconds>(timers.begin()->first - Clock::now());
+        return static_cast<int>(clamp<long long>(wait.count(), 0, INT32_MAX));
+    }
+
+    // Dispara os prazos vencidos. Cada timer sai do mapa antes de rodar:
+    // o callback pode armar ou desarmar outros.
+    void run_timers() {
+        auto now = Clock::now();
+        while (!timers.empty() && timers.begin()->first <= now) {
+            auto fn = move(timers.begin()->second);
+            timers.erase(timers.begin());
+            fn();
+        }
+    }
+
+    void disarm(Waiting& w);
+};
+
+// ---------------------------------------------------------------------------
+// Waiting: operação estacionada no TupleServer. A continuação, o prazo (se
+// houver) e a saída do cliente disputam quem responde; TupleServer::cancel()
+// decide, sob o lock do shard. Só é tocado pelo thread do Loop.
+// ---------------------------------------------------------------------------
+struct TcpServer::Waiting {
+    TupleServer::Ticket                 ticket;
+    Loop::Timers::iterator              timer;
+    bool                                armed  = false;  // prazo no Loop
+    bool                                listed = false;  // em Conn::waiting
+    list<shared_ptr<Waiting>>::iterator pos;
+};
+
+void TcpServer::Loop::disarm(Waiting& d) {
+    if (d.armed) {
+        timers.erase(d.timer);
+        d.armed = false;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Conn: estado de uma conexão.
+// ---------------------------------------------------------------------------
+struct TcpServer::Conn {
+    socket_t fd;
+    Loop*    loop;
+
+    string in;          // bytes recebidos ainda não processados
+    size_t in_pos = 0;  // início do próximo comando em `in`
+    string out;         // resposta ainda não enviada
+
+    // Valores grandes de RD/RDP com a frente publicada (rd_cached()): saem
+    // direto do buffer compartilhado do espaço, sem cópia para `out`. Cada
+    // um vai antes do byte `at` de `out`; `sent` bytes dele já foram.
+    struct Spliced {
+        size_t      at;
+        SharedValue value;
+        size_t      sent = 0;
+    };
+    deque<Spliced> spliced;
+
+    // Protocolo, decidido pelo primeiro byte recebido.
+    enum Mode { UNKNOWN, TEXT, BINARY } mode = UNKNOWN;
+
+    bool     parked      = false;  // texto: há RD/IN/EX estacionado aguardando WR
+    unsigned outstanding = 0;      // binário: operações estacionadas
+    bool     throttled   = false;  // WR/MWR retido acima do limite de memória
+    bool     eof         = false;  // o cliente encerrou o envio
+    bool     half_close  = false;  // HALFCLOSE: o EOF não retira os estacionados
+    bool     want_out    = false;  // EPOLLOUT registrado (envio pendente)
+    bool     closed      = false;
+
+    // Sem EPOLLIN: retida pelo limite de memória, ou (texto) com um comando
+    // estacionado — os seguintes esperam no socket, não em `in`, e a
+    // leitura volta em complete().
+    bool paused() const { return throttled || parked; }
+
+    // Binário: frame grande cujo valor está sendo lido direto do socket.
+    struct BigFrame {
+        protocol::FrameHeader h;
+        string                key;
+        string                value;   // cresce conforme chega (contado em charge())
+        size_t                total;   // valor + trailer
+        size_t                filled;  // bytes de `value` já recebidos
+    };
+    unique_ptr<BigFrame> big;
+
+    // Operações estacionadas, retiradas se o cliente for embora (withdraw()).
+    list<shared_ptr<Waiting>> waiting;
+
+    // SUB: tuplas das assinaturas, criado na primeira (feed_of()).
+    shared_ptr<Subscriptions::Feed> feed;
+    bool                            pumping = false;  // dentro de pump()
+
+    Conn(socket_t fd, Loop* loop) : fd(fd), loop(loop) {}
+
+    bool pending() const { return !out.empty() || !spliced.empty(); }
+};
+
+// ---------------------------------------------------------------------------
+// run(): cria os Loops, registra o socket de escuta no Loop 0 e roda o
+// Loop 0 no thread chamador. Não retorna.
+// ---------------------------------------------------------------------------
+void TcpServer::run() {
+    if (!net::set_nonblocking(server_sock_))
+        throw runtime_error(net::error_message("fcntl(O_NONBLOCK)"));
+
+    for (unsigned i = 0; i < io_threads_; ++i) {
+        auto loop  = make_shared<Loop>();
+        loop->epfd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd < 0)
+            throw runtime_error(net::error_message("epoll_create1()"));
+        loop->wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->wake_fd < 0)
+            throw runtime_error(net::error_message("eventfd()"));
+
+        epoll_event ev{};
+        ev.events   = EPOLLIN;
+        ev.data.ptr = loop.get();
+        ::epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+        loops_.push_back(move(loop));
+    }
+
+    // data.ptr == nullptr identifica o socket de escuta.
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (::epoll_ctl(loops_[0]->epfd, EPOLL_CTL_ADD, server_sock_, &ev) != 0)
+        throw runtime_error(net::error_message("epoll_ctl(listen)"));
+
+    cout << "Servidor Linda ouvindo na porta " << port_
+         << " (epoll, " << io_threads_ << " threads de I/O)" << endl;
+
+    // Os Loops vivem até o fim do processo, como os threads de sessão do
+    // backend portável.
+    for (unsigned i = 1; i < io_threads_; ++i)
+        thread([this, i]() { loop_main(*loops_[i]); }).detach();
+    loop_main(*loops_[0]);
+}
+
+// ---------------------------------------------------------------------------
+// loop_main(): despacha eventos de um Loop.
+// ---------------------------------------------------------------------------
+void TcpServer::loop_main(Loop& loop) {
+    epoll_event events[128];
+    while (true) {
+        int n = ::epoll_wait(loop.epfd, events, 128, loop.next_timeout());
+        if (n < 0) {
+            if (errno != EINTR)
+                cerr << "[ERRO] " << net::error_message("epoll_wait()") << endl;
+            n = 0;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            void* p = events[i].data.ptr;
+            if (p == nullptr) {
+                accept_ready(loop);
+            } else if (p == &loop) {
+                uint64_t count;
+                ssize_t  r = ::read(loop.wake_fd, &count, sizeof(count));
+                (void)r;
+                vector<function<void()>> tasks;
+                {
+                    lock_guard<mutex> lock(loop.tasks_mtx);
+                    tasks.swap(loop.tasks);
+                }
+                for (auto& t : tasks)
+                    t();
+            } else {
+                handle_io(*static_cast<Conn*>(p), events[i].events);
+            }
+        }
+        loop.run_timers();
+
+        // Só agora é seguro destruir conexões fechadas nesta rodada:
+        // eventos posteriores do mesmo lote ainda podiam apontar para elas.
+        loop.closed.clear();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// accept_ready(): aceita todas as conexões pendentes e distribui entre os
+// Loops em round-robin.
+// ---------------------------------------------------------------------------
+void TcpServer::accept_ready(Loop& loop) {
+    while (true) {
+        socket_t fd = ::accept4(server_sock_, nullptr, nullptr,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == INVALID_SOCK) {
+            if (!net::would_block() && errno != ECONNABORTED)
+                cerr << "[ERRO] " << net::error_message("accept()") << endl;
+            return;
+        }
+        net::set_nodelay(fd);
+
+        Loop* target = loops_[next_loop_].get();
+        next_loop_   = (next_loop_ + 1) % loops_.size();
+        if (target == &loop)
+            adopt(loop, fd);
+        else
+            target->post([this, target, fd]() { adopt(*target, fd); });
+    }
+}
+
+void TcpServer::adopt(Loop& loop, socket_t fd) {
+    auto c = make_shared<Conn>(fd, &loop);
+
+    epoll_event ev{};
+    ev.events   = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = c.get();
+    if (::epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        cerr << "[ERRO] " << net::error_message("epoll_ctl(add)") << endl;
+        net::close_socket(fd);
+        return;
+    }
+    loop.conns.emplace(c.get(), move(c));
+    ++connections_;
+}
+
+// ---------------------------------------------------------------------------
+// handle_io(): eventos de uma conexão.
+// ---------------------------------------------------------------------------
+void TcpServer::handle_io(Conn& c, unsigned events) {
+    if (c.closed)
+        return;
+
+    if (events & EPOLLERR) {
+        close_conn(c);
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        flush(c);
+        if (c.closed)
+            return;
+    }
+
+    // Texto com um comando estacionado: só o EPOLLRDHUP fica registrado.
+    // O cliente foi embora (ou só fechou o envio, sem HALFCLOSE): a
+    // operação sai da fila, e os comandos enviados depois dela, ainda no
+    // socket, não são executados.
+    if ((events & EPOLLRDHUP) && c.parked && !c.half_close) {
+        withdraw(c);
+        c.eof = true;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+        while (!c.closed && !c.eof && !c.paused()) {
+            long n;
+            if (c.big) {
+                // Frame grande: direto para o buffer definitivo do valor.
+                auto& big = *c.big;
+                if (big.filled == big.value.size())
+                    grow_big_frame(c);
+                size_t room = big.value.size() - big.filled;
+                n = net::recv_some(c.fd, &big.value[big.filled], room);
+                if (n > 0) {
+                    big.filled += static_cast<size_t>(n);
+                    if (big.filled == big.total)
+                        finish_big_frame(c);
+                    else if (static_cast<size_t>(n) < room)
+                        break;
+                    continue;
+                }
+            } else {
+                // Lê direto para o fim do buffer de entrada, em blocos grandes.
+                size_t old = c.in.size();
+                c.in.resize(old + READ_CHUNK);
+                n = net::recv_some(c.fd, &c.in[old], READ_CHUNK);
+                c.in.resize(old + static_cast<size_t>(max(n, 0L)));
+                if (n > 0) {
+                    if (static_cast<size_t>(n) < READ_CHUNK)
+                        break;
+                    // Um frame grande pode ter começado neste bloco.
+                    if (c.mode != Conn::TEXT)
+                        drain_input(c);
+                    else if (c.in.size() - c.in_pos >= TEXT_BACKLOG)
+                        break;  // executa antes de ler mais (o epoll volta a avisar)
+                    continue;
+                }
+            }
+            if (n == 0) {
+                c.eof = true;  // processa o que já chegou e encerra depois
+                break;
+            }
+            if (net::would_block())
+                break;
+            close_conn(c);
+            return;
+        }
+        drain_input(c);
+    }
+
+    if (c.closed)
+        return;
+    // EPOLLHUP: o socket não aceita mais envio; não há resposta a entregar.
+    if (events & EPOLLHUP) {
+        close_conn(c);
+        return;
+    }
+    close_if_done(c);
+}
+
+// ---------------------------------------------------------------------------
+// close_if_done(): após EOF, as operações estacionadas são retiradas (o
+// cliente não espera mais por elas) e a conexão fecha assim que não houver
+// resposta pendente (mesma ordem do backend de um thread por cliente);
+// senão só atualiza o interesse no epoll. Com HALFCLOSE o EOF é só o fim
+// do envio: elas seguem até a resposta, e só a queda da conexão (EPOLLHUP,
+// EPOLLERR ou envio que falha, em close_conn()) as retira. Um frame grande
+// pela metade nunca vai se completar: fecha na hora.
+// ---------------------------------------------------------------------------
+void TcpServer::close_if_done(Conn& c) {
+    if (c.closed)
+        return;
+    if (c.eof && !c.half_close && !c.waiting.empty())
+        withdraw(c);
+    bool idle = !c.parked && !c.throttled && c.outstanding == 0 && !c.pending();
+    if (c.eof && (idle || c.big))
+        close_conn(c);
+    else
+        update_events(c);
+}
+
+// ---------------------------------------------------------------------------
+// drain_input(): executa todos os comandos completos já recebidos, em ordem
+// (pipelining do cliente), acumulando as respostas em `out`; o lote inteiro
+// sai num único send() no fim. Para no primeiro comando que ficar
+// estacionado — as respostas anteriores são enviadas e as seguintes só são
+// geradas depois dele, então a ordem das respostas é sempre a dos
+// comandos. complete() retoma daqui. Com WAL, as mutações do lote vão ao
+// disco num único fsync, antes das respostas.
+// ---------------------------------------------------------------------------
+void TcpServer::drain_input(Conn& c) {
+    TupleServer::GroupCommit batch;
+    if (c.mode == Conn::UNKNOWN && c.in_pos < c.in.size()) {
+        if (static_cast<unsigned char>(c.in[c.in_pos]) == protocol::BINARY_MAGIC) {
+            c.mode = Conn::BINARY;
+            ++c.in_pos;
+        } else {
+            c.mode = Conn::TEXT;
+        }
+    }
+
+    string_view line;
+    if (c.mode == Conn::BINARY) {
+        drain_frames(c);
+    } else {
+        while (!c.parked && !c.throttled && !c.closed) {
+            size_t start = c.in_pos;
+            if (!protocol::next_line(c.in, c.in_pos, line)) {
+                if (c.in.size() - c.in_pos > ts_.limits().value_bytes + READ_CHUNK)
+                    close_conn(c);  // linha sem fim maior que qualquer valor aceito
+                break;
+            }
+            if (line.empty())
+                continue;
+
+            protocol::Command cmd;
+            if (!protocol::parse_command(line, cmd)) {
+                c.out += "ERROR\n";
+                continue;
+            }
+            if (produces(cmd) && !admit(c)) {
+                c.in_pos = start;  // reexecutado quando o uso cair
+                break;
+            }
+            if (cmd.op == protocol::Command::MWR) {
+                if (!write_batch(cmd, c.in, c.in_pos, c.out)) {
+                    c.in_pos = start;  // lote incompleto: espera o resto
+                    break;
+                }
+                continue;
+            }
+            execute(c, cmd);
+        }
+    }
+
+    ts_.commit();
+    if (c.pending() && !c.closed)
+        flush(c);
+
+    // Descarta o prefixo já consumido.
+    if (c.closed)
+        return;
+    if (c.in_pos == c.in.size()) {
+        c.in.clear();
+        c.in_pos = 0;
+    } else if (c.in_pos > READ_CHUNK) {
+        c.in.erase(0, c.in_pos);
+        c.in_pos = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// admit(): backpressure global. Acima do limite de memória, o WR/MWR não é
+// executado e a conexão para de ler o socket (o TCP segura o cliente) até
+// o uso cair; aí a leitura e o pipeline são retomados no Loop dono. Abaixo
+// do limite (o caso comum) é só uma leitura atômica: a continuação só é
+// montada quando a conexão de fato para.
+// ---------------------------------------------------------------------------
+bool TcpServer::admit(Conn& c) {
+    if (!ts_.over_high_water())
+        return true;
+    shared_ptr<Conn> self   = c.loop->conns.at(&c);
+    auto             resume = [this, self]() {
+        self->loop->post([this, self]() {
+            if (self->closed)
+                return;
+            self->throttled = false;
+            drain_input(*self);
+            close_if_done(*self);
+        });
+    };
+    if (ts_.wait_high_water_async(move(resume)))
+        return true;
+    c.throttled = true;
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// execute(): despacha um comando, escrevendo a resposta direto em `c.out`.
+// Primeiro tenta atender na hora; só se precisar esperar é que a
+// continuação (que devolve a resposta ao Loop dono da conexão) é criada.
+// ---------------------------------------------------------------------------
+void TcpServer::execute(Conn& c, const protocol::Command& cmd) {
+    using protocol::Command;
+
+    Metrics::Span span(metrics_, cmd.op);
+    if (cmd.op == Command::MRD) {
+        read_batch(cmd, c.out);
+        return;
+    }
+    if (cmd.op == Command::EXALL) {
+        transform_batch(cmd, c.out);
+        return;
+    }
+    if (cmd.is_admin()) {
+        admin(cmd, c.out);
+        return;
+    }
+    if (cmd.op == Command::HALFCLOSE) {
+        c.half_close = true;
+        c.out += "OK\n";
+        return;
+    }
+    if (cmd.is_subscription()) {
+        subscription(cmd, feed_of(c));
+        c.out += "OK\n";
+        return;
+    }
+    if (cmd.op == Command::INN && take_batch(cmd, c.out))
+        return;
+
+    // INN que precisa esperar recebe só a tupla que o acordar.
+    // WR e EX já respondem com o status ("OK"/"FULL"/"NO-SERVICE").
+    const char* pfx  = cmd.op == Command::EX || cmd.op == Command::WR ? ""
+                       : cmd.op == Command::INN                       ? "OK 1\n"
+                                                                      : "OK ";
+    size_t      mark = c.out.size();
+    c.out += pfx;
+
+    // RD/RDP de frente publicada: sem lock, e um valor grande não é
+    // copiado para `out`.
+    if (cmd.op == Command::RD || cmd.op == Command::RDP) {
+        SharedValue shared;
+        if (ts_.rd_cached(cmd.key, c.out, &shared)) {
+            if (shared)
+                c.spliced.push_back({c.out.size(), move(shared)});
+            c.out += '\n';
+            return;
+        }
+    }
+
+    if (!try_execute(cmd, c.out, nullptr)) {
+        if (!cmd.may_block()) {
+            c.out.resize(mark);
+            c.out += "NO-TUPLE\n";
+            return;
+        }
+
+        // A continuação mantém a conexão viva até a resposta ser entregue.
+        shared_ptr<Conn>    self  = c.loop->conns.at(&c);
+        shared_ptr<Waiting> w     = make_shared<Waiting>();
+        bool                match = cmd.is_match();
+        auto later = [this, self, w, pfx, match, start = span.start()](string result) {
+            metrics_.end(start);
+            if (match)
+                match_text(result, 0);
+            string resp = pfx + move(result) + "\n";
+            self->loop->post([this, self, w, resp = move(resp)]() mutable {
+                untrack(*self, *w);
+                complete(*self, move(resp));
+            });
+        };
+        // Um WR pode ter chegado entre a tentativa e o estacionamento.
+        if (!try_execute(cmd, c.out, move(later), &w->ticket)) {
+            c.out.resize(mark);
+            c.parked = true;
+            span.release();
+            track(c, w, cmd.timeout_ms, "NO-TUPLE\n");
+            return;
+        }
+    }
+    if (cmd.is_match())
+        match_text(c.out, mark + 3);  // depois do "OK "
+    c.out += '\n';
+}
+
+// ---------------------------------------------------------------------------
+// track(): a operação estacionada entra na lista da conexão. Com prazo,
+// ganha um timer: ao vencer, se ela ainda estiver na fila do TupleServer,
+// é retirada e a conexão recebe `expired`.
+// ---------------------------------------------------------------------------
+void TcpServer::track(Conn& c, const shared_ptr<Waiting>& w, int timeout_ms,
+                      string expired) {
+    w->pos    = c.waiting.insert(c.waiting.end(), w);
+    w->listed = true;
+    if (timeout_ms <= 0)
+        return;
+    shared_ptr<Conn> self = c.loop->conns.at(&c);
+    auto             when = Clock::now() + chrono::milliseconds(timeout_ms);
+    w->timer = c.loop->timers.emplace(when, [this, self, w, expired = move(expired)]() mutable {
+        w->armed = false;
+        if (ts_.cancel(w->ticket)) {
+            untrack(*self, *w);
+            complete(*self, move(expired));
+        }
+    });
+    w->armed = true;
+}
+
+void TcpServer::untrack(Conn& c, Waiting& w) {
+    c.loop->disarm(w);
+    if (w.listed) {
+        w.listed = false;
+        c.waiting.erase(w.pos);  // `w` segue vivo: quem chama tem uma referência
+    }
+}
+
+// ---------------------------------------------------------------------------
+// withdraw(): o cliente foi embora. As operações ainda estacionadas saem da
+// fila do TupleServer sem consumir nada — a tupla que chegar depois vai
+// para outro cliente. As que um WR já atendeu seguem para complete(), que
+// descarta a resposta se a conexão já fechou. No texto, os comandos
+// depois do retirado não são executados.
+// ---------------------------------------------------------------------------
+void TcpServer::withdraw(Conn& c) {
+    while (!c.waiting.empty()) {
+        shared_ptr<Waiting> w = c.waiting.front();
+        untrack(c, *w);
+        if (!ts_.cancel(w->ticket))
+            continue;
+        if (c.mode == Conn::BINARY) {
+            --c.outstanding;
+        } else {
+            c.parked = false;
+            c.in_pos = c.in.size();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// drain_frames(): protocolo binário. Executa todos os frames completos do
+// buffer; operações que precisam esperar não param a conexão — a resposta
+// sai quando ficarem prontas, identificada pelo request_id.
+// ---------------------------------------------------------------------------
+void TcpServer::drain_frames(Conn& c) {
+    while (!c.closed && !c.big && !c.throttled) {
+        size_t avail = c.in.size() - c.in_pos;
+        if (avail < protocol::FRAME_HEADER)
+            return;
+
+        const char* p = c.in.data() + c.in_pos;
+        auto        h = protocol::decode_header(p);
+        if (h.value_len > ts_.limits().value_bytes) {
+            close_conn(c);  // frame impossível: fluxo dessincronizado
+            return;
+        }
+        if (produces(h.opcode) && !admit(c))
+            return;  // o frame fica em `in` até o uso cair
+
+        const char* body  = p + protocol::FRAME_HEADER;
+        size_t      have  = avail - protocol::FRAME_HEADER;
+        if (have >= h.body_len()) {
+            protocol::decode_trailer(h, body + h.key_len + h.value_len);
+            c.in_pos += protocol::FRAME_HEADER + h.body_len();
+            execute_frame(c, h, string_view(body, h.key_len),
+                          string_view(body + h.key_len, h.value_len));
+            continue;
+        }
+
+        // Valor grande ainda incompleto: o restante é lido direto para o
+        // buffer definitivo (handle_io), sem passar por `in`.
+        if (h.value_len >= BIG_VALUE && have >= h.key_len) {
+            auto big = make_unique<Conn::BigFrame>();
+            big->h   = h;
+            big->key.assign(body, h.key_len);
+            big->total  = h.value_len + h.trailer_len();  // trailer vai junto
+            big->filled = have - h.key_len;
+            big->value.assign(body + h.key_len, big->filled);
+            ts_.charge(big->value.size());
+            c.in_pos += protocol::FRAME_HEADER + h.key_len + big->filled;
+            c.big = move(big);
+        }
+        return;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// grow_big_frame(): o buffer de um frame grande cresce com os bytes que
+// chegam (dobrando, até o tamanho do frame), não pelo value_len anunciado
+// no cabeçalho: um cliente não reserva memória sem enviá-la. O que cresce
+// conta no limite global até finish_big_frame() ou close_conn().
+// ---------------------------------------------------------------------------
+void TcpServer::grow_big_frame(Conn& c) {
+    auto&  big = *c.big;
+    size_t old = big.value.size();
+    big.value.resize(min(big.total, max(2 * old, old + READ_CHUNK)));
+    ts_.charge(big.value.size() - old);
+}
+
+void TcpServer::finish_big_frame(Conn& c) {
+    auto big = move(c.big);
+    protocol::decode_trailer(big->h, big->value.data() + big->h.value_len);
+    big->value.resize(big->h.value_len);
+    string result;
+    if (big->h.opcode == protocol::OP_WR &&
+        ts_.write_async(big->key, move(big->value), result, nullptr, nullptr,
+                        big->h.ttl_ms)) {
+        // Só contado: o tempo do WR aqui é o de receber o valor.
+        metrics_.begin(protocol::Command::WR);
+        // O valor já estava no buffer que vai para o espaço de tuplas.
+        protocol::append_reply(c.out, result_status(result), big->h.opcode, big->h.id, {});
+    } else {
+        // Inclui o WR com a chave cheia, que estaciona como os demais.
+        execute_frame(c, big->h, big->key, big->value);
+    }
+    ts_.refund(big->total);  // o valor já conta como tupla, se ficou em fila
+    drain_input(c);
+}
+
+// ---------------------------------------------------------------------------
+// execute_frame(): como execute(), mas com resposta binária escrita direto
+// em `c.out` e sem bloquear a conexão quando a operação estaciona.
+// ---------------------------------------------------------------------------
+void TcpServer::execute_frame(Conn& c, const protocol::FrameHeader& h,
+                              string_view key, string_view value) {
+    using protocol::Command;
+
+    Command cmd;
+    if (!protocol::frame_to_command(h, key, value, cmd)) {
+        protocol::append_reply(c.out, protocol::ST_ERROR, h.opcode, h.id, {});
+        return;
+    }
+    Metrics::Span span(metrics_, cmd.op);
+    switch (cmd.op) {
+    case Command::MWR: write_batch_frame(h, cmd, c.out); return;
+    case Command::MRD: read_batch_frame(h, cmd, c.out);  return;
+    case Command::EXALL: transform_batch_frame(h, cmd, c.out); return;
+    case Command::SUB:
+    case Command::UNSUB:
+        subscription(cmd, feed_of(c));
+        protocol::append_reply(c.out, protocol::ST_OK, h.opcode, h.id, {});
+        return;
+    case Command::INN:
+        if (take_batch_frame(h, cmd, c.out))
+            return;
+        break;
+    default:
+        break;
+    }
+
+    // INN que precisa esperar recebe só a tupla que o acordar, num registro.
+    bool   is_inn = cmd.op == Command::INN;
+    size_t at     = protocol::begin_reply(c.out, protocol::ST_OK, h.opcode, h.id);
+    size_t rec    = is_inn ? protocol::begin_record(c.out) : 0;
+    if (!try_execute(cmd, c.out, nullptr)) {
+        if (!cmd.may_block()) {
+            c.out.resize(at);
+            protocol::append_reply(c.out, protocol::ST_NO_TUPLE, h.opcode, h.id, {});
+            return;
+        }
+
+        shared_ptr<Conn>    self   = c.loop->conns.at(&c);
+        shared_ptr<Waiting> w      = make_shared<Waiting>();
+        bool                status = cmd.op == Command::EX || cmd.op == Command::WR;
+        auto later = [this, self, w, status, is_inn, op = h.opcode, id = h.id,
+                      start = span.start()](string result) {
+            metrics_.end(start);
+            string frame;
+            if (status) {
+                protocol::append_reply(frame, result_status(result), op, id, {});
+            } else if (is_inn) {
+                size_t at = protocol::begin_reply(frame, protocol::ST_OK, op, id);
+                protocol::append_record(frame, result);
+                protocol::finish_reply(frame, at);
+            } else {
+                protocol::append_reply(frame, protocol::ST_OK, op, id, result);
+            }
+            self->loop->post([this, self, w, frame = move(frame)]() mutable {
+                untrack(*self, *w);
+                complete(*self, move(frame));
+            });
+        };
+        if (!try_execute(cmd, c.out, move(later), &w->ticket)) {
+            c.out.resize(at);
+            ++c.outstanding;
+            span.release();
+            string expired;
+            if (cmd.timeout_ms > 0)
+                protocol::append_reply(expired, protocol::ST_NO_TUPLE, h.opcode, h.id, {});
+            track(c, w, cmd.timeout_ms, move(expired));
+            return;
+        }
+    }
+
+    if (cmd.op == Command::EX || cmd.op == Command::WR) {
+        // EX/WR acrescentaram "OK"/"NO-SERVICE"/"FULL": vira o status do frame.
+        size_t res = at + protocol::REPLY_HEADER;
+        c.out[at]  = static_cast<char>(result_status(string_view(c.out).substr(res)));
+        c.out.resize(res);
+    }
+    if (is_inn)
+        protocol::finish_record(c.out, rec);
+    protocol::finish_reply(c.out, at);
+}
+
+// ---------------------------------------------------------------------------
+// complete(): resposta de uma operação estacionada, já no thread do Loop.
+// ---------------------------------------------------------------------------
+void TcpServer::complete(Conn& c, string response) {
+    if (c.closed)
+        return;  // cliente já foi embora; a resposta é descartada
+    if (c.mode == Conn::BINARY)
+        --c.outstanding;
+    else
+        c.parked = false;
+    c.out += response;
+    drain_input(c);  // retoma o pipeline e envia tudo junto
+    close_if_done(c);
+}
+
+// ---------------------------------------------------------------------------
+// feed_of(): o despacho das assinaturas acorda a conexão pelo Loop dono.
+// A referência é fraca: o Feed pertence à conexão.
+// ---------------------------------------------------------------------------
+Subscriptions::Feed& TcpServer::feed_of(Conn& c) {
+    if (!c.feed) {
+        Loop*          loop = c.loop;
+        weak_ptr<Conn> self = c.loop->conns.at(&c);
+        c.feed = ts_.subscriptions().open([this, loop, self]() {
+            loop->post([this, self]() {
+                if (auto c = self.lock())
+                    pump(*c);
+            });
+        });
+    }
+    return *c.feed;
+}
+
+// ---------------------------------------------------------------------------
+// pump(): as tuplas do Feed só vão para `out` quando ele está vazio — com
+// o socket atrasado, quem cresce é o buffer limitado do Feed, não `out`.
+// Por isso as tuplas também nunca caem no meio de uma resposta. flush()
+// chama de novo quando `out` esvazia.
+// ---------------------------------------------------------------------------
+void TcpServer::pump(Conn& c) {
+    if (c.closed || !c.feed || c.pumping)
+        return;
+    if (c.feed->cut()) {
+        close_conn(c);  // DISCONNECT: leitor lento demais
+        return;
+    }
+    c.pumping = true;
+    vector<Subscriptions::EventPtr> events;
+    uint64_t                        lost = 0;
+    while (!c.closed && !c.pending() && c.feed->take(events, lost)) {
+        append_pushes(c.out, c.mode == Conn::BINARY, events, lost);
+        events.clear();
+        flush(c);
+    }
+    c.pumping = false;
+}
+
+// ---------------------------------------------------------------------------
+// flush(): envia o que der de `out`. O resto sai quando vier EPOLLOUT.
+// ---------------------------------------------------------------------------
+void TcpServer::flush(Conn& c) {
+    if (!c.spliced.empty() && !send_spliced(c)) {
+        if (!c.closed && !c.want_out) {
+            c.want_out = true;
+            update_events(c);
+        }
+        return;
+    }
+    size_t sent_total = 0;
+    while (sent_total < c.out.size()) {
+        long n = net::send_some(c.fd, c.out.data() + sent_total,
+                                c.out.size() - sent_total);
+        if (n > 0) {
+            sent_total += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && net::would_block())
+            break;
+        close_conn(c);
+        return;
+    }
+    c.out.erase(0, sent_total);
+
+    bool want = !c.out.empty();
+    if (want != c.want_out) {
+        c.want_out = want;
+        update_events(c);
+    }
+    if (!want && c.feed)
+        pump(c);
+}
+
+// ---------------------------------------------------------------------------
+// send_spliced(): `out` intercalado com os valores compartilhados, num
+// sendmsg() por vez. Retorna true quando todos os valores saíram (o resto
+// de `out` fica para flush()); false se o socket encheu ou foi fechado.
+// ---------------------------------------------------------------------------
+bool TcpServer::send_spliced(Conn& c) {
+    constexpr size_t MAX_IOV = 64;
+    while (!c.spliced.empty()) {
+        iovec  iov[MAX_IOV];
+        size_t n   = 0;
+        size_t pos = 0;
+        auto   it  = c.spliced.begin();
+        for (; it != c.spliced.end() && n + 2 < MAX_IOV; ++it) {
+            if (it->at > pos)
+                iov[n++] = {c.out.data() + pos, it->at - pos};
+            iov[n++] = {const_cast<char*>(it->value->data()) + it->sent,
+                        it->value->size() - it->sent};
+            pos      = it->at;
+        }
+        size_t end = it == c.spliced.end() ? c.out.size() : it->at;
+        if (end > pos)
+            iov[n++] = {c.out.data() + pos, end - pos};
+
+        msghdr msg{};
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = n;
+        long sent      = ::sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent < 0 && net::would_block())
+                return false;
+            close_conn(c);
+            return false;
+        }
+
+        // Descarta o que saiu: trechos de `out` e valores, na ordem.
+        size_t left = static_cast<size_t>(sent);
+        size_t done = 0;  // bytes de `out`
+        while (left > 0) {
+            if (!c.spliced.empty() && c.spliced.front().at == done) {
+                auto&  s = c.spliced.front();
+                size_t k = min(left, s.value->size() - s.sent);
+                s.sent += k;
+                left -= k;
+                if (s.sent == s.value->size())
+                    c.spliced.pop_front();
+                continue;
+            }
+            size_t limit = c.spliced.empty() ? c.out.size() : c.spliced.front().at;
+            size_t k     = min(left, limit - done);
+            done += k;
+            left -= k;
+        }
+        c.out.erase(0, done);
+        for (auto& s : c.spliced)
+            s.at -= done;
+    }
+    return true;
+}
+
+void TcpServer::update_events(Conn& c) {
+    epoll_event ev{};
+    // Após EOF não há mais o que ler; manter EPOLLIN faria o epoll
+    // (level-triggered) reportar o socket em toda rodada.
+    // Pausada (paused()), idem: a leitura volta em admit() ou complete();
+    // com um comando de texto estacionado fica só o EPOLLRDHUP, que avisa
+    // a saída do cliente sem ler os comandos seguintes.
+    unsigned in = 0;
+    if (!c.eof && !c.paused())
+        in = EPOLLIN | EPOLLRDHUP;
+    else if (!c.eof && c.parked && !c.throttled && !c.half_close)
+        in = EPOLLRDHUP;
+    ev.events   = in | (c.want_out ? unsigned(EPOLLOUT) : 0u);
+    ev.data.ptr = &c;
+    ::epoll_ctl(c.loop->epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// ---------------------------------------------------------------------------
+// close_conn(): remove do epoll e fecha o socket. O objeto só é liberado
+// ao fim da rodada (ou quando a última continuação pendente terminar).
+// ---------------------------------------------------------------------------
+void TcpServer::close_conn(Conn& c) {
+    if (c.closed)
+        return;
+    withdraw(c);
+    if (c.big) {
+        ts_.refund(c.big->value.size());
+        c.big.reset();
+    }
+    c.closed = true;
+    --connections_;
+    ::epoll_ctl(c.loop->epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+    net::close_socket(c.fd);
+    c.feed.reset();  // cancela as assinaturas
+
+    auto it = c.loop->conns.find(&c);
+    if (it != c.loop->conns.end()) {
+        c.loop->closed.push_back(move(it->second));
+        c.loop->conns.erase(it);
+    }
+}
+
+#endif  // LINDA_USE_EPOLL
@@ -0,0 +1,533 @@
+// Backend portável: um thread dedicado por cliente, com sockets bloqueantes.
+// Usado quando epoll não está disponível (ex.: Windows).
+#include "tcp_server.hpp"
+
+#if !LINDA_USE_EPOLL
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// run(): loop principal de accept.
+// ---------------------------------------------------------------------------
+void TcpServer::run() {
+    cout << "Servidor Linda ouvindo na porta " << port_ << endl;
+
+    while (true) {
+        sockaddr_in client_addr{};
+        socklen_t   client_len = sizeof(client_addr);
+
+        socket_t client_sock = ::accept(
+            server_sock_,
+            reinterpret_cast<sockaddr*>(&client_addr),
+            &client_len
+        );
+
+        if (client_sock == INVALID_SOCK) {
+            cerr << "[ERRO] " << net::error_message("accept()") << endl;
+            continue;
+        }
+
+        // Cada cliente recebe um thread dedicado.
+        // detach() imediato: o thread fecha o socket e se auto-destrói.
+        thread([this, client_sock]() {
+            ++connections_;
+            session(client_sock);
+            net::close_socket(client_sock);
+            --connections_;
+        }).detach();
+    }
+}
+
+// Tamanho de cada leitura do socket.
+static constexpr size_t READ_CHUNK = 64 * 1024;
+
+// Intervalo em que um thread esperando uma operação estacionada olha se o
+// cliente foi embora (net::peer_closed() / net::peer_gone()).
+static constexpr chrono::milliseconds CLOSE_CHECK{100};
+
+// ---------------------------------------------------------------------------
+// send_all(): envia `out` por inteiro (a pilha TCP pode fragmentar).
+// ---------------------------------------------------------------------------
+static bool send_all(socket_t sock, const string& out) {
+    const char* buf       = out.data();
+    size_t      remaining = out.size();
+    while (remaining > 0) {
+        long sent = net::send_some(sock, buf, remaining);
+        if (sent < 0) return false;
+        buf       += sent;
+        remaining -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Todo envio passa por `mtx`: no protocolo binário, continuações de
+// operações estacionadas escrevem no socket a partir do thread do WR.
+// `open` fica false quando a sessão termina (o socket vai ser fechado).
+struct TcpServer::Session {
+    using Tickets = list<TupleServer::Ticket>;
+
+    socket_t           sock;
+    mutex              mtx;
+    condition_variable idle;
+    bool               open        = true;
+    unsigned           outstanding = 0;  // frames binários estacionados
+    Tickets            tickets;          // os deles ainda não respondidos
+    bool               half_close  = false;  // HALFCLOSE (só o thread da sessão)
+
+    // SUB: tuplas das assinaturas e o thread que as envia (feed_of()).
+    shared_ptr<Subscriptions::Feed> feed;
+    thread                          pusher;
+
+    explicit Session(socket_t sock) : sock(sock) {}
+
+    bool send(const string& out) {
+        lock_guard<mutex> lk(mtx);
+        return open && send_all(sock, out);
+    }
+
+    // Resposta de um frame estacionado.
+    void answer(const string& frame, Tickets::iterator ticket) {
+        lock_guard<mutex> lk(mtx);
+        if (open)
+            send_all(sock, frame);  // falha: a sessão percebe no próximo recv()
+        tickets.erase(ticket);
+        if (--outstanding == 0)
+            idle.notify_all();
+    }
+
+    // O cliente foi embora: os frames ainda estacionados saem da fila do
+    // TupleServer sem consumir nada. Os que um WR já atendeu terminam em
+    // answer(). Continuações rodam fora do lock do shard, então travar o
+    // shard (em cancel()) com `mtx` adquirido não forma ciclo.
+    void withdraw(TupleServer& ts) {
+        lock_guard<mutex> lk(mtx);
+        for (auto it = tickets.begin(); it != tickets.end();) {
+            if (!ts.cancel(*it)) {
+                ++it;
+                continue;
+            }
+            it = tickets.erase(it);
+            if (--outstanding == 0)
+                idle.notify_all();
+        }
+    }
+
+    // Após EOF e withdraw(): espera as respostas já a caminho, como o
+    // protocolo de texto. Se a conexão cair no meio, retira o que restar.
+    void drain(TupleServer& ts) {
+        unique_lock<mutex> lk(mtx);
+        while (!idle.wait_for(lk, CLOSE_CHECK, [this] { return outstanding == 0; })) {
+            if (!net::peer_gone(sock))
+                continue;
+            lk.unlock();
+            withdraw(ts);
+            lk.lock();
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// session(): loop por cliente.
+// Lê em blocos grandes e executa todos os comandos completos já recebidos
+// (pipelining do cliente); as respostas do lote saem num único send(),
+// depois do commit() do lote no WAL. O primeiro byte decide entre o
+// protocolo de texto e o binário.
+// ---------------------------------------------------------------------------
+void TcpServer::session(socket_t client_sock) {
+    auto s = make_shared<Session>(client_sock);
+
+    // Ao sair, os frames estacionados são retirados, continuações ainda
+    // pendentes não podem mais usar o socket, e as assinaturas acabam junto
+    // com o thread que as envia.
+    struct Closer {
+        Session&     s;
+        TupleServer& ts;
+        ~Closer() {
+            s.withdraw(ts);
+            {
+                lock_guard<mutex> lk(s.mtx);
+                s.open = false;
+            }
+            if (s.feed) {
+                s.feed->close();
+                s.pusher.join();
+                s.feed.reset();
+            }
+        }
+    } closer{*s, ts_};
+
+    enum { UNKNOWN, TEXT, BINARY } mode = UNKNOWN;
+    string in, out;
+    size_t pos = 0;  // início do próximo comando em `in`
+
+    // `in` acima de dois blocos (um frame grande chegando) conta no limite
+    // global de memória enquanto existir.
+    struct Held {
+        TupleServer& ts;
+        size_t       bytes = 0;
+        void set(size_t n) {
+            if (n > bytes)
+                ts.charge(n - bytes);
+            else if (n < bytes)
+                ts.refund(bytes - n);
+            bytes = n;
+        }
+        ~Held() { set(0); }
+    } held{ts_};
+
+    while (true) {
+        TupleServer::GroupCommit batch;
+        if (mode == UNKNOWN && pos < in.size()) {
+            mode = static_cast<unsigned char>(in[pos]) == protocol::BINARY_MAGIC
+                       ? BINARY : TEXT;
+            if (mode == BINARY)
+                ++pos;
+        }
+
+        if (mode == BINARY) {
+            while (in.size() - pos >= protocol::FRAME_HEADER) {
+                auto h = protocol::decode_header(&in[pos]);
+                if (h.value_len > ts_.limits().value_bytes)
+                    return;  // frame impossível: fluxo dessincronizado
+                size_t len = protocol::FRAME_HEADER + h.body_len();
+                if (in.size() - pos < len)
+                    break;  // `in` cresce com o que chegar, não pelo value_len
+                if (produces(h.opcode) && !throttle(*s, out))
+                    return;
+                const char* body = &in[pos] + protocol::FRAME_HEADER;
+                protocol::decode_trailer(h, body + h.key_len + h.value_len);
+                process_frame(h, string_view(body, h.key_len),
+                              string_view(body + h.key_len, h.value_len), s, out);
+                pos += len;
+            }
+        } else {
+            string_view line;
+            size_t      start = pos;
+            for (; protocol::next_line(in, pos, line); start = pos) {
+                if (line.empty())
+                    continue;
+                protocol::Command cmd;
+                if (!protocol::parse_command(line, cmd)) {
+                    out += "ERROR\n";
+                    continue;
+                }
+                if (produces(cmd) && !throttle(*s, out))
+                    return;
+                if (cmd.op == protocol::Command::MWR) {
+                    if (!write_batch(cmd, in, pos, out)) {
+                        pos = start;  // lote incompleto: espera o resto
+                        break;
+                    }
+                    continue;
+                }
+                if (!process_command(cmd, *s, out))
+                    return;
+            }
+        }
+        in.erase(0, pos);
+        pos = 0;
+        if (in.size() < READ_CHUNK && in.capacity() > 2 * READ_CHUNK)
+            in.shrink_to_fit();  // o frame grande já foi consumido
+        held.set(in.capacity() > 2 * READ_CHUNK ? in.capacity() : 0);
+
+        ts_.commit();
+        if (!out.empty()) {
+            if (!s->send(out))
+                return;
+            out.clear();
+        }
+
+        // Lê direto para o fim do buffer de entrada.
+        size_t old = in.size();
+        in.resize(old + READ_CHUNK);
+        long n = net::recv_some(client_sock, &in[old], READ_CHUNK);
+        if (n == 0) {
+            s->withdraw(ts_);  // ninguém espera mais pelo que estava estacionado
+            s->drain(ts_);
+        }
+        if (n <= 0)
+            return;   // 0 = conexão encerrada; -1 = erro
+        in.resize(old + static_cast<size_t>(n));
+        held.set(in.capacity() > 2 * READ_CHUNK ? in.capacity() : 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// throttle(): backpressure global. Acima do limite de memória, o WR/MWR
+// espera aqui sem ler o socket (o TCP segura o cliente); as respostas já
+// acumuladas saem antes, pois podem ser o que falta para o uso cair.
+// ---------------------------------------------------------------------------
+bool TcpServer::throttle(Session& s, string& out) {
+    if (!ts_.over_high_water())
+        return true;
+    ts_.commit();
+    if (!out.empty()) {
+        if (!s.send(out))
+            return false;
+        out.clear();
+    }
+    ts_.wait_high_water();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// process_command(): despacho para o TupleServer. A resposta é
+// acrescentada a `out`. Se a operação precisar esperar, as respostas já
+// acumuladas são enviadas antes (o cliente pode depender delas para
+// produzir a tupla esperada). Retorna false se a conexão caiu.
+// ---------------------------------------------------------------------------
+bool TcpServer::process_command(const protocol::Command& cmd, Session& s, string& out) {
+    using protocol::Command;
+
+    Metrics::Span span(metrics_, cmd.op);  // a espera do await_result() inclusive
+    if (cmd.op == Command::MRD) {
+        read_batch(cmd, out);
+        return true;
+    }
+    if (cmd.op == Command::EXALL) {
+        transform_batch(cmd, out);
+        return true;
+    }
+    if (cmd.is_admin()) {
+        admin(cmd, out);
+        return true;
+    }
+    if (cmd.op == Command::HALFCLOSE) {
+        s.half_close = true;
+        out += "OK\n";
+        return true;
+    }
+    if (cmd.is_subscription()) {
+        subscription(cmd, feed_of(s, false));
+        out += "OK\n";
+        return true;
+    }
+    if (cmd.op == Command::INN && take_batch(cmd, out))
+        return true;
+
+    // INN que precisa esperar recebe só a tupla que o acordar; WR e EX já
+    // respondem com o status ("OK"/"FULL"/"NO-SERVICE").
+    const char* pfx  = cmd.op == Command::EX || cmd.op == Command::WR ? ""
+                       : cmd.op == Command::INN                       ? "OK 1\n"
+                                                                      : "OK ";
+    size_t      mark = out.size();
+    out += pfx;
+
+    // Tenta atender na hora; só se precisar esperar é que o lote pendente
+    // vai para o socket e o thread bloqueia.
+    if (!try_execute(cmd, out, nullptr)) {
+        out.resize(mark);
+        string result;
+        switch (cmd.may_block() ? await_result(cmd, s, out, result) : Await::TIMEOUT) {
+        case Await::CLOSED:
+            return false;
+        case Await::TIMEOUT:
+            out += "NO-TUPLE\n";
+            return true;
+        case Await::READY:
+            break;
+        }
+        out += pfx;
+        out += result;
+    }
+    if (cmd.is_match())
+        match_text(out, mark + 3);  // depois do "OK "
+    out += '\n';
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// await_result(): espera no thread da sessão. Enquanto espera, o thread não
+// lê o socket; a cada CLOSE_CHECK ele olha se o cliente foi embora e, se
+// foi, retira a operação (sem consumir nada) e libera o thread. Com
+// HALFCLOSE, só a queda da conexão conta: quem só fechou o envio continua
+// esperando a resposta.
+// ---------------------------------------------------------------------------
+
+TcpServer::Await TcpServer::await_result(const protocol::Command& cmd, Session& s,
+                                         string& out, string& result) {
+    auto                waiting = make_shared<promise<string>>();
+    TupleServer::Ticket ticket;
+    auto done = [waiting](string r) { waiting->set_value(move(r)); };
+    // Um WR pode ter chegado entre a tentativa e o estacionamento.
+    if (try_execute(cmd, result, move(done), &ticket))
+        return Await::READY;
+
+    if (!out.empty()) {
+        ts_.commit();
+        if (!s.send(out)) {
+            ts_.cancel(ticket);
+            return Await::CLOSED;
+        }
+        out.clear();
+    }
+    auto future   = waiting->get_future();
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(cmd.timeout_ms);
+    while (true) {
+        auto slice = CLOSE_CHECK;
+        if (cmd.timeout_ms > 0)
+            slice = min(slice, chrono::duration_cast<chrono::milliseconds>(
+                                   deadline - chrono::steady_clock::now()));
+        if (future.wait_for(slice) == future_status::ready)
+            break;
+        // cancel() falho: a resposta já está a caminho, future.get() a pega.
+        bool gone = s.half_close ? net::peer_gone(s.sock) : net::peer_closed(s.sock);
+        if (gone && ts_.cancel(ticket))
+            return Await::CLOSED;
+        if (cmd.timeout_ms > 0 && chrono::steady_clock::now() >= deadline &&
+            ts_.cancel(ticket))
+            return Await::TIMEOUT;
+    }
+    result = future.get();
+    return Await::READY;
+}
+
+// ---------------------------------------------------------------------------
+// feed_of() / push_loop(): as tuplas assinadas saem por um thread próprio
+// da sessão, que bloqueia no envio sem prender o despacho (só o buffer
+// limitado do Feed cresce). Um Feed cortado (DISCONNECT) derruba a
+// conexão: shutdown() faz o recv() da sessão retornar.
+// ---------------------------------------------------------------------------
+Subscriptions::Feed& TcpServer::feed_of(Session& s, bool binary) {
+    if (!s.feed) {
+        s.feed   = ts_.subscriptions().open();
+        s.pusher = thread([&s, binary]() { push_loop(s, binary); });
+    }
+    return *s.feed;
+}
+
+void TcpServer::push_loop(Session& s, bool binary) {
+    vector<Subscriptions::EventPtr> events;
+    uint64_t                        lost = 0;
+    string                          out;
+    while (s.feed->wait(events, lost)) {
+        out.clear();
+        append_pushes(out, binary, events, lost);
+        events.clear();
+        if (!s.send(out))
+            return;
+    }
+    if (s.feed->cut())
+        net::shutdown_socket(s.sock);
+}
+
+// ---------------------------------------------------------------------------
+// process_frame(): protocolo binário. Uma operação que precisa esperar não
+// bloqueia a sessão: a continuação envia a resposta (identificada pelo
+// request_id) quando o WR chegar, do próprio thread que escreveu.
+// ---------------------------------------------------------------------------
+void TcpServer::process_frame(const protocol::FrameHeader& h, string_view key,
+                              string_view value, const shared_ptr<Session>& s,
+                              string& out) {
+    using protocol::Command;
+
+    Command cmd;
+    if (!protocol::frame_to_command(h, key, value, cmd)) {
+        protocol::append_reply(out, protocol::ST_ERROR, h.opcode, h.id, {});
+        return;
+    }
+    Metrics::Span span(metrics_, cmd.op);
+    switch (cmd.op) {
+    case Command::MWR: write_batch_frame(h, cmd, out); return;
+    case Command::MRD: read_batch_frame(h, cmd, out);  return;
+    case Command::EXALL: transform_batch_frame(h, cmd, out); return;
+    case Command::SUB:
+    case Command::UNSUB:
+        subscription(cmd, feed_of(*s, true));
+        protocol::append_reply(out, protocol::ST_OK, h.opcode, h.id, {});
+        return;
+    case Command::INN:
+        if (take_batch_frame(h, cmd, out))
+            return;
+        break;
+    default:
+        break;
+    }
+
+    // INN que precisa esperar recebe só a tupla que o acordar, num registro.
+    bool   is_inn = cmd.op == Command::INN;
+    size_t at     = protocol::begin_reply(out, protocol::ST_OK, h.opcode, h.id);
+    size_t rec    = is_inn ? protocol::begin_record(out) : 0;
+    if (!try_execute(cmd, out, nullptr)) {
+        if (!cmd.may_block()) {
+            out.resize(at);
+            protocol::append_reply(out, protocol::ST_NO_TUPLE, h.opcode, h.id, {});
+            return;
+        }
+
+        // Sem event loop para os prazos: um frame com timeout espera no
+        // próprio thread da sessão (os demais continuam fora de ordem).
+        if (cmd.timeout_ms > 0) {
+            out.resize(at);
+            string result;
+            switch (await_result(cmd, *s, out, result)) {
+            case Await::CLOSED:
+                return;  // o próximo recv() encerra a sessão
+            case Await::TIMEOUT:
+                protocol::append_reply(out, protocol::ST_NO_TUPLE, h.opcode, h.id, {});
+                return;
+            case Await::READY:
+                break;
+            }
+            at  = protocol::begin_reply(out, protocol::ST_OK, h.opcode, h.id);
+            rec = is_inn ? protocol::begin_record(out) : 0;
+            out += result;
+        } else {
+            bool status = cmd.op == Command::EX || cmd.op == Command::WR;
+            // Conta antes de estacionar: a continuação pode rodar a qualquer
+            // momento depois disso.
+            Session::Tickets::iterator ticket;
+            {
+                lock_guard<mutex> lk(s->mtx);
+                ++s->outstanding;
+                ticket = s->tickets.emplace(s->tickets.end());
+            }
+            auto later  = [this, s, ticket, status, is_inn, op = h.opcode, id = h.id,
+                           start = span.start()](string result) {
+                metrics_.end(start);
+                string frame;
+                if (status) {
+                    protocol::append_reply(frame, result_status(result), op, id, {});
+                } else if (is_inn) {
+                    size_t at = protocol::begin_reply(frame, protocol::ST_OK, op, id);
+                    protocol::append_record(frame, result);
+                    protocol::finish_reply(frame, at);
+                } else {
+                    protocol::append_reply(frame, protocol::ST_OK, op, id, result);
+                }
+                s->answer(frame, ticket);
+            };
+            if (!try_execute(cmd, out, move(later), &*ticket)) {
+                out.resize(at);
+                span.release();
+                return;
+            }
+            lock_guard<mutex> lk(s->mtx);
+            s->tickets.erase(ticket);
+            --s->outstanding;  // atendido na segunda tentativa
+        }
+    }
+
+    if (cmd.op == Command::EX || cmd.op == Command::WR) {
+        // EX/WR acrescentaram "OK"/"NO-SERVICE"/"FULL": vira o status do frame.
+        size_t res = at + protocol::REPLY_HEADER;
+        out[at]    = static_cast<char>(result_status(string_view(out).substr(res)));
+        out.resize(res);
+    }
+    if (is_inn)
+        protocol::finish_record(out, rec);
+    protocol::finish_reply(out, at);
+}
+
+#endif  // !LINDA_USE_EPOLL
@@ -1,10 +1,25 @@
+#include "histogram.hpp"
 #include "main.hpp"
+#include "metrics.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
+#include "simd.hpp"
+#include "tcp_server.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <future>
 #include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -30,6 +45,175 @@ static int failed = 0;
     }                                   \
 } while (0)
 
+// Parser original (istringstream), mantido como referência para o teste
+// diferencial do parser sem alocação (protocol::parse_command), com o
+// prazo opcional de RD/IN/EX e os verbos RDP/INP.
+// Retorna a resposta "ERROR" ou uma descrição canônica do comando.
+static string reference_parse(const string& line) {
+    istringstream iss(line);
+    string cmd;
+    if (!(iss >> cmd))
+        return "ERROR";
+
+    if (cmd == "WR") {
+        string key;
+        if (!(iss >> key))
+            return "ERROR";
+        string value;
+        getline(iss, value);
+        if (!value.empty() && value.front() == ' ')
+            value.erase(0, 1);
+        return "WR|" + key + "|" + value;
+    }
+    // Prazo: só conta um inteiro >= 0 logo após os argumentos.
+    auto timeout = [&iss]() {
+        int t;
+        return (iss >> t) && t >= 0 ? "|t=" + to_string(t) : string();
+    };
+    if (cmd == "RD" || cmd == "IN") {
+        string key;
+        if (!(iss >> key))
+            return "ERROR";
+        return cmd + "|" + key + timeout();
+    }
+    if (cmd == "RDP" || cmd == "INP") {
+        string key;
+        if (!(iss >> key))
+            return "ERROR";
+        return cmd + "|" + key;
+    }
+    if (cmd == "EX") {
+        string k_in, k_out;
+        int    svc_id;
+        if (!(iss >> k_in))   return "ERROR";
+        if (!(iss >> k_out))  return "ERROR";
+        if (!(iss >> svc_id)) return "ERROR";
+        return "EX|" + k_in + "|" + k_out + "|" + to_string(svc_id) + timeout();
+    }
+    return "ERROR";
+}
+
+static string describe(const protocol::Command& c) {
+    using protocol::Command;
+    string t = c.timeout_ms >= 0 ? "|t=" + to_string(c.timeout_ms) : string();
+    string chain;  // svc_ids de um pipeline além do primeiro
+    for (size_t i = 1; i < c.stages && (c.op == Command::EX || c.op == Command::EXALL); ++i)
+        chain += "," + to_string(c.chain[i]);
+    t = chain + t;
+    switch (c.op) {
+    case Command::WR:
+        return "WR|" + string(c.key) + "|" + string(c.value) +
+               (c.ttl_ms >= 0 ? "|ttl=" + to_string(c.ttl_ms) : string());
+    case Command::RD:  return "RD|" + string(c.key) + t;
+    case Command::IN:  return "IN|" + string(c.key) + t;
+    case Command::RDP: return "RDP|" + string(c.key);
+    case Command::INP: return "INP|" + string(c.key);
+    case Command::EX:
+        return "EX|" + string(c.key) + "|" + string(c.value) + "|" +
+               to_string(c.svc_id) + t;
+    case Command::MWR: return "MWR|" + to_string(c.count);
+    case Command::INN: return "INN|" + string(c.key) + "|" + to_string(c.count) + t;
+    case Command::MRD: return "MRD|" + string(c.value);
+    case Command::EXALL:
+        return "EXALL|" + string(c.key) + "|" + string(c.value) + "|" + to_string(c.svc_id) + t;
+    case Command::LOAD:   return "LOAD|" + string(c.key);
+    case Command::UNLOAD: return "UNLOAD|" + to_string(c.svc_id);
+    case Command::SUB:    return "SUB|" + string(c.key);
+    case Command::UNSUB:  return "UNSUB|" + string(c.key);
+    case Command::RDM:    return "RDM|" + string(c.key) + t;
+    case Command::INM:    return "INM|" + string(c.key) + t;
+    case Command::HALFCLOSE: return "HALFCLOSE";
+    case Command::STATS:  return "STATS";
+    }
+    return "?";
+}
+
+// Servidor TCP de verdade para os testes de ponta a ponta: um espaço
+// próprio e um TcpServer numa porta livre (55100-55199), rodando num thread
+// destacado até o fim do processo (run() não retorna). Nunca destruídos.
+static TupleServer& net_space() {
+    static TupleServer* ts = new TupleServer(2);
+    return *ts;
+}
+
+static unsigned short net_port() {
+    static unsigned short port = [] {
+        for (unsigned short p = 55100; p < 55200; ++p) {
+            try {
+                auto* srv = new TcpServer(net_space(), p, 1);
+                thread([srv] { srv->run(); }).detach();
+                return p;
+            } catch (const exception&) {
+            }
+        }
+        return (unsigned short)0;
+    }();
+    return port;
+}
+
+// Conexão de cliente ao servidor de teste (timeouts de 2 s).
+static socket_t connect_to(unsigned short port) {
+    socket_t s = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in   addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (s == INVALID_SOCK) return s;
+    if (::connect(s, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        net::close_socket(s);
+        return INVALID_SOCK;
+    }
+    net::set_timeouts(s, 2000);
+    return s;
+}
+
+static bool send_all(socket_t s, const string& data) {
+    for (size_t off = 0; off < data.size();) {
+        long n = net::send_some(s, data.data() + off, data.size() - off);
+        if (n <= 0) return false;
+        off += size_t(n);
+    }
+    return true;
+}
+
+// Lê até `lines` respostas completas (ou o timeout / fim da conexão).
+static string read_lines(socket_t s, size_t lines) {
+    string out;
+    char   buf[256];
+    while (size_t(count(out.begin(), out.end(), '\n')) < lines) {
+        long n = net::recv_some(s, buf, sizeof(buf));
+        if (n <= 0) break;
+        out.append(buf, size_t(n));
+    }
+    return out;
+}
+
+// Espera (até ~2 s) uma condição observada de outro thread.
+template <typename Pred> static bool eventually(Pred pred) {
+    for (int i = 0; i < 200; ++i) {
+        if (pred()) return true;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    return pred();
+}
+
+// Arquivos de um WAL de teste (segmentos e snapshot), em ordem de nome.
+static vector<string> wal_files(const string& base) {
+    filesystem::path p(base);
+    string           prefix = p.filename().string() + ".";
+    vector<string>   out;
+    for (auto& ent : filesystem::directory_iterator(p.parent_path()))
+        if (ent.path().filename().string().rfind(prefix, 0) == 0)
+            out.push_back(ent.path().string());
+    sort(out.begin(), out.end());
+    return out;
+}
+
+static void remove_wal(const string& base) {
+    for (auto& f : wal_files(base))
+        filesystem::remove(f);
+}
+
 int main() {
     cout << "=== Testes do Espaco de Tuplas (TupleServer) ===\n";
     TupleServer ts;
@@ -200,6 +384,1838 @@ int main() {
         CHECK_EQ(ts.rd("ex_block_out"), "HELLO", "EX bloqueante: resultado correto");
     }
 
+    // ---------------------------------------------------------------
+    // 11) Continuações (backend epoll): operação estacionada não prende
+    //     thread e é completada pelo WR, em ordem de chegada.
+    // ---------------------------------------------------------------
+    {
+        string out;
+        ts.write("async_now", "pronto");
+        CHECK(ts.rd_async("async_now", out, [](string) {}),
+              "rd_async com tupla existente completa na hora");
+        CHECK_EQ(out, "pronto", "rd_async devolve o valor em out");
+
+        vector<string> got;
+        auto record = [&got](string tag) {
+            return [&got, tag](string v) { got.push_back(tag + "=" + v); };
+        };
+        CHECK(!ts.rd_async("async_k", out, record("rd")),
+              "rd_async sem tupla estaciona a continuacao");
+        CHECK(!ts.in_async("async_k", out, record("in1")),
+              "in_async sem tupla estaciona a continuacao");
+        CHECK(!ts.in_async("async_k", out, record("in2")),
+              "segundo in_async tambem estaciona");
+
+        ts.write("async_k", "a");
+        CHECK_EQ(got.size(), size_t(2), "WR atende o RD e apenas um IN");
+        CHECK_EQ(got[0] + "," + got[1], string("rd=a,in1=a"),
+                 "continuacoes servidas em ordem de chegada");
+
+        ts.write("async_k", "b");
+        CHECK_EQ(got.back(), string("in2=b"), "segundo WR atende o segundo IN");
+
+        string ex_result;
+        CHECK(!ts.ex_async("async_ex_in", "async_ex_out", 2, out,
+                           [&ex_result](string r) { ex_result = r; }),
+              "ex_async sem tupla estaciona");
+        ts.write("async_ex_in", "abc");
+        CHECK_EQ(ex_result, string("OK"), "ex_async completa com OK");
+        CHECK_EQ(ts.rd("async_ex_out"), "cba", "ex_async publica o resultado");
+    }
+
+    // ---------------------------------------------------------------
+    // 12) Shards: semântica idêntica com 1 ou vários shards; EX entre
+    //     chaves de shards diferentes consome k_in e publica em k_out.
+    // ---------------------------------------------------------------
+    {
+        TupleServer single(1);
+        CHECK_EQ(single.shard_count(), size_t(1), "TupleServer(1) tem um shard");
+        single.write("s", "um");
+        single.write("s", "dois");
+        CHECK_EQ(single.in("s"), "um", "1 shard: FIFO preservado");
+
+        TupleServer sharded(8);
+        CHECK_EQ(sharded.shard_count(), size_t(8), "TupleServer(8) tem oito shards");
+
+        // Com 8 shards, FNV-1a põe "cross_in" no shard 3 e "cross_out" no 0.
+        const string k_in = "cross_in", k_out = "cross_out";
+
+        sharded.write(k_in, "abc");
+        CHECK_EQ(sharded.ex(k_in, k_out, 1), "OK", "EX entre shards retorna OK");
+        CHECK_EQ(sharded.in(k_out), "ABC", "EX entre shards publica em k_out");
+
+        string out;
+        CHECK(!sharded.rd_async(k_in, out, [](string) {}),
+              "EX entre shards consumiu k_in");
+    }
+
+    // ---------------------------------------------------------------
+    // 13) Waiters por chave: um WR acorda todos os RDs e exatamente um
+    //     IN, e os INs bloqueados são servidos em ordem de chegada.
+    // ---------------------------------------------------------------
+    {
+        const string key = "fila_waiters";
+        string first, second, reader;
+
+        thread in1([&]() { first = ts.in(key); });
+        this_thread::sleep_for(chrono::milliseconds(5));
+        thread in2([&]() { second = ts.in(key); });
+        this_thread::sleep_for(chrono::milliseconds(5));
+        thread rd1([&]() { reader = ts.rd(key); });
+        this_thread::sleep_for(chrono::milliseconds(5));
+
+        ts.write(key, "v1");
+        in1.join();
+        rd1.join();
+        CHECK_EQ(first,  "v1", "WR entrega ao IN mais antigo");
+        CHECK_EQ(reader, "v1", "mesmo WR entrega copia ao RD pendente");
+
+        // Outra chave nao acorda o segundo IN.
+        ts.write("outra_chave", "x");
+        ts.write(key, "v2");
+        in2.join();
+        CHECK_EQ(second, "v2", "segundo IN recebe o WR seguinte");
+
+        string out;
+        CHECK(!ts.rd_async(key, out, [](string) {}),
+              "tuplas entregues a waiters nao ficam na fila");
+        ts.write(key, "fim");
+    }
+
+    // ---------------------------------------------------------------
+    // 14) Parser sem alocação: fuzz diferencial contra o parser original
+    //     (mesmo aceite/rejeição, mesmos campos, mesmo "ERROR").
+    // ---------------------------------------------------------------
+    {
+        static const char* pieces[] = {
+            "WR", "RD", "IN", "EX", "RDP", "INP", "wr", "W", "WRX", " ", " ", " ", "\t", "\v",
+            "\f", "a", "bc", "k1", "0", "1", "42", "-", "+", "-7", "+3", "12x",
+            "2147483647", "2147483648", "-2147483648", "-2147483649",
+            "99999999999999999999", "007", "x y", "\xc3\xa9",
+        };
+        mt19937 rng(12345);
+        int mismatches = 0;
+        string first_bad;
+        for (int i = 0; i < 200000; ++i) {
+            string line;
+            int n = static_cast<int>(rng() % 8);
+            // Comandos válidos aparecem mais: começa com um verbo na maioria.
+            if (rng() % 4 != 0)
+                line += pieces[rng() % 6], line += ' ';
+            for (int j = 0; j < n; ++j)
+                line += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+
+            protocol::Command cmd;
+            string got  = protocol::parse_command(line, cmd) ? describe(cmd) : "ERROR";
+            string want = reference_parse(line);
+            if (got != want && mismatches++ == 0)
+                first_bad = "\"" + line + "\": " + got + " != " + want;
+        }
+        CHECK(mismatches == 0, "fuzz: parse_command identico ao parser original" +
+                               (first_bad.empty() ? string() : " (" + first_bad + ")"));
+
+        string buf = "WR a b\r\nRD\ra\n\nINCOMPLETO";
+        size_t pos = 0;
+        string_view line;
+        vector<string> lines;
+        while (protocol::next_line(buf, pos, line))
+            lines.emplace_back(line);
+        CHECK_EQ(lines.size(), size_t(3), "next_line separa apenas linhas completas");
+        CHECK_EQ(lines[0] + "|" + lines[1] + "|" + lines[2], string("WR a b|RDa|"),
+                 "next_line remove '\\r' em qualquer posicao");
+        CHECK_EQ(buf.substr(pos), string("INCOMPLETO"), "resto fica no buffer");
+    }
+
+    // ---------------------------------------------------------------
+    // 15) Protocolo binário: ida e volta de requisições e respostas.
+    // ---------------------------------------------------------------
+    {
+        string value("a\nb\0c", 5);  // qualquer byte, inclusive '\n' e '\0'
+        string buf;
+        protocol::append_request(buf, protocol::OP_WR, 7, "chave", value);
+        protocol::append_request(buf, protocol::OP_EX, 0xA1B2C3D4u, "in", "out", 3);
+        CHECK_EQ(buf.size(), 2 * protocol::FRAME_HEADER + 5 + 5 + 2 + 3,
+                 "frames com cabecalho de 16 bytes");
+
+        auto h = protocol::decode_header(buf.data());
+        CHECK(h.opcode == protocol::OP_WR && h.id == 7 && h.key_len == 5 &&
+              h.value_len == 5, "decode_header do WR");
+        const char* body = buf.data() + protocol::FRAME_HEADER;
+        protocol::Command cmd;
+        CHECK(protocol::frame_to_command(h, string_view(body, h.key_len),
+                                         string_view(body + h.key_len, h.value_len), cmd) &&
+              cmd.op == protocol::Command::WR && cmd.key == "chave" && cmd.value == value,
+              "frame_to_command preserva o valor binario");
+
+        auto h2 = protocol::decode_header(buf.data() + protocol::FRAME_HEADER + h.body_len());
+        body    = buf.data() + 2 * protocol::FRAME_HEADER + h.body_len();
+        CHECK(h2.id == 0xA1B2C3D4u &&
+              protocol::frame_to_command(h2, string_view(body, h2.key_len),
+                                         string_view(body + h2.key_len, h2.value_len), cmd) &&
+              cmd.op == protocol::Command::EX && cmd.key == "in" && cmd.value == "out" &&
+              cmd.svc_id == 3, "EX: chave de saida no valor, svc_id em arg");
+
+        h.opcode = 42;
+        CHECK(!protocol::frame_to_command(h, {}, {}, cmd), "opcode desconhecido rejeitado");
+
+        string out;
+        size_t at = protocol::begin_reply(out, protocol::ST_OK, protocol::OP_RD, 9);
+        out += value;
+        protocol::finish_reply(out, at);
+        CHECK_EQ(out.size(), protocol::REPLY_HEADER + value.size(), "resposta com cabecalho de 12 bytes");
+        CHECK(static_cast<unsigned char>(out[0]) == protocol::ST_OK &&
+              static_cast<unsigned char>(out[1]) == protocol::OP_RD &&
+              out.compare(4, 8, string("\0\0\0\x09\0\0\0\x05", 8)) == 0 &&
+              out.substr(protocol::REPLY_HEADER) == value,
+              "begin_reply/finish_reply: id e tamanho em big-endian");
+    }
+
+    // ---------------------------------------------------------------
+    // 16) RDP/INP e operações com prazo: nada é consumido no timeout.
+    // ---------------------------------------------------------------
+    {
+        using namespace std::chrono;
+        string v = "intocado";
+        CHECK(!ts.rdp("prazo", v) && !ts.inp("prazo", v) && v == "intocado",
+              "RDP/INP sem tupla retornam false na hora");
+        ts.write("prazo", "p1");
+        CHECK(ts.rdp("prazo", v) && v == "p1", "RDP le sem remover");
+        CHECK(ts.inp("prazo", v) && v == "p1" && !ts.rdp("prazo", v), "INP remove");
+
+        auto t0 = steady_clock::now();
+        CHECK(!ts.in_for("prazo", milliseconds(30), v), "IN com prazo expira sem tupla");
+        CHECK(steady_clock::now() - t0 >= milliseconds(30), "IN esperou o prazo");
+        CHECK(!ts.ex_for("prazo", "prazo_out", 1, milliseconds(0), v),
+              "EX com prazo zero nao bloqueia");
+
+        // Um waiter que expirou não pode roubar a tupla de quem chega depois.
+        ts.write("prazo", "p2");
+        CHECK(ts.in_for("prazo", milliseconds(10), v) && v == "p2",
+              "IN com prazo e tupla disponivel");
+
+        thread writer([&ts]() {
+            this_thread::sleep_for(milliseconds(20));
+            ts.write("prazo", "p3");
+        });
+        CHECK(ts.ex_for("prazo", "prazo_out", 1, seconds(5), v) && v == "OK",
+              "EX com prazo atendido por WR de outro thread");
+        writer.join();
+        CHECK_EQ(ts.in("prazo_out"), string("P3"), "EX com prazo publicou o resultado");
+
+        // cancel(): a continuação não roda e a tupla seguinte fica na fila.
+        TupleServer::Ticket ticket;
+        bool   called = false;
+        string out;
+        CHECK(!ts.in_async("cancela", out, [&called](string) { called = true; }, &ticket),
+              "IN assincrono estaciona");
+        CHECK(ts.cancel(ticket), "cancel retira a operacao da fila");
+        CHECK(!ts.cancel(ticket), "cancel repetido retorna false");
+        ts.write("cancela", "c1");
+        CHECK(!called && ts.rdp("cancela", v) && v == "c1",
+              "operacao cancelada nao consome o WR seguinte");
+
+        CHECK(!ts.rd_async("cancela2", out, [&called](string) { called = true; }, &ticket),
+              "RD assincrono estaciona");
+        ts.write("cancela2", "c2");
+        CHECK(called && !ts.cancel(ticket), "cancel depois da entrega retorna false");
+    }
+
+    // ---------------------------------------------------------------
+    // 17) Lotes: MWR atômico, INN e MRD.
+    // ---------------------------------------------------------------
+    {
+        TupleServer ls(8);
+        string      got;
+        thread waiter([&ls, &got]() { got = ls.in("lote_a"); });
+        this_thread::sleep_for(chrono::milliseconds(20));
+
+        ls.write_many({{"lote_a", "a1"}, {"lote_b", "b1"}, {"lote_a", "a2"},
+                       {"lote_a", "a3"}, {"lote_c", "c1"}});
+        waiter.join();
+        CHECK_EQ(got, string("a1"), "MWR atende o waiter com a primeira tupla da chave");
+
+        auto vals = ls.in_many("lote_a", 10);
+        CHECK(vals == vector<string>({"a2", "a3"}), "INN leva ate n tuplas, em ordem FIFO");
+        vector<string> none;
+        CHECK_EQ(ls.inp_many("lote_a", 5, none), size_t(0), "INN sem bloquear: nada disponivel");
+
+        ls.write_many({{"lote_b", "b2"}, {"lote_b", "b3"}});
+        vals.clear();
+        CHECK(ls.inp_many("lote_b", 2, vals) == 2 && vals[0] == "b1" && vals[1] == "b2",
+              "INN respeita o limite n");
+
+        auto rds = ls.rd_many({"lote_b", "nenhuma", "lote_c", "lote_b"});
+        CHECK(rds.size() == 4 && rds[0] == string("b3") && !rds[1] &&
+              rds[2] == string("c1") && rds[3] == string("b3"),
+              "MRD le varias chaves sem remover");
+
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("MWR 3", cmd) && describe(cmd) == "MWR|3",
+              "parse: MWR n");
+        CHECK(protocol::parse_command("INN k 5 100", cmd) && describe(cmd) == "INN|k|5|t=100",
+              "parse: INN chave n prazo");
+        CHECK(!protocol::parse_command("INN k 0", cmd) && !protocol::parse_command("MWR", cmd) &&
+              !protocol::parse_command("MRD", cmd), "parse: lotes vazios sao ERROR");
+        CHECK(protocol::parse_command("MRD a  b", cmd) && describe(cmd) == "MRD|a  b",
+              "parse: MRD com as chaves");
+
+        string buf = "MWR 2\nk v\r\nk2\r v2";
+        size_t pos = 0;
+        string_view line;
+        protocol::next_line(buf, pos, line);
+        CHECK(!protocol::has_lines(buf, pos, 2), "has_lines: lote incompleto");
+        buf += "\n";
+        CHECK(protocol::has_lines(buf, pos, 2), "has_lines: lote completo");
+        size_t again = pos;
+        protocol::next_line(buf, pos, line);
+        protocol::next_line(buf, pos, line);
+        string first = string(line);
+        protocol::next_line(buf, again, line);
+        protocol::next_line(buf, again, line);
+        CHECK(first == "k2 v2" && line == first, "next_line relida da o mesmo resultado");
+
+        string recs;
+        protocol::append_record(recs, "um");
+        protocol::append_missing(recs);
+        string_view rest = recs, rec;
+        CHECK(protocol::next_record(rest, rec) && rec == "um" &&
+              !protocol::next_record(rest, rec) && rest.size() == 4,
+              "registros: valor e marcador de ausente");
+    }
+
+    // ---------------------------------------------------------------
+    // 18) WAL: releitura reconstrói as filas; cauda corrompida é
+    //     descartada; group commit junta as mutações de um lote.
+    // ---------------------------------------------------------------
+    cout << "\n--- WAL ---\n";
+    {
+        string path = (filesystem::temp_directory_path() / "linda_tests.wal").string();
+        remove_wal(path);
+        Wal::Options opt{path, Wal::Sync::ALWAYS, chrono::milliseconds(10)};
+
+        {
+            TupleServer ts(4);
+            ts.open_wal(opt);
+            ts.write("fila", "a1");
+            ts.write_many({{"fila", "a2"}, {"fila", "a3"}, {"outra", "b"}});
+            ts.in("fila");
+            ts.write("x", "abc");
+            ts.ex("x", "y", 1);
+            vector<string> taken;
+            ts.inp_many("outra", 5, taken);
+
+            // Entregue direto ao IN estacionado: não passa pela fila.
+            string got;
+            ts.in_async("h", got, [&got](string v) { got = move(v); });
+            ts.write("h", "direto");
+            CHECK_EQ(got, string("direto"), "WAL: WR entregue ao waiter");
+        }
+
+        TupleServer ts(2);  // outro número de shards: o log não depende dele
+        ts.open_wal(opt);
+        vector<string> fila;
+        ts.inp_many("fila", 10, fila);
+        CHECK(fila == vector<string>({"a2", "a3"}), "WAL: fila reconstruída na ordem FIFO");
+        string v;
+        CHECK(ts.rdp("y", v) && v == "ABC", "WAL: saída do EX sobrevive ao reinício");
+        CHECK(!ts.rdp("x", v) && !ts.rdp("outra", v) && !ts.rdp("h", v),
+              "WAL: tuplas consumidas não voltam");
+
+        ts.write("z", "1");
+        ts.commit();
+        uint64_t before = ts.wal_log()->flush_count();
+        {
+            TupleServer::GroupCommit batch;
+            for (int i = 0; i < 200; ++i)
+                ts.write("lote", to_string(i));
+            ts.commit();
+        }
+        CHECK(ts.wal_log()->flush_count() - before < 20,
+              "WAL: group commit grava o lote em poucos fsyncs");
+    }
+    {
+        string path = (filesystem::temp_directory_path() / "linda_tests.wal").string();
+        string   last = wal_files(path).back();  // segmento aberto por último
+        uint64_t good = filesystem::file_size(last);
+        {
+            ofstream f(last, ios::binary | ios::app);
+            f << "lixo de uma escrita interrompida";
+        }
+        TupleServer ts;
+        ts.open_wal(Wal::Options{path, Wal::Sync::OS, chrono::milliseconds(1)});
+        CHECK_EQ(filesystem::file_size(last), good, "WAL: cauda corrompida é cortada");
+        string v;
+        CHECK(ts.rdp("z", v) && v == "1", "WAL: registros válidos antes da cauda");
+
+        Wal::Sync sync;
+        CHECK(Wal::parse_sync("interval", sync) && sync == Wal::Sync::INTERVAL &&
+              !Wal::parse_sync("nunca", sync), "WAL: nomes dos modos de sincronização");
+    }
+
+    // ---------------------------------------------------------------
+    // 19) Snapshots: partida a partir do snapshot + cauda do log,
+    //     segmentos antigos apagados, formato validado.
+    // ---------------------------------------------------------------
+    cout << "\n--- Snapshots ---\n";
+    {
+        string path = (filesystem::temp_directory_path() / "linda_tests.wal").string();
+        remove_wal(path);
+        Wal::Options opt{path, Wal::Sync::OS, chrono::milliseconds(1)};
+
+        {
+            TupleServer ts(4);
+            ts.open_wal(opt);
+            for (int i = 0; i < 5; ++i)
+                ts.write("fila", "v" + to_string(i));
+            ts.write("apagada", "x");
+            ts.in("fila");
+            CHECK(ts.write_snapshot(), "snapshot: gravado");
+
+            // Depois do snapshot: só no log.
+            ts.write("fila", "v5");
+            ts.in("fila");
+            ts.in("apagada");
+            ts.write("nova", "n");
+        }
+        size_t segments = wal_files(path).size() - 1;  // menos o .snap
+
+        {
+            TupleServer ts(8);
+            ts.open_wal(opt);
+            vector<string> fila;
+            ts.inp_many("fila", 10, fila);
+            CHECK(fila == vector<string>({"v2", "v3", "v4", "v5"}),
+                  "snapshot: frente no snapshot, cauda no log");
+            string v;
+            CHECK(!ts.rdp("apagada", v) && ts.rdp("nova", v) && v == "n",
+                  "snapshot: mutações posteriores ao corte reaplicadas");
+
+            // Fila parcialmente consumida do snapshot entra no próximo.
+            ts.write("fila", "w1");
+            ts.write("parcial", "p1");
+            CHECK(ts.write_snapshot(), "snapshot: segundo snapshot");
+        }
+        CHECK(segments <= 2 && wal_files(path).size() <= 3,
+              "snapshot: segmentos cobertos são apagados");
+        {
+            TupleServer ts;
+            ts.open_wal(opt);
+            string v;
+            CHECK(ts.rdp("fila", v) && v == "w1" && ts.rdp("parcial", v) && v == "p1" &&
+                  ts.rdp("nova", v) && v == "n", "snapshot: reinício sem log pendente");
+        }
+
+        {
+            fstream f(path + ".snap", ios::binary | ios::in | ios::out);
+            f.seekp(8);
+            f.put('\x7f');  // versão desconhecida
+        }
+        bool rejected = false;
+        try {
+            TupleServer ts;
+            ts.open_wal(opt);
+        } catch (const runtime_error&) {
+            rejected = true;
+        }
+        CHECK(rejected, "snapshot: versão desconhecida é recusada");
+        remove_wal(path);
+
+        // Snapshots com WR/IN em andamento: nada se perde nem duplica.
+        {
+            TupleServer    ts;
+            ts.open_wal(opt);
+            vector<thread> pool;
+            for (int t = 0; t < 4; ++t)
+                pool.emplace_back([&ts, t] {
+                    string key = "k" + to_string(t);
+                    for (int i = 0; i < 3000; ++i) {
+                        ts.write(key, to_string(i));
+                        if (i % 3 == 0)
+                            ts.in(key);
+                    }
+                });
+            for (int i = 0; i < 5; ++i)
+                ts.write_snapshot();
+            for (auto& th : pool)
+                th.join();
+        }
+        TupleServer ts;
+        ts.open_wal(opt);
+        bool intact = true;
+        for (int t = 0; t < 4; ++t) {
+            vector<string> got;
+            ts.inp_many("k" + to_string(t), 5000, got);
+            // Cada IN consome a mais antiga: sobram as de i = 1000..2999.
+            intact = intact && got.size() == 2000 && got.front() == "1000" && got.back() == "2999";
+        }
+        CHECK(intact, "snapshot: cortes por shard consistentes com o log");
+        remove_wal(path);
+    }
+
+    // ---------------------------------------------------------------
+    // 20) Índice de chaves: fila compacta, chaves drenadas saem do
+    //     índice, crescimento e encolhimento da tabela.
+    // ---------------------------------------------------------------
+    {
+        TupleQueue q;
+        for (int i = 0; i < 3; ++i)
+            q.push_back(to_string(i));
+        CHECK(q.pop_front() == "0" && q.pop_front() == "1", "TupleQueue: FIFO ao sair do inline");
+        for (int i = 3; i < 12; ++i)  // dá a volta no anel e cresce
+            q.push_back(to_string(i));
+        bool fifo = q.size() == 10 && q.front() == "2" && q.back() == "11" && q[5] == "7";
+        for (int i = 2; i < 12; ++i)
+            fifo = fifo && q.pop_front() == to_string(i);
+        CHECK(fifo && q.empty(), "TupleQueue: FIFO com volta e crescimento do anel");
+
+        TupleServer idx;
+        for (int i = 0; i < 1000; ++i) {
+            idx.write("resp:" + to_string(i), "ok");
+            idx.in("resp:" + to_string(i));
+        }
+        CHECK_EQ(idx.key_count(), size_t(0), "chaves de uso unico drenadas saem do indice");
+
+        string v, out;
+        idx.write("par", "a");
+        idx.write("par", "b");
+        idx.write_many({{"lote", "1"}, {"lote", "2"}});
+        vector<string> got;
+        idx.inp_many("lote", 10, got);
+        CHECK(idx.inp("par", v) && idx.key_count() == 1 && idx.inp("par", v) &&
+                  idx.key_count() == 0,
+              "INP e INN drenando a fila removem a chave");
+
+        // Um waiter mantém a chave; cancelamento e timeout a liberam.
+        TupleServer::Ticket ticket;
+        CHECK(!idx.in_async("espera", out, [](string) {}, &ticket) && idx.key_count() == 1,
+              "chave com waiter fica no indice");
+        CHECK(idx.cancel(ticket) && idx.key_count() == 0, "cancel libera a chave");
+        CHECK(!idx.in_for("espera", chrono::milliseconds(1), v) && idx.key_count() == 0,
+              "timeout libera a chave");
+
+        // WR entregue ao consumidor estacionado não deixa chave para trás.
+        string delivered;
+        idx.in_async("entrega", out, [&delivered](string s) { delivered = move(s); });
+        idx.write("entrega", "x");
+        CHECK(delivered == "x" && idx.key_count() == 0, "WR entregue direto nao deixa chave");
+        idx.in_async("entrega", out, [&delivered](string s) { delivered = move(s); });
+        idx.write_many({{"entrega", "y"}, {"entrega", "z"}});
+        CHECK(delivered == "y" && idx.inp("entrega", v) && v == "z" && idx.key_count() == 0,
+              "MWR entregue ao waiter e depois enfileirado na mesma chave");
+
+        // Muitas chaves: a tabela cresce e encolhe sem perder nenhuma.
+        const int N = 50000;
+        for (int i = 0; i < N; ++i)
+            idx.write("k" + to_string(i), to_string(i));
+        for (int i = 0; i < N; i += 2)
+            idx.inp("k" + to_string(i), v);
+        bool all = idx.key_count() == size_t(N / 2);
+        for (int i = 1; i < N; i += 2)
+            all = all && idx.rdp("k" + to_string(i), v) && v == to_string(i) &&
+                  !idx.rdp("k" + to_string(i - 1), v);
+        for (int i = 1; i < N; i += 2)
+            idx.inp("k" + to_string(i), v);
+        CHECK(all && idx.key_count() == 0, "indice com muitas chaves: busca e remocao");
+    }
+
+    // ---------------------------------------------------------------
+    // 21) Limites de memória: contagem de bytes, chave cheia (FULL ou
+    //     espera por vaga), MWR atômico e backpressure global.
+    // ---------------------------------------------------------------
+    {
+        TupleServer lim;
+        TupleServer::Limits l;
+        l.key_tuples = 2;
+        l.key_bytes  = 10;
+        l.block      = false;
+        lim.set_limits(l);
+
+        string v, out;
+        CHECK(lim.write("k", "abc") && lim.write("k", "de"), "WR dentro do limite");
+        CHECK(lim.bytes_used() == 5 && lim.key_bytes("k") == 5, "bytes contados por chave");
+        CHECK(!lim.write("k", "f") && lim.key_bytes("k") == 5, "chave com 2 tuplas: FULL");
+        CHECK(lim.write("grande", string(50, 'x')), "tupla maior que o limite cabe em fila vazia");
+        CHECK(!lim.write("grande", "y"), "chave acima de key_bytes: FULL");
+        CHECK(lim.write_async("k", string("g"), out, nullptr) && out == "FULL",
+              "write_async com a chave cheia responde FULL");
+        lim.inp("k", v);
+        CHECK(lim.key_bytes("k") == 2 && lim.write("k", "h"), "IN abre vaga");
+        CHECK(!lim.write_many({{"novo", "1"}, {"k", "2"}}) && lim.key_bytes("novo") == 0,
+              "MWR com uma chave cheia: nada é escrito");
+        CHECK(!lim.write_many({{"lote", "1"}, {"lote", "2"}, {"lote", "3"}}),
+              "MWR acima do limite na mesma chave");
+        CHECK(lim.write_many({{"lote", "1"}, {"lote", "2"}}), "MWR dentro do limite");
+
+        // O resultado do EX não passa pelo limite: o serviço já consumiu.
+        lim.write("ein", "x");
+        lim.write("eout", "1");
+        lim.write("eout", "2");
+        CHECK_EQ(lim.ex("ein", "eout", 1), "OK", "EX com a saída cheia");
+        CHECK_EQ(lim.key_bytes("eout"), size_t(3), "saída do EX acima do limite");
+        lim.inp("eout", v);
+        lim.inp("eout", v);
+        lim.inp("eout", v);
+        lim.inp("grande", v);
+        lim.inp("k", v);
+        lim.inp("k", v);
+        vector<string> rest;
+        lim.inp_many("lote", 10, rest);
+        CHECK_EQ(lim.bytes_used(), size_t(0), "filas drenadas: nenhum byte em uso");
+    }
+    {
+        // Política de espera: o WR fica parado até um IN abrir vaga.
+        TupleServer lim;
+        TupleServer::Limits l;
+        l.key_tuples = 1;
+        lim.set_limits(l);
+
+        lim.write("q", "1");
+        atomic<bool> wrote{false};
+        thread producer([&]() {
+            lim.write("q", "2");
+            wrote = true;
+        });
+        this_thread::sleep_for(chrono::milliseconds(50));
+        CHECK(!wrote.load(), "WR espera com a chave cheia");
+        CHECK_EQ(lim.in("q"), "1", "IN abre vaga");
+        producer.join();
+        CHECK(wrote.load() && lim.rd("q") == "2", "WR admitido depois do IN");
+
+        // Assíncrono: o WR estacionado entra quando um INN esvazia a fila.
+        string out, resumed;
+        CHECK(!lim.write_async("q", string("3"), out, [&resumed](string r) { resumed = r; }),
+              "write_async estaciona com a chave cheia");
+        vector<string> got;
+        lim.inp_many("q", 10, got);
+        CHECK(resumed == "OK" && got.size() == 1 && lim.rd("q") == "3",
+              "INN admite o WR estacionado");
+
+        // Cancelado, o WR estacionado não escreve nada.
+        TupleServer::Ticket ticket;
+        CHECK(!lim.write_async("q", string("4"), out, [](string) {}, &ticket) &&
+                  lim.cancel(ticket),
+              "WR estacionado pode ser cancelado");
+        CHECK(lim.in("q") == "3" && !lim.inp("q", out), "WR cancelado não escreve");
+    }
+    {
+        // Backpressure global: acima do limite, produtores esperam até o
+        // uso cair a 7/8 dele.
+        TupleServer lim;
+        TupleServer::Limits l;
+        l.high_water = 800;
+        lim.set_limits(l);
+
+        for (int i = 0; i < 9; ++i)
+            lim.write("hw", string(100, 'x'));
+        CHECK(lim.over_high_water(), "acima do limite global");
+        bool resumed = false;
+        CHECK(!lim.wait_high_water_async([&resumed]() { resumed = true; }),
+              "produtor retido acima do limite");
+        string v;
+        lim.inp("hw", v);
+        CHECK(!lim.over_high_water() && !resumed, "abaixo do limite, acima de 7/8: ainda retido");
+        lim.inp("hw", v);
+        CHECK(resumed, "produtor liberado a 7/8 do limite");
+        CHECK(lim.wait_high_water_async([]() {}), "abaixo do limite segue direto");
+
+        // Frames ainda chegando contam no limite como as filas.
+        lim.charge(300);
+        CHECK(lim.over_high_water() && lim.bytes_used() == 1000, "frame em recepção conta no uso");
+        resumed = false;
+        CHECK(!lim.wait_high_water_async([&resumed]() { resumed = true; }),
+              "produtor retido pelo frame em recepção");
+        lim.refund(300);
+        CHECK(resumed && lim.bytes_used() == 700, "refund() libera o produtor retido");
+    }
+
+    // ---------------------------------------------------------------
+    // 22) Pool de serviços do EX: modos de confirmação, limite de
+    //     concorrência por serviço e roubo de tarefas entre workers.
+    // ---------------------------------------------------------------
+    {
+        ServicePool::Ack ack;
+        CHECK(ServicePool::parse_ack("consume", ack) && ack == ServicePool::Ack::CONSUME &&
+                  !ServicePool::parse_ack("never", ack),
+              "parse_ack");
+
+        TupleServer pub;
+        ServicePool::Options opt;
+        opt.workers = 2;
+        pub.start_service_pool(opt);
+        CHECK(pub.ex_deferred(), "modo PUBLISH: resposta espera o worker");
+
+        pub.write("pin", "abc");
+        CHECK_EQ(pub.ex("pin", "pout", 2), "OK", "EX síncrono com pool");
+        string v;
+        CHECK(pub.rdp("pout", v) && v == "cba", "PUBLISH: resultado publicado antes do OK");
+
+        string         out;
+        promise<string> async_result;
+        pub.write("pin", "xyz");
+        CHECK(!pub.ex_async("pin", "pout2", 1, out,
+                            [&](string r) { async_result.set_value(r); }),
+              "ex_async com pool responde pela continuação");
+        CHECK_EQ(pub.in("pout2"), "XYZ", "ex_async publica no worker");
+        CHECK_EQ(async_result.get_future().get(), string("OK"),
+                 "continuação chamada após a publicação");
+
+        pub.write("pin", "abc");
+        out.clear();
+        CHECK(pub.ex_async("pin", "pout3", 3, out, nullptr) && out == "OK" &&
+                  pub.rdp("pout3", v) && v == "3",
+              "sondagem sem continuação roda o serviço na hora");
+        pub.write("pin", "q");
+        CHECK_EQ(pub.ex("pin", "nada", 99), "NO-SERVICE", "NO-SERVICE não passa pelo pool");
+        // A resposta sai de dentro da tarefa; a contagem, logo depois.
+        const ServicePool* sp = pub.service_pool();
+        for (int i = 0; i < 1000 && sp->stats(1).completed + sp->stats(2).completed < 2; ++i)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        CHECK(sp->stats(2).completed == 1 && sp->stats(1).completed == 1 &&
+                  sp->stats(3).completed == 0,
+              "tarefas concluídas por serviço");
+
+        TupleServer con;
+        opt.ack = ServicePool::Ack::CONSUME;
+        con.start_service_pool(opt);
+        CHECK(!con.ex_deferred(), "modo CONSUME: resposta na hora");
+        out.clear();
+        con.write("cin", "abc");
+        CHECK(con.ex_async("cin", "cout", 1, out, [](string) {}) && out == "OK" &&
+                  !con.rdp("cin", v),
+              "CONSUME: OK logo após consumir a entrada");
+        CHECK_EQ(con.in("cout"), "ABC", "CONSUME: resultado publicado depois");
+    }
+    {
+        // Limite de concorrência: com limite 1, as tarefas do serviço
+        // esperam no backlog e nunca rodam duas ao mesmo tempo.
+        ServicePool::Options opt;
+        opt.workers                = 4;
+        opt.service_concurrency[7] = 1;
+        ServicePool pool(opt);
+
+        atomic<int> now{0}, peak{0}, done{0};
+        promise<void> release;
+        shared_future<void> gate = release.get_future().share();
+        for (int i = 0; i < 6; ++i)
+            pool.submit(7, [&, gate]() {
+                int n = ++now;
+                for (int p = peak.load(); n > p && !peak.compare_exchange_weak(p, n);) {
+                }
+                gate.wait();
+                --now;
+                ++done;
+            });
+        this_thread::sleep_for(chrono::milliseconds(20));
+        auto s = pool.stats(7);
+        CHECK(s.running == 1 && s.queued == 5, "limite 1: uma rodando, cinco na fila");
+
+        atomic<bool> other{false};
+        pool.submit(8, [&]() { other = true; });
+        for (int i = 0; i < 200 && !other; ++i)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        CHECK(other.load(), "serviço sem limite não espera o limitado");
+
+        release.set_value();
+        for (int i = 0; i < 1000 && done < 6; ++i)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        CHECK(done == 6 && peak == 1 && pool.stats(7).completed == 6,
+              "limite de concorrência respeitado");
+    }
+    {
+        // Roubo: subtarefas submetidas por um worker vão para a fila dele;
+        // com ele ocupado, só o outro worker pode executá-las.
+        ServicePool::Options opt;
+        opt.workers = 2;
+        ServicePool pool(opt);
+        atomic<int>   sub{0};
+        promise<bool> finished;
+        pool.submit(1, [&]() {
+            for (int i = 0; i < 3; ++i)
+                pool.submit(1, [&]() { ++sub; });
+            for (int i = 0; i < 1000 && sub < 3; ++i)
+                this_thread::sleep_for(chrono::milliseconds(1));
+            finished.set_value(sub == 3);
+        });
+        CHECK(finished.get_future().get() && pool.steal_count() >= 3,
+              "tarefas da fila de um worker ocupado são roubadas");
+    }
+
+    // ---------------------------------------------------------------
+    // 23) Registro de serviços: internos na ABI de linda_service.h,
+    //     carga e remoção de bibliotecas em execução (o exemplo
+    //     svc_example.c, compilado pelo Makefile) e leitura sem lock
+    //     durante as trocas.
+    // ---------------------------------------------------------------
+    {
+#ifdef _WIN32
+        const string example = "linda_svc_example.dll";
+#else
+        const string example = "./linda_svc_example.so";
+#endif
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("LOAD svc.so", cmd) && describe(cmd) == "LOAD|svc.so" &&
+                  cmd.is_admin() && !cmd.may_block(),
+              "parse: LOAD arquivo");
+        CHECK(protocol::parse_command("UNLOAD 10", cmd) && describe(cmd) == "UNLOAD|10" &&
+                  !protocol::parse_command("UNLOAD x", cmd) &&
+                  !protocol::parse_command("LOAD", cmd),
+              "parse: UNLOAD svc_id");
+
+        ServiceRegistry reg;
+        CHECK(reg.find(1) && reg.find(2) && reg.find(3) && !reg.find(10),
+              "serviços internos registrados");
+        CHECK_EQ(reg.find(1)->apply("abc"), string("ABC"), "upper no próprio buffer");
+        CHECK_EQ(reg.find(3)->apply(""), string("0"), "length de valor vazio");
+        CHECK_EQ(reg.find(3)->apply(string(12345, 'x')), string("12345"), "length");
+
+        vector<int> ids = reg.load(example);
+        CHECK(ids == vector<int>({10, 11}) && reg.find(10)->origin == example,
+              "load registra os serviços da biblioteca");
+        CHECK_EQ(reg.find(10)->apply("Linda!"), string("Yvaqn!"), "rot13 carregado");
+        CHECK_EQ(reg.find(11)->apply("ab"), string("abab"), "double cabe na folga");
+        string big(1000, 'z');
+        CHECK(reg.find(11)->apply(big) == big + big, "double pede mais capacidade");
+
+        vector<string> batch = {"abc", "", string(40, 'n')};
+        reg.find(10)->apply_batch(batch);
+        CHECK(batch[0] == "nop" && batch[1].empty() && batch[2] == string(40, 'a'),
+              "lote com batch() da biblioteca");
+        batch = {"x", string(100, 'y')};
+        reg.find(11)->apply_batch(batch);
+        CHECK(batch[0] == "xx" && batch[1] == string(200, 'y'), "lote refaz quem não coube");
+
+        auto held = reg.find(10);
+        CHECK(reg.unload(10) && !reg.find(10) && !reg.unload(10), "unload");
+        CHECK_EQ(held->apply("a"), string("n"), "serviço obtido antes do unload segue válido");
+        held.reset();
+        CHECK(reg.load(example).size() == 2 && reg.find(10), "recarga após unload");
+
+        bool threw = false;
+        try { reg.load("./nao_existe.so"); } catch (const exception&) { threw = true; }
+        CHECK(threw, "load de arquivo inexistente lança");
+        threw = false;
+        try { reg.load_file("x.so"); } catch (const exception&) { threw = true; }
+        CHECK(threw, "load_file sem diretório lança");
+        reg.set_dir(".");
+        threw = false;
+        try { reg.load_file("../x.so"); } catch (const exception&) { threw = true; }
+        CHECK(threw, "load_file recusa caminhos");
+        CHECK(reg.load_file(example.substr(example.find_first_not_of("./"))).size() == 2,
+              "load_file pelo nome");
+
+        // EX pelo TupleServer, com e sem pool.
+        TupleServer ts;
+        ts.service_registry().load(example);
+        ts.write("rin", "abc");
+        CHECK_EQ(ts.ex("rin", "rout", 10), "OK", "EX com serviço carregado");
+        CHECK_EQ(ts.in("rout"), "nop", "resultado do serviço carregado");
+        CHECK(ts.service_registry().unload(10), "unload pelo TupleServer");
+        ts.write("rin", "abc");
+        CHECK_EQ(ts.ex("rin", "rout", 10), "NO-SERVICE", "EX após unload");
+
+        TupleServer pooled;
+        ServicePool::Options opt;
+        opt.workers = 2;
+        pooled.start_service_pool(opt);
+        pooled.service_registry().load(example);
+        pooled.write("rin", "hi");
+        CHECK_EQ(pooled.ex("rin", "rout", 11), "OK", "EX carregado depois do pool");
+        CHECK(pooled.in("rout") == "hihi" && pooled.service_pool()->stats(11).completed == 1,
+              "serviço carregado roda no pool");
+
+        // Leitores contínuos enquanto o escritor troca a tabela.
+        atomic<bool> stop{false};
+        atomic<long> misses{0};
+        vector<thread> readers;
+        for (int t = 0; t < 4; ++t)
+            readers.emplace_back([&]() {
+                while (!stop) {
+                    auto h = reg.find(1);
+                    if (!h || h->apply("a") != "A")
+                        ++misses;
+                    if (auto x = reg.find(11))
+                        x->apply("q");
+                }
+            });
+        for (int i = 0; i < 100; ++i) {
+            reg.unload(11);
+            reg.load(example);
+        }
+        stop = true;
+        for (auto& r : readers)
+            r.join();
+        CHECK(misses == 0, "find() sem lock durante load/unload");
+    }
+
+    // ---------------------------------------------------------------
+    // 24) Kernels vetorizados (cada conjunto disponível contra a
+    //     referência escalar, em tamanhos e alinhamentos variados) e
+    //     EXALL.
+    // ---------------------------------------------------------------
+    {
+        mt19937 rng(2024);
+        int     bad = 0;
+        const simd::Isa isas[] = {simd::Isa::SCALAR, simd::Isa::SSE2, simd::Isa::AVX2};
+        for (size_t len = 0; len < 300; ++len) {
+            string src(len + 7, '\0');
+            for (auto& ch : src)
+                ch = static_cast<char>(rng());
+            for (size_t off : {size_t(0), size_t(1), size_t(7)}) {
+                string up = src.substr(off, len), rev = up;
+                for (auto& ch : up)
+                    if (ch >= 'a' && ch <= 'z')
+                        ch = static_cast<char>(ch - 32);
+                reverse(rev.begin(), rev.end());
+                for (auto isa : isas) {
+                    simd::Kernel u = simd::upper_kernel(isa), r = simd::reverse_kernel(isa);
+                    if (u == nullptr)
+                        continue;
+                    string a = src, b = src;
+                    u(&a[off], len);
+                    r(&b[off], len);
+                    bad += a.compare(off, len, up) != 0 || b.compare(off, len, rev) != 0 ||
+                           a.compare(0, off, src, 0, off) != 0 ||
+                           b.compare(off + len, string::npos, src, off + len) != 0;
+                }
+            }
+        }
+        CHECK(bad == 0, string("kernels iguais à referência escalar (despacho: ") +
+                            simd::name(simd::best()) + ")");
+        CHECK(simd::upper_kernel(simd::Isa::SCALAR) && simd::upper_kernel(simd::best()),
+              "escalar e o conjunto escolhido sempre disponíveis");
+
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("EXALL a b 2", cmd) && describe(cmd) == "EXALL|a|b|2" &&
+                  !cmd.may_block() && !protocol::parse_command("EXALL a b", cmd),
+              "parse: EXALL");
+
+        TupleServer es;
+        for (int i = 0; i < 5; ++i)
+            es.write("ea", "v" + to_string(i) + string(40, 'x'));
+        size_t n = 99;
+        CHECK(!es.ex_all("ea", "eb", 42, n) && n == 99 && es.key_bytes("ea") > 0,
+              "EXALL com serviço inexistente não consome");
+
+        // Um IN esperando em k_out recebe o primeiro resultado.
+        string got, out;
+        CHECK(!es.in_async("eb", out, [&](string v) { got = v; }), "IN estacionado em k_out");
+        CHECK(es.ex_all("ea", "eb", 1, n) && n == 5, "EXALL consome todas as tuplas");
+        vector<string> rest;
+        es.inp_many("eb", 10, rest);
+        CHECK(got == "V0" + string(40, 'X') && rest.size() == 4 &&
+                  rest[3] == "V4" + string(40, 'X') && es.key_bytes("ea") == 0,
+              "resultados publicados em ordem");
+        CHECK(es.ex_all("ea", "eb", 2, n) && n == 0, "EXALL sem tupla não bloqueia");
+
+        es.write("ec", "abc");
+        es.write("ec", "de");
+        CHECK(es.ex_all("ec", "ec", 2, n) && n == 2 && es.in("ec") == "cba" &&
+                  es.in("ec") == "ed",
+              "EXALL com k_in == k_out transforma uma vez");
+    }
+
+    // ---------------------------------------------------------------
+    // 25) Pipelines de serviços no EX: parse, fusão dos internos,
+    //     composição com serviços carregados e limites do pool.
+    // ---------------------------------------------------------------
+    {
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("EX a b 1,2,3 100", cmd) &&
+                  describe(cmd) == "EX|a|b|1,2,3|t=100" && cmd.stages == 3,
+              "parse: EX com pipeline e prazo");
+        CHECK(protocol::parse_command("EXALL a b 2,1", cmd) && describe(cmd) == "EXALL|a|b|2,1",
+              "parse: EXALL com pipeline");
+        CHECK(!protocol::parse_command("EX a b 1, 2", cmd) &&
+                  !protocol::parse_command("EX a b 1,", cmd) &&
+                  !protocol::parse_command("EX a b 1,,2", cmd) &&
+                  !protocol::parse_command("EX a b 1,2,3,1,2,3,1,2,3", cmd),
+              "parse: pipeline mal-formado ou longo demais é ERROR");
+
+        // Kernel fundido contra a referência, em cada conjunto.
+        mt19937 rng(77);
+        int     bad = 0;
+        for (size_t len = 0; len < 200; ++len) {
+            string src(len, '\0');
+            for (auto& ch : src)
+                ch = static_cast<char>(rng());
+            string want(src.rbegin(), src.rend());
+            for (auto& ch : want)
+                if (ch >= 'a' && ch <= 'z')
+                    ch = static_cast<char>(ch - 32);
+            for (auto isa : {simd::Isa::SCALAR, simd::Isa::SSE2, simd::Isa::AVX2}) {
+                if (simd::Kernel k = simd::upper_reverse_kernel(isa)) {
+                    string v = src;
+                    k(&v[0], v.size());
+                    bad += v != want;
+                }
+            }
+        }
+        CHECK(bad == 0, "upper_reverse igual a maiúsculas + inversão");
+
+        ServiceRegistry reg;
+        auto stages = [&](vector<int> ids) {
+            auto h = reg.resolve(ServiceChain(ids.data(), ids.size()));
+            string names;
+            for (auto& s : h->stages)
+                names += string(names.empty() ? "" : ",") + s->desc->name;
+            return names;
+        };
+        CHECK_EQ(stages({1, 2}), string("upper+reverse"), "fusão: 1,2 numa passada");
+        CHECK_EQ(stages({2, 1, 2, 2, 1}), string("upper+reverse"), "fusão: sequência de 1 e 2");
+        CHECK_EQ(stages({2, 2}), string(""), "fusão: inversão dupla some");
+        CHECK_EQ(stages({1, 2, 3}), string("length"), "fusão: antes de length, descartados");
+        CHECK_EQ(stages({3, 2}), string("length,reverse"), "sem fusão depois de length");
+
+        TupleServer ps;
+        auto run = [&](const string& v, vector<int> ids) {
+            ps.write("pin", v);
+            string r = ps.ex("pin", "pout", ServiceChain(ids.data(), ids.size()));
+            return r == "OK" ? ps.in("pout") : r;
+        };
+        CHECK_EQ(run("abc1", {1, 2}), string("1CBA"), "pipeline 1,2");
+        CHECK_EQ(run("abcd", {2, 2}), string("abcd"), "pipeline 2,2");
+        CHECK_EQ(run("abcdef", {2, 1, 3}), string("6"), "pipeline terminado em length");
+        CHECK_EQ(run(string(1234, 'x'), {3, 3}), string("4"), "length do length");
+        CHECK_EQ(run("abc", {1, 99}), string("NO-SERVICE"), "pipeline com serviço inexistente");
+        CHECK(ps.key_count() == 0, "nenhuma tupla intermediária");
+
+#ifdef _WIN32
+        const string example = "linda_svc_example.dll";
+#else
+        const string example = "./linda_svc_example.so";
+#endif
+        ps.service_registry().load(example);
+        CHECK_EQ(run("Hello", {10, 1}), string("URYYB"), "pipeline com serviço carregado");
+        CHECK_EQ(run("ab", {11, 2, 11}), string("babababa"), "carregado entre internos");
+        CHECK_EQ(run("abc", {1, 11, 3}), string("6"), "length depois de carregado não funde");
+
+        size_t n = 0;
+        ps.write("pall", "ab");
+        ps.write("pall", "cd");
+        int ids[] = {2, 1};
+        CHECK(ps.ex_all("pall", "pout", ServiceChain(ids, 2), n) && n == 2 &&
+                  ps.in("pout") == "BA" && ps.in("pout") == "DC",
+              "EXALL com pipeline");
+
+        TupleServer pp;
+        ServicePool::Options opt;
+        opt.workers = 2;
+        pp.start_service_pool(opt);
+        pp.write("pin", "xy");
+        int chain[] = {2, 1};
+        CHECK_EQ(pp.ex("pin", "pout", ServiceChain(chain, 2)), "OK", "pipeline no pool");
+        const ServicePool* sp = pp.service_pool();
+        for (int i = 0; i < 1000 && sp->stats(2).completed < 1; ++i)
+            this_thread::sleep_for(chrono::milliseconds(1));
+        CHECK(pp.in("pout") == "YX" && sp->stats(2).completed == 1 &&
+                  sp->stats(1).completed == 0,
+              "pipeline conta no primeiro svc_id");
+    }
+
+    // ---------------------------------------------------------------
+    // 26) Assinaturas: padrões exatos e por prefixo, toda forma de
+    //     entrada no espaço, buffer limitado (DROP e DISCONNECT).
+    // ---------------------------------------------------------------
+    {
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("SUB log.*", cmd) && describe(cmd) == "SUB|log.*" &&
+                  cmd.is_subscription() && !cmd.may_block(),
+              "parse: SUB com prefixo");
+        CHECK(protocol::parse_command("UNSUB a", cmd) && describe(cmd) == "UNSUB|a" &&
+                  !protocol::parse_command("SUB", cmd),
+              "parse: UNSUB; SUB sem padrão é ERROR");
+        protocol::FrameHeader h;
+        h.opcode = protocol::OP_SUB;
+        CHECK(protocol::frame_to_command(h, "k*", {}, cmd) && cmd.op == protocol::Command::SUB &&
+                  cmd.key == "k*",
+              "frame: OP_SUB");
+
+        // Espera o thread de despacho.
+        auto eventually = [](auto cond) {
+            for (int i = 0; i < 2000; ++i) {
+                if (cond())
+                    return true;
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            return false;
+        };
+        using Events = vector<Subscriptions::EventPtr>;
+        auto joined  = [](const Events& evs) {
+            string r;
+            for (auto& e : evs)
+                r += (r.empty() ? "" : " ") + e->key + "=" + e->value;
+            return r;
+        };
+        uint64_t lost = 0;
+
+        TupleServer    ss;
+        Subscriptions& subs = ss.subscriptions();
+        ss.write("a", "0");
+        CHECK(!subs.active() && subs.published() == 0, "sem assinatura, nada é publicado");
+
+        auto feed = subs.open();
+        auto all  = subs.open();
+        subs.subscribe(*feed, "a");
+        subs.subscribe(*feed, "log.*");
+        subs.subscribe(*feed, "log.*");
+        subs.subscribe(*feed, "log.err");
+        subs.subscribe(*all, "*");
+        ss.write("a", "1");
+        ss.write("b", "x");
+        ss.write("log.err", "2");
+        ss.write_many({{"log.x", "3"}, {"c", "y"}});
+        ss.write("in", "abc");
+        ss.ex("in", "a", 1);
+        string out;
+        ss.in_async("log.w", out, [](string) {});
+        ss.write("log.w", "4");  // entregue direto ao IN estacionado
+        Events evs;
+        eventually([&] { feed->take(evs, lost); return evs.size() >= 5; });
+        CHECK_EQ(joined(evs), string("a=1 log.err=2 log.x=3 a=ABC log.w=4"),
+                 "WR, MWR, EX e entrega a waiter, em ordem, uma vez cada");
+        Events rest;
+        CHECK(eventually([&] { all->take(rest, lost); return rest.size() >= 8; }) &&
+                  joined(rest) == "a=1 b=x log.err=2 log.x=3 c=y in=abc a=ABC log.w=4",
+              "\"*\" recebe todas as chaves");
+
+        CHECK(subs.unsubscribe(*feed, "log.*") && !subs.unsubscribe(*feed, "log.*"),
+              "UNSUB remove o padrão uma vez");
+        ss.write("log.y", "5");
+        ss.write("log.err", "6");
+        evs.clear();
+        CHECK(eventually([&] { feed->take(evs, lost); return !evs.empty(); }) &&
+                  joined(evs) == "log.err=6",
+              "depois do UNSUB, só os padrões restantes");
+        feed.reset();
+        all.reset();
+        CHECK(!subs.active(), "Feed destruído cancela as assinaturas");
+
+        // DROP: o buffer guarda as primeiras; a perda vem na próxima retirada.
+        TupleServer          sd;
+        Subscriptions::Options o;
+        o.max_events = 2;
+        sd.subscriptions().set_options(o);
+        atomic<int> wakes{0};
+        auto        f = sd.subscriptions().open([&wakes] { ++wakes; });
+        sd.subscriptions().subscribe(*f, "k");
+        for (int i = 0; i < 5; ++i)
+            sd.write("k", to_string(i));
+        evs.clear();
+        CHECK(eventually([&] { return sd.subscriptions().dropped() == 3; }) &&
+                  f->take(evs, lost) && joined(evs) == "k=0 k=1" && lost == 3 &&
+                  eventually([&] { return wakes == 1; }),
+              "DROP: buffer cheio descarta e conta as perdidas");
+        sd.write("k", "5");
+        evs.clear();
+        CHECK(eventually([&] { return f->take(evs, lost); }) && joined(evs) == "k=5" &&
+                  lost == 0 && eventually([&] { return wakes == 2; }),
+              "DROP: entrega volta depois de esvaziar");
+
+        o.max_events = 100;
+        o.max_bytes  = 10;
+        sd.subscriptions().set_options(o);
+        for (int i = 0; i < 3; ++i)
+            sd.write("k", "abcd");  // 5 bytes com a chave
+        evs.clear();
+        CHECK(eventually([&] { return sd.subscriptions().dropped() == 4; }) &&
+                  f->take(evs, lost) && evs.size() == 2 && lost == 1,
+              "DROP: limite em bytes");
+
+        // DISCONNECT: o Feed é cortado e wait() retorna.
+        TupleServer sx;
+        o.max_bytes = 1 << 20;
+        o.max_events = 2;
+        o.overflow   = Subscriptions::Overflow::DISCONNECT;
+        sx.subscriptions().set_options(o);
+        auto fx = sx.subscriptions().open();
+        sx.subscriptions().subscribe(*fx, "k*");
+        auto waiting = async(launch::async, [&] {
+            Events   got;
+            uint64_t n = 0;
+            while (fx->wait(got, n))
+                this_thread::sleep_for(chrono::milliseconds(50));  // leitor lento
+            return got.size();
+        });
+        for (int i = 0; i < 10; ++i)
+            sx.write("k" + to_string(i), "v");
+        CHECK(waiting.wait_for(chrono::seconds(5)) == future_status::ready &&
+                  fx->cut() && waiting.get() < 10,
+              "DISCONNECT: leitor lento é cortado");
+    }
+
+    // ---------------------------------------------------------------
+    // 27) Histograma de latências (linda_bench): valores pequenos
+    //     exatos, percentis com erro < 1% e merge igual ao todo.
+    // ---------------------------------------------------------------
+    {
+        Histogram small;
+        for (uint64_t v = 0; v < 200; ++v)
+            small.record(v);
+        CHECK_EQ(small.percentile(0.5), uint64_t(99), "valores < 256: percentil exato");
+        CHECK_EQ(small.min(), uint64_t(0), "mínimo exato");
+        CHECK_EQ(small.max(), uint64_t(199), "máximo exato");
+
+        Histogram all, a, b;
+        for (uint64_t v = 1; v <= 1000000; ++v) {
+            all.record(v * 1000);
+            (v % 2 ? a : b).record(v * 1000);
+        }
+        bool close = true;
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            double want = q * 1e9;
+            double got  = static_cast<double>(all.percentile(q));
+            close       = close && got >= want && got <= want * 1.008;
+        }
+        CHECK(close, "p50/p90/p99/p99.9 dentro de 0,8% (acima do valor exato)");
+        CHECK_EQ(all.percentile(1.0), uint64_t(1000000000), "p100 = máximo");
+        CHECK(all.mean() > 500000499 && all.mean() < 500000501, "média exata");
+
+        a.merge(b);
+        bool same = a.count() == all.count() && a.max() == all.max();
+        for (double q : {0.001, 0.5, 0.99, 0.9999})
+            same = same && a.percentile(q) == all.percentile(q);
+        CHECK(same, "merge das metades = histograma do todo");
+        CHECK_EQ(Histogram().percentile(0.99), uint64_t(0), "sem amostras: 0");
+    }
+
+    // ---------------------------------------------------------------
+    // 28) Métricas: STATS, contadores por thread somados na leitura,
+    //     faixas de latência, retrato do espaço e texto do Prometheus.
+    // ---------------------------------------------------------------
+    {
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("STATS", cmd) && describe(cmd) == "STATS" &&
+                  cmd.is_admin() && !cmd.may_block(),
+              "parse: STATS é administrativo e nunca bloqueia");
+
+        using Op = protocol::Command::Op;
+        Metrics m;
+        vector<thread> pool;
+        for (int t = 0; t < 4; ++t)
+            pool.emplace_back([&m] {
+                for (int i = 0; i < 1000; ++i)
+                    m.end(m.begin(Op::WR));
+            });
+        for (auto& th : pool)
+            th.join();
+        thread([&m] { m.begin(Op::WR); }).join();  // reaproveita um Slot
+        Metrics::Totals t = m.totals();
+        uint64_t sampled = 0;
+        for (size_t i = 0; i < Metrics::BUCKETS; ++i)
+            sampled += t.lat[Op::WR][i];
+        CHECK_EQ(t.ops[Op::WR], uint64_t(4001), "ops de todos os threads, encerrados inclusive");
+        // O sorteio segue no Slot reaproveitado: entre 62 e 62,5 por thread.
+        CHECK(sampled >= 4 * (1000 / Metrics::SAMPLE) && sampled <= 4000 / Metrics::SAMPLE,
+              "latência: 1 em SAMPLE");
+
+        Metrics lat;
+        lat.begin(Op::RD);
+        lat.end({Op::RD, Metrics::Clock::now() - chrono::milliseconds(3)});
+        lat.end({Op::RD, Metrics::Clock::time_point{}});  // sem amostra
+        t = lat.totals();
+        CHECK(t.lat[Op::RD][12] == 1 && t.lat_ns[Op::RD] >= 3000000,
+              "3 ms cai na faixa de 4,096 ms");
+
+        TupleServer sx;
+        sx.write("cheia", "12345");
+        string out;
+        sx.rd_async("espera", out, [](string) {});
+        sx.in_async("espera", out, [](string) {});
+        sx.in_async("a\"b", out, [](string) {});
+        TupleServer::Stats st = sx.stats(1);
+        CHECK(st.keys == 3 && st.bytes == 5, "retrato: chaves e bytes");
+        CHECK(st.parked.readers == 1 && st.parked.takers == 2 && st.blocked.size() == 1 &&
+                  st.blocked[0].key == "espera" && st.blocked[0].total() == 2,
+              "retrato: estacionadas por chave, as mais disputadas primeiro");
+
+        string text = lat.render(sx.stats(), 7, true);
+        auto   has  = [&text](const string& line) { return text.find(line) != string::npos; };
+        CHECK(has("# TYPE linda_op_latency_seconds histogram\n") &&
+                  has("linda_op_latency_seconds_bucket{op=\"rd\",le=\"0.002048\"} 0\n") &&
+                  has("linda_op_latency_seconds_bucket{op=\"rd\",le=\"0.004096\"} 1\n") &&
+                  has("linda_op_latency_seconds_bucket{op=\"rd\",le=\"+Inf\"} 1\n") &&
+                  has("linda_op_latency_seconds_count{op=\"rd\"} 1\n"),
+              "Prometheus: histograma cumulativo");
+        CHECK(has("linda_ops_total{op=\"rd\"} 1\n") && !has("linda_ops_total{op=\"wr\"}") &&
+                  has("linda_blocked{key=\"a\\\"b\",op=\"in\"} 1\n") &&
+                  has("linda_blocked_total{op=\"in\"} 2\n") && has("linda_keys 3\n") &&
+                  has("linda_tuple_bytes 5\n") && has("linda_connections 7\n"),
+              "Prometheus: contadores, rótulo escapado e retrato do espaço");
+
+        sx.write("espera", "v");
+        sx.write("a\"b", "v");
+        st = sx.stats();
+        CHECK(st.parked.total() == 0 && st.blocked.empty() && st.keys == 1,
+              "retrato: nada estacionado depois dos WRs");
+        CHECK(lat.render(st, 0, false).find('#') == string::npos, "STATS: sem comentários");
+    }
+
+#if LINDA_FUTEX_WAITS
+    // ---------------------------------------------------------------
+    // 29) Espera dos waiters sobre futex: espera com prazo e
+    //     notificação sem despertar perdido.
+    // ---------------------------------------------------------------
+    {
+        mutex              mtx;
+        FutexCondVar       cv;
+        bool               ready = false;
+        unique_lock<mutex> lk(mtx);
+        auto t0 = chrono::steady_clock::now();
+        CHECK(!cv.wait_for(lk, chrono::milliseconds(30), [&] { return ready; }) &&
+                  chrono::steady_clock::now() - t0 >= chrono::milliseconds(30),
+              "FutexCondVar: prazo sem notificação");
+        thread notifier([&] {
+            lock_guard<mutex> g(mtx);
+            ready = true;
+            cv.notify_one();
+        });
+        CHECK(cv.wait_for(lk, chrono::seconds(5), [&] { return ready; }),
+              "FutexCondVar: notificação acorda quem espera");
+        lk.unlock();
+        notifier.join();
+    }
+#endif
+
+    // ---------------------------------------------------------------
+    // 30) RD sem lock: a frente lida duas vezes é publicada; IN a
+    //     despublica, WR atrás dela não a muda; chaves que disputam a
+    //     mesma posição do cache continuam corretas.
+    // ---------------------------------------------------------------
+    {
+        TupleServer rc(1);
+        string      out;
+        rc.write("cfg", "v1");
+        rc.write("cfg", "v2");
+        CHECK(!rc.rd_cached("cfg", out), "RD sem lock: frente ainda não publicada");
+        rc.rd("cfg");
+        rc.rd("cfg");
+        CHECK(rc.rd_cached("cfg", out) && out == "v1", "RD sem lock: frente publicada");
+        rc.write("cfg", "v3");
+        out.clear();
+        CHECK(rc.rd_cached("cfg", out) && out == "v1", "RD sem lock: WR atrás não muda a frente");
+        CHECK_EQ(rc.in("cfg"), string("v1"), "RD sem lock: IN leva a frente");
+        out.clear();
+        CHECK(!rc.rd_cached("cfg", out) && rc.rd("cfg") == "v2" && rc.rd("cfg") == "v2" &&
+                  rc.rd_cached("cfg", out) && out == "v2",
+              "RD sem lock: IN despublica, a nova frente é publicada de novo");
+        rc.in("cfg");
+        rc.in("cfg");
+        CHECK(!rc.rd_cached("cfg", out) && rc.key_count() == 0,
+              "RD sem lock: chave drenada sai do cache e do índice");
+
+        string big(TupleServer::SHARE_BYTES, 'g');
+        rc.write("grande", big);
+        rc.rd("grande");
+        rc.rd("grande");
+        SharedValue shared;
+        out.clear();
+        CHECK(rc.rd_cached("grande", out, &shared) && out.empty() && shared && *shared == big,
+              "RD sem lock: valor grande compartilhado, sem cópia");
+        CHECK_EQ(rc.in("grande"), big, "RD sem lock: IN com o valor ainda referenciado");
+        CHECK_EQ(*shared, big, "RD sem lock: referência sobrevive à retirada");
+
+        // Mais chaves que posições: despejos entre elas.
+        bool ok = true;
+        for (int k = 0; k < 2000; ++k) {
+            string key = "k" + to_string(k);
+            rc.write(key, "a" + to_string(k));
+            rc.write(key, "b" + to_string(k));
+            rc.rd(key);
+            rc.rd(key);
+        }
+        for (int k = 0; k < 2000; k += 2)
+            rc.in("k" + to_string(k));
+        for (int k = 0; k < 2000 && ok; ++k) {
+            string key  = "k" + to_string(k);
+            string want = (k % 2 ? "a" : "b") + to_string(k);
+            string v;
+            ok = rc.rd(key) == want && rc.rdp(key, v) && v == want;
+        }
+        CHECK(ok, "RD sem lock: despejos no cache não trocam valores");
+
+        // Leitores sem lock contra um escritor que troca a frente: cada
+        // leitor vê versões que nunca voltam atrás.
+        TupleServer      live(2);
+        atomic<bool>     stop{false};
+        atomic<unsigned> regress{0};
+        live.write("versao", "0");
+        vector<thread> readers;
+        for (int t = 0; t < 4; ++t)
+            readers.emplace_back([&] {
+                long last = -1;
+                while (!stop.load()) {
+                    long v = stol(live.rd("versao"));
+                    if (v < last)
+                        ++regress;
+                    last = v;
+                }
+            });
+        for (int i = 1; i <= 20000; ++i) {
+            live.write("versao", to_string(i));
+            live.in("versao");
+        }
+        stop = true;
+        for (auto& th : readers)
+            th.join();
+        CHECK_EQ(regress.load(), 0u, "RD sem lock: leituras concorrentes linearizáveis");
+        CHECK_EQ(live.rd("versao"), string("20000"), "RD sem lock: frente final");
+    }
+
+    // ---------------------------------------------------------------
+    // 31) Cliente que vai embora: as operações estacionadas de uma
+    //     conexão são retiradas sem consumir nada (como em withdraw()
+    //     dos backends), também no FIN de um cliente real (a não ser
+    //     com HALFCLOSE); peer_closed() percebe o fim mesmo com dados
+    //     ainda não lidos, e peer_gone() só a queda da conexão.
+    // ---------------------------------------------------------------
+    {
+        TupleServer               ws(4);
+        list<TupleServer::Ticket> tickets;
+        unsigned                  called = 0;
+        string                    out;
+        for (int k = 0; k < 64; ++k) {
+            auto& t = *tickets.emplace(tickets.end());
+            ws.in_async("fila" + to_string(k % 8), out, [&called](string) { ++called; }, &t);
+        }
+        ws.rd_async("fila0", out, [&called](string) { ++called; }, &*tickets.emplace(tickets.end()));
+        ws.ex_async("fila1", "saida", ServiceChain{1}, out, [&called](string) { ++called; },
+                    &*tickets.emplace(tickets.end()));
+        CHECK_EQ(ws.stats().parked.takers, size_t(65), "saida do cliente: operacoes estacionadas");
+
+        size_t cancelled = 0;
+        for (auto& t : tickets)
+            cancelled += ws.cancel(t);
+        CHECK_EQ(cancelled, size_t(66), "saida do cliente: todas retiradas");
+        auto st = ws.stats();
+        CHECK(st.parked.takers == 0 && st.parked.readers == 0,
+              "saida do cliente: nenhuma operacao estacionada");
+
+        string v;
+        ws.write("fila0", "a");
+        ws.write("fila1", "b");
+        CHECK(called == 0 && ws.inp("fila0", v) && v == "a" && ws.inp("fila1", v) && v == "b" &&
+                  !ws.rdp("saida", v),
+              "saida do cliente: WR seguinte nao vai para as retiradas");
+
+#ifndef _WIN32
+        int pair[2];
+        CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "peer_closed: socketpair");
+        CHECK(!net::peer_closed(pair[0]), "peer_closed: conexao aberta");
+        CHECK(::send(pair[1], "IN k\n", 5, 0) == 5 && !net::peer_closed(pair[0]),
+              "peer_closed: dados pendentes nao sao fim");
+        ::shutdown(pair[1], SHUT_WR);
+        CHECK(net::peer_closed(pair[0]), "peer_closed: meio fechamento com dados pendentes");
+        CHECK(!net::peer_gone(pair[0]), "peer_gone: meio fechamento nao e queda");
+        ::close(pair[1]);
+        CHECK(net::peer_closed(pair[0]) && net::peer_gone(pair[0]),
+              "peer_closed/peer_gone: conexao fechada");
+        ::close(pair[0]);
+
+        // De ponta a ponta: o cliente que estacionou um IN e fechou a
+        // conexão (FIN) não leva a tupla escrita depois; com HALFCLOSE, quem
+        // só fechou o envio ainda recebe a resposta.
+        unsigned short port = net_port();
+        CHECK(port != 0, "saida do cliente: servidor de teste");
+        if (port != 0) {
+            TupleServer&  ns     = net_space();
+            socket_t taker  = connect_to(port);
+            socket_t writer = connect_to(port);
+            CHECK(taker != INVALID_SOCK && writer != INVALID_SOCK,
+                  "saida do cliente: conexoes");
+            send_all(taker, "IN saida-k\n");
+            CHECK(eventually([&] { return ns.stats().parked.takers == 1; }),
+                  "saida do cliente: IN estacionado");
+            net::close_socket(taker);
+            CHECK(eventually([&] { return ns.stats().parked.takers == 0; }),
+                  "saida do cliente: IN retirado no FIN");
+            send_all(writer, "WR saida-k v\nRDP saida-k\n");
+            CHECK_EQ(read_lines(writer, 2), string("OK\nOK v\n"),
+                     "saida do cliente: RDP ainda ve a tupla");
+            send_all(writer, "INP saida-k\n");
+            read_lines(writer, 1);
+
+            socket_t half = connect_to(port);
+            send_all(half, "HALFCLOSE\nIN saida-h\n");
+            CHECK(eventually([&] { return ns.stats().parked.takers == 1; }),
+                  "HALFCLOSE: IN estacionado");
+            ::shutdown(half, SHUT_WR);
+            this_thread::sleep_for(chrono::milliseconds(200));
+            CHECK_EQ(ns.stats().parked.takers, size_t(1), "HALFCLOSE: IN fica apos o FIN");
+            send_all(writer, "WR saida-h w\n");
+            CHECK_EQ(read_lines(half, 2), string("OK\nOK w\n"),
+                     "HALFCLOSE: resposta chega a quem so fechou o envio");
+            CHECK_EQ(read_lines(writer, 1), string("OK\n"), "HALFCLOSE: WR");
+            net::close_socket(half);
+            net::close_socket(writer);
+        }
+#endif
+    }
+
+    // ---------------------------------------------------------------
+    // 32) TTL: a roda de timers vence em ordem e no tick certo (inclusive
+    //     além do alcance dos níveis); tuplas vencidas nunca são
+    //     entregues, na frente ou no meio da fila; TTL padrão por chave e
+    //     prefixo; tuplas com TTL fora do WAL; sintaxe nos dois protocolos.
+    // ---------------------------------------------------------------
+    cout << "\n--- TTL ---\n";
+    {
+        TimerWheel<int> wheel;
+        wheel.reset(1000);
+        const uint64_t at[] = {1000, 1001, 1063, 1064, 1065, 5000, 1000 + 4096 * 64,
+                               1000 + (uint64_t(1) << 24) + 7, 1000 + (uint64_t(1) << 30)};
+        for (int i = 8; i >= 0; --i)
+            wheel.schedule(at[i], i);
+        vector<pair<uint64_t, int>> fired;
+        uint64_t                    now   = 0;
+        bool                        early = false;
+        auto fire = [&](int i) {
+            early |= at[i] > now;
+            fired.push_back({now, i});
+        };
+        for (uint64_t t : {uint64_t(999), uint64_t(1000), uint64_t(1063), uint64_t(1065),
+                           uint64_t(4999), uint64_t(1000 + 4096 * 64)}) {
+            now = t;
+            wheel.advance(t, fire);
+        }
+        CHECK(fired.size() == 7 && !early, "roda: vencidos ate o instante, nenhum antes");
+        bool ordered = true;
+        for (size_t i = 0; i < fired.size(); ++i)
+            ordered &= fired[i].second == static_cast<int>(i);
+        CHECK(ordered && fired[3].first == 1065, "roda: ordem de vencimento e cascata");
+        CHECK_EQ(wheel.next_event() <= at[7], true, "roda: proximo evento nunca depois do prazo");
+        now = at[8];
+        wheel.advance(now, fire);
+        CHECK(fired.size() == 9 && !early && wheel.empty(), "roda: timers alem do alcance");
+
+        wheel.reset(0);
+        wheel.schedule(10, 0);
+        int again = 0;
+        wheel.advance(20, [&](int) {
+            if (again++ < 3)
+                wheel.schedule(wheel.now() + 5, 0);  // reagendado dentro do fire
+        });
+        CHECK(again == 3 && wheel.size() == 1, "roda: agendar dentro do fire");
+    }
+    {
+        TupleServer ts(4);
+        string      v;
+        ts.write("k", "a", 50);
+        ts.write("k", "b");
+        CHECK(ts.rdp("k", v) && v == "a", "TTL: tupla entregue antes do prazo");
+        this_thread::sleep_for(chrono::milliseconds(80));
+        v.clear();
+        CHECK(ts.rdp("k", v) && v == "b" && ts.inp("k", v) && v == "b" && !ts.rdp("k", v),
+              "TTL: tupla vencida nunca entregue");
+
+        ts.write("m", "x");
+        ts.write("m", "yyyy", 20);
+        ts.write("m", "z");
+        ts.write("solo", "v", 20);
+        this_thread::sleep_for(chrono::milliseconds(100));  // o thread de expiração passa
+        auto st = ts.stats();
+        CHECK(st.expired == 3 && st.expired_bytes == 6 && st.ttl_tuples == 0,
+              "TTL: expiradas contadas");
+        CHECK(ts.key_bytes("m") == 2 && st.keys == 1, "TTL: bytes liberados, chave drenada sai");
+        vector<string> got;
+        CHECK(ts.inp_many("m", 5, got) == 2 && got == vector<string>({"x", "z"}),
+              "TTL: expirada no meio da fila nao volta");
+
+        TupleServer::Limits one;
+        one.key_tuples = 1;
+        ts.set_limits(one);
+        ts.write("cheia", "a", 20);
+        promise<string> admitted;
+        string          out;
+        CHECK(!ts.write_async("cheia", "b", out, [&](string r) { admitted.set_value(r); }),
+              "TTL: WR espera vaga");
+        auto ok = admitted.get_future();
+        CHECK(ok.wait_for(chrono::seconds(5)) == future_status::ready && ok.get() == "OK" &&
+                  ts.rdp("cheia", v) && v == "b",
+              "TTL: vaga aberta pela expiracao admite o WR");
+    }
+    {
+        // A expiração vista pelo próprio WR (o thread de expiração está
+        // preso na continuação de "trava") admite o primeiro WR esperando;
+        // o WR que chega e também estaciona precisa responder por ele.
+        TupleServer         ts(2);
+        TupleServer::Limits one;
+        one.key_tuples = 1;
+        ts.set_limits(one);
+        promise<void> release;
+        auto          stuck = release.get_future().share();
+        string        out;
+        ts.write("trava", "a", 10);
+        ts.write_async("trava", "b", out, [stuck](string) {
+            stuck.wait_for(chrono::seconds(5));
+        });
+        ts.write("k", "velho", 30);
+        ts.write("k2", "velho", 30);
+        promise<string> p1, p2, q1;
+        CHECK(!ts.write_async("k", "p1", out, [&](string r) { p1.set_value(r); }) &&
+                  !ts.write_async("k", "p2", out, [&](string r) { p2.set_value(r); }) &&
+                  !ts.write_async("k2", "q1", out, [&](string r) { q1.set_value(r); }),
+              "TTL: dois WRs esperando vaga");
+        this_thread::sleep_for(chrono::milliseconds(60));
+        CHECK(!ts.write_async("k", "p3", out, [](string) {}), "TTL: WR que chega estaciona");
+        auto f1 = p1.get_future(), f2 = p2.get_future();
+        CHECK(f1.wait_for(chrono::seconds(2)) == future_status::ready && f1.get() == "OK" &&
+                  f2.wait_for(chrono::milliseconds(0)) == future_status::timeout,
+              "TTL: WR admitido pela expiracao responde mesmo se o seguinte estaciona");
+
+        thread sync([&] { ts.write("k2", "q2"); });  // estaciona atrás de q1
+        auto fq = q1.get_future();
+        CHECK(fq.wait_for(chrono::seconds(2)) == future_status::ready && fq.get() == "OK",
+              "TTL: WR sincrono que estaciona responde pelo admitido antes de esperar");
+        string v;
+        ts.inp("k2", v);
+        sync.join();
+        release.set_value();
+        ts.inp("k", v);
+        ts.inp("k", v);
+        CHECK(v == "p2" && f2.wait_for(chrono::seconds(2)) == future_status::ready,
+              "TTL: os demais seguem na ordem");
+    }
+    {
+        TupleServer ts(2);
+        ts.set_default_ttl("cache:*", chrono::milliseconds(20));
+        ts.set_default_ttl("cache:longo*", chrono::minutes(10));
+        ts.set_default_ttl("cache:fixa", chrono::minutes(10));
+        ts.write("cache:a", "1");
+        ts.write("cache:longo1", "2");
+        ts.write("cache:fixa", "3");
+        ts.write("cache:b", "4", 0);
+        ts.write_many({{"cache:c", "5"}});
+        this_thread::sleep_for(chrono::milliseconds(60));
+        string v;
+        CHECK(!ts.rdp("cache:a", v) && !ts.rdp("cache:c", v), "TTL padrao por prefixo (WR e MWR)");
+        CHECK(ts.rdp("cache:longo1", v) && ts.rdp("cache:fixa", v),
+              "TTL padrao: prefixo mais longo e chave exata vencem");
+        CHECK(ts.rdp("cache:b", v) && v == "4", "TTL padrao: ttl=0 desliga");
+    }
+    {
+        string path = (filesystem::temp_directory_path() / "linda_tests.wal").string();
+        remove_wal(path);
+        Wal::Options opt{path, Wal::Sync::OS, chrono::milliseconds(1)};
+        {
+            TupleServer ts(2);
+            ts.open_wal(opt);
+            ts.write("p", "duravel");
+            ts.write("p", "volatil", 60000);
+            ts.write("q", "t1", 60000);
+            ts.write("q", "d1");
+            CHECK_EQ(ts.in("q"), string("t1"), "TTL + WAL: IN da tupla com TTL");
+            CHECK(ts.write_snapshot(), "TTL + WAL: snapshot");
+            ts.write("q", "t2", 60000);
+        }
+        TupleServer ts(2);
+        ts.open_wal(opt);
+        vector<string> p, q;
+        ts.inp_many("p", 5, p);
+        ts.inp_many("q", 5, q);
+        CHECK(p == vector<string>({"duravel"}) && q == vector<string>({"d1"}),
+              "TTL + WAL: tuplas com TTL nao sobrevivem ao reinicio");
+        remove_wal(path);
+    }
+    {
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("WRT k 250 um valor", cmd) &&
+                  describe(cmd) == "WR|k|um valor|ttl=250",
+              "parse: WRT");
+        CHECK(protocol::parse_command("WRT k 0 v", cmd) && describe(cmd) == "WR|k|v|ttl=0" &&
+                  protocol::parse_command("WRT k 5", cmd) && describe(cmd) == "WR|k||ttl=5",
+              "parse: WRT com TTL 0 e sem valor");
+        CHECK(!protocol::parse_command("WRT k abc v", cmd) &&
+                  !protocol::parse_command("WRT k 5x v", cmd) &&
+                  !protocol::parse_command("WRT k -5 v", cmd) &&
+                  !protocol::parse_command("WRT k", cmd),
+              "parse: WRT sem TTL valido e ERROR");
+        CHECK(protocol::parse_command("WR k ttl=5000 v", cmd) &&
+                  describe(cmd) == "WR|k|ttl=5000 v",
+              "parse: valor do WR que comeca com ttl= fica intacto, sem TTL");
+
+        string buf;
+        protocol::append_request(buf, protocol::OP_WR, 3, "k", "v", 0, 7, 1500);
+        auto h = protocol::decode_header(buf.data());
+        CHECK_EQ(h.body_len(), size_t(1 + 1 + 8), "binario: trailer com prazo e TTL");
+        protocol::decode_trailer(h, buf.data() + protocol::FRAME_HEADER + 2);
+        CHECK(protocol::frame_to_command(h, "k", "v", cmd) && cmd.ttl_ms == 1500 &&
+                  cmd.timeout_ms == 7,
+              "binario: FLAG_TTL");
+    }
+
+    // ---------------------------------------------------------------
+    // 33) RDM/INM: árvore de prefixos (divisão e fusão de arestas) e glob;
+    //     prefixo, glob e chave exata; vez das chaves em FIFO entre
+    //     chaves; waiters por padrão acordados só pelas chaves que casam;
+    //     prazo, cancelamento e TTL; sintaxe nos dois protocolos.
+    // ---------------------------------------------------------------
+    cout << "\n--- RDM/INM ---\n";
+    {
+        RadixTree<int> tree;
+        for (const char* k : {"romano", "romulo", "rubens", "ruber", "rubicon", "r", ""})
+            tree.emplace(k).value = static_cast<int>(strlen(k)) + 1;
+        CHECK(tree.size() == 7 && tree.find("rom") == nullptr && tree.find("romulo")->value == 7 &&
+                  tree.find("")->value == 1,
+              "radix: busca exata, com e sem divisao de aresta");
+        vector<string> under;
+        tree.for_each(*tree.subtree("rube"), [&](RadixTree<int>::Node& n) {
+            under.push_back(RadixTree<int>::key(n));
+        });
+        CHECK(under == vector<string>({"rubens", "ruber"}) && tree.subtree("rx") == nullptr,
+              "radix: subarvore de um prefixo no meio da aresta");
+        vector<int> path;
+        tree.along("rubicon!", [&](RadixTree<int>::Node& n) { path.push_back(n.value); });
+        CHECK(path == vector<int>({1, 2, 8}), "radix: prefixos de uma chave");
+        for (const char* k : {"rubens", "ruber", "r", ""})
+            tree.erase(*tree.find(k));
+        CHECK(tree.size() == 3 && tree.find("rubicon")->value == 8 &&
+                  tree.root().children.size() == 1 && tree.root().children[0]->label == "r",
+              "radix: remocao funde os nos que sobram");
+
+        CHECK(glob_match("a*c?e", "abxcde") && glob_match("*", "") && glob_match("a**", "a") &&
+                  !glob_match("a?", "a") && !glob_match("*x", "abc") &&
+                  glob_prefix("ped:*:?x") == "ped:",
+              "glob: curingas e parte literal");
+    }
+    {
+        TupleServer        ts(4);
+        TupleServer::Match m;
+        CHECK(!ts.inm_for("ped:*", chrono::milliseconds(0), m), "INM: sondagem sem tupla");
+        ts.write("ped:b", "b1");
+        ts.write("ped:a", "a1");
+        ts.write("ped:b", "b2");
+        ts.write("outro", "x");
+        CHECK(ts.rdm_for("ped:*", chrono::milliseconds(0), m) && m.key == "ped:b" &&
+                  m.value == "b1",
+              "RDM: chave mais antiga do prefixo");
+        vector<string> order;
+        for (int i = 0; i < 3; ++i) {
+            m = ts.inm("ped:*");
+            order.push_back(m.key + "=" + m.value);
+        }
+        CHECK(order == vector<string>({"ped:b=b1", "ped:a=a1", "ped:b=b2"}),
+              "INM: vez das chaves em FIFO, FIFO dentro da chave");
+        CHECK(ts.inm_for("o?tr*", chrono::milliseconds(0), m) && m.key == "outro" &&
+                  !ts.rdm_for("outro", chrono::milliseconds(0), m) && ts.key_count() == 0,
+              "INM: glob e chave exata; chave drenada sai do indice");
+
+        // Waiters por padrão: o WR de uma chave que não casa não acorda ninguém.
+        promise<string> got_a, got_b, got_rd;
+        string          out;
+        TupleServer::Ticket cancelled;
+        CHECK(!ts.match_async("job:*:alta", true, out, [&](string r) { got_a.set_value(r); }) &&
+                  !ts.match_async("job:*", true, out, [&](string r) { got_b.set_value(r); }) &&
+                  !ts.match_async("job:?", false, out, [&](string r) { got_rd.set_value(r); }) &&
+                  !ts.match_async("job:*", true, out, [](string) {}, &cancelled),
+              "INM/RDM estacionam");
+        CHECK(ts.cancel(cancelled) && !ts.cancel(cancelled), "INM: cancelamento");
+        ts.write("jobx", "nada");
+        auto fa = got_a.get_future(), fb = got_b.get_future(), fr = got_rd.get_future();
+        CHECK(fa.wait_for(chrono::milliseconds(20)) == future_status::timeout &&
+                  fb.wait_for(chrono::milliseconds(0)) == future_status::timeout,
+              "WR que nao casa nao acorda padroes");
+        ts.write("job:7:alta", "urgente");
+        string_view k, v;
+        string      ra = fa.get();
+        CHECK(TupleServer::split_match(ra, k, v) && k == "job:7:alta" && v == "urgente" &&
+                  fb.wait_for(chrono::milliseconds(0)) == future_status::timeout,
+              "WR entregue ao INM mais antigo que casa");
+        ts.write("job:1", "um");
+        string rr = fr.get(), rb = fb.get();
+        CHECK(TupleServer::split_match(rr, k, v) && k == "job:1" && v == "um" &&
+                  TupleServer::split_match(rb, k, v) && k == "job:1" && v == "um" &&
+                  !ts.rdp("job:1", out),
+              "WR: RDM recebe copia, INM consome");
+
+        // IN da própria chave antes do INM; o que sobra vai para a fila.
+        promise<string> exact, pattern;
+        CHECK(!ts.in_async("job:2", out, [&](string r) { exact.set_value(r); }) &&
+                  !ts.match_async("job:*", true, out, [&](string r) { pattern.set_value(r); }),
+              "IN e INM estacionam na mesma chave");
+        ts.write("job:2", "primeiro");
+        ts.write("job:2", "segundo");
+        string rp = pattern.get_future().get();
+        CHECK(exact.get_future().get() == "primeiro" && TupleServer::split_match(rp, k, v) &&
+                  v == "segundo",
+              "WR: IN da chave antes do INM");
+
+        thread later([&] {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            ts.write("fila:z", "z");
+        });
+        CHECK(ts.inm_for("fila:*", chrono::seconds(5), m) && m.key == "fila:z",
+              "INM com prazo acordado pelo WR");
+        later.join();
+        CHECK(!ts.inm_for("fila:*", chrono::milliseconds(10), m), "INM: timeout");
+
+        ts.write("ttl:a", "velho", 20);
+        ts.write("ttl:b", "novo");
+        this_thread::sleep_for(chrono::milliseconds(40));
+        CHECK(ts.inm_for("ttl:*", chrono::milliseconds(0), m) && m.key == "ttl:b",
+              "INM: frente vencida nao e entregue");
+    }
+    {
+        TupleServer ts(2);
+        ts.write("antes:1", "x");  // já no espaço quando o índice é criado
+        TupleServer::Match m;
+        CHECK(ts.rdm_for("antes:*", chrono::milliseconds(0), m) && m.value == "x",
+              "RDM: indice criado com as chaves existentes");
+
+        protocol::Command cmd;
+        CHECK(protocol::parse_command("RDM ped:* 250", cmd) && describe(cmd) == "RDM|ped:*|t=250" &&
+                  cmd.is_match() && protocol::parse_command("INM a?b", cmd) &&
+                  describe(cmd) == "INM|a?b" && cmd.may_block() && !protocol::parse_command("INM", cmd),
+              "parse: RDM/INM");
+        string buf;
+        protocol::append_request(buf, protocol::OP_INM, 9, "ped:*", {}, 0, 0);
+        auto h = protocol::decode_header(buf.data());
+        protocol::decode_trailer(h, buf.data() + protocol::FRAME_HEADER + 5);
+        CHECK(protocol::frame_to_command(h, "ped:*", {}, cmd) && cmd.op == protocol::Command::INM &&
+                  !cmd.may_block(),
+              "binario: OP_INM com prazo zero");
+    }
+
+    // ---------------------------------------------------------------
+    // 34) Pipeline no protocolo de texto, de ponta a ponta: um lote num
+    //     único send() responde na ordem dos pedidos mesmo com um RD
+    //     estacionado no meio, e nenhuma linha depois do comando
+    //     estacionado roda antes de ele completar.
+    // ---------------------------------------------------------------
+    cout << "\n--- Pipeline TCP ---\n";
+#ifndef _WIN32
+    if (unsigned short port = net_port()) {
+        TupleServer&  ns     = net_space();
+        socket_t      client = connect_to(port);
+        socket_t      writer = connect_to(port);
+        CHECK(client != INVALID_SOCK && writer != INVALID_SOCK, "lote TCP: conexoes");
+
+        send_all(client, "WR pipe-a 1\nRD pipe-b\nRD pipe-a\n");
+        CHECK(eventually([&] { return ns.stats().parked.readers == 1; }),
+              "lote TCP: RD pipe-b estacionado");
+        send_all(writer, "WR pipe-b x\n");
+        CHECK_EQ(read_lines(writer, 1), string("OK\n"), "lote TCP: WR da outra conexao");
+        CHECK_EQ(read_lines(client, 3), string("OK\nOK x\nOK 1\n"),
+                 "lote TCP: respostas na ordem dos pedidos");
+
+        string v;
+        send_all(client, "IN pipe-p\nWR pipe-q 1\nRDP pipe-q\n");
+        CHECK(eventually([&] { return ns.stats().parked.takers == 1; }),
+              "lote TCP: IN pipe-p estacionado");
+        this_thread::sleep_for(chrono::milliseconds(100));
+        CHECK(!ns.rdp("pipe-q", v), "lote TCP: linha seguinte espera o estacionado");
+        send_all(writer, "WR pipe-p 2\n");
+        CHECK_EQ(read_lines(writer, 1), string("OK\n"), "lote TCP: WR desbloqueia");
+        CHECK_EQ(read_lines(client, 3), string("OK 2\nOK\nOK 1\n"),
+                 "lote TCP: lote retomado em ordem apos o estacionado");
+        CHECK(ns.inp("pipe-q", v) && v == "1" && !ns.rdp("pipe-p", v),
+              "lote TCP: espaco final");
+        net::close_socket(client);
+        net::close_socket(writer);
+    } else {
+        CHECK(false, "lote TCP: servidor de teste");
+    }
+#endif
+
     // ---------------------------------------------------------------
     cout << "\n=== Fim dos testes ===\n";
     if (failed > 0) {
@@ -0,0 +1,174 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// TimerWheel: roda de timers hierárquica (Varghese & Lauck), em ticks
+// inteiros (o TupleServer usa milissegundos).
+//
+// LEVELS níveis de 64 posições; o nível L conta em passos de 64^L ticks.
+// Um timer entra no nível do grupo de 6 bits mais alto em que o seu
+// instante difere do tick atual, na posição desse grupo: o nível 0 guarda
+// os próximos 64 ticks, o nível 1 os próximos 64*64, e assim por diante.
+// Quando o tick atual chega ao início de uma posição de nível L > 0, os
+// timers dela descem para os níveis de baixo (cascata); os do nível 0
+// vencem. Agendar é O(1); cada timer desce no máximo LEVELS vezes. Timers
+// além do alcance (64^LEVELS ticks) ficam à parte e são reagendados a
+// cada volta completa do nível mais alto.
+//
+// advance() salta direto para o próximo tick com algo a fazer (um mapa de
+// bits de posições ocupadas por nível), então uma roda parada há horas
+// não percorre os ticks vazios. Sem sincronização: o dono trava.
+// ---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+template <class T>
+class TimerWheel {
+public:
+    static constexpr unsigned LEVELS = 4;
+    static constexpr unsigned BITS   = 6;
+    static constexpr unsigned SLOTS  = 1u << BITS;
+    static constexpr std::uint64_t NEVER = std::numeric_limits<std::uint64_t>::max();
+
+    bool        empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    std::uint64_t now() const { return tick; }
+
+    // Reposiciona o tick atual de uma roda vazia (parada há tempo).
+    void reset(std::uint64_t now) {
+        if (count == 0)
+            tick = now;
+    }
+
+    // Agenda `item` para `when`; um instante já passado vence no próximo
+    // advance().
+    void schedule(std::uint64_t when, T item) {
+        ++count;
+        if (when <= tick)
+            due.push_back({when, std::move(item)});
+        else
+            place({when, std::move(item)});
+    }
+
+    // Avança até `now`, chamando `fire(item)` para cada timer vencido, em
+    // ordem de tick; um `now` antes do tick atual não faz nada. `fire` pode
+    // agendar novos timers.
+    template <class F>
+    void advance(std::uint64_t now, F&& fire) {
+        if (now < tick)
+            return;
+        while (true) {
+            fire_all(due, fire);
+            std::uint64_t t = next_event();
+            if (t > now)
+                break;
+            tick = t;
+            step(fire);
+        }
+        if (now > tick)
+            tick = now;
+    }
+
+    // Próximo tick em que advance() tem algo a fazer (vencimento ou
+    // cascata), NEVER sem timers. Nunca depois do vencimento real.
+    std::uint64_t next_event() const {
+        if (count == 0)
+            return NEVER;
+        if (!due.empty())
+            return tick;
+        std::uint64_t best = NEVER;
+        for (unsigned l = 0; l < LEVELS; ++l) {
+            unsigned shift = BITS * l;
+            unsigned at    = static_cast<unsigned>(tick >> shift) & (SLOTS - 1);
+            // Posições depois da atual neste nível (as anteriores já passaram).
+            std::uint64_t ahead = at + 1 < SLOTS ? occupied[l] & (~std::uint64_t(0) << (at + 1)) : 0;
+            if (ahead == 0)
+                continue;
+            unsigned      slot  = static_cast<unsigned>(__builtin_ctzll(ahead));
+            std::uint64_t span  = std::uint64_t(1) << (shift + BITS);
+            std::uint64_t start = (tick & ~(span - 1)) + (std::uint64_t(slot) << shift);
+            if (start < best)
+                best = start;
+        }
+        if (!far.empty()) {
+            std::uint64_t span = std::uint64_t(1) << (BITS * LEVELS);
+            std::uint64_t wrap = (tick & ~(span - 1)) + span;
+            if (wrap < best)
+                best = wrap;
+        }
+        return best;
+    }
+
+private:
+    struct Entry {
+        std::uint64_t when;
+        T             item;
+    };
+
+    void place(Entry e) {
+        std::uint64_t diff = e.when ^ tick;
+        unsigned      high = diff == 0 ? 0 : 63u - static_cast<unsigned>(__builtin_clzll(diff));
+        unsigned      l    = high / BITS;
+        if (l >= LEVELS) {
+            far.push_back(std::move(e));
+            return;
+        }
+        unsigned slot = static_cast<unsigned>(e.when >> (BITS * l)) & (SLOTS - 1);
+        slots[l][slot].push_back(std::move(e));
+        occupied[l] |= std::uint64_t(1) << slot;
+    }
+
+    // Tick `tick` recém-alcançado: cascatas (de cima para baixo: o que
+    // desce de um nível alto pode cair numa posição que desce em seguida)
+    // e os vencimentos do nível 0.
+    template <class F>
+    void step(F& fire) {
+        std::uint64_t span = std::uint64_t(1) << (BITS * LEVELS);
+        if ((tick & (span - 1)) == 0 && !far.empty()) {
+            std::vector<Entry> again;
+            again.swap(far);
+            for (auto& e : again)
+                place(std::move(e));
+        }
+        for (unsigned l = LEVELS - 1; l > 0; --l) {
+            if ((tick & ((std::uint64_t(1) << (BITS * l)) - 1)) != 0)
+                continue;
+            unsigned slot = static_cast<unsigned>(tick >> (BITS * l)) & (SLOTS - 1);
+            if (!(occupied[l] >> slot & 1))
+                continue;
+            std::vector<Entry> down;
+            down.swap(slots[l][slot]);
+            occupied[l] &= ~(std::uint64_t(1) << slot);
+            for (auto& e : down)
+                place(std::move(e));
+        }
+        unsigned slot = static_cast<unsigned>(tick) & (SLOTS - 1);
+        if (occupied[0] >> slot & 1) {
+            std::vector<Entry> now;
+            now.swap(slots[0][slot]);
+            occupied[0] &= ~(std::uint64_t(1) << slot);
+            fire_all(now, fire);
+        }
+    }
+
+    template <class F>
+    void fire_all(std::vector<Entry>& list, F& fire) {
+        if (list.empty())
+            return;
+        std::vector<Entry> batch;
+        batch.swap(list);
+        count -= batch.size();
+        for (auto& e : batch)
+            fire(std::move(e.item));
+    }
+
+    std::uint64_t      tick  = 0;
+    std::size_t        count = 0;
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    std::uint64_t      occupied[LEVELS] = {};  // bit s: slots[l][s] não vazia
+    std::vector<Entry> due;  // agendados já vencidos
+    std::vector<Entry> far;  // além do alcance dos níveis
+};
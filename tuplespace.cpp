@@ -1,101 +1,1663 @@
 #include "main.hpp"
+#include "snapshot.hpp"
 
 #include <algorithm>
-#include <cctype>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <system_error>
+#include <utility>
 
 using namespace std;
 
+// Mutações registradas no WAL por este thread e ainda não confirmadas
+// (commit()), e a profundidade de GroupCommit aberta.
+namespace {
+struct PendingSync {
+    const Wal* wal   = nullptr;
+    uint64_t   lsn   = 0;
+    unsigned   defer = 0;
+};
+thread_local PendingSync pending_sync;
+
+// Relógio dos prazos de TTL: milissegundos do steady_clock.
+uint64_t expiry_clock() {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+                                     chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+// Relógio da vez das chaves no RDM/INM: nanossegundos do steady_clock,
+// comparáveis entre shards.
+uint64_t age_clock() {
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                                     chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+// Resultado do RDM/INM: chave e valor, cada um como u32 big-endian + bytes.
+void append_field(string& out, string_view v) {
+    uint32_t n = static_cast<uint32_t>(v.size());
+    char     len[4] = {static_cast<char>(n >> 24), static_cast<char>(n >> 16),
+                       static_cast<char>(n >> 8), static_cast<char>(n)};
+    out.append(len, 4);
+    out += v;
+}
+
+string match_result(string_view key, string_view value) {
+    string r;
+    r.reserve(8 + key.size() + value.size());
+    append_field(r, key);
+    append_field(r, value);
+    return r;
+}
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Construtor: cria os shards. Os três serviços obrigatórios vêm do
+// ServiceRegistry.
+// ---------------------------------------------------------------------------
+TupleServer::TupleServer(size_t n_shards)
+    : n_shards(max<size_t>(1, n_shards)),
+      shards(new Shard[this->n_shards]) {
+    for (size_t i = 0; i < this->n_shards; ++i) {
+        shards[i].budget   = &budget;
+        shards[i].subs     = &subs;
+        shards[i].expirer  = &expirer;
+        shards[i].patterns = &patterns;
+    }
+    expirer.body = [this] { expire_loop(); };
+}
+
+TupleServer::~TupleServer() {
+    pool.reset();  // as tarefas pendentes ainda publicam nos shards
+    if (snapshotter.joinable()) {
+        {
+            lock_guard<mutex> lk(snapshotter_mtx);
+            snapshotter_stop = true;
+        }
+        snapshotter_cv.notify_one();
+        snapshotter.join();
+    }
+    {
+        lock_guard<mutex> lk(expirer.mtx);
+        expirer.stop = true;
+    }
+    expirer.cv.notify_one();
+    if (expirer.thread.joinable())
+        expirer.thread.join();
+}
+
+// ---------------------------------------------------------------------------
+// key_hash(): FNV-1a de 64 bits. Estável entre execuções e plataformas
+// (ao contrário de std::hash), então a distribuição de chaves por shard é
+// reprodutível.
+// ---------------------------------------------------------------------------
+uint64_t TupleServer::key_hash(string_view key) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+size_t TupleServer::shard_index(string_view key) const {
+    return key_hash(key) % n_shards;
+}
+
 // ---------------------------------------------------------------------------
-// Construtor: registra os três serviços obrigatórios.
+// open_wal(): as filas são reconstruídas antes de o log ser reaberto para
+// acréscimo. Do snapshot só o índice é lido (custo proporcional ao número
+// de chaves); o log é relido a partir do menor corte, e os registros de um
+// shard que o snapshot já inclui (LSN até o corte do shard, pela divisão
+// em shards da época do snapshot) são pulados.
 // ---------------------------------------------------------------------------
-TupleServer::TupleServer() {
-    // Serviço 1: converter para maiúsculas.
-    services[1] = [](string s) {
-        string r;
-        r.reserve(s.size());
-        for (unsigned char c : s)
-            r += static_cast<char>(std::toupper(c));
-        return r;
+void TupleServer::open_wal(const Wal::Options& opt) {
+    snapshot_path = opt.path + ".snap";
+    error_code ec;
+    filesystem::remove(snapshot_path + ".tmp", ec);  // snapshot interrompido
+
+    vector<uint64_t> cuts;
+    if (filesystem::exists(snapshot_path, ec)) {
+        image = make_shared<snapshot::Image>(snapshot_path);
+        image->for_each_key([this](string_view key, string_view recs, size_t n) {
+            KeyEntry& e  = shard_for(key).tuple_space.emplace(key);
+            e.snap       = recs;
+            e.snap_count = n;
+            e.bytes      = recs.size() - min(recs.size(), 4 * n);  // sem os tamanhos
+            budget.used += e.bytes;
+        });
+        for (uint32_t i = 0; i < image->shard_count(); ++i)
+            cuts.push_back(image->cut(i));
+    }
+
+    uint64_t from = cuts.empty() ? 0 : *min_element(cuts.begin(), cuts.end());
+    uint64_t end  = Wal::replay(opt.path, from, [&](const Wal::Record& r) {
+        if (!cuts.empty() && r.lsn <= cuts[key_hash(r.key) % cuts.size()])
+            return;
+        Shard& sh = shard_for(r.key);
+        if (r.type == Wal::PUT) {
+            sh.enqueue(r.key, sh.tuple_space.emplace(r.key), string(r.value));
+            return;
+        }
+        KeyEntry* e = sh.tuple_space.find(r.key);
+        if (e == nullptr)
+            return;
+        for (uint32_t i = 0; i < r.count && e->has_tuples(); ++i)
+            sh.dequeue(*e);
+        sh.reclaim(*e);
+    });
+    if (!cuts.empty())
+        end = max(end, *max_element(cuts.begin(), cuts.end()));
+
+    wal = make_unique<Wal>(opt, end);
+    for (size_t i = 0; i < n_shards; ++i)
+        shards[i].wal = wal.get();
+}
+
+// ---------------------------------------------------------------------------
+// write_snapshot(): o WAL troca de segmento antes dos cortes, então os
+// segmentos anteriores ficam inteiramente cobertos pelo snapshot. Um shard
+// por vez: cópia das filas sob o lock, gravação fora dele. Tuplas com TTL
+// ficam de fora (também não estão no WAL).
+// ---------------------------------------------------------------------------
+bool TupleServer::write_snapshot() {
+    if (!wal)
+        return false;
+    lock_guard<mutex> one(snapshot_mtx);
+    wal->rotate();
+
+    struct Copy {
+        string         key;
+        string_view    snap;  // ainda no snapshot anterior, já codificada
+        size_t         snap_count;
+        vector<string> tuples;
     };
+    snapshot::Writer out(snapshot_path, static_cast<uint32_t>(n_shards));
+    vector<uint64_t> cuts(n_shards);
+    vector<Copy>     copy;
+    for (size_t i = 0; i < n_shards; ++i) {
+        {
+            auto lock = shards[i].lock();
+            // Toda mutação do shard é registrada sob este lock: as de LSN
+            // até o corte estão na cópia; as seguintes, não.
+            cuts[i] = wal->end_lsn();
+            shards[i].tuple_space.for_each([&](string_view key, const KeyEntry& e) {
+                if (!e.has_tuples())
+                    return;
+                vector<string> tuples;
+                tuples.reserve(e.tuples.size());
+                const Timed* tm = e.timed.get();
+                size_t       k  = 0;
+                for (size_t t = 0; t < e.tuples.size(); ++t) {
+                    if (tm) {
+                        uint64_t pos = tm->head + e.snap_count + t;
+                        while (k < tm->tuples.size() && tm->tuples[k].pos < pos)
+                            ++k;
+                        if (k < tm->tuples.size() && tm->tuples[k].pos == pos)
+                            continue;
+                    }
+                    tuples.push_back(e.tuples[t]);
+                }
+                if (e.snap_count == 0 && tuples.empty())
+                    return;  // só tuplas com TTL
+                copy.push_back({string(key), e.snap, e.snap_count, move(tuples)});
+            });
+        }
+        for (auto& c : copy) {
+            out.begin_key(c.key);
+            out.add_records(c.snap, c.snap_count);
+            for (auto& v : c.tuples)
+                out.add_tuple(v);
+            out.end_key();
+        }
+        copy.clear();
+    }
+    out.finish(cuts);
+    wal->drop_before(*min_element(cuts.begin(), cuts.end()));
+    return true;
+}
+
+void TupleServer::start_snapshots(chrono::seconds every) {
+    snapshotter = thread([this, every] {
+        // Sem mutação desde o último snapshot (ou da partida), nada a gravar.
+        uint64_t           seen = wal ? wal->end_lsn() : 0;
+        unique_lock<mutex> lk(snapshotter_mtx);
+        while (!snapshotter_cv.wait_for(lk, every, [this] { return snapshotter_stop; })) {
+            lk.unlock();
+            try {
+                uint64_t now = wal ? wal->end_lsn() : 0;
+                if (now != seen && write_snapshot())
+                    seen = now;
+            } catch (const exception& e) {
+                cerr << "[ERRO] " << e.what() << endl;  // tenta de novo na próxima
+            }
+            lk.lock();
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Fila de uma chave: frente no snapshot mapeado, depois `tuples`.
+// ---------------------------------------------------------------------------
+size_t TupleServer::KeyEntry::tuple_count() const {
+    return snap_count + tuples.size() - (timed ? timed->dead : 0);
+}
+
+bool TupleServer::KeyEntry::front_timed() const {
+    return timed && !timed->tuples.empty() && timed->tuples.front().pos == timed->head;
+}
+
+string_view TupleServer::KeyEntry::front() const {
+    if (snap_count == 0)
+        return tuples.front();
+    string_view recs = snap;
+    return snapshot::next_tuple(recs);
+}
+
+void TupleServer::KeyEntry::push_back(string v) {
+    bytes += v.size();
+    tuples.push_back(move(v));
+}
+
+string TupleServer::KeyEntry::pop_front() {
+    reads = 0;
+    string v;
+    if (snap_count > 0) {
+        v = string(snapshot::next_tuple(snap));
+        if (--snap_count == 0)
+            snap = {};
+    } else {
+        v = tuples.pop_front();
+    }
+    bytes -= min(bytes, v.size());
+    if (timed) {
+        if (front_timed()) {
+            timed->dead -= timed->tuples.front().expires == 0;
+            timed->tuples.pop_front();
+        }
+        ++timed->head;
+    }
+    return v;
+}
+
+void TupleServer::Shard::log_put(string_view key, string_view value) {
+    if (wal) {
+        pending_sync.wal = wal;
+        pending_sync.lsn = wal->put(key, value);
+    }
+}
+
+void TupleServer::Shard::log_take(string_view key, size_t n) {
+    if (wal) {
+        pending_sync.wal = wal;
+        pending_sync.lsn = wal->take(key, static_cast<uint32_t>(n));
+    }
+}
+
+void TupleServer::commit() {
+    if (!wal || pending_sync.wal != wal.get() || pending_sync.lsn == 0)
+        return;
+    wal->wait_durable(exchange(pending_sync.lsn, 0));
+}
 
-    // Serviço 2: inverter a string.
-    services[2] = [](string s) {
-        return string(s.rbegin(), s.rend());
+void TupleServer::settle() {
+    if (wal && pending_sync.defer == 0)
+        commit();
+    wake_throttled();
+}
+
+void TupleServer::wake_throttled() {
+    if (budget.throttled.load() > 0 && budget.used.load() <= budget.low_water()) {
+        vector<function<void()>> resume;
+        {
+            lock_guard<mutex> lock(budget.mtx);
+            resume.swap(budget.resume);
+            budget.throttled -= resume.size();
+        }
+        budget.below.notify_all();
+        for (auto& r : resume)
+            r();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Limites de memória. `used` é atômico (somado sob o lock de cada shard);
+// quem espera pelo limite global se conta em `throttled` antes de conferir
+// `used`, e quem libera memória subtrai de `used` antes de olhar
+// `throttled` — um dos dois sempre vê o outro.
+// ---------------------------------------------------------------------------
+void TupleServer::set_limits(const Limits& limits) {
+    budget.limits = limits;
+}
+
+size_t TupleServer::key_bytes(string_view key) {
+    Shard&    sh   = shard_for(key);
+    auto      lock = sh.lock();
+    KeyEntry* e    = sh.tuple_space.find(key);
+    return e ? e->bytes : 0;
+}
+
+void TupleServer::charge(size_t bytes) {
+    budget.used += bytes;
+}
+
+void TupleServer::refund(size_t bytes) {
+    budget.used -= bytes;
+    wake_throttled();
+}
+
+bool TupleServer::over_high_water() const {
+    return budget.limits.high_water > 0 && budget.used.load() > budget.limits.high_water;
+}
+
+void TupleServer::wait_high_water() {
+    if (!over_high_water())
+        return;
+    unique_lock<mutex> lock(budget.mtx);
+    ++budget.throttled;
+    budget.below.wait(lock, [this] { return budget.used.load() <= budget.low_water(); });
+    --budget.throttled;
+}
+
+bool TupleServer::wait_high_water_async(function<void()> resume) {
+    if (!over_high_water())
+        return true;
+    lock_guard<mutex> lock(budget.mtx);
+    budget.resume.push_back(move(resume));
+    ++budget.throttled;
+    if (budget.used.load() <= budget.low_water()) {  // liberada no meio-tempo
+        budget.resume.pop_back();
+        --budget.throttled;
+        return true;
+    }
+    return false;
+}
+
+TupleServer::GroupCommit::GroupCommit() {
+    ++pending_sync.defer;
+}
+
+TupleServer::GroupCommit::~GroupCommit() {
+    --pending_sync.defer;
+}
+
+TupleServer::Shard& TupleServer::shard_for(string_view key) {
+    return shards[shard_index(key)];
+}
+
+TupleServer::ShardLocks TupleServer::lock_shards(vector<size_t> indices) {
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+    ShardLocks locks;
+    locks.reserve(indices.size());
+    for (size_t i : indices)
+        locks.push_back(shards[i].lock());
+    return locks;
+}
+
+LockStats TupleServer::lock_stats() {
+    LockStats total;
+#if LINDA_LOCK_STATS
+    for (size_t i = 0; i < n_shards; ++i) {
+        auto lock = shards[i].lock();
+        total += shards[i].mtx.stats();
+    }
+#endif
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// stats(): as chaves com operação estacionada saem de `blocked` (só os
+// shards que já estacionaram alguma coisa são percorridos além da
+// contagem); as que não têm mais ninguém esperando são descartadas aqui.
+// ---------------------------------------------------------------------------
+TupleServer::Stats TupleServer::stats(size_t top) {
+    Stats st;
+    st.bytes = budget.used.load();
+    for (size_t i = 0; i < n_shards; ++i) {
+        Shard& sh   = shards[i];
+        auto   lock = sh.lock();
+        st.keys += sh.tuple_space.size();
+        st.lock_contended += sh.contended;
+        st.lock_wait_ns += sh.wait_ns;
+        st.ttl_tuples += sh.ttl_tuples;
+        st.expired += sh.expired;
+        st.expired_bytes += sh.expired_bytes;
+        for (auto it = sh.blocked.begin(); it != sh.blocked.end();) {
+            const KeyEntry& e = **it;
+            if (e.waiters.empty() && e.producers.empty()) {
+                it = sh.blocked.erase(it);
+                continue;
+            }
+            Blocked b;
+            for (auto& w : e.waiters)
+                ++(w->consume ? b.takers : b.readers);
+            b.writers = e.producers.size();
+            st.parked.readers += b.readers;
+            st.parked.takers += b.takers;
+            st.parked.writers += b.writers;
+            if (top > 0) {
+                b.key = string(KeyIndex<KeyEntry, KeyHash>::key(e));
+                st.blocked.push_back(move(b));
+            }
+            ++it;
+        }
+    }
+    auto by_total = [](const Blocked& a, const Blocked& b) {
+        return a.total() != b.total() ? a.total() > b.total() : a.key < b.key;
     };
+    if (st.blocked.size() > top) {
+        partial_sort(st.blocked.begin(), st.blocked.begin() + top, st.blocked.end(), by_total);
+        st.blocked.resize(top);
+    } else {
+        sort(st.blocked.begin(), st.blocked.end(), by_total);
+    }
+    return st;
+}
+
+size_t TupleServer::key_count() {
+    size_t n = 0;
+    for (size_t i = 0; i < n_shards; ++i) {
+        auto lock = shards[i].lock();
+        n += shards[i].tuple_space.size();
+    }
+    return n;
+}
+
+unique_lock<ShardMutex> TupleServer::Shard::lock() {
+    unique_lock<ShardMutex> lk(mtx, try_to_lock);
+    if (!lk.owns_lock()) {
+        auto t0 = chrono::steady_clock::now();
+        lk.lock();
+        ++contended;
+        wait_ns += static_cast<uint64_t>(
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+    }
+    return lk;
+}
+
+// ---------------------------------------------------------------------------
+// try_take(): find() sem inserir — RD/IN com tupla disponível não cria
+// entrada no índice, e o IN que drena a fila a remove.
+// Uma frente lida PUBLISH_AFTER vezes é copiada uma vez para um
+// SharedValue e publicada: os RDs seguintes não passam mais por aqui.
+// Chaves lidas uma vez só (canal de resposta: RD e depois IN) não pagam a
+// cópia. Para tomar a posição de outra chave são EVICT_AFTER leituras:
+// duas chaves quentes na mesma posição não se despejam a cada RD.
+// Uma frente com TTL nunca é publicada: o RD sem lock não confere prazo.
+// ---------------------------------------------------------------------------
+static constexpr uint16_t PUBLISH_AFTER = 2;
+static constexpr uint16_t EVICT_AFTER   = 16;
 
-    // Serviço 3: retornar o tamanho como texto.
-    services[3] = [](string s) {
-        return to_string(s.size());
+bool TupleServer::Shard::try_take(string_view key, bool consume, string& out,
+                                  Ready& ready) {
+    KeyEntry* e = tuple_space.find(key);
+    if (e == nullptr)
+        return false;
+    if (e->timed && drop_expired(*e, expiry_clock())) {
+        admit(key, *e, ready);
+        if (reclaim(*e))
+            return false;
+    }
+    if (!e->has_tuples())
+        return false;
+
+    if (!consume) {
+        if (e->cache_slot != 0 || ++e->reads < PUBLISH_AFTER || e->front_timed()) {
+            out += e->front();
+            return true;
+        }
+        uint64_t h = key_hash(key);
+        if (e->reads < EVICT_AFTER && fronts.maybe(h)) {
+            out += e->front();
+            return true;
+        }
+        auto v = make_shared<const string>(e->front());
+        out += *v;
+        fronts.publish(key, h, *e, move(v));
+    } else {
+        bool durable = !e->front_timed();
+        if (out.empty())
+            out = dequeue(*e);  // aproveita o buffer da tupla
+        else
+            out += dequeue(*e);
+        if (durable)
+            log_take(key, 1);
+        admit(key, *e, ready);
+        reclaim(*e);
+    }
+    return true;
+}
+
+void TupleServer::Shard::enqueue(string_view key, KeyEntry& e, string value,
+                                 uint64_t expires) {
+    bool first = !e.has_tuples();
+    if (expires == 0) {
+        log_put(key, value);
+    } else {
+        uint64_t now = expiry_clock();
+        if (expires <= now) {  // WR que esperou vaga além do TTL
+            ++expired;
+            expired_bytes += value.size();
+            return;
+        }
+        if (!e.timed) {
+            e.timed      = make_unique<Timed>();
+            e.timed->gen = ++next_gen;
+            timed_keys.emplace(e.timed->gen, &e);
+        }
+        uint64_t pos = e.timed->head + e.snap_count + e.tuples.size();
+        e.timed->tuples.push_back({pos, expires});
+        ++ttl_tuples;
+        expiry.reset(now);
+        expiry.schedule(expires, {e.timed->gen, pos});
+        expirer->wake(expires);
+    }
+    budget->used += value.size();
+    e.push_back(move(value));
+    if (first && ages)
+        requeue(key, e);
+}
+
+string TupleServer::Shard::dequeue(KeyEntry& e) {
+    fronts.drop(e);
+    if (e.front_timed())
+        --ttl_tuples;
+    string v = e.pop_front();
+    budget->used -= v.size();
+    if (e.timed) {
+        // Expiradas no meio da fila que chegaram à frente: já liberadas.
+        while (e.front_timed() && e.timed->tuples.front().expires == 0)
+            e.pop_front();
+        if (e.timed->tuples.empty()) {
+            timed_keys.erase(e.timed->gen);
+            e.timed.reset();
+        }
+    }
+    if (ages)
+        requeue(KeyIndex<KeyEntry, KeyHash>::key(e), e);
+    return v;
+}
+
+void TupleServer::Shard::put(string_view key, KeyEntry& e, string value, Ready& ready,
+                             uint64_t expires) {
+    if (subs->active())
+        subs->publish(key, value);
+    bool taken = patterns->count.load() > 0 ? offer(key, e, value, ready)
+                                            : !e.waiters.empty() && deliver(e, value, ready);
+    if (!taken)
+        enqueue(key, e, move(value), expires);
+}
+
+// ---------------------------------------------------------------------------
+// TTL. A frente da fila nunca é uma tupla já liberada (dequeue() as pula),
+// então drop_expired() só conta tuplas com valor.
+// ---------------------------------------------------------------------------
+bool TupleServer::Shard::drop_expired(KeyEntry& e, uint64_t now) {
+    bool dropped = false;
+    while (e.front_timed() && e.timed->tuples.front().expires <= now) {
+        ++expired;
+        expired_bytes += e.front().size();
+        dequeue(e);
+        dropped = true;
+    }
+    return dropped;
+}
+
+// O timer identifica a tupla pela geração do Timed da chave e pela posição;
+// se ela já saiu (IN, ou a chave foi drenada e recriada), não encontra nada.
+// Na frente a tupla sai da fila; no meio, o valor é liberado e ela fica no
+// lugar até chegar à frente — a contagem e os bytes da chave já caem aqui,
+// e a vaga aberta admite WRs esperando.
+uint64_t TupleServer::Shard::expire(uint64_t now, Ready& ready) {
+    expiry.advance(now, [&](const Expiry& x) {
+        auto it = timed_keys.find(x.gen);
+        if (it == timed_keys.end())
+            return;
+        KeyEntry& e = *it->second;
+        auto&     q = e.timed->tuples;
+        auto      t = lower_bound(q.begin(), q.end(), x.pos,
+                                  [](const Timed::Tuple& a, uint64_t pos) { return a.pos < pos; });
+        if (t == q.end() || t->pos != x.pos || t->expires == 0)
+            return;
+        string_view key = KeyIndex<KeyEntry, KeyHash>::key(e);
+        if (x.pos == e.timed->head) {
+            drop_expired(e, now);
+            admit(key, e, ready);
+            reclaim(e);
+            return;
+        }
+        size_t i = static_cast<size_t>(x.pos - e.timed->head) - e.snap_count;
+        size_t n = e.tuples[i].size();
+        e.tuples.release(i);
+        e.bytes -= min(e.bytes, n);
+        budget->used -= n;
+        t->expires = 0;
+        ++e.timed->dead;
+        --ttl_tuples;
+        ++expired;
+        expired_bytes += n;
+        admit(key, e, ready);
+    });
+    return expiry.next_event();
+}
+
+bool TupleServer::Shard::room(const KeyEntry* e, size_t n, size_t bytes) const {
+    const Limits& lim   = budget->limits;
+    size_t        count = e ? e->tuple_count() : 0;
+    size_t        have  = e ? e->bytes : 0;
+    if (count == 0 && n == 1)
+        return true;
+    return (lim.key_tuples == 0 || count + n <= lim.key_tuples) &&
+           (lim.key_bytes == 0 || have + bytes <= lim.key_bytes);
+}
+
+void TupleServer::Shard::admit(string_view key, KeyEntry& e, Ready& ready) {
+    while (!e.producers.empty() && room(&e, 1, e.producers.front()->value.size())) {
+        WaiterPtr w = move(e.producers.front());
+        e.producers.pop_front();
+        w->entry = nullptr;
+        if (subs->active())
+            subs->publish(key, w->value);
+        enqueue(key, e, move(w->value), w->expires);
+        hand_over(w, "OK", ready);
+    }
+}
+
+void TupleServer::Shard::park(string_view key, WaiterPtr w) {
+    KeyEntry& e    = tuple_space.emplace(key);
+    auto&     list = w->put ? e.producers : e.waiters;
+    Waiter&   r    = *w;
+    r.entry        = &e;  // o nó da chave não muda de endereço
+    r.pos          = list.insert(list.end(), move(w));
+    blocked.insert(&e);
+}
+
+void TupleServer::Shard::unpark(const WaiterPtr& w) {
+    KeyEntry& e = *w->entry;
+    (w->put ? e.producers : e.waiters).erase(w->pos);
+    w->entry = nullptr;
+    reclaim(e);
+}
+
+bool TupleServer::Shard::reclaim(KeyEntry& e) {
+    if (e.has_tuples() || !e.waiters.empty() || !e.producers.empty())
+        return false;
+    if (!blocked.empty())
+        blocked.erase(&e);
+    tuple_space.erase(e);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// TTL padrão: a busca só olha os comprimentos de prefixo configurados.
+// ---------------------------------------------------------------------------
+void TupleServer::set_default_ttl(string_view pattern, chrono::milliseconds ttl) {
+    bool prefix = !pattern.empty() && pattern.back() == '*';
+    if (prefix)
+        pattern.remove_suffix(1);
+    auto& rules = prefix ? ttl_rules.prefix : ttl_rules.exact;
+    if (ttl.count() > 0) {
+        rules[string(pattern)] = static_cast<uint32_t>(ttl.count());
+    } else if (auto it = rules.find(pattern); it != rules.end()) {
+        rules.erase(it);
+    }
+    ttl_rules.lengths.clear();
+    for (auto& [p, ms] : ttl_rules.prefix)
+        ttl_rules.lengths.push_back(p.size());
+    sort(ttl_rules.lengths.begin(), ttl_rules.lengths.end(), greater<size_t>());
+    ttl_rules.lengths.erase(unique(ttl_rules.lengths.begin(), ttl_rules.lengths.end()),
+                            ttl_rules.lengths.end());
+}
+
+uint32_t TupleServer::TtlRules::find(string_view key) const {
+    if (!exact.empty())
+        if (auto it = exact.find(key); it != exact.end())
+            return it->second;
+    for (size_t len : lengths) {
+        if (len > key.size())
+            continue;
+        if (auto it = prefix.find(key.substr(0, len)); it != prefix.end())
+            return it->second;
+    }
+    return 0;
+}
+
+uint64_t TupleServer::deadline(string_view key, int ttl_ms) const {
+    uint64_t ttl = ttl_ms < 0 ? ttl_rules.find(key) : static_cast<uint64_t>(ttl_ms);
+    return ttl > 0 ? expiry_clock() + ttl : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Thread de expiração. Percorre só os shards com timers e dorme até o
+// próximo evento do conjunto; durante a volta `planned` fica em NEVER,
+// então um timer agendado no meio dela pede outra volta (`kick`).
+// ---------------------------------------------------------------------------
+void TupleServer::Expirer::wake(uint64_t when) {
+    if (when >= planned.load())
+        return;
+    lock_guard<mutex> lk(mtx);
+    if (stop)
+        return;
+    if (!thread.joinable())
+        thread = std::thread(body);
+    kick = true;
+    cv.notify_one();
+}
+
+void TupleServer::expire_loop() {
+    using Wheel = TimerWheel<Expiry>;
+    unique_lock<mutex> lk(expirer.mtx);
+    while (!expirer.stop) {
+        expirer.kick    = false;
+        expirer.planned = Wheel::NEVER;
+        lk.unlock();
+        uint64_t next = Wheel::NEVER;
+        for (size_t i = 0; i < n_shards; ++i) {
+            Shard& sh = shards[i];
+            Ready  ready;
+            {
+                auto lock = sh.lock();
+                if (sh.expiry.empty())
+                    continue;
+                next = min(next, sh.expire(expiry_clock(), ready));
+            }
+            settle();
+            run_ready(ready);
+        }
+        lk.lock();
+        if (expirer.kick)
+            continue;
+        expirer.planned = next;
+        auto woken = [this] { return expirer.stop || expirer.kick; };
+        if (next == Wheel::NEVER)
+            expirer.cv.wait(lk, woken);
+        else
+            expirer.cv.wait_until(
+                lk, chrono::steady_clock::time_point(chrono::milliseconds(next)), woken);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// WR: só o shard da chave é travado, e só os waiters da própria chave são
+// acordados. Com a chave cheia, o WR espera vaga como um waiter da chave
+// (producers): o IN que abrir a vaga enfileira a tupla por ele.
+// ---------------------------------------------------------------------------
+bool TupleServer::write(string key, string value, int ttl_ms) {
+    return store(move(key), move(value), true, ttl_ms);
+}
+
+bool TupleServer::store(string key, string value, bool limited, int ttl_ms) {
+    Shard&   sh      = shard_for(key);
+    uint64_t expires = deadline(key, ttl_ms);
+    Ready    ready;
+    bool     stored = true;
+    {
+        auto      lock = sh.lock();
+        KeyEntry& e    = sh.tuple_space.emplace(key);
+        if (e.timed && sh.drop_expired(e, expiry_clock()))
+            sh.admit(key, e, ready);
+        bool full = limited && !(e.producers.empty() && sh.room(&e, 1, value.size()));
+        if (full && !budget.limits.block) {
+            stored = false;  // os WRs admitidos pela expiração seguem abaixo
+        } else if (full) {
+            auto w     = make_shared<Waiter>(false, nullptr);
+            w->put     = true;
+            w->value   = move(value);
+            w->expires = expires;
+            sh.park(key, w);
+            if (!ready.empty()) {
+                // A expiração admitiu WRs que estavam na frente deste: eles
+                // respondem antes da espera, fora do lock.
+                lock.unlock();
+                settle();
+                run_ready(ready);
+                ready.clear();
+                lock.lock();
+            }
+            w->cv.wait(lock, [&w] { return w->done; });
+            if (wal) {  // registrada pelo thread que abriu a vaga
+                pending_sync.wal = wal.get();
+                pending_sync.lsn = wal->end_lsn();
+            }
+        } else {
+            sh.put(key, e, move(value), ready, expires);
+            sh.reclaim(e);  // entregue ao último consumidor à espera
+        }
+    }
+    settle();
+
+    // Continuações rodam sem o lock: podem chamar write() (EX) livremente.
+    run_ready(ready);
+    return stored;
+}
+
+void TupleServer::store_all(string_view key, vector<string> values) {
+    Shard&   sh      = shard_for(key);
+    uint64_t expires = deadline(key, -1);
+    Ready    ready;
+    {
+        auto      lock = sh.lock();
+        KeyEntry* e    = nullptr;
+        for (auto& v : values) {
+            if (e == nullptr)
+                e = &sh.tuple_space.emplace(key);
+            sh.put(key, *e, move(v), ready, expires);
+            if (sh.reclaim(*e))
+                e = nullptr;
+        }
+    }
+    settle();
+    run_ready(ready);
+}
+
+bool TupleServer::write_async(string_view key, string&& value, string& out,
+                              Continuation done, Ticket* ticket, int ttl_ms) {
+    Shard&   sh      = shard_for(key);
+    uint64_t expires = deadline(key, ttl_ms);
+    Ready    ready;
+    bool     finished = true;
+    {
+        auto      lock = sh.lock();
+        KeyEntry& e    = sh.tuple_space.emplace(key);
+        if (e.timed && sh.drop_expired(e, expiry_clock()))
+            sh.admit(key, e, ready);
+        if (e.producers.empty() && sh.room(&e, 1, value.size())) {
+            sh.put(key, e, move(value), ready, expires);
+            sh.reclaim(e);
+            out += "OK";
+        } else if (!budget.limits.block) {
+            out += "FULL";
+        } else {
+            if (done) {
+                auto w     = make_shared<Waiter>(false, move(done));
+                w->put     = true;
+                w->value   = move(value);
+                w->expires = expires;
+                if (ticket) {
+                    ticket->waiter_shard = &sh;
+                    ticket->waiter       = w;
+                }
+                sh.park(key, move(w));
+            }
+            finished = false;
+        }
+    }
+    // Também no FULL e ao estacionar: a expiração pode ter admitido WRs.
+    settle();
+    run_ready(ready);
+    return finished;
+}
+
+void TupleServer::run_ready(Ready& ready) {
+    // WR admitido numa vaga: a tupla foi registrada no WAL por este thread,
+    // e a resposta dele só sai depois que ela estiver no disco.
+    if (any_of(ready.begin(), ready.end(), [](const WaiterPtr& w) { return w->put; }))
+        commit();
+    for (auto& w : ready)
+        w->cont(move(w->value));
+}
+
+// ---------------------------------------------------------------------------
+// MWR: todos os shards do lote ficam travados durante a aplicação (em
+// ordem crescente; as demais operações seguram no máximo um shard por
+// vez, então não há ciclo de espera).
+// ---------------------------------------------------------------------------
+bool TupleServer::write_many(vector<pair<string, string>> tuples) {
+    vector<size_t> idx;
+    idx.reserve(tuples.size());
+    for (auto& t : tuples)
+        idx.push_back(shard_index(t.first));
+
+    Ready ready;
+    {
+        ShardLocks locks = lock_shards(idx);
+        if (!batch_fits(tuples, idx))
+            return false;
+        KeyEntry* e = nullptr;
+        for (size_t i = 0; i < tuples.size(); ++i) {
+            // Rajadas na mesma chave: uma só busca no índice.
+            Shard& sh = shards[idx[i]];
+            if (e == nullptr || tuples[i].first != tuples[i - 1].first)
+                e = &sh.tuple_space.emplace(tuples[i].first);
+            sh.put(tuples[i].first, *e, move(tuples[i].second), ready,
+                   deadline(tuples[i].first, -1));
+            if (sh.reclaim(*e))
+                e = nullptr;
+        }
+    }
+    settle();
+    run_ready(ready);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// batch_fits(): soma as tuplas do lote por chave e confere cada chave uma
+// vez. Uma chave com WRs esperando vaga não aceita lote (passaria na
+// frente deles).
+// ---------------------------------------------------------------------------
+bool TupleServer::batch_fits(const vector<pair<string, string>>& tuples,
+                             const vector<size_t>& idx) {
+    const Limits& lim = budget.limits;
+    if (lim.key_tuples == 0 && lim.key_bytes == 0)
+        return true;
+
+    struct Sum {
+        size_t shard, n, bytes;
     };
+    map<string_view, Sum> sums;
+    for (size_t i = 0; i < tuples.size(); ++i) {
+        Sum& s = sums.try_emplace(tuples[i].first, Sum{idx[i], 0, 0}).first->second;
+        ++s.n;
+        s.bytes += tuples[i].second.size();
+    }
+    for (auto& [key, s] : sums) {
+        Shard&    sh = shards[s.shard];
+        KeyEntry* e  = sh.tuple_space.find(key);
+        if ((e && !e->producers.empty()) || !sh.room(e, s.n, s.bytes))
+            return false;
+    }
+    return true;
 }
 
 // ---------------------------------------------------------------------------
-// Auxiliar: verifica se existe ao menos uma tupla para a chave.
-// Usa find() para NÃO criar entrada vazia no mapa com operator[].
+// deliver(): um WR atende todos os RDs pendentes e exatamente um IN/EX —
+// o mais antigo —, de modo que nenhum consumidor bloqueado passa fome.
 // ---------------------------------------------------------------------------
-bool TupleServer::has_tuple(const string& key) const {
-    auto it = tuple_space.find(key);
-    return it != tuple_space.end() && !it->second.empty();
+bool TupleServer::deliver(KeyEntry& e, string& value, Ready& ready) {
+    auto consumer = e.waiters.end();
+    for (auto it = e.waiters.begin(); it != e.waiters.end();) {
+        if ((*it)->consume) {
+            if (consumer == e.waiters.end())
+                consumer = it;
+            ++it;
+            continue;
+        }
+        hand_over(*it, value, ready);
+        it = e.waiters.erase(it);
+    }
+
+    if (consumer == e.waiters.end())
+        return false;
+    hand_over(*consumer, move(value), ready);
+    e.waiters.erase(consumer);
+    return true;
+}
+
+void TupleServer::hand_over(const WaiterPtr& w, string value, Ready& ready) {
+    w->value = move(value);
+    w->done  = true;
+    if (w->cont)
+        ready.push_back(w);
+    else
+        // Notifica com o lock adquirido: quem espera pode liberar o waiter
+        // assim que enxergar `done`.
+        w->cv.notify_one();
 }
 
 // ---------------------------------------------------------------------------
-// WR: insere sem bloquear.
+// take(): RD/IN síncronos. Bloqueiam no cv do próprio waiter, sem
+// busy-waiting e sem acordar com WRs de outras chaves.
 // ---------------------------------------------------------------------------
-void TupleServer::write(string key, string value) {
+string TupleServer::take(const string& key, bool consume) {
+    Shard& sh = shard_for(key);
+    string out;
+    Ready  ready;
+    if (!consume && rd_cached(key, out))
+        return out;
     {
-        unique_lock<mutex> lock(mtx);
-        tuple_space[key].push_back(move(value));
+        auto lock = sh.lock();
+        if (!sh.try_take(key, consume, out, ready)) {
+            auto w = make_shared<Waiter>(consume, nullptr);
+            sh.park(key, w);
+            w->cv.wait(lock, [&w] { return w->done; });
+            out = move(w->value);
+        }
     }
-    // Notifica fora do lock: threads acordadas não precisam esperar
-    // que este thread libere o mutex para adquiri-lo.
-    cv.notify_all();
+    if (consume)
+        settle();
+    run_ready(ready);
+    return out;
+}
+
+bool TupleServer::take_now(string_view key, bool consume, string& out) {
+    Shard& sh = shard_for(key);
+    string v;
+    Ready  ready;
+    if (!consume && rd_cached(key, v)) {
+        out = move(v);
+        return true;
+    }
+    {
+        auto lock = sh.lock();
+        if (!sh.try_take(key, consume, v, ready))
+            return false;
+    }
+    if (consume)
+        settle();
+    run_ready(ready);
+    out = move(v);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// take_for(): como take(), mas desiste após `timeout`. O waiter é retirado
+// da fila sob o mesmo lock em que o WR o atenderia: ou o valor foi
+// entregue (e é retornado), ou nada foi consumido.
+// ---------------------------------------------------------------------------
+bool TupleServer::take_for(const string& key, bool consume,
+                           chrono::milliseconds timeout, string& out) {
+    Shard& sh = shard_for(key);
+    string v;
+    Ready  ready;
+    if (!consume && rd_cached(key, v)) {
+        out = move(v);
+        return true;
+    }
+    {
+        auto lock = sh.lock();
+        if (!sh.try_take(key, consume, v, ready)) {
+            if (timeout <= chrono::milliseconds::zero())
+                return false;
+            auto w = make_shared<Waiter>(consume, nullptr);
+            sh.park(key, w);
+            if (!w->cv.wait_for(lock, timeout, [&w] { return w->done; })) {
+                sh.unpark(w);
+                return false;
+            }
+            v = move(w->value);
+        }
+    }
+    if (consume)
+        settle();
+    run_ready(ready);
+    out = move(v);
+    return true;
 }
 
 // ---------------------------------------------------------------------------
 // RD: bloqueante, não destrutivo, FIFO.
 // ---------------------------------------------------------------------------
 string TupleServer::rd(string key) {
-    unique_lock<mutex> lock(mtx);
-    // CORREÇÃO: usa has_tuple() com find() em vez de operator[],
-    // que criaria uma entrada vazia no mapa para chaves inexistentes.
-    cv.wait(lock, [this, &key] { return has_tuple(key); });
-    return tuple_space.at(key).front();
+    return take(key, false);
 }
 
 // ---------------------------------------------------------------------------
 // IN: bloqueante, destrutivo, FIFO.
 // ---------------------------------------------------------------------------
 string TupleServer::in(string key) {
-    unique_lock<mutex> lock(mtx);
-    cv.wait(lock, [this, &key] { return has_tuple(key); });
-    auto& dq = tuple_space.at(key);
-    string v = move(dq.front());
-    dq.pop_front();
-    return v;
+    return take(key, true);
+}
+
+// ---------------------------------------------------------------------------
+// INN: várias tuplas da mesma chave com um único lock.
+// ---------------------------------------------------------------------------
+size_t TupleServer::inp_many(string_view key, size_t n, vector<string>& out) {
+    Shard& sh      = shard_for(key);
+    size_t taken   = 0;
+    bool   dropped = false;
+    Ready  ready;
+    {
+        auto      lock = sh.lock();
+        KeyEntry* e    = sh.tuple_space.find(key);
+        if (e == nullptr)
+            return 0;
+
+        // Com TTL na fila, o prazo da frente é conferido a cada retirada
+        // (um só relógio para o lote) e só as tuplas sem TTL vão ao TAKE.
+        uint64_t now     = e->timed ? expiry_clock() : 0;
+        size_t   durable = 0;
+        for (; taken < n; ++taken) {
+            if (e->timed && sh.drop_expired(*e, now))
+                dropped = true;
+            if (!e->has_tuples())
+                break;
+            durable += !e->front_timed();
+            out.push_back(sh.dequeue(*e));
+        }
+        if (durable > 0)
+            sh.log_take(key, durable);
+        if (taken > 0 || dropped) {
+            sh.admit(key, *e, ready);
+            sh.reclaim(*e);
+        }
+    }
+    if (taken > 0 || dropped)
+        settle();
+    run_ready(ready);
+    return taken;
+}
+
+// ---------------------------------------------------------------------------
+// EXALL: o serviço roda sobre o lote sem lock nenhum, entre a retirada e
+// a publicação.
+// ---------------------------------------------------------------------------
+bool TupleServer::ex_all(string_view k_in, string_view k_out, const ServiceChain& chain,
+                         size_t& n) {
+    ServiceRegistry::Handle svc = services.resolve(chain);
+    if (!svc)
+        return false;
+    vector<string> values;
+    n = inp_many(k_in, SIZE_MAX, values);
+    if (n > 0) {
+        svc->apply_batch(values);
+        store_all(k_out, move(values));
+    }
+    return true;
+}
+
+vector<string> TupleServer::in_many(const string& key, size_t n) {
+    vector<string> out;
+    if (inp_many(key, n, out) == 0)
+        out.push_back(in(key));
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// MRD: todos os shards envolvidos travados juntos, como no MWR.
+// ---------------------------------------------------------------------------
+vector<optional<string>> TupleServer::rd_many(const vector<string_view>& keys) {
+    vector<size_t> idx;
+    idx.reserve(keys.size());
+    for (auto k : keys)
+        idx.push_back(shard_index(k));
+
+    vector<optional<string>> out(keys.size());
+    Ready                    ready;  // só TTL vencido na frente abre vaga
+    {
+        ShardLocks locks = lock_shards(idx);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            string v;
+            if (shards[idx[i]].try_take(keys[i], false, v, ready))
+                out[i] = move(v);
+        }
+    }
+    run_ready(ready);
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// rd_cached(): sem lock. A posição vazia é descartada sem entrar na seção
+// de leitura (a cerca dela só é paga quando há o que ler).
+// ---------------------------------------------------------------------------
+bool TupleServer::rd_cached(string_view key, string& out, SharedValue* shared) {
+    uint64_t h  = key_hash(key);
+    Shard&   sh = shards[h % n_shards];
+    if (!sh.fronts.maybe(h))
+        return false;
+    epoch::Guard       guard;
+    const SharedValue* v = sh.fronts.find(key, h);
+    if (v == nullptr)
+        return false;
+    if (shared && (*v)->size() >= SHARE_BYTES)
+        *shared = *v;
+    else
+        out += **v;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// RDP/INP: sondagem, nunca bloqueiam.
+// ---------------------------------------------------------------------------
+bool TupleServer::rdp(string_view key, string& out) {
+    return take_now(key, false, out);
+}
+
+bool TupleServer::inp(string_view key, string& out) {
+    return take_now(key, true, out);
+}
+
+// ---------------------------------------------------------------------------
+// RD/IN/EX com prazo. O EX só consome k_in se ela chegar dentro do prazo.
+// ---------------------------------------------------------------------------
+bool TupleServer::rd_for(const string& key, chrono::milliseconds timeout, string& out) {
+    return take_for(key, false, timeout, out);
+}
+
+bool TupleServer::in_for(const string& key, chrono::milliseconds timeout, string& out) {
+    return take_for(key, true, timeout, out);
+}
+
+bool TupleServer::ex_for(const string& k_in, string k_out, const ServiceChain& chain,
+                         chrono::milliseconds timeout, string& out) {
+    string v;
+    if (!in_for(k_in, timeout, v))
+        return false;
+    out = await_ex(move(v), move(k_out), chain);
+    return true;
 }
 
 // ---------------------------------------------------------------------------
 // EX: consume k_in, aplica serviço, insere em k_out.
 // Se o serviço não existir, a tupla de entrada já foi consumida e
 // retorna "NO-SERVICE" sem inserir nada — conforme o enunciado.
+// k_in e k_out podem cair em shards diferentes: o consumo acontece sob o
+// lock de k_in, que é liberado antes da publicação sob o lock de k_out.
+// O EX nunca segura dois locks de shard ao mesmo tempo. No WAL ele aparece
+// como um TAKE de k_in seguido de um PUT de k_out.
+// ---------------------------------------------------------------------------
+string TupleServer::ex(string k_in, string k_out, const ServiceChain& chain) {
+    return await_ex(in(move(k_in)), move(k_out), chain);
+}
+
+// ---------------------------------------------------------------------------
+// finish_ex(): sem pool, o serviço roda aqui mesmo. Com pool, vai para um
+// worker, que publica o resultado; no modo PUBLISH a resposta sai pela
+// continuação depois da publicação, no modo CONSUME sai já.
+// A publicação já acorda os waiters de k_out. Fica fora dos limites por
+// chave: recusar ou esperar aqui perderia (ou prenderia) a tupla já
+// consumida.
+// ---------------------------------------------------------------------------
+bool TupleServer::finish_ex(string v, string k_out, const ServiceChain& chain,
+                            string& result, const Continuation& done) {
+    ServiceRegistry::Handle svc = services.resolve(chain);
+    if (!svc) {
+        result = "NO-SERVICE";
+        return true;
+    }
+    bool publish = !pool || pool->ack() == ServicePool::Ack::PUBLISH;
+    if (!pool || (publish && !done)) {
+        store(move(k_out), svc->apply(move(v)), false);
+        result = "OK";
+        return true;
+    }
+
+    // A tarefa guarda o serviço: um UNLOAD no meio não fecha a biblioteca.
+    Continuation reply = publish ? done : nullptr;
+    pool->submit(svc->queue, [this, svc, v = move(v), k_out = move(k_out), reply]() mutable {
+        store(move(k_out), svc->apply(move(v)), false);
+        if (reply)
+            reply("OK");
+    });
+    if (publish)
+        return false;
+    result = "OK";
+    return true;
+}
+
+// EX síncrono: espera o worker quando a resposta depende dele.
+string TupleServer::await_ex(string v, string k_out, const ServiceChain& chain) {
+    string result;
+    if (!ex_deferred()) {
+        finish_ex(move(v), move(k_out), chain, result, nullptr);
+        return result;
+    }
+    auto waiting = make_shared<promise<string>>();
+    auto future  = waiting->get_future();
+    if (!finish_ex(move(v), move(k_out), chain, result,
+                   [waiting](string r) { waiting->set_value(move(r)); }))
+        result = future.get();
+    return result;
+}
+
+void TupleServer::start_service_pool(const ServicePool::Options& opt) {
+    pool = make_unique<ServicePool>(opt);
+    services.attach(pool.get());
+}
+
+// ---------------------------------------------------------------------------
+// Versões assíncronas: mesma fila de waiters, mas em vez de bloquear no cv
+// a continuação é chamada pelo WR que atender a operação. O waiter só é
+// alocado quando realmente precisa estacionar.
+// ---------------------------------------------------------------------------
+bool TupleServer::take_async(string_view key, bool consume, string& out,
+                             Continuation done, Ticket* ticket) {
+    if (!consume && rd_cached(key, out))
+        return true;
+    Shard& sh = shard_for(key);
+    Ready  ready;
+    {
+        auto lock = sh.lock();
+        if (!sh.try_take(key, consume, out, ready)) {
+            if (done) {
+                auto w = make_shared<Waiter>(consume, move(done));
+                if (ticket) {
+                    ticket->waiter_shard = &sh;
+                    ticket->waiter       = w;
+                }
+                sh.park(key, move(w));
+            }
+            return false;
+        }
+    }
+    if (consume)
+        settle();
+    run_ready(ready);
+    return true;
+}
+
+bool TupleServer::rd_async(string_view key, string& out, Continuation done,
+                           Ticket* ticket) {
+    return take_async(key, false, out, move(done), ticket);
+}
+
+bool TupleServer::in_async(string_view key, string& out, Continuation done,
+                           Ticket* ticket) {
+    return take_async(key, true, out, move(done), ticket);
+}
+
 // ---------------------------------------------------------------------------
-string TupleServer::ex(string k_in, string k_out, int svc_id) {
+// cancel(): decide, sob o lock do shard, a corrida entre o WR que atenderia
+// a operação e quem desistiu dela (timeout). Só um dos dois vence.
+// ---------------------------------------------------------------------------
+bool TupleServer::cancel(const Ticket& ticket) {
+    if (ticket.pattern) {
+        lock_guard<ShardMutex> lock(patterns.mtx);
+        WaiterPtr              w = ticket.waiter.lock();
+        if (!w || w->done || w->node == nullptr)
+            return false;
+        patterns.unpark(w);
+        return true;
+    }
+    if (ticket.waiter_shard == nullptr)
+        return false;
+    auto      lock = ticket.waiter_shard->lock();
+    WaiterPtr w    = ticket.waiter.lock();
+    if (!w || w->done || w->entry == nullptr)
+        return false;
+    ticket.waiter_shard->unpark(w);
+    return true;
+}
+
+bool TupleServer::ex_async(string_view k_in, string_view k_out, const ServiceChain& chain,
+                           string& out, Continuation done, Ticket* ticket) {
+    // A continuação do IN interno completa o EX no thread do WR (ou passa
+    // o serviço a um worker, que responde depois).
+    Continuation then;
+    if (done)
+        then = [this, k_out = string(k_out), chain, done](string v) {
+            string result;
+            if (finish_ex(move(v), k_out, chain, result, done))
+                done(move(result));
+        };
+
     string v;
+    if (!in_async(k_in, v, move(then), ticket))
+        return false;
+    string result;
+    if (!finish_ex(move(v), string(k_out), chain, result, done))
+        return false;
+    out += result;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// RDM/INM. Índice de chaves: requeue() sobe da chave até a raiz
+// recalculando `oldest` e para no primeiro nó em que ele não mudou (os de
+// cima também não mudam). Um nó tem no máximo 256 filhos, então o custo é
+// O(profundidade) mesmo no pior caso.
+// ---------------------------------------------------------------------------
+void TupleServer::Shard::index_keys() {
+    ages = make_unique<AgeTree>();
+    tuple_space.for_each([this](string_view key, KeyEntry& e) {
+        if (e.has_tuples())
+            requeue(key, e);
+    });
+}
+
+void TupleServer::Shard::requeue(string_view key, KeyEntry& e) {
+    AgeTree::Node* n;
+    if (e.has_tuples()) {
+        n              = &ages->emplace(key);
+        n->value.entry = &e;
+        n->value.since = age_clock();
+    } else if (AgeTree::Node* old = ages->find(key)) {
+        n = ages->erase(*old);
+    } else {
+        return;
+    }
+    for (; n; n = n->parent) {
+        uint64_t m = n->used ? n->value.since : TimerWheel<Expiry>::NEVER;
+        for (auto& c : n->children)
+            m = min(m, c->value.oldest);
+        if (m == n->value.oldest)
+            break;
+        n->value.oldest = m;
+    }
+}
+
+// Sem curinga é a chave exata; só um '*' no fim, um prefixo (desce pelos
+// mínimos); qualquer outro glob confere as chaves sob a parte literal.
+TupleServer::KeyEntry* TupleServer::Shard::oldest_match(string_view pattern, uint64_t& since) {
+    string_view literal = glob_prefix(pattern);
+    if (literal.size() == pattern.size()) {
+        AgeTree::Node* n = ages->find(pattern);
+        if (n == nullptr)
+            return nullptr;
+        since = n->value.since;
+        return n->value.entry;
+    }
+    AgeTree::Node* n = ages->subtree(literal);
+    if (n == nullptr || n->value.oldest == TimerWheel<Expiry>::NEVER)
+        return nullptr;
+    if (literal.size() + 1 == pattern.size() && pattern.back() == '*') {
+        while (!(n->used && n->value.since == n->value.oldest))
+            for (auto& c : n->children)
+                if (c->value.oldest == n->value.oldest) {
+                    n = c.get();
+                    break;
+                }
+        since = n->value.since;
+        return n->value.entry;
+    }
+    KeyEntry* best = nullptr;
+    ages->for_each(*n, [&](AgeTree::Node& k) {
+        if ((best == nullptr || k.value.since < since) &&
+            glob_match(pattern, KeyIndex<KeyEntry, KeyHash>::key(*k.value.entry))) {
+            best  = k.value.entry;
+            since = k.value.since;
+        }
+    });
+    return best;
+}
+
+// ---------------------------------------------------------------------------
+// offer(): os padrões registrados num prefixo da chave que de fato casam
+// com ela. Os RDMs recebem cópia; o consumidor é o IN/EX da própria chave
+// ou, sem ele, o INM mais antigo (menor `seq`). Os nós que esvaziaram só
+// saem da árvore no fim: um nó com valor não é liberado por outro erase.
+// ---------------------------------------------------------------------------
+bool TupleServer::Shard::offer(string_view key, KeyEntry& e, string& value, Ready& ready) {
+    lock_guard<ShardMutex>     lock(patterns->mtx);
+    vector<PatternTree::Node*> nodes;
+    patterns->tree.along(key, [&nodes](PatternTree::Node& n) { nodes.push_back(&n); });
+
+    WaiterPtr consumer;
+    for (PatternTree::Node* n : nodes) {
+        for (auto it = n->value.begin(); it != n->value.end();) {
+            WaiterPtr w = *it;
+            if (!glob_match(w->pattern, key)) {
+                ++it;
+                continue;
+            }
+            if (w->consume) {
+                if (!consumer || w->seq < consumer->seq)
+                    consumer = move(w);
+                ++it;
+                continue;
+            }
+            it      = n->value.erase(it);
+            w->node = nullptr;
+            --patterns->count;
+            hand_over(w, match_result(key, value), ready);
+        }
+    }
+
+    bool taken = !e.waiters.empty() && deliver(e, value, ready);
+    if (!taken && consumer) {
+        consumer->node->value.erase(consumer->pos);
+        consumer->node = nullptr;
+        --patterns->count;
+        hand_over(consumer, match_result(key, value), ready);
+        taken = true;
+    }
+    for (PatternTree::Node* n : nodes)
+        if (n->value.empty())
+            patterns->tree.erase(*n);
+    return taken;
+}
+
+void TupleServer::Patterns::park(string_view pattern, WaiterPtr w) {
+    PatternTree::Node& n = tree.emplace(glob_prefix(pattern));
+    Waiter&            r = *w;
+    r.pattern            = string(pattern);
+    r.seq                = ++next_seq;
+    r.node               = &n;
+    r.pos                = n.value.insert(n.value.end(), move(w));
+    ++count;
+}
+
+void TupleServer::Patterns::unpark(const WaiterPtr& w) {
+    PatternTree::Node& n = *w->node;
+    n.value.erase(w->pos);
+    w->node = nullptr;
+    --count;
+    if (n.value.empty())
+        tree.erase(n);
+}
+
+TupleServer::ShardLocks TupleServer::lock_for_match() {
+    ShardLocks locks;
+    locks.reserve(n_shards);
+    for (size_t i = 0; i < n_shards; ++i) {
+        locks.push_back(shards[i].lock());
+        if (!shards[i].ages)
+            shards[i].index_keys();
+    }
+    return locks;
+}
+
+// ---------------------------------------------------------------------------
+// take_match(): a chave mais antiga entre os shards. Se a frente dela
+// venceu (TTL), try_take() a tira e a chave vai para o fim da vez (ou sai
+// do índice): a busca recomeça.
+// ---------------------------------------------------------------------------
+bool TupleServer::take_match(string_view pattern, bool consume, string& out, Ready& ready) {
+    while (true) {
+        Shard*    best   = nullptr;
+        KeyEntry* e      = nullptr;
+        uint64_t  oldest = TimerWheel<Expiry>::NEVER;
+        for (size_t i = 0; i < n_shards; ++i) {
+            uint64_t since;
+            if (KeyEntry* k = shards[i].oldest_match(pattern, since); k && since < oldest) {
+                best   = &shards[i];
+                e      = k;
+                oldest = since;
+            }
+        }
+        if (best == nullptr)
+            return false;
+        string key(KeyIndex<KeyEntry, KeyHash>::key(*e));
+        string v;
+        if (best->try_take(key, consume, v, ready)) {
+            out += match_result(key, v);
+            return true;
+        }
+    }
+}
+
+bool TupleServer::match_async(string_view pattern, bool consume, string& out,
+                              Continuation done, Ticket* ticket) {
+    Ready ready;
+    bool  found;
     {
-        unique_lock<mutex> lock(mtx);
-        cv.wait(lock, [this, &k_in] { return has_tuple(k_in); });
-        auto& dq = tuple_space.at(k_in);
-        v = move(dq.front());
-        dq.pop_front();
-    }
-    // Liberamos o lock antes de procurar o serviço e de chamar write(),
-    // que vai adquirir o lock novamente. Isso reduz o tempo de contenção.
-
-    auto it = services.find(svc_id);
-    if (it == services.end())
-        return "NO-SERVICE";
-
-    string vout = it->second(move(v));
-    write(move(k_out), move(vout));  // já faz notify_all internamente
-    return "OK";
-}
\ No newline at end of file
+        ShardLocks locks = lock_for_match();
+        found            = take_match(pattern, consume, out, ready);
+        if (!found && done) {
+            auto w = make_shared<Waiter>(consume, move(done));
+            if (ticket) {
+                ticket->waiter_shard = nullptr;
+                ticket->pattern      = true;
+                ticket->waiter       = w;
+            }
+            lock_guard<ShardMutex> lock(patterns.mtx);
+            patterns.park(pattern, move(w));
+        }
+    }
+    if (found && consume)
+        settle();
+    run_ready(ready);
+    return found;
+}
+
+// ---------------------------------------------------------------------------
+// match_for(): o waiter é registrado com os shards travados e a espera
+// acontece só sob `patterns.mtx`, o lock com que o WR o atende.
+// ---------------------------------------------------------------------------
+bool TupleServer::match_for(string_view pattern, bool consume,
+                            chrono::milliseconds timeout, Match& out) {
+    string    r;
+    Ready     ready;
+    WaiterPtr w;
+    bool      found;
+    {
+        ShardLocks locks = lock_for_match();
+        found            = take_match(pattern, consume, r, ready);
+        if (!found && timeout != chrono::milliseconds::zero()) {
+            w = make_shared<Waiter>(consume, nullptr);
+            lock_guard<ShardMutex> lock(patterns.mtx);
+            patterns.park(pattern, w);
+        }
+    }
+    if (found && consume)
+        settle();
+    run_ready(ready);
+    if (w) {
+        unique_lock<ShardMutex> lock(patterns.mtx);
+        auto                    delivered = [&w] { return w->done; };
+        if (timeout < chrono::milliseconds::zero()) {
+            w->cv.wait(lock, delivered);
+        } else if (!w->cv.wait_for(lock, timeout, delivered)) {
+            patterns.unpark(w);
+            return false;
+        }
+        r     = move(w->value);
+        found = true;
+    }
+    if (!found)
+        return false;
+    string_view key, value;
+    split_match(r, key, value);
+    out.key   = string(key);
+    out.value = string(value);
+    return true;
+}
+
+TupleServer::Match TupleServer::rdm(string_view pattern) {
+    Match m;
+    match_for(pattern, false, chrono::milliseconds(-1), m);
+    return m;
+}
+
+TupleServer::Match TupleServer::inm(string_view pattern) {
+    Match m;
+    match_for(pattern, true, chrono::milliseconds(-1), m);
+    return m;
+}
+
+bool TupleServer::rdm_for(string_view pattern, chrono::milliseconds timeout, Match& out) {
+    return match_for(pattern, false, max(timeout, chrono::milliseconds::zero()), out);
+}
+
+bool TupleServer::inm_for(string_view pattern, chrono::milliseconds timeout, Match& out) {
+    return match_for(pattern, true, max(timeout, chrono::milliseconds::zero()), out);
+}
+
+bool TupleServer::split_match(string_view result, string_view& key, string_view& value) {
+    auto field = [&result](string_view& f) {
+        if (result.size() < 4)
+            return false;
+        uint32_t n = static_cast<uint32_t>(static_cast<unsigned char>(result[0])) << 24 |
+                     static_cast<uint32_t>(static_cast<unsigned char>(result[1])) << 16 |
+                     static_cast<uint32_t>(static_cast<unsigned char>(result[2])) << 8 |
+                     static_cast<uint32_t>(static_cast<unsigned char>(result[3]));
+        if (result.size() - 4 < n)
+            return false;
+        f = result.substr(4, n);
+        result.remove_prefix(4 + n);
+        return true;
+    };
+    return field(key) && field(value) && result.empty();
+}
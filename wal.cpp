@@ -0,0 +1,345 @@
+#include "wal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Cabeçalho de um registro: crc + tipo + key_len + arg.
+static constexpr size_t RECORD_HEADER = 4 + 1 + 4 + 4;
+
+// ---------------------------------------------------------------------------
+// CRC-32 (polinômio refletido 0xEDB88320, o mesmo do zlib), por tabela.
+// ---------------------------------------------------------------------------
+static const array<uint32_t, 256>& crc_table() {
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    return table;
+}
+
+uint32_t Wal::crc32(const char* p, size_t n, uint32_t crc) {
+    const auto& t = crc_table();
+    crc           = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = t[(crc ^ static_cast<unsigned char>(p[i])) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(string& out, uint32_t v) {
+    out += static_cast<char>(v >> 24);
+    out += static_cast<char>(v >> 16);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+static uint32_t get_u32(const char* p) {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+bool Wal::sync_file(FILE* f) {
+    if (fflush(f) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#elif defined(__linux__)
+    return ::fdatasync(fileno(f)) == 0;
+#else
+    return ::fsync(fileno(f)) == 0;
+#endif
+}
+
+bool Wal::parse_sync(string_view name, Sync& out) {
+    if (name == "always")   { out = Sync::ALWAYS;   return true; }
+    if (name == "interval") { out = Sync::INTERVAL; return true; }
+    if (name == "os")       { out = Sync::OS;       return true; }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Segmentos: "<path>.<LSN inicial, 16 dígitos hex>".
+// ---------------------------------------------------------------------------
+static string segment_name(const string& base, uint64_t start) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(start));
+    return base + "." + hex;
+}
+
+// Segmentos existentes, em ordem de LSN inicial.
+static vector<pair<uint64_t, string>> list_segments(const string& base) {
+    filesystem::path p(base);
+    filesystem::path dir    = p.has_parent_path() ? p.parent_path() : filesystem::path(".");
+    string           prefix = p.filename().string() + ".";
+
+    vector<pair<uint64_t, string>> out;
+    error_code                     ec;
+    for (auto& ent : filesystem::directory_iterator(dir, ec)) {
+        string name = ent.path().filename().string();
+        if (name.size() != prefix.size() + 16 || name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        string hex = name.substr(prefix.size());
+        if (hex.find_first_not_of("0123456789abcdef") != string::npos)
+            continue;
+        out.emplace_back(stoull(hex, nullptr, 16), ent.path().string());
+    }
+    sort(out.begin(), out.end());
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// replay_segment(): lê registro a registro até o fim ou até o primeiro
+// registro inválido. Retorna o offset do fim do último registro válido.
+// ---------------------------------------------------------------------------
+static uint64_t replay_segment(const string& file, uint64_t start, uint64_t size,
+                               const function<void(const Wal::Record&)>& apply) {
+    FILE* f = fopen(file.c_str(), "rb");
+    if (f == nullptr)
+        throw runtime_error("WAL: não foi possível abrir " + file);
+
+    uint64_t good = 0;  // fim do último registro válido
+    char     hdr[RECORD_HEADER];
+    string   body;
+    while (fread(hdr, 1, RECORD_HEADER, f) == RECORD_HEADER) {
+        auto     type    = static_cast<uint8_t>(hdr[4]);
+        uint32_t key_len = get_u32(hdr + 5);
+        uint32_t arg     = get_u32(hdr + 9);
+        uint64_t len     = key_len + (type == Wal::PUT ? uint64_t(arg) : 0);
+        if ((type != Wal::PUT && type != Wal::TAKE) || len > size - good - RECORD_HEADER)
+            break;  // tamanho impossível: cauda corrompida
+
+        body.resize(len);
+        if (fread(&body[0], 1, len, f) != len)
+            break;
+        uint32_t crc = Wal::crc32(hdr + 4, RECORD_HEADER - 4);
+        if (Wal::crc32(body.data(), body.size(), crc) != get_u32(hdr))
+            break;
+
+        good += RECORD_HEADER + len;
+        Wal::Record r{static_cast<Wal::Type>(type), string_view(body).substr(0, key_len),
+                      {}, 0, start + good};
+        if (type == Wal::PUT)
+            r.value = string_view(body).substr(key_len);
+        else
+            r.count = arg;
+        apply(r);
+    }
+    fclose(f);
+    return good;
+}
+
+// ---------------------------------------------------------------------------
+// replay(): segmentos em ordem. Só o último pode ter a cauda corrompida
+// (queda no meio de uma escrita); ela é cortada, para que os próximos
+// registros não fiquem atrás de lixo.
+// ---------------------------------------------------------------------------
+uint64_t Wal::replay(const string& path, uint64_t from_lsn,
+                     const function<void(const Record&)>& apply) {
+    // Log de um único arquivo (formato anterior aos segmentos): segmento 0.
+    error_code ec;
+    if (filesystem::is_regular_file(path, ec))
+        filesystem::rename(path, segment_name(path, 0));
+
+    auto     segs = list_segments(path);
+    uint64_t end  = from_lsn;
+    bool     used = false;
+    for (size_t i = 0; i < segs.size(); ++i) {
+        const auto& [start, file] = segs[i];
+        bool last = i + 1 == segs.size();
+        if (!last && segs[i + 1].first <= from_lsn && !used)
+            continue;  // inteiro antes do corte: já está no snapshot
+        if (start > end || (used && start != end))
+            throw runtime_error("WAL: falta o segmento anterior a " + file);
+        used = true;
+
+        uint64_t size = filesystem::file_size(file);
+        uint64_t good = replay_segment(file, start, size, apply);
+        if (good < size) {
+            if (!last)
+                throw runtime_error("WAL: segmento corrompido: " + file);
+            cerr << "[AVISO] WAL: descartando " << (size - good)
+                 << " bytes corrompidos no fim de " << file << "\n";
+            filesystem::resize_file(file, good);
+        }
+        end = start + good;
+    }
+    return max(end, from_lsn);
+}
+
+// ---------------------------------------------------------------------------
+// Construtor / destrutor.
+// ---------------------------------------------------------------------------
+Wal::Wal(Options opt, uint64_t start_lsn)
+    : opt(move(opt)), segment_start(start_lsn), appended(start_lsn),
+      durable_lsn(start_lsn) {
+    string name = segment_name(this->opt.path, start_lsn);
+    file        = fopen(name.c_str(), "ab");
+    if (file == nullptr)
+        throw runtime_error("WAL: não foi possível abrir " + name);
+    writer = thread([this] { flusher(); });
+}
+
+Wal::~Wal() {
+    {
+        lock_guard<mutex> lk(mtx);
+        stop = true;
+    }
+    has_data.notify_one();
+    writer.join();
+    fclose(file);
+}
+
+// ---------------------------------------------------------------------------
+// append(): só copia para o buffer (o CRC é calculado fora do lock);
+// quem grava é o flusher().
+// ---------------------------------------------------------------------------
+uint64_t Wal::append(Type type, string_view key, string_view value, uint32_t arg) {
+    string hdr;  // cabe no buffer interno da string: sem alocação
+    put_u32(hdr, 0);
+    hdr += static_cast<char>(type);
+    put_u32(hdr, static_cast<uint32_t>(key.size()));
+    put_u32(hdr, arg);
+    uint32_t crc = crc32(hdr.data() + 4, RECORD_HEADER - 4);
+    crc          = crc32(key.data(), key.size(), crc);
+    crc          = crc32(value.data(), value.size(), crc);
+    for (int i = 0; i < 4; ++i)
+        hdr[i] = static_cast<char>(crc >> (24 - 8 * i));
+
+    bool     wake;
+    uint64_t lsn;
+    {
+        lock_guard<mutex> lk(mtx);
+        wake = buf.empty();
+        buf += hdr;
+        buf.append(key.data(), key.size());
+        buf.append(value.data(), value.size());
+        lsn = appended += RECORD_HEADER + key.size() + value.size();
+    }
+    // Nos modos INTERVAL e OS o flusher acorda sozinho no próximo intervalo.
+    if (wake && waits())
+        has_data.notify_one();
+    return lsn;
+}
+
+uint64_t Wal::put(string_view key, string_view value) {
+    return append(PUT, key, value, static_cast<uint32_t>(value.size()));
+}
+
+uint64_t Wal::take(string_view key, uint32_t n) {
+    return append(TAKE, key, {}, n);
+}
+
+void Wal::wait_durable(uint64_t lsn) {
+    if (!waits())
+        return;
+    unique_lock<mutex> lk(mtx);
+    durable.wait(lk, [&] { return durable_lsn >= lsn || failed; });
+    if (durable_lsn < lsn)
+        throw runtime_error("WAL: falha ao gravar " + opt.path);
+}
+
+uint64_t Wal::flush_count() const {
+    lock_guard<mutex> lk(mtx);
+    return flushes;
+}
+
+uint64_t Wal::end_lsn() const {
+    lock_guard<mutex> lk(mtx);
+    return appended;
+}
+
+void Wal::rotate() {
+    unique_lock<mutex> lk(mtx);
+    uint64_t           ticket = ++rotations;
+    has_data.notify_one();
+    durable.wait(lk, [&] { return rotated >= ticket || failed; });
+}
+
+void Wal::drop_before(uint64_t lsn) {
+    uint64_t current;
+    {
+        lock_guard<mutex> lk(mtx);
+        current = segment_start;
+    }
+    auto       segs = list_segments(opt.path);
+    error_code ec;
+    for (size_t i = 0; i + 1 < segs.size(); ++i)
+        if (segs[i + 1].first <= lsn && segs[i].first < current)
+            filesystem::remove(segs[i].second, ec);
+}
+
+// ---------------------------------------------------------------------------
+// flusher(): thread de gravação. Cada rodada leva tudo o que se acumulou
+// no buffer — inclusive o que chegou durante o fsync anterior — num único
+// write + fsync (modo OS: só o write). Pedidos de rotate() são atendidos
+// depois da gravação da rodada.
+// ---------------------------------------------------------------------------
+void Wal::flusher() {
+    string             batch;
+    unique_lock<mutex> lk(mtx);
+    while (true) {
+        auto ready = [this] { return stop || rotations > rotated; };
+        if (!waits())
+            has_data.wait_for(lk, opt.interval, ready);
+        else
+            has_data.wait(lk, [&] { return ready() || !buf.empty(); });
+        uint64_t rotate_to = rotations;
+        if (buf.empty() && rotate_to == rotated) {
+            if (stop)
+                return;
+            continue;
+        }
+
+        batch.swap(buf);  // `buf` fica com a capacidade do lote anterior
+        uint64_t upto = appended;
+        lk.unlock();
+        bool ok = batch.empty() ||
+                  (fwrite(batch.data(), 1, batch.size(), file) == batch.size() &&
+                   fflush(file) == 0 && (opt.sync == Sync::OS || sync_file(file)));
+        bool wrote = !batch.empty();
+        batch.clear();
+        // Segmento novo só se o atual recebeu algo desde a última troca.
+        bool rotate = ok && rotate_to != rotated && upto != segment_start;
+        if (rotate) {
+            string name = segment_name(opt.path, upto);
+            fclose(file);
+            file = fopen(name.c_str(), "ab");
+            ok   = file != nullptr;
+        }
+        lk.lock();
+
+        if (wrote)
+            ++flushes;
+        if (!ok) {
+            // Sem como garantir a durabilidade: quem espera recebe erro.
+            cerr << "[ERRO] WAL: falha ao gravar " << opt.path << endl;
+            failed = true;
+            durable.notify_all();
+            return;
+        }
+        if (rotate)
+            segment_start = upto;
+        rotated     = rotate_to;
+        durable_lsn = upto;
+        durable.notify_all();
+    }
+}
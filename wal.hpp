@@ -0,0 +1,142 @@
+#pragma once
+
+// ---------------------------------------------------------------------------
+// Write-ahead log (opcional) do espaço de tuplas.
+//
+// Arquivo só de acréscimo com as mutações que mudam as filas: PUT (tupla
+// entrou no fim da fila da chave) e TAKE (n tuplas saíram da frente). Um
+// WR entregue direto a um IN/EX estacionado não muda fila nenhuma e não é
+// registrado. Na partida o log é relido para reconstruir as filas.
+//
+// Registro (inteiros em big-endian, como no protocolo binário):
+//
+//   u32 crc32       dos bytes seguintes do registro
+//   u8  tipo        1=PUT 2=TAKE
+//   u32 key_len
+//   u32 arg         PUT: bytes do valor; TAKE: quantas tuplas saíram
+//   chave, valor (só PUT)
+//
+// O log é dividido em segmentos "<path>.<LSN inicial em hex>"; o LSN é a
+// posição absoluta de um byte na história do log. Um registro incompleto
+// ou com CRC errado no fim do último segmento (queda no meio de uma
+// escrita) é descartado na releitura. Segmentos já cobertos por um
+// snapshot são apagados (drop_before()).
+//
+// Group commit: os registros são acrescentados a um buffer em memória (sob
+// o lock do shard que fez a mutação, o que fixa a ordem por chave) e um
+// único thread os grava. No modo ALWAYS, quem precisa de durabilidade
+// espera em wait_durable(); enquanto um fsync está em andamento os
+// registros seguintes se acumulam e saem juntos no próximo — um fsync por
+// lote de escritores concorrentes, não por operação.
+// ---------------------------------------------------------------------------
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+class Wal {
+public:
+    enum class Sync {
+        ALWAYS,    // a operação só é confirmada depois do fsync (group commit)
+        INTERVAL,  // fsync a cada `interval`; perde no máximo esse intervalo
+        OS,        // write() a cada `interval`, sem fsync: o sistema decide
+                   // quando os dados vão ao disco
+    };
+
+    struct Options {
+        std::string               path;
+        Sync                      sync     = Sync::ALWAYS;
+        std::chrono::milliseconds interval = std::chrono::milliseconds(10);
+    };
+
+    enum Type : std::uint8_t { PUT = 1, TAKE = 2 };
+
+    // Registro relido do log. Os string_view valem só durante o callback.
+    struct Record {
+        Type             type;
+        std::string_view key;
+        std::string_view value;  // PUT
+        std::uint32_t    count;  // TAKE
+        std::uint64_t    lsn;    // fim do registro
+    };
+
+    // CRC-32 (o mesmo do zlib); `crc` encadeia blocos.
+    static std::uint32_t crc32(const char* p, std::size_t n, std::uint32_t crc = 0);
+
+    // fflush() + fsync: leva o arquivo ao disco. Retorna false em falha.
+    static bool sync_file(std::FILE* f);
+
+    // "always" / "interval" / "os". Retorna false se o nome é desconhecido.
+    static bool parse_sync(std::string_view name, Sync& out);
+
+    // Relê os segmentos do log em `path`, chamando `apply` em ordem para
+    // cada registro válido — a partir do segmento que contém `from_lsn`
+    // (registros anteriores, do mesmo segmento, também são entregues) — e
+    // corta a cauda corrompida. Retorna o LSN do fim do log (no mínimo
+    // `from_lsn`). Lança std::runtime_error se falta um segmento ou se um
+    // segmento que não é o último está corrompido.
+    static std::uint64_t replay(const std::string& path, std::uint64_t from_lsn,
+                                const std::function<void(const Record&)>& apply);
+
+    // Abre (ou cria) o segmento que começa em `start_lsn` (o retorno de
+    // replay()) e inicia o thread de gravação. Lança std::runtime_error se
+    // o arquivo não puder ser aberto.
+    explicit Wal(Options opt, std::uint64_t start_lsn = 0);
+    ~Wal();  // grava (e sincroniza) o que estiver pendente
+
+    Wal(const Wal&)            = delete;
+    Wal& operator=(const Wal&) = delete;
+
+    // Acrescentam um registro ao buffer. Retornam o LSN (bytes acrescentados
+    // desde a abertura, até o fim do registro), usado em wait_durable().
+    std::uint64_t put(std::string_view key, std::string_view value);
+    std::uint64_t take(std::string_view key, std::uint32_t n);
+
+    // Modo ALWAYS: bloqueia até o registro `lsn` estar no disco. Nos demais
+    // modos retorna na hora. Lança std::runtime_error se a gravação falhou.
+    void wait_durable(std::uint64_t lsn);
+
+    // Verdadeiro se wait_durable() pode bloquear (modo ALWAYS).
+    bool waits() const { return opt.sync == Sync::ALWAYS; }
+
+    // Quantas rodadas de gravação (write + fsync) já aconteceram.
+    std::uint64_t flush_count() const;
+
+    // LSN do fim do último registro acrescentado.
+    std::uint64_t end_lsn() const;
+
+    // Fecha o segmento atual (depois de gravar o que estiver pendente) e
+    // passa a gravar num novo. Bloqueia até a troca.
+    void rotate();
+
+    // Apaga os segmentos fechados cujos registros terminam todos até `lsn`.
+    void drop_before(std::uint64_t lsn);
+
+private:
+    std::uint64_t append(Type type, std::string_view key, std::string_view value,
+                         std::uint32_t arg);
+    void          flusher();
+
+    Options       opt;
+    std::FILE*    file;
+    std::uint64_t segment_start;  // LSN inicial do segmento aberto
+
+    mutable std::mutex      mtx;
+    std::condition_variable has_data;  // acorda o thread de gravação
+    std::condition_variable durable;   // acorda quem espera em wait_durable()
+    std::string             buf;       // registros ainda não gravados
+    std::uint64_t           appended     = 0;  // LSN do último registro
+    std::uint64_t           durable_lsn  = 0;  // LSN já gravado
+    std::uint64_t           flushes      = 0;
+    std::uint64_t           rotations    = 0;  // pedidas em rotate()
+    std::uint64_t           rotated      = 0;  // já feitas pelo flusher
+    bool                    failed       = false;
+    bool                    stop         = false;
+    std::thread             writer;
+};